@@ -0,0 +1,317 @@
+/*
+ * ============================================================================
+ * 文件名: ipfix_collector.cpp
+ * 描述: 最小的 IPFIX 采集器，用于在本机验证 tcp_analyzer 的导出
+ * 平台: Linux
+ *
+ * 功能:
+ *   1. 在 UDP 端口上接收 IPFIX (RFC 7011) 消息
+ *   2. 校验消息头（版本、长度）和每个集合 (Set) 的边界
+ *   3. 记住模板，按模板解码数据记录；未知模板的数据集单独计数
+ *   4. 根据消息头中的序列号检测丢失的记录
+ *   5. 按 samplingInterval 把采样的计数放大，估计总量
+ *   6. 结束时打印统计；用 -n 指定期望的记录数时据此返回成功/失败
+ * ============================================================================
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <map>
+#include <vector>
+
+// 一个模板字段
+struct TemplateField {
+    uint16_t id;
+    uint16_t length;
+};
+
+// 统计
+struct CollectorStats {
+    unsigned long long messages;        // 有效消息数
+    unsigned long long invalid;         // 格式错误的消息数
+    unsigned long long templates;       // 收到的模板记录数
+    unsigned long long records;         // 解码的数据记录数
+    unsigned long long unknown_sets;    // 模板未知的数据集数
+    unsigned long long lost;            // 按序列号推算丢失的记录数
+    unsigned long long packets;         // packetDeltaCount 之和
+    unsigned long long octets;          // octetDeltaCount 之和
+    unsigned long long scaled_packets;  // 乘以 samplingInterval 后的包数（对总量的估计）
+    unsigned long long scaled_octets;
+    unsigned long long end_reasons[5];  // flowEndReason 1~4 的记录数（下标 0 为其他）
+};
+
+CollectorStats stats;
+std::map<uint16_t, std::vector<TemplateField> > templates;  // 模板 ID -> 字段
+std::map<uint32_t, uint32_t> next_sequence;                 // 观察域 -> 期望的下一个序列号
+bool verbose = false;
+volatile sig_atomic_t stop_requested = 0;
+
+void handle_stop_signal(int) {
+    stop_requested = 1;
+}
+
+uint16_t get_be16(const unsigned char* p) {
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t get_be32(const unsigned char* p) {
+    return ((uint32_t)get_be16(p) << 16) | get_be16(p + 2);
+}
+
+/*
+ * 读取一个最长 8 字节的无符号大端整数（IPFIX 允许缩减长度编码）
+ */
+uint64_t get_be_uint(const unsigned char* p, int len) {
+    uint64_t v = 0;
+    for (int i = 0; i < len && i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/*
+ * 解析模板集，记录每个模板的字段
+ */
+bool parse_template_set(const unsigned char* p, size_t len) {
+    size_t pos = 0;
+    while (pos + 4 <= len) {
+        uint16_t id = get_be16(p + pos);
+        uint16_t count = get_be16(p + pos + 2);
+        pos += 4;
+        if (id == 0 && count == 0) {
+            break;  // 填充
+        }
+        std::vector<TemplateField> fields;
+        for (uint16_t i = 0; i < count; i++) {
+            if (pos + 4 > len) {
+                return false;
+            }
+            TemplateField f;
+            f.id = get_be16(p + pos);
+            f.length = get_be16(p + pos + 2);
+            pos += 4;
+            if (f.id & 0x8000) {
+                pos += 4;   // 企业编号
+                f.id &= 0x7fff;
+            }
+            if (f.length == 0xffff) {
+                return false;   // 变长字段：本工具不支持
+            }
+            fields.push_back(f);
+        }
+        if (pos > len) {
+            return false;
+        }
+        templates[id] = fields;
+        stats.templates++;
+    }
+    return true;
+}
+
+/*
+ * 解码一条数据记录，累加计数，详细模式下打印
+ */
+void decode_record(const std::vector<TemplateField>& fields, const unsigned char* p) {
+    uint32_t src_ip = 0, dst_ip = 0;
+    uint64_t src_port = 0, dst_port = 0, packets = 0, octets = 0, reason = 0, start = 0, end = 0;
+    uint64_t sampling = 1, ingress = 0;
+
+    for (size_t i = 0; i < fields.size(); i++) {
+        const TemplateField& f = fields[i];
+        uint64_t v = get_be_uint(p, f.length);
+        switch (f.id) {
+            case 8:   src_ip = htonl((uint32_t)v); break;
+            case 12:  dst_ip = htonl((uint32_t)v); break;
+            case 7:   src_port = v; break;
+            case 11:  dst_port = v; break;
+            case 2:   packets = v; break;
+            case 1:   octets = v; break;
+            case 136: reason = v; break;
+            case 152: start = v; break;
+            case 153: end = v; break;
+            case 34:  sampling = v ? v : 1; break;
+            case 10:  ingress = v; break;
+            default: break;
+        }
+        p += f.length;
+    }
+
+    stats.records++;
+    stats.packets += packets;
+    stats.octets += octets;
+    stats.scaled_packets += packets * sampling;
+    stats.scaled_octets += octets * sampling;
+    stats.end_reasons[reason >= 1 && reason <= 4 ? reason : 0]++;
+
+    if (verbose) {
+        char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &src_ip, src, sizeof(src));
+        inet_ntop(AF_INET, &dst_ip, dst, sizeof(dst));
+        printf("  %s:%llu -> %s:%llu  %llu 包 / %llu 字节, 持续 %llu ms, 结束原因 %llu, 采样 1/%llu, 入接口 %llu\n",
+               src, (unsigned long long)src_port, dst, (unsigned long long)dst_port,
+               (unsigned long long)packets, (unsigned long long)octets,
+               (unsigned long long)(end >= start ? end - start : 0), (unsigned long long)reason,
+               (unsigned long long)sampling, (unsigned long long)ingress);
+    }
+}
+
+/*
+ * 校验并处理一个 IPFIX 消息
+ */
+void handle_message(const unsigned char* msg, size_t len) {
+    if (len < 16 || get_be16(msg) != 10 || get_be16(msg + 2) != len) {
+        stats.invalid++;
+        return;
+    }
+    uint32_t sequence = get_be32(msg + 8);
+    uint32_t domain = get_be32(msg + 12);
+    uint32_t records_in_message = 0;
+
+    size_t pos = 16;
+    while (pos < len) {
+        if (pos + 4 > len) {
+            stats.invalid++;
+            return;
+        }
+        uint16_t set_id = get_be16(msg + pos);
+        uint16_t set_len = get_be16(msg + pos + 2);
+        if (set_len < 4 || pos + set_len > len) {
+            stats.invalid++;
+            return;
+        }
+        const unsigned char* body = msg + pos + 4;
+        size_t body_len = set_len - 4;
+
+        if (set_id == 2) {
+            if (!parse_template_set(body, body_len)) {
+                stats.invalid++;
+                return;
+            }
+        } else if (set_id >= 256) {
+            std::map<uint16_t, std::vector<TemplateField> >::const_iterator it = templates.find(set_id);
+            if (it == templates.end()) {
+                stats.unknown_sets++;
+            } else {
+                size_t record_len = 0;
+                for (size_t i = 0; i < it->second.size(); i++) {
+                    record_len += it->second[i].length;
+                }
+                // 记录之后剩余不足一条记录的字节是填充
+                for (size_t off = 0; record_len > 0 && off + record_len <= body_len; off += record_len) {
+                    decode_record(it->second, body + off);
+                    records_in_message++;
+                }
+            }
+        }
+        pos += set_len;
+    }
+
+    // 序列号 = 此前发送的数据记录总数；跳变说明中间的消息丢失
+    std::map<uint32_t, uint32_t>::iterator seq = next_sequence.find(domain);
+    if (seq != next_sequence.end() && sequence != seq->second) {
+        stats.lost += (uint32_t)(sequence - seq->second);
+    }
+    next_sequence[domain] = sequence + records_in_message;
+    stats.messages++;
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "用法: " << prog << " [-p 端口] [-n 期望记录数] [-t 空闲秒数] [-v]\n";
+    std::cerr << "  -p  监听的 UDP 端口 (默认 4739)\n";
+    std::cerr << "  -n  期望收到的数据记录数，结束时校验 (不指定则只打印统计)\n";
+    std::cerr << "  -t  收到第一个消息后，空闲多少秒自动结束 (默认 0: 直到 Ctrl+C)\n";
+    std::cerr << "  -v  打印每条数据记录\n";
+}
+
+int main(int argc, char* argv[]) {
+    int port = 4739;
+    long long expected = -1;
+    double idle_timeout = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:t:vh")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'n': expected = atoll(optarg); break;
+            case 't': idle_timeout = atof(optarg); break;
+            case 'v': verbose = true; break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("创建套接字失败");
+        return 1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("绑定端口失败");
+        close(sock);
+        return 1;
+    }
+
+    // 接收超时：定期检查退出信号和空闲时间
+    struct timeval tv = {0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+
+    printf("📥 IPFIX 采集器监听 UDP 端口 %d ...\n", port);
+
+    unsigned char buffer[65536];
+    struct timeval last_message = {0, 0};
+    while (!stop_requested) {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        if (n > 0) {
+            handle_message(buffer, n);
+            last_message = now;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("接收失败");
+            break;
+        }
+        double idle = (now.tv_sec - last_message.tv_sec) + (now.tv_usec - last_message.tv_usec) / 1e6;
+        if (idle_timeout > 0 && stats.messages > 0 && idle >= idle_timeout) {
+            break;
+        }
+    }
+    close(sock);
+
+    printf("\n====================================================\n");
+    printf("消息:       %llu (格式错误 %llu)\n", stats.messages, stats.invalid);
+    printf("模板记录:   %llu\n", stats.templates);
+    printf("数据记录:   %llu (模板未知的数据集 %llu, 序列号推算丢失 %llu)\n",
+           stats.records, stats.unknown_sets, stats.lost);
+    printf("包 / 字节:  %llu / %llu (按采样率放大: %llu / %llu)\n",
+           stats.packets, stats.octets, stats.scaled_packets, stats.scaled_octets);
+    printf("结束原因:   不活跃 %llu, 活跃超时 %llu, 连接结束 %llu, 强制结束 %llu, 其他 %llu\n",
+           stats.end_reasons[1], stats.end_reasons[2], stats.end_reasons[3],
+           stats.end_reasons[4], stats.end_reasons[0]);
+    printf("====================================================\n");
+
+    if (expected < 0) {
+        return 0;
+    }
+    bool ok = stats.records == (unsigned long long)expected && stats.invalid == 0 &&
+              stats.unknown_sets == 0 && stats.lost == 0;
+    printf("%s 期望 %lld 条记录, 收到 %llu 条\n", ok ? "✅ 校验通过:" : "❌ 校验失败:",
+           expected, stats.records);
+    return ok ? 0 : 1;
+}
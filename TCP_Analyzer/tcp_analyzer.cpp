@@ -2,27 +2,57 @@
  * TCP 协议分析器 - 有状态的连接跟踪器
  *
  * 功能：捕获网络数据包，解析 TCP 协议，跟踪每个连接的状态转换
- * 平台：Linux (使用 AF_PACKET 原始套接字)
- * 编译：g++ -o tcp_analyzer tcp_analyzer.cpp
- * 运行：sudo ./tcp_analyzer <interface>
+ * 平台：Linux (AF_PACKET 原始套接字，AF_XDP 高速捕获后端，或 eBPF tracepoint 本机分析)
+ * 编译：g++ -pthread -o tcp_analyzer tcp_analyzer.cpp
+ * 运行：sudo ./tcp_analyzer [-b packet|xdp] <interface>...
+ *       sudo ./tcp_analyzer -b trace
  */
 
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdarg>
 #include <cstring>
+#include <cstddef>
+#include <csignal>
+#include <cerrno>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <map>
+#include <vector>
 #include <string>
+#include <algorithm>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <sys/time.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+#include <linux/sock_diag.h>
+#include <linux/sockios.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include "../nslookup/dns_message.h"     // DNS 报文解析（与 resolver 共用，-D）
 
 // ======================== 协议头部结构定义 ========================
 
@@ -171,21 +201,281 @@ ConnectionID make_canonical_id(uint32_t ip1, uint16_t port1,
     return id;
 }
 
+// ======================== 连接事件时间线 ========================
+
+/*
+ * 每个连接的事件时间线
+ *
+ * 逐条打印的事件只出现一次，连接出问题时很难还原它的完整生命周期。
+ * 时间线把状态变化、重传、窗口事件按发生顺序记在连接记录里，可以随时导出：
+ * - 连接结束时附在摘要后面 (-T)
+ * - 收到 SIGUSR1 时导出所有仍在跟踪的连接
+ *
+ * 编码：每个事件 = 1 字节类型/方向 + 变长整数时间增量（微秒）+ 变长整数参数。
+ * 事件间隔通常在毫秒级，增量只占 1~3 字节，一个事件一般 3~5 字节。
+ *
+ * 存储：前 TIMELINE_INLINE_BYTES 字节直接放在连接记录里（握手和开始阶段），
+ * 写满后从全局块池申请溢出块，按链表串起来。每个连接最多 TIMELINE_MAX_CHUNKS 块，
+ * 超出时回收最早的溢出块重用，保留"开头 + 最近"的事件；被覆盖的事件数会记下来。
+ * 每个溢出块记录自己第一个事件之前的时间，所以丢掉前面的块后仍能解码。
+ */
+const int TIMELINE_INLINE_BYTES = 48;           // 连接记录内联区大小
+const int TIMELINE_CHUNK_BYTES = 112;           // 溢出块的数据区大小（块总长 128 字节）
+const int TIMELINE_MAX_CHUNKS = 8;              // 每个连接最多占用的溢出块数
+const int TIMELINE_MAX_EVENT = 11;              // 一个事件编码后的最大长度（1 + 5 + 5）
+const uint32_t TIMELINE_SLAB_CHUNKS = 1024;     // 每次向系统申请的块数
+const uint32_t TIMELINE_POOL_LIMIT = 1 << 16;   // 块池上限（8 MB）
+const uint32_t TIMELINE_NONE = 0xffffffff;
+
+// 事件类型
+enum TimelineEventType {
+    TL_STATE = 1,           // 状态变化，参数为新状态
+    TL_RETRANSMIT = 2,      // 重传，参数为负载字节数
+    TL_ZERO_WINDOW = 3,     // 通告零窗口
+    TL_WINDOW_OPEN = 4,     // 零窗口后重新打开，参数为新窗口（字节）
+    TL_WINDOW_FULL = 5,     // 在途数据开始用满对方窗口，参数为在途字节数
+    TL_BAD_CHECKSUM = 6,    // 校验和错误的段（-C）
+    TL_END = 7              // 连接结束，参数为结束原因（IPFIX flowEndReason）
+};
+
+struct TimelineChunk {
+    uint32_t next;          // 下一个（更新的）块，TIMELINE_NONE 表示没有
+    uint16_t used;          // 已用字节数
+    uint16_t events;        // 块内事件数
+    uint64_t prev_us;       // 本块第一个事件之前那个事件的时间（解码起点）
+    unsigned char data[TIMELINE_CHUNK_BYTES];
+};
+
+struct FlowTimeline {
+    uint64_t base_us;       // 第一个事件之前的时间（内联区解码起点，即连接首次出现的时间）
+    uint64_t last_us;       // 最近一个事件的时间
+    uint32_t head;          // 最早的溢出块
+    uint32_t tail;          // 最新的溢出块
+    uint32_t events;        // 记录过的事件总数
+    uint32_t overwritten;   // 因回收溢出块而丢掉的事件数
+    uint8_t inline_used;
+    uint8_t chunks;         // 占用的溢出块数
+    uint8_t last_state;     // 时间线中最近记录的状态（用于发现状态变化）
+    bool full;              // 内联区已写满，后续事件进溢出块
+    unsigned char inline_data[TIMELINE_INLINE_BYTES];
+};
+
+/*
+ * 溢出块池：按块号寻址，块号 = 第几个 slab * TIMELINE_SLAB_CHUNKS + slab 内偏移。
+ * slab 按需申请、不归还系统；释放的块进入空闲链表重用
+ */
+struct TimelinePool {
+    std::vector<TimelineChunk*> slabs;
+    uint32_t carved;                    // 已从 slab 中切出的块数
+    uint32_t free_head;                 // 空闲链表
+    uint32_t in_use;
+    unsigned long long exhausted;       // 池已满而丢弃的事件数
+};
+
+TimelinePool timeline_pool = {std::vector<TimelineChunk*>(), 0, TIMELINE_NONE, 0, 0};
+
+TimelineChunk& timeline_chunk(uint32_t index) {
+    return timeline_pool.slabs[index / TIMELINE_SLAB_CHUNKS][index % TIMELINE_SLAB_CHUNKS];
+}
+
+uint32_t timeline_alloc_chunk() {
+    uint32_t index;
+    if (timeline_pool.free_head != TIMELINE_NONE) {
+        index = timeline_pool.free_head;
+        timeline_pool.free_head = timeline_chunk(index).next;
+    } else if (timeline_pool.carved < TIMELINE_POOL_LIMIT) {
+        if (timeline_pool.carved % TIMELINE_SLAB_CHUNKS == 0) {
+            timeline_pool.slabs.push_back(new TimelineChunk[TIMELINE_SLAB_CHUNKS]);
+        }
+        index = timeline_pool.carved++;
+    } else {
+        return TIMELINE_NONE;
+    }
+    timeline_pool.in_use++;
+    return index;
+}
+
+/*
+ * 把连接的溢出块全部还给池（连接从跟踪表删除前调用）
+ */
+void timeline_release(FlowTimeline& tl) {
+    while (tl.head != TIMELINE_NONE) {
+        uint32_t next = timeline_chunk(tl.head).next;
+        timeline_chunk(tl.head).next = timeline_pool.free_head;
+        timeline_pool.free_head = tl.head;
+        timeline_pool.in_use--;
+        tl.head = next;
+    }
+    tl.tail = TIMELINE_NONE;
+    tl.chunks = 0;
+}
+
+int put_varint(unsigned char* p, uint64_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+uint64_t get_varint(const unsigned char*& p, const unsigned char* end) {
+    uint64_t v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return v;
+}
+
+/*
+ * 追加一个事件
+ *
+ * 参数：
+ * - now_us: 事件时间（相对程序启动的微秒数）
+ * - d: 方向（0 = ConnectionID.src 发出，1 = dst 发出）
+ */
+void timeline_record(FlowTimeline& tl, TimelineEventType type, int d, uint64_t now_us, uint32_t value) {
+    if (tl.events == 0) {
+        tl.base_us = now_us;
+        tl.last_us = now_us;
+    }
+    unsigned char event[TIMELINE_MAX_EVENT];
+    uint64_t delta = now_us > tl.last_us ? now_us - tl.last_us : 0;
+    int len = 0;
+    event[len++] = (unsigned char)(type | (d << 4));
+    len += put_varint(event + len, delta);
+    len += put_varint(event + len, value);
+
+    if (!tl.full && tl.inline_used + len <= TIMELINE_INLINE_BYTES) {
+        memcpy(tl.inline_data + tl.inline_used, event, len);
+        tl.inline_used += len;
+    } else {
+        // 内联区写满后不再回填，保证事件按时间顺序排列
+        tl.full = true;
+        if (tl.tail == TIMELINE_NONE || timeline_chunk(tl.tail).used + len > TIMELINE_CHUNK_BYTES) {
+            uint32_t index;
+            if (tl.chunks < TIMELINE_MAX_CHUNKS) {
+                index = timeline_alloc_chunk();
+                if (index == TIMELINE_NONE) {
+                    timeline_pool.exhausted++;
+                    return;
+                }
+                tl.chunks++;
+            } else {
+                // 回收最早的溢出块放到链尾
+                index = tl.head;
+                tl.head = timeline_chunk(index).next;
+                tl.overwritten += timeline_chunk(index).events;
+            }
+            TimelineChunk& chunk = timeline_chunk(index);
+            chunk.next = TIMELINE_NONE;
+            chunk.used = 0;
+            chunk.events = 0;
+            chunk.prev_us = tl.last_us;
+            if (tl.tail == TIMELINE_NONE || tl.head == TIMELINE_NONE) {
+                tl.head = index;
+            } else {
+                timeline_chunk(tl.tail).next = index;
+            }
+            tl.tail = index;
+        }
+        TimelineChunk& chunk = timeline_chunk(tl.tail);
+        memcpy(chunk.data + chunk.used, event, len);
+        chunk.used += len;
+        chunk.events++;
+    }
+    tl.events++;
+    tl.last_us = now_us;
+}
+
 // ======================== 全局连接跟踪表 ========================
 
+/*
+ * 单方向的连接指标
+ *
+ * 一个连接有两个方向：dir[0] 是从 ConnectionID.src 发出的数据，
+ * dir[1] 是从 ConnectionID.dst 发出的数据。握手中的选项（MSS、窗口扩大因子、
+ * SACK、时间戳）属于发送方，通告窗口表示发送方自己的接收能力。
+ */
+struct FlowDirection {
+    int mss;                        // SYN 中通告的 MSS，0 表示未知
+    int wscale;                     // SYN 中通告的窗口扩大因子，-1 表示未通告
+    bool sack_permitted;            // SYN 中是否允许 SACK
+    uint32_t window;                // 最近一次通告的接收窗口（已按扩大因子换算，字节）
+    bool seq_valid;                 // snd_nxt 是否有效
+    uint32_t snd_nxt;               // 已发送的最高序列号 + 1
+    bool ack_valid;                 // ack 是否有效
+    uint32_t ack;                   // 最近一次确认号（对另一方向数据的确认）
+    unsigned long long packets;     // 包数
+    unsigned long long bytes;       // 负载字节数
+    unsigned long long octets;      // IP 层字节数（含头部）
+    uint8_t tcp_flags;              // 出现过的 TCP 标志位（按位或）
+    int ifindex;                    // 最近一个包的入接口（0 表示未知）
+    unsigned long long exported_packets;   // 已通过 IPFIX 导出的包数
+    unsigned long long exported_octets;    // 已通过 IPFIX 导出的字节数
+    unsigned long long data_packets;   // 带负载的包数
+    unsigned long long window_limited; // 发送时已用满对方窗口的次数
+    unsigned long long zero_windows;   // 通告零窗口的次数
+    unsigned long long sack_blocks;    // 携带的 SACK 块数（对另一方向丢包/乱序的报告）
+    unsigned long long bad_checksums;  // TCP 校验和错误而丢弃的段数（-C）
+    unsigned long long retransmits;    // 重传的数据段数（序列号没有超过已发送的最高序列号）
+    bool in_zero_window;               // 当前通告的是零窗口
+    bool window_full;                  // 上一个数据段已用满对方窗口
+    uint32_t dns_skip;                 // TCP/53: 上一条 DNS 消息在后续段中还剩的字节数（-D）
+
+    // 时间戳 RTT：记住本方向最近一个 TSval 第一次出现的时间，
+    // 等对方在 TSecr 中回显它时，两者之差就是"捕获点 -> 对方 -> 捕获点"的往返时间
+    bool ts_pending;
+    uint32_t ts_pending_val;
+    double ts_pending_time;
+    unsigned rtt_samples;
+    double srtt;                    // 平滑 RTT（秒，EWMA 1/8）
+    double min_rtt;                 // 最小 RTT（秒）
+};
+
+/*
+ * 连接记录：状态 + 两个方向的指标
+ */
+struct FlowRecord {
+    TcpState state;
+    double first_seen;              // 第一次出现的相对时间
+    double last_seen;               // 最近一个包的相对时间（不活跃超时）
+    double last_export;             // 最近一次 IPFIX 导出的相对时间（活跃超时）
+    uint32_t sample_rate;           // 接纳时的采样率 N（过载时按流 1/N 采样）
+    int client_dir;                 // 发出 SYN 的一方（客户端）的方向，-1 表示未见到 SYN
+    double synack_time;             // SYN-ACK 的相对时间，0 表示未见到
+    double client_data_time;        // 客户端第一个负载字节的相对时间，0 表示未见到
+    FlowDirection dir[2];
+    FlowTimeline timeline;          // 事件时间线（溢出块在删除记录前用 timeline_release 归还）
+
+    FlowRecord() : state(CLOSED), first_seen(0.0), last_seen(0.0), last_export(0.0), sample_rate(1),
+                   client_dir(-1), synack_time(0.0), client_data_time(0.0) {
+        memset(dir, 0, sizeof(dir));
+        dir[0].wscale = dir[1].wscale = -1;
+        memset(&timeline, 0, sizeof(timeline));
+        timeline.head = timeline.tail = TIMELINE_NONE;
+    }
+};
+
 /*
  * 连接跟踪器 (Connection Tracker)
  *
  * 这是整个程序的核心数据结构：
  * - Key: 规范化的 ConnectionID (确保双向数据包映射到同一个连接)
- * - Value: 当前的 TCP 状态
+ * - Value: 当前的 TCP 状态及两个方向的指标
  *
  * 作用：
  * 1. 记录每个 TCP 连接的当前状态
  * 2. 根据接收到的 TCP 标志位更新状态
  * 3. 检测连接的建立、数据传输、关闭过程
+ * 4. 统计 RTT、窗口等指标，连接结束时给出诊断
  */
-std::map<ConnectionID, TcpState> connection_tracker;
+std::map<ConnectionID, FlowRecord> connection_tracker;
 
 // ======================== 辅助函数 ========================
 
@@ -220,382 +510,4448 @@ double get_relative_time() {
     return get_timestamp() - start_time;
 }
 
-// ======================== TCP 状态机处理逻辑 ========================
+// 安静模式：不逐条打印事件（-q，用于测量捕获吞吐）
+bool quiet_mode = false;
 
 /*
- * 处理 TCP 数据包并更新状态机
+ * 打印一条连接事件（安静模式下不输出）
+ */
+void log_event(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void log_event(const char* format, ...) {
+    if (quiet_mode) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// ======================== 服务级延迟统计 ========================
+
+/*
+ * 按服务端 (服务器 IP, 端口) 聚合的延迟统计
  *
- * 参数：
- * - key: 规范化的连接标识符
- * - tcp: TCP 头部指针
- * - src_ip, dst_ip: 源和目标 IP 地址
- * - src_port, dst_port: 源和目标端口号
- * - data_len: TCP 数据部分的长度
+ * 每个连接按发出 SYN 的一方判定客户端，SYN 的接收方即服务端。每个服务维护三个延迟直方图：
+ * - 握手：SYN -> SYN-ACK（捕获点到服务端的往返时间加上服务端的建连开销）
+ * - 首字节 (TTFB)：客户端第一个请求字节 -> 服务端第一个响应字节；
+ *   服务端先发言的协议（SMTP 欢迎语等）从 SYN-ACK 开始计算
+ * - 持续时间：SYN -> 连接结束（FIN/RST/不活跃超时）
+ * 以及连接数和双向字节数。
  *
- * 这个函数实现了简化的 TCP 状态机，根据当前状态和接收到的标志位
- * 决定状态转换，并输出相应的事件信息
+ * 直方图是 HDR 风格的对数-线性分桶：每个 2 的幂量级内再分 128 个线性子桶，
+ * 相对误差小于 1%，覆盖 1 us 到约 12 天。桶的边界是固定的，
+ * 两个直方图的合并就是对应桶计数相加，因此可以跨线程、跨时间段（以及在下游）精确合并。
+ *
+ * 每个捕获线程记录到自己的表中；周期报告时把各线程的表合并成本周期的快照，
+ * 打印并（可选）以 JSON 行写入文件，再并入累计表后清空。
  */
-void process_tcp_packet(ConnectionID key, struct tcphdr* tcp,
-                        uint32_t src_ip, uint32_t dst_ip,
-                        uint16_t src_port, uint16_t dst_port,
-                        int data_len) {
 
-    // 获取当前连接的状态（如果不存在，默认为 CLOSED）
-    TcpState current_state = CLOSED;
-    auto it = connection_tracker.find(key);
-    if (it != connection_tracker.end()) {
-        current_state = it->second;
+const int HIST_SUB_BUCKET_BITS = 7;
+const int HIST_SUB_BUCKETS = 1 << HIST_SUB_BUCKET_BITS;        // 每个量级 128 个子桶
+const int HIST_MAGNITUDES = 34;                                 // 最大值约 255 << 32 us
+const int HIST_BUCKETS = HIST_MAGNITUDES * HIST_SUB_BUCKETS;
+const size_t MAX_SERVICES = 256;                                // 每张表最多跟踪的服务数
+
+/*
+ * 延迟直方图（单位：微秒）
+ */
+struct LatencyHistogram {
+    uint64_t total;                 // 样本数
+    uint64_t min;
+    uint64_t max;
+    uint64_t counts[HIST_BUCKETS];
+
+    LatencyHistogram() : total(0), min(0), max(0) {
+        memset(counts, 0, sizeof(counts));
     }
+};
 
-    std::string src_ip_str = ip_to_string(src_ip);
-    std::string dst_ip_str = ip_to_string(dst_ip);
-    double timestamp = get_relative_time();
+/*
+ * 数值 -> 桶下标
+ *
+ * 小于 256 的值每个值一个桶（精确）；更大的值取最高 8 位有效位：
+ * shift = 最高位位置 - 7，子桶 = v >> shift（128 ~ 255）
+ */
+int histogram_index(uint64_t v) {
+    if (v < (uint64_t)(2 * HIST_SUB_BUCKETS)) {
+        return (int)v;
+    }
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BUCKET_BITS;
+    int index = (shift + 1) * HIST_SUB_BUCKETS + (int)(v >> shift) - HIST_SUB_BUCKETS;
+    return std::min(index, HIST_BUCKETS - 1);
+}
 
-    // ==================== RST 处理 ====================
-    /*
-     * RST (Reset) 标志：立即终止连接
-     * 任何状态下收到 RST 都应该删除连接记录
-     */
-    if (tcp->rst) {
-        connection_tracker.erase(key);
-        printf("[%.3f] 🔴 连接重置 (RST): %s:%d <-> %s:%d [%s -> CLOSED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port),
-               state_to_string(current_state));
-        return;
+/*
+ * 桶下标 -> 该桶覆盖的最小值 / 最大值
+ */
+uint64_t histogram_lowest(int index) {
+    if (index < 2 * HIST_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    return (uint64_t)(index % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS) << shift;
+}
+
+uint64_t histogram_highest(int index) {
+    if (index < 2 * HIST_SUB_BUCKETS) {
+        return index;
     }
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    return histogram_lowest(index) + ((uint64_t)1 << shift) - 1;
+}
 
-    // ==================== 三次握手：连接建立 ====================
+void histogram_record(LatencyHistogram& h, double seconds) {
+    uint64_t us = seconds > 0 ? (uint64_t)(seconds * 1e6) : 0;
+    h.counts[histogram_index(us)]++;
+    h.min = h.total == 0 ? us : std::min(h.min, us);
+    h.max = std::max(h.max, us);
+    h.total++;
+}
 
-    /*
-     * 状态转换 1: CLOSED -> SYN_SENT
-     * 触发条件：收到 SYN 标志，且没有 ACK 标志
-     * 含义：客户端发起连接请求（三次握手的第一步）
-     */
-    if (current_state == CLOSED && tcp->syn && !tcp->ack) {
-        connection_tracker[key] = SYN_SENT;
-        printf("[%.3f] 🟢 新连接发起 (SYN): %s:%d -> %s:%d [CLOSED -> SYN_SENT]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
+void histogram_merge(LatencyHistogram& into, const LatencyHistogram& from) {
+    if (from.total == 0) {
         return;
     }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        into.counts[i] += from.counts[i];
+    }
+    into.min = into.total == 0 ? from.min : std::min(into.min, from.min);
+    into.max = std::max(into.max, from.max);
+    into.total += from.total;
+}
 
-    /*
-     * 状态转换 2: SYN_SENT -> ESTABLISHED
-     * 触发条件：收到 SYN + ACK 标志
-     * 含义：服务器响应连接请求（三次握手的第二步）
-     *
-     * 注意：这是简化模型，实际上应该先转到 SYN_RECEIVED，
-     * 然后等待最后的 ACK 才转到 ESTABLISHED
-     */
-    if (current_state == SYN_SENT && tcp->syn && tcp->ack) {
-        connection_tracker[key] = ESTABLISHED;
-        printf("[%.3f] 🟢 连接建立 (SYN-ACK): %s:%d <-> %s:%d [SYN_SENT -> ESTABLISHED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
-        return;
+/*
+ * 百分位数（返回所在桶的上界，与 HDR Histogram 的约定一致；不超过实际最大值）
+ */
+uint64_t histogram_percentile(const LatencyHistogram& h, double p) {
+    if (h.total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max((uint64_t)1, (uint64_t)(p / 100.0 * h.total + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h.counts[i];
+        if (seen >= rank) {
+            return std::min(histogram_highest(i), h.max);
+        }
     }
+    return h.max;
+}
 
-    /*
-     * 状态转换 2b: SYN_SENT -> ESTABLISHED (收到最后的 ACK)
-     * 触发条件：当前状态是 SYN_SENT，只有 ACK 标志
-     * 含义：三次握手的第三步，客户端确认服务器的 SYN-ACK
-     */
-    if (current_state == SYN_SENT && tcp->ack && !tcp->syn && !tcp->fin) {
-        connection_tracker[key] = ESTABLISHED;
-        printf("[%.3f] 🟢 连接确认 (ACK): %s:%d <-> %s:%d [SYN_SENT -> ESTABLISHED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
-        return;
+struct ServiceKey {
+    uint32_t ip;                    // 服务端 IP（网络字节序）
+    uint16_t port;                  // 服务端端口（主机字节序）
+
+    bool operator<(const ServiceKey& other) const {
+        if (ip != other.ip) return ip < other.ip;
+        return port < other.port;
     }
+};
 
-    // ==================== 数据传输阶段 ====================
+struct ServiceStats {
+    unsigned long long flows;           // 结束的连接数
+    unsigned long long bytes_to_server; // 客户端 -> 服务端的负载字节
+    unsigned long long bytes_to_client; // 服务端 -> 客户端的负载字节
+    LatencyHistogram handshake;
+    LatencyHistogram ttfb;
+    LatencyHistogram duration;
 
-    /*
-     * 数据传输：ESTABLISHED 状态下，有数据负载
-     * 触发条件：连接已建立，且 TCP 数据部分长度 > 0
-     */
-    if (current_state == ESTABLISHED && data_len > 0) {
-        printf("[%.3f] 📦 数据传输: %s:%d -> %s:%d (%d bytes) [ESTABLISHED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port),
-               data_len);
-        return;
+    ServiceStats() : flows(0), bytes_to_server(0), bytes_to_client(0) {}
+};
+
+typedef std::map<ServiceKey, ServiceStats> ServiceTable;
+
+/*
+ * 服务统计的全局状态（持有 analyzer_lock 时访问）
+ */
+struct ServiceReporter {
+    double interval;                // 周期报告间隔（秒，-P），0 表示只在退出时报告
+    double last_report;             // 上次报告的相对时间
+    FILE* json;                     // -H 指定的 JSON 行文件
+    ServiceTable totals;            // 累计（各周期合并）
+    unsigned long long overflow;    // 因超过 MAX_SERVICES 未统计的样本数
+};
+
+ServiceReporter service_reporter = {0.0, 0.0, NULL, ServiceTable(), 0};
+
+/*
+ * 连接的服务端
+ */
+ServiceKey service_key_of(const ConnectionID& key, const FlowRecord& flow) {
+    ServiceKey s;
+    // client_dir 是客户端发出数据的方向；dir 0 从 key.src 发出
+    s.ip = flow.client_dir == 0 ? key.dst_ip : key.src_ip;
+    s.port = flow.client_dir == 0 ? key.dst_port : key.src_port;
+    return s;
+}
+
+/*
+ * 取服务的统计项，表满时返回 NULL
+ */
+ServiceStats* service_entry(ServiceTable& table, const ServiceKey& s) {
+    ServiceTable::iterator it = table.find(s);
+    if (it != table.end()) {
+        return &it->second;
+    }
+    if (table.size() >= MAX_SERVICES) {
+        service_reporter.overflow++;
+        return NULL;
     }
+    return &table[s];
+}
 
-    // ==================== 四次挥手：连接关闭 ====================
+/*
+ * 把 from 合并进 into
+ */
+void service_merge(ServiceTable& into, const ServiceTable& from) {
+    for (ServiceTable::const_iterator it = from.begin(); it != from.end(); ++it) {
+        ServiceStats* st = service_entry(into, it->first);
+        if (st == NULL) {
+            continue;
+        }
+        st->flows += it->second.flows;
+        st->bytes_to_server += it->second.bytes_to_server;
+        st->bytes_to_client += it->second.bytes_to_client;
+        histogram_merge(st->handshake, it->second.handshake);
+        histogram_merge(st->ttfb, it->second.ttfb);
+        histogram_merge(st->duration, it->second.duration);
+    }
+}
 
-    /*
-     * 状态转换 3: ESTABLISHED -> FIN_WAIT_1
-     * 触发条件：收到 FIN 标志
-     * 含义：主动关闭方发起关闭请求（四次挥手的第一步）
-     */
-    if (current_state == ESTABLISHED && tcp->fin) {
-        connection_tracker[key] = FIN_WAIT_1;
-        printf("[%.3f] 🔵 连接关闭发起 (FIN): %s:%d -> %s:%d [ESTABLISHED -> FIN_WAIT_1]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
-        return;
+/*
+ * 握手完成：记录 SYN -> SYN-ACK 的时间
+ */
+void service_record_handshake(ServiceTable& table, const ConnectionID& key,
+                              FlowRecord& flow, double now) {
+    flow.synack_time = now;
+    ServiceStats* st = service_entry(table, service_key_of(key, flow));
+    if (st != NULL) {
+        histogram_record(st->handshake, now - flow.first_seen);
     }
+}
 
-    /*
-     * 状态转换 4: FIN_WAIT_1 -> FIN_WAIT_2
-     * 触发条件：收到 ACK（对 FIN 的确认）
-     * 含义：对方确认了我方的关闭请求（四次挥手的第二步）
-     */
-    if (current_state == FIN_WAIT_1 && tcp->ack && !tcp->fin) {
-        connection_tracker[key] = FIN_WAIT_2;
-        printf("[%.3f] 🔵 关闭确认 (ACK): %s:%d <-> %s:%d [FIN_WAIT_1 -> FIN_WAIT_2]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
+/*
+ * 某个方向的第一个负载字节：服务端的第一个字节记录首字节时间
+ *
+ * 参数：
+ * - d: 负载的方向
+ */
+void service_record_first_data(ServiceTable& table, const ConnectionID& key,
+                               FlowRecord& flow, int d, double now) {
+    if (d == flow.client_dir) {
+        flow.client_data_time = now;
         return;
     }
-
-    /*
-     * 状态转换 5: FIN_WAIT_1 -> CLOSING (同时关闭)
-     * 触发条件：在 FIN_WAIT_1 状态下收到对方的 FIN
-     * 含义：双方同时发起关闭
-     */
-    if (current_state == FIN_WAIT_1 && tcp->fin) {
-        connection_tracker[key] = CLOSING;
-        printf("[%.3f] 🔵 同时关闭 (FIN): %s:%d <-> %s:%d [FIN_WAIT_1 -> CLOSING]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
+    // 客户端先发请求时从请求开始计时，否则（服务端先发言）从 SYN-ACK 开始
+    double since = flow.client_data_time > 0 ? flow.client_data_time : flow.synack_time;
+    if (since <= 0) {
         return;
     }
+    ServiceStats* st = service_entry(table, service_key_of(key, flow));
+    if (st != NULL) {
+        histogram_record(st->ttfb, now - since);
+    }
+}
 
-    /*
-     * 状态转换 6: FIN_WAIT_2 -> TIME_WAIT
-     * 触发条件：收到对方的 FIN（四次挥手的第三步）
-     * 含义：对方也发起关闭，进入等待状态
-     */
-    if (current_state == FIN_WAIT_2 && tcp->fin) {
-        connection_tracker[key] = TIME_WAIT;
-        printf("[%.3f] 🔵 对方关闭 (FIN): %s:%d <-> %s:%d [FIN_WAIT_2 -> TIME_WAIT]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
+/*
+ * 连接结束：记录持续时间和双向字节数
+ */
+void service_record_end(ServiceTable& table, const ConnectionID& key,
+                        const FlowRecord& flow, double now) {
+    ServiceStats* st = service_entry(table, service_key_of(key, flow));
+    if (st == NULL) {
         return;
     }
+    st->flows++;
+    st->bytes_to_server += flow.dir[flow.client_dir].bytes;
+    st->bytes_to_client += flow.dir[1 - flow.client_dir].bytes;
+    histogram_record(st->duration, now - flow.first_seen);
+}
 
-    /*
-     * 状态转换 7: TIME_WAIT -> CLOSED
-     * 触发条件：收到最后的 ACK（四次挥手的第四步）
-     * 含义：连接完全关闭
-     */
-    if (current_state == TIME_WAIT && tcp->ack) {
-        connection_tracker.erase(key);
-        printf("[%.3f] 🔵 连接完全关闭 (ACK): %s:%d <-> %s:%d [TIME_WAIT -> CLOSED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
+/*
+ * 打印服务统计表（按连接数从多到少，最多 20 行）
+ */
+void service_print_table(const ServiceTable& table, const char* title) {
+    if (table.empty()) {
         return;
     }
+    std::vector<std::pair<unsigned long long, ServiceTable::const_iterator> > order;
+    for (ServiceTable::const_iterator it = table.begin(); it != table.end(); ++it) {
+        order.push_back(std::make_pair(it->second.flows + it->second.handshake.total, it));
+    }
+    std::sort(order.begin(), order.end(),
+              [](const std::pair<unsigned long long, ServiceTable::const_iterator>& a,
+                 const std::pair<unsigned long long, ServiceTable::const_iterator>& b) {
+                  return a.first > b.first;
+              });
 
-    /*
-     * 状态转换 8: CLOSING -> CLOSED
+    printf("[%.3f] 📊 服务延迟%s:\n", get_relative_time(), title);
+    // 中文字符占两列，表头按显示宽度手工对齐
+    printf("%s\n", "    服务端                   连接  握手 p50/p99 ms    首字节 p50/p99 ms    持续 p50/p99 s           上行/下行字节");
+    for (size_t i = 0; i < order.size() && i < 20; i++) {
+        const ServiceStats& st = order[i].second->second;
+        char server[32];
+        snprintf(server, sizeof(server), "%s:%d",
+                 ip_to_string(order[i].second->first.ip).c_str(), order[i].second->first.port);
+        printf("    %-21s %7llu %9.2f/%-9.2f %9.2f/%-9.2f %9.3f/%-9.3f %10llu/%llu\n",
+               server, st.flows,
+               histogram_percentile(st.handshake, 50) / 1e3, histogram_percentile(st.handshake, 99) / 1e3,
+               histogram_percentile(st.ttfb, 50) / 1e3, histogram_percentile(st.ttfb, 99) / 1e3,
+               histogram_percentile(st.duration, 50) / 1e6, histogram_percentile(st.duration, 99) / 1e6,
+               st.bytes_to_server, st.bytes_to_client);
+    }
+    if (order.size() > 20) {
+        printf("    ... 共 %zu 个服务\n", order.size());
+    }
+    fflush(stdout);
+}
+
+/*
+ * 以 JSON 输出一个直方图：样本数、最值、常用百分位，以及非空桶 [桶下界, 计数]，
+ * 下游按相同的分桶规则即可精确合并
+ */
+void service_write_histogram(FILE* out, const char* name, const LatencyHistogram& h) {
+    fprintf(out, "\"%s\":{\"count\":%llu,\"min\":%llu,\"max\":%llu,\"p50\":%llu,\"p90\":%llu,"
+            "\"p99\":%llu,\"p999\":%llu,\"buckets\":[",
+            name, (unsigned long long)h.total, (unsigned long long)h.min, (unsigned long long)h.max,
+            (unsigned long long)histogram_percentile(h, 50), (unsigned long long)histogram_percentile(h, 90),
+            (unsigned long long)histogram_percentile(h, 99), (unsigned long long)histogram_percentile(h, 99.9));
+    bool first = true;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (h.counts[i] != 0) {
+            fprintf(out, "%s[%llu,%llu]", first ? "" : ",",
+                    (unsigned long long)histogram_lowest(i), (unsigned long long)h.counts[i]);
+            first = false;
+        }
+    }
+    fprintf(out, "]}");
+}
+
+/*
+ * 每个服务写一行 JSON（一个报告周期的增量）
+ */
+void service_write_json(FILE* out, const ServiceTable& table, double period_start, double period_end) {
+    for (ServiceTable::const_iterator it = table.begin(); it != table.end(); ++it) {
+        const ServiceStats& st = it->second;
+        fprintf(out, "{\"start\":%.3f,\"end\":%.3f,\"server\":\"%s\",\"port\":%d,\"flows\":%llu,"
+                "\"bytes_to_server\":%llu,\"bytes_to_client\":%llu,\"unit\":\"us\",",
+                start_time + period_start, start_time + period_end,
+                ip_to_string(it->first.ip).c_str(), it->first.port,
+                st.flows, st.bytes_to_server, st.bytes_to_client);
+        service_write_histogram(out, "handshake", st.handshake);
+        fprintf(out, ",");
+        service_write_histogram(out, "ttfb", st.ttfb);
+        fprintf(out, ",");
+        service_write_histogram(out, "duration", st.duration);
+        fprintf(out, "}\n");
+    }
+    fflush(out);
+}
+
+// ======================== 捕获接口 ========================
+
+/*
+ * 一个捕获接口
+ *
+ * 每个接口有自己的套接字/环和捕获线程，所有接口共享同一个连接跟踪表。
+ * 规范化的 ConnectionID 与方向无关，所以即使一个连接的两个方向
+ * 经过不同的网卡（路由器上的非对称路径），也会合并到同一条记录中。
+ */
+struct CaptureInterface {
+    std::string name;
+    int ifindex;
+    std::thread thread;
+    int result;                         // 捕获函数的返回值
+    double last_overload_check;         // 本接口上次过载检查的时间
+    unsigned long long packets;         // 收到的帧数
+    unsigned long long bytes;           // 收到的字节数
+    unsigned long long tcp_packets;     // 进入状态机的 TCP 段数
+    unsigned long long kernel_drops;    // 内核丢弃的帧数
+    unsigned long long bad_ip_checksums;    // IP 头部校验和错误的帧数（-C）
+    unsigned long long bad_tcp_checksums;   // TCP 校验和错误的段数（-C）
+    unsigned long long last_report;     // 上次打印吞吐时的帧数
+    ServiceTable services;              // 本线程记录的服务统计（周期报告时合并）
+};
+
+// 启动捕获线程前建好，之后不再增删
+std::vector<CaptureInterface> capture_interfaces;
+
+/*
+ * 分析器锁：保护连接跟踪表、分片重组表、各项统计和过载控制器
+ *
+ * 各接口线程并行收包，处理帧时依次进入分析器，
+ * 不同接口上同一连接的包按进入顺序更新同一条记录
+ */
+std::mutex analyzer_lock;
+
+// 正在处理的帧来自哪个接口（持有 analyzer_lock 时有效，tracepoint 后端为 NULL）
+CaptureInterface* current_interface = NULL;
+
+/*
+ * 当前线程的服务统计表（tracepoint 后端没有捕获接口，使用全局表）
+ */
+ServiceTable local_services;
+
+ServiceTable& current_services() {
+    return current_interface != NULL ? current_interface->services : local_services;
+}
+
+/*
+ * 合并各线程的服务统计，得到本周期的快照并打印/写文件，再并入累计表
+ *
+ * 参数：
+ * - final: 程序退出时调用，打印累计表
+ */
+void service_report(bool final) {
+    double now = get_relative_time();
+    ServiceTable period;
+    service_merge(period, local_services);
+    local_services.clear();
+    for (size_t i = 0; i < capture_interfaces.size(); i++) {
+        service_merge(period, capture_interfaces[i].services);
+        capture_interfaces[i].services.clear();
+    }
+
+    if (service_reporter.interval > 0 && !period.empty()) {
+        char title[64];
+        snprintf(title, sizeof(title), " (最近 %.0f s)", now - service_reporter.last_report);
+        service_print_table(period, title);
+    }
+    if (service_reporter.json != NULL) {
+        service_write_json(service_reporter.json, period, service_reporter.last_report, now);
+    }
+    service_merge(service_reporter.totals, period);
+    service_reporter.last_report = now;
+
+    if (final) {
+        service_print_table(service_reporter.totals, " (累计)");
+    }
+}
+
+// ======================== TCP 选项与连接指标 ========================
+
+/*
+ * TCP 选项 (位于固定 20 字节头部之后，长度 = doff * 4 - 20)
+ *
+ *   kind 0  EOL           选项结束
+ *   kind 1  NOP           填充
+ *   kind 2  MSS           len 4   最大报文段长度（仅 SYN）
+ *   kind 3  Window Scale  len 3   窗口扩大因子（仅 SYN，双方都通告才生效）
+ *   kind 4  SACK-Permitted len 2  允许选择性确认（仅 SYN）
+ *   kind 5  SACK          len 2+8n  已收到的不连续数据块
+ *   kind 8  Timestamps    len 10  TSval + TSecr
+ */
+struct TcpOptions {
+    int mss;                // 0 表示没有
+    int wscale;             // -1 表示没有
+    bool sack_permitted;
+    int sack_blocks;        // SACK 块个数
+    bool has_timestamp;
+    uint32_t tsval;
+    uint32_t tsecr;
+};
+
+const int TCP_MAX_WSCALE = 14;      // RFC 7323：扩大因子上限
+
+/*
+ * 解析 TCP 选项
+ *
+ * 快速路径：连接建立后几乎所有段的选项都是 "NOP NOP TS"（12 字节，
+ * 与 Linux 内核 tcp_parse_aligned_timestamp 的判断相同），一次 32 位比较即可识别
+ */
+void parse_tcp_options(const unsigned char* opt, int len, TcpOptions& o) {
+    o.mss = 0;
+    o.wscale = -1;
+    o.sack_permitted = false;
+    o.sack_blocks = 0;
+    o.has_timestamp = false;
+
+    if (len == 12) {
+        uint32_t head;
+        memcpy(&head, opt, sizeof(head));
+        if (head == htonl((1 << 24) | (1 << 16) | (8 << 8) | 10)) {
+            o.has_timestamp = true;
+            memcpy(&o.tsval, opt + 4, 4);
+            memcpy(&o.tsecr, opt + 8, 4);
+            o.tsval = ntohl(o.tsval);
+            o.tsecr = ntohl(o.tsecr);
+            return;
+        }
+    }
+
+    int i = 0;
+    while (i < len) {
+        unsigned char kind = opt[i];
+        if (kind == 0) {
+            break;              // EOL
+        }
+        if (kind == 1) {
+            i++;                // NOP
+            continue;
+        }
+        if (i + 1 >= len) {
+            break;
+        }
+        int olen = opt[i + 1];
+        if (olen < 2 || i + olen > len) {
+            break;              // 格式错误，忽略余下的选项
+        }
+        switch (kind) {
+            case 2:
+                if (olen == 4) {
+                    o.mss = (opt[i + 2] << 8) | opt[i + 3];
+                }
+                break;
+            case 3:
+                if (olen == 3) {
+                    o.wscale = std::min((int)opt[i + 2], TCP_MAX_WSCALE);
+                }
+                break;
+            case 4:
+                o.sack_permitted = (olen == 2);
+                break;
+            case 5:
+                o.sack_blocks = (olen - 2) / 8;
+                break;
+            case 8:
+                if (olen == 10) {
+                    o.has_timestamp = true;
+                    memcpy(&o.tsval, opt + i + 2, 4);
+                    memcpy(&o.tsecr, opt + i + 6, 4);
+                    o.tsval = ntohl(o.tsval);
+                    o.tsecr = ntohl(o.tsecr);
+                }
+                break;
+            default:
+                break;
+        }
+        i += olen;
+    }
+}
+
+/*
+ * 序列号比较（考虑 32 位回绕）：a 在 b 之后返回 true
+ */
+bool seq_after(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/*
+ * 用一个 TCP 段更新连接指标
+ *
+ * 参数：
+ * - key, flow: 连接标识和记录
+ * - d: 段的方向（0 = 从 ConnectionID.src 发出，1 = 反方向）
+ * - tcp, opts: TCP 头部和已解析的选项
+ * - data_len: 负载长度
+ * - ip_len: IP 数据报总长度
+ */
+void update_flow_metrics(const ConnectionID& key, FlowRecord& flow, int d, const struct tcphdr* tcp,
+                         const TcpOptions& opts, int data_len, int ip_len) {
+    FlowDirection& me = flow.dir[d];
+    FlowDirection& peer = flow.dir[1 - d];
+    double now = get_timestamp();
+
+    me.packets++;
+    me.octets += ip_len;
+    me.tcp_flags |= ((const uint8_t*)tcp)[13];  // CWR ECE URG ACK PSH RST SYN FIN
+    if (current_interface != NULL) {
+        me.ifindex = current_interface->ifindex;
+    }
+    flow.last_seen = now - start_time;
+    uint64_t now_us = (uint64_t)(flow.last_seen * 1e6);
+
+    // 状态机刚刚改变了状态（连接结束的情况由 finish_flow 记录）
+    if (flow.state != flow.timeline.last_state) {
+        timeline_record(flow.timeline, TL_STATE, d, now_us, flow.state);
+        flow.timeline.last_state = flow.state;
+    }
+
+    // ==================== 握手选项 ====================
+    if (tcp->syn) {
+        if (opts.mss) {
+            me.mss = opts.mss;
+        }
+        me.wscale = opts.wscale;
+        me.sack_permitted = opts.sack_permitted;
+    }
+
+    // ==================== 通告窗口（按扩大因子换算） ====================
+    // SYN 段中的窗口不扩大；扩大因子只有在双方都通告时才生效
+    int shift = (!tcp->syn && me.wscale >= 0 && peer.wscale >= 0) ? me.wscale : 0;
+    me.window = (uint32_t)ntohs(tcp->window) << shift;
+    if (me.window == 0 && !tcp->syn && !tcp->rst) {
+        me.zero_windows++;
+        if (!me.in_zero_window) {
+            me.in_zero_window = true;
+            timeline_record(flow.timeline, TL_ZERO_WINDOW, d, now_us, 0);
+        }
+    } else if (me.window > 0 && me.in_zero_window) {
+        me.in_zero_window = false;
+        timeline_record(flow.timeline, TL_WINDOW_OPEN, d, now_us, me.window);
+    }
+
+    // ==================== 序列号 / 确认号 ====================
+    uint32_t end_seq = ntohl(tcp->seq) + data_len + (tcp->syn ? 1 : 0) + (tcp->fin ? 1 : 0);
+    // 负载没有超出已发送的最高序列号：重传（或网络乱序）
+    if (data_len > 0 && me.seq_valid && !seq_after(end_seq, me.snd_nxt)) {
+        me.retransmits++;
+        timeline_record(flow.timeline, TL_RETRANSMIT, d, now_us, data_len);
+    }
+    if (!me.seq_valid || seq_after(end_seq, me.snd_nxt)) {
+        me.snd_nxt = end_seq;
+        me.seq_valid = true;
+    }
+    if (tcp->ack) {
+        me.ack = ntohl(tcp->ack_seq);
+        me.ack_valid = true;
+    }
+
+    if (data_len > 0) {
+        if (me.data_packets == 0 && flow.client_dir >= 0) {
+            service_record_first_data(current_services(), key, flow, d, flow.last_seen);
+        }
+        me.bytes += data_len;
+        me.data_packets++;
+
+        // 在途数据 = 已发送 - 对方已确认；接近对方窗口说明发送被接收方限制
+        if (peer.ack_valid && peer.window > 0) {
+            uint32_t in_flight = me.snd_nxt - peer.ack;
+            uint32_t segment = me.mss ? me.mss : 536;
+            bool limited = (int32_t)in_flight > 0 && in_flight + segment > peer.window;
+            if (limited) {
+                me.window_limited++;
+                if (!me.window_full) {
+                    timeline_record(flow.timeline, TL_WINDOW_FULL, d, now_us, in_flight);
+                }
+            }
+            me.window_full = limited;
+        }
+    }
+
+    me.sack_blocks += opts.sack_blocks;
+
+    // ==================== 时间戳 RTT ====================
+    if (opts.has_timestamp) {
+        // 对方回显了我们记住的 TSval：得到一个 RTT 样本
+        if (tcp->ack && peer.ts_pending && opts.tsecr == peer.ts_pending_val) {
+            double rtt = now - peer.ts_pending_time;
+            peer.ts_pending = false;
+            if (peer.rtt_samples == 0) {
+                peer.srtt = rtt;
+                peer.min_rtt = rtt;
+            } else {
+                peer.srtt += (rtt - peer.srtt) / 8;
+                peer.min_rtt = std::min(peer.min_rtt, rtt);
+            }
+            peer.rtt_samples++;
+        }
+
+        // 记住本方向新的 TSval（上一个还没被回显时保留旧的，超过 1 秒视为丢失）
+        if ((!me.ts_pending || now - me.ts_pending_time > 1.0) && opts.tsval != me.ts_pending_val) {
+            me.ts_pending = true;
+            me.ts_pending_val = opts.tsval;
+            me.ts_pending_time = now;
+        }
+    }
+}
+
+/*
+ * 根据一个方向的指标判断发送受什么限制
+ */
+const char* diagnose_direction(const FlowDirection& me) {
+    if (me.data_packets == 0) {
+        return "无数据";
+    }
+    if (me.window_limited * 2 > me.data_packets) {
+        return "接收方受限 (对方窗口已满)";
+    }
+    return "非窗口受限";
+}
+
+/*
+ * 打印一个方向的指标摘要
+ */
+void print_direction_summary(const ConnectionID& key, const FlowRecord& flow, int d) {
+    const FlowDirection& me = flow.dir[d];
+    const FlowDirection& peer = flow.dir[1 - d];
+    uint32_t from_ip = d == 0 ? key.src_ip : key.dst_ip;
+    uint32_t to_ip = d == 0 ? key.dst_ip : key.src_ip;
+    uint16_t from_port = d == 0 ? key.src_port : key.dst_port;
+    uint16_t to_port = d == 0 ? key.dst_port : key.src_port;
+
+    std::string rtt = "RTT 未知";
+    if (me.rtt_samples > 0) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "RTT %.3f ms (最小 %.3f ms, %u 个样本)",
+                 me.srtt * 1000, me.min_rtt * 1000, me.rtt_samples);
+        rtt = buf;
+    }
+    std::string from_str = ip_to_string(from_ip);
+    std::string to_str = ip_to_string(to_ip);
+    char ifname[IF_NAMESIZE] = "?";
+    if (me.ifindex != 0) {
+        if_indextoname(me.ifindex, ifname);
+    }
+    char bad[96] = "";
+    if (me.retransmits > 0) {
+        snprintf(bad, sizeof(bad), ", 重传 %llu 个段", me.retransmits);
+    }
+    if (me.bad_checksums > 0) {
+        size_t used = strlen(bad);
+        snprintf(bad + used, sizeof(bad) - used, ", 校验和错误 %llu 个段", me.bad_checksums);
+    }
+
+    log_event("    %s:%d -> %s:%d (入接口 %s): %llu 包 / %llu 字节%s, MSS %d, 扩大因子 %d, %s, "
+              "对方窗口 %u, 对方零窗口 %llu 次, 对方 SACK 块 %llu, %s\n",
+              from_str.c_str(), from_port, to_str.c_str(), to_port, ifname,
+              me.packets, me.bytes, bad, me.mss, me.wscale, rtt.c_str(),
+              peer.window, peer.zero_windows, peer.sack_blocks,
+              peer.sack_blocks > 0 ? "网络受限 (有丢包/乱序)" : diagnose_direction(me));
+}
+
+// 连接结束原因（IPFIX flowEndReason，RFC 5102）
+enum FlowEndReason {
+    IPFIX_END_IDLE = 1,         // 不活跃超时
+    IPFIX_END_ACTIVE = 2,       // 活跃超时（连接仍在继续）
+    IPFIX_END_OF_FLOW = 3,      // 检测到连接结束 (FIN/RST)
+    IPFIX_END_FORCED = 4        // 程序退出
+};
+
+void ipfix_export_flow(const ConnectionID& key, FlowRecord& flow, uint8_t reason);
+
+// 连接结束时在摘要后打印时间线（-T）
+bool show_timeline = false;
+
+/*
+ * 解码并打印一段连续的事件
+ *
+ * 参数：
+ * - t: 解码起点时间（微秒），返回时为最后一个事件的时间
+ */
+void timeline_dump_events(FILE* out, const unsigned char* p, const unsigned char* end, uint64_t& t) {
+    static const char* const end_reasons[] = {"?", "不活跃超时", "活跃超时", "连接结束", "程序退出"};
+    while (p < end) {
+        int type = *p & 0x0f;
+        int d = (*p >> 4) & 1;
+        p++;
+        uint64_t delta = get_varint(p, end);
+        uint32_t value = (uint32_t)get_varint(p, end);
+        t += delta;
+
+        char what[64];
+        switch (type) {
+            case TL_STATE:
+                snprintf(what, sizeof(what), "状态 -> %s", state_to_string((TcpState)value));
+                break;
+            case TL_RETRANSMIT:
+                if (value > 0) {
+                    snprintf(what, sizeof(what), "重传 %u 字节", value);
+                } else {
+                    snprintf(what, sizeof(what), "重传");     // tracepoint 事件没有长度
+                }
+                break;
+            case TL_ZERO_WINDOW:
+                snprintf(what, sizeof(what), "通告零窗口");
+                break;
+            case TL_WINDOW_OPEN:
+                snprintf(what, sizeof(what), "窗口重新打开 (%u 字节)", value);
+                break;
+            case TL_WINDOW_FULL:
+                snprintf(what, sizeof(what), "用满对方窗口 (在途 %u 字节)", value);
+                break;
+            case TL_BAD_CHECKSUM:
+                snprintf(what, sizeof(what), "校验和错误");
+                break;
+            case TL_END:
+                snprintf(what, sizeof(what), "连接结束 (%s)", end_reasons[value <= 4 ? value : 0]);
+                break;
+            default:
+                snprintf(what, sizeof(what), "未知事件 %d", type);
+                break;
+        }
+        fprintf(out, "      %11.6f  +%9.3f ms  %s  %s\n", t / 1e6, delta / 1e3,
+                type == TL_END ? "  " : (d == 0 ? "→" : "←"), what);
+    }
+}
+
+/*
+ * 打印一个连接的时间线（→ 表示从 ConnectionID.src 发出，← 表示从 dst 发出）
+ */
+void timeline_dump(FILE* out, const ConnectionID& key, const FlowRecord& flow) {
+    const FlowTimeline& tl = flow.timeline;
+    std::string src = ip_to_string(key.src_ip);
+    std::string dst = ip_to_string(key.dst_ip);
+    fprintf(out, "    🕒 时间线 (→ = %s:%d -> %s:%d): %u 个事件, 内联 %u 字节 + %u 个溢出块\n",
+            src.c_str(), key.src_port, dst.c_str(), key.dst_port, tl.events, tl.inline_used, tl.chunks);
+    uint64_t t = tl.base_us;
+    timeline_dump_events(out, tl.inline_data, tl.inline_data + tl.inline_used, t);
+    if (tl.overwritten > 0) {
+        fprintf(out, "      ... 省略 %u 个事件 ...\n", tl.overwritten);
+    }
+    for (uint32_t index = tl.head; index != TIMELINE_NONE; index = timeline_chunk(index).next) {
+        const TimelineChunk& chunk = timeline_chunk(index);
+        t = chunk.prev_us;
+        timeline_dump_events(out, chunk.data, chunk.data + chunk.used, t);
+    }
+}
+
+/*
+ * 导出所有仍在跟踪的连接的时间线（SIGUSR1）
+ */
+void timeline_dump_all(FILE* out) {
+    fprintf(out, "[%.3f] 🕒 导出 %zu 个连接的时间线 (溢出块 %u 个在用 / 共 %u 个, 块池已满丢弃 %llu 个事件)\n",
+            get_relative_time(), connection_tracker.size(), timeline_pool.in_use, timeline_pool.carved,
+            timeline_pool.exhausted);
+    for (auto it = connection_tracker.begin(); it != connection_tracker.end(); ++it) {
+        fprintf(out, "  %s:%d <-> %s:%d [%s]\n", ip_to_string(it->first.src_ip).c_str(), it->first.src_port,
+                ip_to_string(it->first.dst_ip).c_str(), it->first.dst_port, state_to_string(it->second.state));
+        timeline_dump(out, it->first, it->second);
+    }
+    fflush(out);
+}
+
+/*
+ * 连接结束：打印指标摘要、交给 IPFIX 导出，并从跟踪表中删除
+ */
+void finish_flow(const ConnectionID& key, FlowEndReason reason = IPFIX_END_OF_FLOW) {
+    auto it = connection_tracker.find(key);
+    if (it == connection_tracker.end()) {
+        return;
+    }
+    FlowRecord& flow = it->second;
+    timeline_record(flow.timeline, TL_END, 0, (uint64_t)(get_relative_time() * 1e6), reason);
+    ipfix_export_flow(key, flow, reason);
+    if (flow.client_dir >= 0) {
+        service_record_end(current_services(), key, flow, get_relative_time());
+    }
+    if (flow.dir[0].packets + flow.dir[1].packets > 0) {
+        log_event("[%.3f] 📏 连接摘要: 持续 %.3f s, 采样率 1/%u\n",
+                  get_relative_time(), get_relative_time() - flow.first_seen, flow.sample_rate);
+        print_direction_summary(key, flow, 0);
+        print_direction_summary(key, flow, 1);
+        if (show_timeline && !quiet_mode) {
+            timeline_dump(stdout, key, flow);
+        }
+    }
+    timeline_release(flow.timeline);
+    connection_tracker.erase(it);
+}
+
+// ======================== 过载控制与自适应采样 ========================
+
+/*
+ * 过载控制器
+ *
+ * 处理速度跟不上包速率时，内核会静默丢帧，状态机因缺包而失步。控制器定期观察：
+ * - 接收队列的填充率（AF_PACKET: 套接字接收缓冲区占用；AF_XDP: RX 环中待处理的描述符）
+ * - 处理延迟（AF_PACKET: 内核收包时间戳到现在的时间差）
+ * - 内核新增的丢弃数
+ *
+ * 任一指标过高时把采样率 N 翻倍，进入按流一致的 1/N 采样：
+ * - 对规范化的四元组做哈希，只接纳 hash % N == 0 的新连接，同一连接的两个方向结果相同
+ * - 已在跟踪的连接继续完整处理，不会因为 N 变化而半途缺包
+ * - N 取 2 的幂，N 变大时被选中的流是原来的子集
+ * 各项指标持续 OVERLOAD_RECOVER_SEC 秒处于低位后 N 减半，直到恢复完整跟踪 (N = 1)。
+ *
+ * 每个连接记录它被接纳时的采样率（摘要和 IPFIX 记录中都带上），计数乘以采样率即可估计总量。
+ */
+
+const double OVERLOAD_CHECK_SEC = 0.1;      // 检查间隔
+const double OVERLOAD_HOLD_SEC = 0.5;       // 提高采样率后至少等待多久再提高（等待积压消化）
+const double OVERLOAD_RECOVER_SEC = 2.0;    // 低负载持续多久后降低采样率
+const double OVERLOAD_FILL_HIGH = 0.5;      // 填充率高于此值视为过载
+const double OVERLOAD_FILL_LOW = 0.1;       // 填充率低于此值视为空闲
+const double OVERLOAD_LAG_HIGH = 0.1;       // 处理延迟高于此值（秒）视为过载
+const double OVERLOAD_LAG_LOW = 0.01;       // 处理延迟低于此值（秒）视为空闲
+
+struct OverloadController {
+    uint32_t sample_rate;           // 当前采样率 N（1 = 完整跟踪）
+    uint32_t max_sample_rate;       // 上限（-S，1 表示关闭自适应采样）
+    double last_check;              // 上次检查的时间
+    double last_increase;           // 上次提高采样率的时间
+    double calm_since;              // 指标开始处于低位的时间，0 表示当前不空闲
+    unsigned long long sampled_out;      // 因采样跳过的 TCP 段（-D 时也包括 UDP DNS 报文）
+    unsigned long long rate_changes;     // 采样率调整次数
+    unsigned long long admitted_flows;   // 接纳跟踪的新连接数
+    unsigned long long estimated_flows;  // 按接纳时的采样率放大后的新连接数
+};
+
+OverloadController overload = {1, 1024, 0.0, 0.0, 0.0, 0, 0, 0, 0};
+
+/*
+ * 规范化四元组的哈希（64 位混合函数），用于按流一致的采样
+ */
+uint32_t flow_hash(const ConnectionID& key) {
+    uint64_t h = ((uint64_t)key.src_ip << 32 | key.dst_ip) ^
+                 (((uint64_t)key.src_port << 16 | key.dst_port) * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+/*
+ * 采样判断：完整跟踪、被哈希选中、或已在跟踪的连接才进入状态机
+ */
+bool overload_admit(const ConnectionID& key) {
+    if (overload.sample_rate == 1 || (flow_hash(key) & (overload.sample_rate - 1)) == 0) {
+        return true;
+    }
+    return connection_tracker.count(key) != 0;
+}
+
+/*
+ * 是否到了下一次过载检查（捕获循环每一轮调用）
+ *
+ * 参数：
+ * - last_check: 本接口上次检查的时间；每个接口分别观察自己的队列，
+ *   任一接口过载都会提高采样率，所有接口都空闲时才会降低
+ */
+bool overload_check_due(double& last_check) {
+    double now = get_timestamp();
+    if (now - last_check < OVERLOAD_CHECK_SEC) {
+        return false;
+    }
+    last_check = now;
+    overload.last_check = now;
+    return true;
+}
+
+/*
+ * 根据一次观察调整采样率
+ *
+ * 参数：
+ * - fill: 接收队列填充率 (0 ~ 1)
+ * - lag: 处理延迟（秒），无法测量时传 0
+ * - new_drops: 上次检查以来内核新增的丢弃数
+ */
+void overload_update(double fill, double lag, unsigned long long new_drops) {
+    double now = overload.last_check;
+    bool high = fill > OVERLOAD_FILL_HIGH || lag > OVERLOAD_LAG_HIGH || new_drops > 0;
+    bool low = fill < OVERLOAD_FILL_LOW && lag < OVERLOAD_LAG_LOW && new_drops == 0;
+
+    if (high) {
+        overload.calm_since = 0.0;
+        if (overload.sample_rate < overload.max_sample_rate &&
+            now - overload.last_increase >= OVERLOAD_HOLD_SEC) {
+            overload.sample_rate *= 2;
+            overload.last_increase = now;
+            overload.rate_changes++;
+            printf("[%.3f] ⚠️  过载 (填充率 %.0f%%, 延迟 %.1f ms, 新增丢弃 %llu): 采样率 1/%u\n",
+                   get_relative_time(), fill * 100, lag * 1000, new_drops, overload.sample_rate);
+        }
+    } else if (low) {
+        if (overload.calm_since == 0.0) {
+            overload.calm_since = now;
+        } else if (overload.sample_rate > 1 && now - overload.calm_since >= OVERLOAD_RECOVER_SEC) {
+            overload.sample_rate /= 2;
+            overload.calm_since = now;
+            overload.rate_changes++;
+            printf("[%.3f] ✅ 负载下降: 采样率 1/%u%s\n", get_relative_time(), overload.sample_rate,
+                   overload.sample_rate == 1 ? " (恢复完整跟踪)" : "");
+        }
+    } else {
+        overload.calm_since = 0.0;
+    }
+}
+
+// ======================== IPFIX 流导出 ========================
+
+/*
+ * IPFIX (RFC 7011) 导出器
+ *
+ * 捕获线程只负责把结束/到期的连接转换成定长记录放入队列；
+ * 独立的导出线程从队列取记录，按路径 MTU 打包成 IPFIX 消息，经 UDP 发给采集器：
+ *
+ *   消息头 (16 字节): 版本 10 | 消息长度 | 导出时间 | 序列号 | 观察域 ID
+ *   模板集 (Set ID 2): 定义数据记录的字段（IANA 信息元素编号 + 长度）
+ *   数据集 (Set ID 256): 若干条按模板编码的定长数据记录
+ *
+ * - 每个 TCP 连接按方向导出两条单向流记录
+ * - 计数是增量 (packetDeltaCount / octetDeltaCount)：长连接每经过一个活跃超时导出一次增量，
+ *   此时 flowStartMilliseconds 是本次增量区间的开始
+ * - 连接结束 (FIN/RST)、不活跃超时、活跃超时、程序退出时导出，flowEndReason 记录原因
+ * - UDP 不可靠，模板随第一个消息发送，之后每 IPFIX_TEMPLATE_REFRESH_SEC 秒重发一次
+ * - 序列号 = 此前已成功发送的数据记录总数，采集器据此检测丢失
+ * - 令牌桶限制每秒发送的消息数，避免大量连接同时结束时冲垮采集器
+ */
+
+const uint16_t IPFIX_VERSION = 10;
+const uint16_t IPFIX_TEMPLATE_SET_ID = 2;
+const uint16_t IPFIX_TEMPLATE_ID = 256;             // 数据记录使用的模板 ID（>= 256）
+const uint32_t IPFIX_OBSERVATION_DOMAIN = 1;
+const size_t IPFIX_HEADER_LEN = 16;
+const size_t IPFIX_SET_HEADER_LEN = 4;
+const size_t IPFIX_RECORD_LEN = 56;                 // 模板中所有字段长度之和
+const size_t IPFIX_QUEUE_LIMIT = 65536;             // 待导出记录上限，超出则丢弃并计数
+const double IPFIX_FLUSH_SEC = 1.0;                 // 未填满的消息最多等待多久发送
+const double IPFIX_TEMPLATE_REFRESH_SEC = 30.0;     // 模板重发周期
+
+/*
+ * 模板字段：IANA 信息元素编号和长度
+ */
+struct IpfixField {
+    uint16_t id;
+    uint16_t length;
+};
+
+const IpfixField IPFIX_FIELDS[] = {
+    {8, 4},     // sourceIPv4Address
+    {12, 4},    // destinationIPv4Address
+    {7, 2},     // sourceTransportPort
+    {11, 2},    // destinationTransportPort
+    {4, 1},     // protocolIdentifier
+    {6, 2},     // tcpControlBits
+    {136, 1},   // flowEndReason
+    {2, 8},     // packetDeltaCount
+    {1, 8},     // octetDeltaCount
+    {152, 8},   // flowStartMilliseconds
+    {153, 8},   // flowEndMilliseconds
+    {34, 4},    // samplingInterval（连接被接纳时的采样率 N）
+    {10, 4},    // ingressInterface（该方向最近一个包的入接口 ifindex）
+};
+const int IPFIX_FIELD_COUNT = sizeof(IPFIX_FIELDS) / sizeof(IPFIX_FIELDS[0]);
+
+/*
+ * 一条单向流记录（捕获线程生成，导出线程编码）
+ */
+struct IpfixRecord {
+    uint32_t src_ip;            // 网络字节序
+    uint32_t dst_ip;            // 网络字节序
+    uint16_t src_port;          // 主机字节序
+    uint16_t dst_port;          // 主机字节序
+    uint8_t tcp_flags;
+    uint8_t end_reason;
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t start_ms;          // Unix 毫秒
+    uint64_t end_ms;
+    uint32_t sampling_interval;
+    uint32_t ingress_ifindex;
+};
+
+/*
+ * 导出器状态
+ *
+ * queue / stopping / records_dropped 由 lock 保护；
+ * 其余统计只由导出线程更新，在线程结束后读取
+ */
+struct IpfixExporter {
+    bool enabled;
+    int sock;
+    size_t max_message;         // 单个 IPFIX 消息的最大长度（路径 MTU - IP/UDP 头部）
+    double active_timeout;      // 秒
+    double inactive_timeout;    // 秒
+    int max_messages_per_sec;   // 0 表示不限速
+    double last_expire;         // 上次检查超时的相对时间
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::deque<IpfixRecord> queue;
+    bool stopping;
+    std::thread thread;
+
+    uint32_t sequence;
+    unsigned long long records_queued;
+    unsigned long long records_dropped;
+    unsigned long long records_sent;
+    unsigned long long messages_sent;
+    unsigned long long templates_sent;
+    unsigned long long send_errors;
+};
+
+IpfixExporter ipfix;
+
+/*
+ * 查询到采集器的路径 MTU，更新单个消息的最大长度
+ */
+void ipfix_update_mtu() {
+    int mtu = 0;
+    socklen_t optlen = sizeof(mtu);
+    if (getsockopt(ipfix.sock, IPPROTO_IP, IP_MTU, &mtu, &optlen) < 0 || mtu <= 0) {
+        mtu = 1500;
+    }
+    // 减去 IPv4 (20) 和 UDP (8) 头部；下限为 IPv4 保证可达的 576 字节
+    size_t limit = (size_t)std::max(mtu, 576) - 28;
+    ipfix.max_message = std::min(limit, (size_t)65535);
+}
+
+/*
+ * 打开到采集器的 UDP 套接字
+ *
+ * 参数：
+ * - spec: "IP:端口"
+ */
+bool ipfix_open(const char* spec) {
+    std::string s = spec;
+    size_t colon = s.rfind(':');
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (colon == std::string::npos ||
+        inet_pton(AF_INET, s.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "无效的采集器地址: %s (应为 IP:端口)\n", spec);
+        return false;
+    }
+    addr.sin_port = htons(atoi(s.c_str() + colon + 1));
+
+    ipfix.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ipfix.sock < 0) {
+        perror("创建 IPFIX 套接字失败");
+        return false;
+    }
+
+    // 禁止分片：消息按路径 MTU 打包，connect 之后内核才能给出到采集器的路由 MTU
+    int pmtu = IP_PMTUDISC_DO;
+    setsockopt(ipfix.sock, IPPROTO_IP, IP_MTU_DISCOVER, &pmtu, sizeof(pmtu));
+    if (connect(ipfix.sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("连接 IPFIX 采集器失败");
+        close(ipfix.sock);
+        return false;
+    }
+    ipfix_update_mtu();
+    ipfix.enabled = true;
+    return true;
+}
+
+/*
+ * 向缓冲区追加大端整数
+ */
+void put_be16(std::vector<unsigned char>& buf, uint16_t v) {
+    buf.push_back(v >> 8);
+    buf.push_back(v & 0xff);
+}
+
+void put_be32(std::vector<unsigned char>& buf, uint32_t v) {
+    put_be16(buf, v >> 16);
+    put_be16(buf, v & 0xffff);
+}
+
+void put_be64(std::vector<unsigned char>& buf, uint64_t v) {
+    put_be32(buf, v >> 32);
+    put_be32(buf, v & 0xffffffff);
+}
+
+/*
+ * 开始一个新消息：预留消息头，按需写入模板集，再写数据集头部
+ */
+void ipfix_begin_message(std::vector<unsigned char>& buf, bool with_template) {
+    buf.assign(IPFIX_HEADER_LEN, 0);    // 发送时填写
+    if (with_template) {
+        put_be16(buf, IPFIX_TEMPLATE_SET_ID);
+        put_be16(buf, IPFIX_SET_HEADER_LEN + 4 + IPFIX_FIELD_COUNT * 4);
+        put_be16(buf, IPFIX_TEMPLATE_ID);
+        put_be16(buf, IPFIX_FIELD_COUNT);
+        for (int i = 0; i < IPFIX_FIELD_COUNT; i++) {
+            put_be16(buf, IPFIX_FIELDS[i].id);
+            put_be16(buf, IPFIX_FIELDS[i].length);
+        }
+    }
+    put_be16(buf, IPFIX_TEMPLATE_ID);
+    put_be16(buf, 0);                   // 数据集长度，发送时填写
+}
+
+/*
+ * 按模板字段顺序编码一条数据记录
+ */
+void ipfix_append_record(std::vector<unsigned char>& buf, const IpfixRecord& r) {
+    put_be32(buf, ntohl(r.src_ip));
+    put_be32(buf, ntohl(r.dst_ip));
+    put_be16(buf, r.src_port);
+    put_be16(buf, r.dst_port);
+    buf.push_back(IPPROTO_TCP);
+    put_be16(buf, r.tcp_flags);
+    buf.push_back(r.end_reason);
+    put_be64(buf, r.packets);
+    put_be64(buf, r.octets);
+    put_be64(buf, r.start_ms);
+    put_be64(buf, r.end_ms);
+    put_be32(buf, r.sampling_interval);
+    put_be32(buf, r.ingress_ifindex);
+}
+
+/*
+ * 填写消息头和数据集长度后发送；令牌不足时等待（限速）
+ *
+ * 参数：
+ * - data_set: 数据集头部在缓冲区中的偏移
+ * - records: 消息中的数据记录数
+ * - tokens / last_refill: 令牌桶状态
+ */
+void ipfix_send_message(std::vector<unsigned char>& buf, size_t data_set, uint32_t records,
+                        bool with_template, double& tokens, double& last_refill) {
+    if (ipfix.max_messages_per_sec > 0) {
+        double rate = ipfix.max_messages_per_sec;
+        double now = get_timestamp();
+        tokens = std::min(rate, tokens + (now - last_refill) * rate);
+        last_refill = now;
+        if (tokens < 1.0) {
+            usleep((useconds_t)((1.0 - tokens) / rate * 1e6));
+            tokens = 1.0;
+            last_refill = get_timestamp();
+        }
+        tokens -= 1.0;
+    }
+
+    uint16_t set_len = buf.size() - data_set;
+    buf[data_set + 2] = set_len >> 8;
+    buf[data_set + 3] = set_len & 0xff;
+
+    std::vector<unsigned char> header;
+    put_be16(header, IPFIX_VERSION);
+    put_be16(header, buf.size());
+    put_be32(header, (uint32_t)time(NULL));
+    put_be32(header, ipfix.sequence);
+    put_be32(header, IPFIX_OBSERVATION_DOMAIN);
+    std::copy(header.begin(), header.end(), buf.begin());
+
+    if (send(ipfix.sock, buf.data(), buf.size(), 0) < 0) {
+        ipfix.send_errors++;
+        if (errno == EMSGSIZE) {
+            ipfix_update_mtu();     // 路径 MTU 变小了，后续消息按新的 MTU 打包
+        }
+        return;
+    }
+    ipfix.sequence += records;
+    ipfix.records_sent += records;
+    ipfix.messages_sent++;
+    if (with_template) {
+        ipfix.templates_sent++;
+    }
+}
+
+/*
+ * 导出线程：取出队列中的记录，填满一个消息（路径 MTU）就发送；
+ * 未填满的消息最多等待 IPFIX_FLUSH_SEC 秒
+ */
+void ipfix_export_thread() {
+    std::vector<unsigned char> buf;
+    buf.reserve(65535);
+    std::vector<IpfixRecord> batch;
+    double tokens = ipfix.max_messages_per_sec;
+    double last_refill = get_timestamp();
+    double last_template = 0.0;
+    double message_started = 0.0;
+    bool with_template = false;
+    size_t data_set = 0;
+    uint32_t records = 0;
+
+    std::unique_lock<std::mutex> guard(ipfix.lock);
+    while (true) {
+        if (ipfix.queue.empty() && !ipfix.stopping) {
+            ipfix.wakeup.wait_for(guard, std::chrono::milliseconds((int)(IPFIX_FLUSH_SEC * 1000)));
+        }
+        bool stopping = ipfix.stopping;
+        batch.assign(ipfix.queue.begin(), ipfix.queue.end());
+        ipfix.queue.clear();
+        guard.unlock();
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (records == 0) {
+                double now = get_timestamp();
+                with_template = now - last_template >= IPFIX_TEMPLATE_REFRESH_SEC;
+                if (with_template) {
+                    last_template = now;
+                }
+                ipfix_begin_message(buf, with_template);
+                data_set = buf.size() - IPFIX_SET_HEADER_LEN;
+                message_started = now;
+            }
+            ipfix_append_record(buf, batch[i]);
+            records++;
+            if (buf.size() + IPFIX_RECORD_LEN > ipfix.max_message) {
+                ipfix_send_message(buf, data_set, records, with_template, tokens, last_refill);
+                records = 0;
+            }
+        }
+
+        if (records > 0 && (stopping || get_timestamp() - message_started >= IPFIX_FLUSH_SEC)) {
+            ipfix_send_message(buf, data_set, records, with_template, tokens, last_refill);
+            records = 0;
+        }
+
+        guard.lock();
+        if (stopping && ipfix.queue.empty()) {
+            break;
+        }
+    }
+}
+
+/*
+ * 启动导出线程
+ */
+void ipfix_start() {
+    printf("📤 IPFIX 导出已开启: 每个消息最多 %zu 字节 (%zu 条记录), 活跃超时 %.0f s, "
+           "不活跃超时 %.0f s, 限速 %d 消息/秒\n\n",
+           ipfix.max_message,
+           (ipfix.max_message - IPFIX_HEADER_LEN - IPFIX_SET_HEADER_LEN) / IPFIX_RECORD_LEN,
+           ipfix.active_timeout, ipfix.inactive_timeout, ipfix.max_messages_per_sec);
+    ipfix.thread = std::thread(ipfix_export_thread);
+}
+
+/*
+ * 把一个连接自上次导出以来的增量放入导出队列（捕获线程调用）
+ *
+ * 参数：
+ * - reason: flowEndReason (1 不活跃超时, 2 活跃超时, 3 连接结束, 4 强制结束)
+ */
+void ipfix_export_flow(const ConnectionID& key, FlowRecord& flow, uint8_t reason) {
+    if (!ipfix.enabled) {
+        return;
+    }
+    double interval_start = std::max(flow.first_seen, flow.last_export);
+    double interval_end = std::max(interval_start, flow.last_seen);
+    IpfixRecord out[2];
+    int count = 0;
+
+    for (int d = 0; d < 2; d++) {
+        FlowDirection& dir = flow.dir[d];
+        if (dir.packets == dir.exported_packets) {
+            continue;   // 这个方向没有新的包
+        }
+        IpfixRecord& r = out[count++];
+        r.src_ip = d == 0 ? key.src_ip : key.dst_ip;
+        r.dst_ip = d == 0 ? key.dst_ip : key.src_ip;
+        r.src_port = d == 0 ? key.src_port : key.dst_port;
+        r.dst_port = d == 0 ? key.dst_port : key.src_port;
+        r.tcp_flags = dir.tcp_flags;
+        r.end_reason = reason;
+        r.packets = dir.packets - dir.exported_packets;
+        r.octets = dir.octets - dir.exported_octets;
+        r.start_ms = (uint64_t)((start_time + interval_start) * 1000);
+        r.end_ms = (uint64_t)((start_time + interval_end) * 1000);
+        r.sampling_interval = flow.sample_rate;
+        r.ingress_ifindex = dir.ifindex;
+        dir.exported_packets = dir.packets;
+        dir.exported_octets = dir.octets;
+    }
+    flow.last_export = get_relative_time();
+    if (count == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(ipfix.lock);
+    for (int i = 0; i < count; i++) {
+        if (ipfix.queue.size() >= IPFIX_QUEUE_LIMIT) {
+            ipfix.records_dropped++;
+            continue;
+        }
+        ipfix.queue.push_back(out[i]);
+        ipfix.records_queued++;
+    }
+    // 攒够一个消息再唤醒导出线程，否则由它的定时刷新处理
+    if (ipfix.queue.size() * IPFIX_RECORD_LEN >= ipfix.max_message) {
+        ipfix.wakeup.notify_one();
+    }
+}
+
+/*
+ * 检查活跃/不活跃超时（捕获线程调用，每秒最多一次）
+ *
+ * - 不活跃超时：导出并从跟踪表中删除（丢失 FIN/RST 的连接也能被回收）
+ * - 活跃超时：长连接导出一次增量，继续跟踪
+ */
+void ipfix_expire_flows() {
+    double now = get_relative_time();
+    if (now - ipfix.last_expire < 1.0) {
+        return;
+    }
+    ipfix.last_expire = now;
+
+    std::vector<ConnectionID> idle;
+    for (auto& entry : connection_tracker) {
+        FlowRecord& flow = entry.second;
+        if (now - std::max(flow.first_seen, flow.last_seen) >= ipfix.inactive_timeout) {
+            idle.push_back(entry.first);
+        } else if (now - std::max(flow.first_seen, flow.last_export) >= ipfix.active_timeout) {
+            ipfix_export_flow(entry.first, flow, IPFIX_END_ACTIVE);
+        }
+    }
+    for (size_t i = 0; i < idle.size(); i++) {
+        log_event("[%.3f] ⌛ 连接不活跃超时: %s:%d <-> %s:%d [%s]\n", now,
+                  ip_to_string(idle[i].src_ip).c_str(), idle[i].src_port,
+                  ip_to_string(idle[i].dst_ip).c_str(), idle[i].dst_port,
+                  state_to_string(connection_tracker[idle[i]].state));
+        finish_flow(idle[i], IPFIX_END_IDLE);
+    }
+}
+
+/*
+ * 程序退出：导出所有仍在跟踪的连接，等待导出线程发完队列
+ */
+void ipfix_shutdown() {
+    for (auto& entry : connection_tracker) {
+        ipfix_export_flow(entry.first, entry.second, IPFIX_END_FORCED);
+    }
+    {
+        std::lock_guard<std::mutex> guard(ipfix.lock);
+        ipfix.stopping = true;
+    }
+    ipfix.wakeup.notify_one();
+    ipfix.thread.join();
+    close(ipfix.sock);
+}
+
+// ======================== TCP 状态机处理逻辑 ========================
+
+/*
+ * 处理 TCP 数据包并更新状态机
+ *
+ * 参数：
+ * - key: 规范化的连接标识符
+ * - tcp: TCP 头部指针
+ * - src_ip, dst_ip: 源和目标 IP 地址
+ * - src_port, dst_port: 源和目标端口号
+ * - data_len: TCP 数据部分的长度
+ *
+ * 这个函数实现了简化的 TCP 状态机，根据当前状态和接收到的标志位
+ * 决定状态转换，并输出相应的事件信息
+ */
+void process_tcp_packet(ConnectionID key, struct tcphdr* tcp,
+                        uint32_t src_ip, uint32_t dst_ip,
+                        uint16_t src_port, uint16_t dst_port,
+                        int data_len) {
+
+    // 获取当前连接的状态（如果不存在，默认为 CLOSED）
+    TcpState current_state = CLOSED;
+    auto it = connection_tracker.find(key);
+    if (it != connection_tracker.end()) {
+        current_state = it->second.state;
+    }
+
+    std::string src_ip_str = ip_to_string(src_ip);
+    std::string dst_ip_str = ip_to_string(dst_ip);
+    double timestamp = get_relative_time();
+
+    // ==================== RST 处理 ====================
+    /*
+     * RST (Reset) 标志：立即终止连接
+     * 任何状态下收到 RST 都应该删除连接记录
+     */
+    if (tcp->rst) {
+        finish_flow(key);
+        log_event("[%.3f] 🔴 连接重置 (RST): %s:%d <-> %s:%d [%s -> CLOSED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port),
+               state_to_string(current_state));
+        return;
+    }
+
+    // ==================== 三次握手：连接建立 ====================
+
+    /*
+     * 状态转换 1: CLOSED -> SYN_SENT
+     * 触发条件：收到 SYN 标志，且没有 ACK 标志
+     * 含义：客户端发起连接请求（三次握手的第一步）
+     */
+    if (current_state == CLOSED && tcp->syn && !tcp->ack) {
+        connection_tracker[key].state = SYN_SENT;
+        connection_tracker[key].first_seen = timestamp;
+        connection_tracker[key].sample_rate = overload.sample_rate;
+        connection_tracker[key].client_dir =
+            (src_ip == key.src_ip && ntohs(src_port) == key.src_port) ? 0 : 1;
+        overload.admitted_flows++;
+        overload.estimated_flows += overload.sample_rate;
+        log_event("[%.3f] 🟢 新连接发起 (SYN): %s:%d -> %s:%d [CLOSED -> SYN_SENT]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 2: SYN_SENT -> ESTABLISHED
+     * 触发条件：收到 SYN + ACK 标志
+     * 含义：服务器响应连接请求（三次握手的第二步）
+     *
+     * 注意：这是简化模型，实际上应该先转到 SYN_RECEIVED，
+     * 然后等待最后的 ACK 才转到 ESTABLISHED
+     */
+    if (current_state == SYN_SENT && tcp->syn && tcp->ack) {
+        FlowRecord& flow = connection_tracker[key];
+        flow.state = ESTABLISHED;
+        int d = (src_ip == key.src_ip && ntohs(src_port) == key.src_port) ? 0 : 1;
+        if (flow.client_dir >= 0 && d != flow.client_dir && flow.synack_time == 0) {
+            service_record_handshake(current_services(), key, flow, timestamp);
+        }
+        log_event("[%.3f] 🟢 连接建立 (SYN-ACK): %s:%d <-> %s:%d [SYN_SENT -> ESTABLISHED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 2b: SYN_SENT -> ESTABLISHED (收到最后的 ACK)
+     * 触发条件：当前状态是 SYN_SENT，只有 ACK 标志
+     * 含义：三次握手的第三步，客户端确认服务器的 SYN-ACK
+     */
+    if (current_state == SYN_SENT && tcp->ack && !tcp->syn && !tcp->fin) {
+        connection_tracker[key].state = ESTABLISHED;
+        log_event("[%.3f] 🟢 连接确认 (ACK): %s:%d <-> %s:%d [SYN_SENT -> ESTABLISHED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    // ==================== 数据传输阶段 ====================
+
+    /*
+     * 数据传输：ESTABLISHED 状态下，有数据负载
+     * 触发条件：连接已建立，且 TCP 数据部分长度 > 0
+     */
+    if (current_state == ESTABLISHED && data_len > 0) {
+        log_event("[%.3f] 📦 数据传输: %s:%d -> %s:%d (%d bytes) [ESTABLISHED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port),
+               data_len);
+        return;
+    }
+
+    // ==================== 四次挥手：连接关闭 ====================
+
+    /*
+     * 状态转换 3: ESTABLISHED -> FIN_WAIT_1
+     * 触发条件：收到 FIN 标志
+     * 含义：主动关闭方发起关闭请求（四次挥手的第一步）
+     */
+    if (current_state == ESTABLISHED && tcp->fin) {
+        connection_tracker[key].state = FIN_WAIT_1;
+        log_event("[%.3f] 🔵 连接关闭发起 (FIN): %s:%d -> %s:%d [ESTABLISHED -> FIN_WAIT_1]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 4: FIN_WAIT_1 -> FIN_WAIT_2
+     * 触发条件：收到 ACK（对 FIN 的确认）
+     * 含义：对方确认了我方的关闭请求（四次挥手的第二步）
+     */
+    if (current_state == FIN_WAIT_1 && tcp->ack && !tcp->fin) {
+        connection_tracker[key].state = FIN_WAIT_2;
+        log_event("[%.3f] 🔵 关闭确认 (ACK): %s:%d <-> %s:%d [FIN_WAIT_1 -> FIN_WAIT_2]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 5: FIN_WAIT_1 -> CLOSING (同时关闭)
+     * 触发条件：在 FIN_WAIT_1 状态下收到对方的 FIN
+     * 含义：双方同时发起关闭
+     */
+    if (current_state == FIN_WAIT_1 && tcp->fin) {
+        connection_tracker[key].state = CLOSING;
+        log_event("[%.3f] 🔵 同时关闭 (FIN): %s:%d <-> %s:%d [FIN_WAIT_1 -> CLOSING]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 6: FIN_WAIT_2 -> TIME_WAIT
+     * 触发条件：收到对方的 FIN（四次挥手的第三步）
+     * 含义：对方也发起关闭，进入等待状态
+     */
+    if (current_state == FIN_WAIT_2 && tcp->fin) {
+        connection_tracker[key].state = TIME_WAIT;
+        log_event("[%.3f] 🔵 对方关闭 (FIN): %s:%d <-> %s:%d [FIN_WAIT_2 -> TIME_WAIT]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 7: TIME_WAIT -> CLOSED
+     * 触发条件：收到最后的 ACK（四次挥手的第四步）
+     * 含义：连接完全关闭
+     */
+    if (current_state == TIME_WAIT && tcp->ack) {
+        finish_flow(key);
+        log_event("[%.3f] 🔵 连接完全关闭 (ACK): %s:%d <-> %s:%d [TIME_WAIT -> CLOSED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 8: CLOSING -> CLOSED
      * 触发条件：在同时关闭状态下收到 ACK
      */
-    if (current_state == CLOSING && tcp->ack) {
-        connection_tracker.erase(key);
-        printf("[%.3f] 🔵 连接完全关闭 (ACK): %s:%d <-> %s:%d [CLOSING -> CLOSED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
+    if (current_state == CLOSING && tcp->ack) {
+        finish_flow(key);
+        log_event("[%.3f] 🔵 连接完全关闭 (ACK): %s:%d <-> %s:%d [CLOSING -> CLOSED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    // ==================== 被动关闭方的状态转换 ====================
+
+    /*
+     * 状态转换 9: ESTABLISHED -> CLOSE_WAIT
+     * 触发条件：被动方收到对方的 FIN
+     */
+    if (current_state == ESTABLISHED && tcp->fin) {
+        connection_tracker[key].state = CLOSE_WAIT;
+        log_event("[%.3f] 🔵 收到关闭请求 (FIN): %s:%d <-> %s:%d [ESTABLISHED -> CLOSE_WAIT]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 10: CLOSE_WAIT -> LAST_ACK
+     * 触发条件：被动方也发起关闭（发送 FIN）
+     */
+    if (current_state == CLOSE_WAIT && tcp->fin) {
+        connection_tracker[key].state = LAST_ACK;
+        log_event("[%.3f] 🔵 被动关闭 (FIN): %s:%d -> %s:%d [CLOSE_WAIT -> LAST_ACK]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+
+    /*
+     * 状态转换 11: LAST_ACK -> CLOSED
+     * 触发条件：收到对最后一个 FIN 的 ACK
+     */
+    if (current_state == LAST_ACK && tcp->ack) {
+        finish_flow(key);
+        log_event("[%.3f] 🔵 连接完全关闭 (ACK): %s:%d <-> %s:%d [LAST_ACK -> CLOSED]\n",
+               timestamp,
+               src_ip_str.c_str(), ntohs(src_port),
+               dst_ip_str.c_str(), ntohs(dst_port));
+        return;
+    }
+}
+
+// ======================== 数据包解析 ========================
+
+// 捕获统计（两种捕获后端共用）
+struct CaptureStats {
+    unsigned long long packets;      // 收到的帧数
+    unsigned long long bytes;        // 收到的字节数
+    unsigned long long tcp_packets;  // 进入状态机的 TCP 段数
+    unsigned long long kernel_drops; // 内核因来不及处理而丢弃的帧数
+    unsigned long long trace_events; // tracepoint 事件数（本机分析模式）
+    unsigned long long retransmits;  // 内核报告的重传次数（本机分析模式）
+};
+
+CaptureStats capture_stats = {0, 0, 0, 0, 0, 0};
+
+// 收到 SIGINT/SIGTERM 后置位，捕获循环退出并打印统计
+volatile sig_atomic_t stop_requested = 0;
+
+void handle_stop_signal(int) {
+    stop_requested = 1;
+}
+
+// 收到 SIGUSR1 后置位，下一轮 periodic_tasks 导出所有连接的时间线
+volatile sig_atomic_t timeline_dump_requested = 0;
+
+void handle_timeline_signal(int) {
+    timeline_dump_requested = 1;
+}
+
+// ======================== 校验和验证 ========================
+
+/*
+ * 可选的 IP / TCP 校验和验证 (-C)
+ *
+ * 损坏的帧（线路错误、抓包点之前的设备故障）会带着错误的标志位和序列号进入状态机，
+ * 造成虚假的状态转换。开启验证后，校验和错误的帧像内核一样直接丢弃，不进入状态机：
+ * - IP 头部校验和：每个帧（包括每个分片）都验证
+ * - TCP 校验和：覆盖伪首部 + TCP 头部 + 负载，对完整的数据报（未分片或重组完成）验证
+ *
+ * 校验和卸载：网卡已经验证过的包（TP_STATUS_CSUM_VALID），以及本机发出、
+ * 校验和还没有填写的包（TP_STATUS_CSUMNOTREADY，由网卡发送时计算）跳过 TCP 校验和验证。
+ * 这两个标志通过 AF_PACKET 的 PACKET_AUXDATA 获得；AF_XDP 帧没有这类元数据，总是验证。
+ *
+ * 16 位反码和 (RFC 1071) 与字节序无关：把数据按本机字节序当作 32 位字累加到 64 位累加器，
+ * 最后折叠成 16 位，得到的就是按内存字节序表示的结果。2^16 ≡ 1 (mod 0xffff)，
+ * 所以可以用任意宽度的字累加、最后再折叠，这正好适合 SIMD：每条指令处理 8 个 32 位字。
+ * 数据（含校验和字段本身）的反码和为 0xffff 时校验和正确。
+ */
+struct ChecksumVerifier {
+    bool enabled;
+    const char* impl;                                       // 选中的实现（AVX2 / SSE2 / 标量）
+    uint64_t (*partial)(const unsigned char*, size_t);      // 未折叠的部分和
+    unsigned long long ip_verified;     // 验证过的 IP 头部数
+    unsigned long long tcp_verified;    // 验证过的 TCP 段数
+    unsigned long long offloaded;       // 因校验和卸载跳过 TCP 验证的段数
+    unsigned long long unverifiable;    // 截断而无法验证 TCP 校验和的段数（照常处理）
+    unsigned long long bad_ip;          // IP 头部校验和错误
+    unsigned long long bad_tcp;         // TCP 校验和错误
+};
+
+ChecksumVerifier checksum = {false, "", NULL, 0, 0, 0, 0, 0, 0};
+
+/*
+ * 标量实现：逐个 32 位字累加，剩余的 2 字节和 1 字节（补 0）单独处理
+ */
+uint64_t checksum_partial_scalar(const unsigned char* p, size_t len) {
+    uint64_t sum = 0;
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        sum += w;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, p, 2);
+        sum += w;
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        uint16_t w = 0;
+        memcpy(&w, p, 1);   // 奇数长度：最后一个字节后面补 0
+        sum += w;
+    }
+    return sum;
+}
+
+#if defined(__x86_64__)
+/*
+ * SSE2 实现（x86-64 都支持）：每轮 32 字节，
+ * 32 位字与 0 交错展开成 64 位，累加到两个 64 位累加器，不会溢出
+ */
+uint64_t checksum_partial_sse2(const unsigned char* p, size_t len) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    while (len >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+        p += 32;
+        len -= 32;
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + checksum_partial_scalar(p, len);
+}
+
+/*
+ * AVX2 实现：同样的方法，每轮 64 字节（运行时检测到 CPU 支持才使用）
+ */
+__attribute__((target("avx2")))
+uint64_t checksum_partial_avx2(const unsigned char* p, size_t len) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero;
+    __m256i acc1 = zero;
+    while (len >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)p);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+        p += 64;
+        len -= 64;
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + checksum_partial_sse2(p, len);
+}
+#endif
+
+/*
+ * 把 64 位部分和折叠成 16 位反码和
+ */
+uint16_t checksum_fold(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/*
+ * 选择本机可用的最快实现，并用 16 MB 数据测一次吞吐（GB/s）
+ */
+double checksum_init() {
+    checksum.impl = "标量";
+    checksum.partial = checksum_partial_scalar;
+#if defined(__x86_64__)
+    checksum.impl = "SSE2";
+    checksum.partial = checksum_partial_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        checksum.impl = "AVX2";
+        checksum.partial = checksum_partial_avx2;
+    }
+#endif
+
+    const size_t bench_len = 64 * 1024;
+    const int rounds = 256;
+    std::vector<unsigned char> buf(bench_len);
+    for (size_t i = 0; i < bench_len; i++) {
+        buf[i] = (unsigned char)(i * 131 + 7);
+    }
+    volatile uint16_t sink = checksum_fold(checksum.partial(buf.data(), bench_len));   // 预热缓存
+    double begin = get_timestamp();
+    for (int r = 0; r < rounds; r++) {
+        sink = sink + checksum_fold(checksum.partial(buf.data(), bench_len - (r & 3)));
+    }
+    double elapsed = get_timestamp() - begin;
+    return elapsed > 0 ? (double)bench_len * rounds / elapsed / 1e9 : 0.0;
+}
+
+/*
+ * 验证 IP 头部校验和
+ *
+ * 返回值：false 表示校验和错误（帧应丢弃）；头部不完整时交给后续的长度检查处理
+ */
+bool verify_ip_header(const struct iphdr* ip, size_t len) {
+    size_t header_len = ip->ihl * 4;
+    if (header_len < sizeof(struct iphdr) || header_len > len) {
+        return true;
+    }
+    checksum.ip_verified++;
+    if (checksum_fold(checksum.partial((const unsigned char*)ip, header_len)) == 0xffff) {
+        return true;
+    }
+    checksum.bad_ip++;
+    if (current_interface != NULL) {
+        current_interface->bad_ip_checksums++;
+    }
+    return false;
+}
+
+/*
+ * 验证 TCP 校验和（伪首部：源/目的地址、协议号、TCP 长度）
+ *
+ * 参数：
+ * - len: 数据报的可用长度（从 IP 头部起）
+ * - csum_status: PACKET_AUXDATA 中的 tp_status（没有时为 0）
+ *
+ * 返回值：false 表示校验和错误（段应丢弃）
+ */
+bool verify_tcp_checksum(const struct iphdr* ip, size_t len, uint32_t csum_status) {
+    if (csum_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY)) {
+        checksum.offloaded++;
+        return true;
+    }
+    size_t ip_header_len = ip->ihl * 4;
+    size_t ip_total_len = ntohs(ip->tot_len);
+    if (ip_total_len > len || ip_total_len < ip_header_len + sizeof(struct tcphdr)) {
+        checksum.unverifiable++;
+        return true;
+    }
+    size_t tcp_len = ip_total_len - ip_header_len;
+
+    // 伪首部的各字段都按网络字节序（内存顺序）加入
+    uint64_t sum = (uint64_t)ip->saddr + ip->daddr + htons(IPPROTO_TCP) + htons((uint16_t)tcp_len);
+    sum += checksum.partial((const unsigned char*)ip + ip_header_len, tcp_len);
+    checksum.tcp_verified++;
+    if (checksum_fold(sum) == 0xffff) {
+        return true;
+    }
+    checksum.bad_tcp++;
+    if (current_interface != NULL) {
+        current_interface->bad_tcp_checksums++;
+    }
+    return false;
+}
+
+// ======================== 控制套接字与流查询 ========================
+
+/*
+ * 实时流查询 (-U)
+ *
+ * 在 Unix 套接字上接受一行查询，按条件筛选当前的连接表，结果分批写回：
+ *
+ *   $ echo "ip=10.0.0.5 port=25 state=SYN_SENT" | socat - UNIX-CONNECT:/tmp/tcp_analyzer.sock
+ *
+ * 查询不能拖慢收包，所以查询线程从不持有分析器锁，而是读取"快照"：
+ * 1. 查询线程请求一个新快照（已有的快照足够新时直接复用，多个查询合并成一次）
+ * 2. 捕获线程在下一轮 periodic_tasks（已持有锁）中把连接表复制成紧凑的只读数组，
+ *    编号 (epoch) 加一后发布
+ * 3. 查询线程拿到快照的引用计数指针，在锁外筛选、格式化、写给客户端；
+ *    发布新快照不必等待旧快照的读者，最后一个读者释放时旧快照才被回收（RCU 式）
+ *
+ * 捕获线程每次只付出一次数组复制（每个连接几十字节），筛选和慢速客户端都不会占用分析器锁。
+ */
+const double CONTROL_SNAPSHOT_MAX_AGE = 0.1;    // 快照新于此值（秒）时直接复用
+const double CONTROL_SNAPSHOT_WAIT = 1.0;       // 等待捕获线程发布快照的上限（秒）
+const size_t CONTROL_BATCH_BYTES = 16384;       // 攒够多少字节写一次
+
+// 快照中的一条连接（只复制查询需要的字段）
+struct FlowSnapshotEntry {
+    ConnectionID key;
+    TcpState state;
+    int client_dir;
+    double first_seen;
+    double last_seen;
+    unsigned long long packets[2];
+    unsigned long long bytes[2];
+    unsigned long long retransmits[2];
+};
+
+struct FlowSnapshot {
+    unsigned long long epoch;
+    double taken;                   // 快照时间（相对时间）
+    double build_us;                // 复制耗时（微秒，持有分析器锁的时间）
+    std::vector<FlowSnapshotEntry> flows;
+};
+
+struct ControlServer {
+    bool enabled;
+    std::string path;
+    int listen_fd;
+    std::thread thread;
+    std::mutex lock;                                // 只保护下面几项，持有时间 O(1)
+    std::condition_variable published;
+    bool snapshot_requested;
+    std::shared_ptr<const FlowSnapshot> current;
+    unsigned long long epoch;
+    unsigned long long queries;
+};
+
+ControlServer control;
+
+/*
+ * 捕获线程调用（持有 analyzer_lock）：有查询在等待时复制连接表并发布
+ */
+void control_publish_snapshot() {
+    {
+        std::lock_guard<std::mutex> guard(control.lock);
+        if (!control.snapshot_requested) {
+            return;
+        }
+    }
+    double begin = get_timestamp();
+    std::shared_ptr<FlowSnapshot> snap(new FlowSnapshot());
+    snap->flows.reserve(connection_tracker.size());
+    for (auto it = connection_tracker.begin(); it != connection_tracker.end(); ++it) {
+        const FlowRecord& flow = it->second;
+        FlowSnapshotEntry e;
+        e.key = it->first;
+        e.state = flow.state;
+        e.client_dir = flow.client_dir;
+        e.first_seen = flow.first_seen;
+        e.last_seen = flow.last_seen;
+        for (int d = 0; d < 2; d++) {
+            e.packets[d] = flow.dir[d].packets;
+            e.bytes[d] = flow.dir[d].bytes;
+            e.retransmits[d] = flow.dir[d].retransmits;
+        }
+        snap->flows.push_back(e);
+    }
+    snap->taken = get_relative_time();
+    snap->build_us = (get_timestamp() - begin) * 1e6;
+
+    std::lock_guard<std::mutex> guard(control.lock);
+    snap->epoch = ++control.epoch;
+    control.current = snap;
+    control.snapshot_requested = false;
+    control.published.notify_all();
+}
+
+/*
+ * 查询线程调用：取得一个足够新的快照（超时返回旧快照或空指针）
+ */
+std::shared_ptr<const FlowSnapshot> control_take_snapshot() {
+    std::unique_lock<std::mutex> guard(control.lock);
+    if (control.current && get_relative_time() - control.current->taken < CONTROL_SNAPSHOT_MAX_AGE) {
+        return control.current;
+    }
+    unsigned long long want = control.epoch + 1;
+    control.snapshot_requested = true;
+    control.published.wait_for(guard, std::chrono::duration<double>(CONTROL_SNAPSHOT_WAIT),
+                               [want]() { return control.epoch >= want || stop_requested; });
+    return control.current;
+}
+
+/*
+ * 一条查询：所有条件同时满足才输出
+ */
+struct FlowQuery {
+    bool has_ip;
+    uint32_t ip;                    // 任一端的地址
+    int port;                       // 任一端的端口，-1 表示不限
+    int state;                      // -1 表示不限
+    double min_age, max_age;        // 存在时间（秒）
+    double min_idle, max_idle;      // 距最近一个包的时间（秒）
+    unsigned long long min_bytes, max_bytes;    // 两个方向的负载字节之和
+    size_t limit;
+};
+
+/*
+ * 解析查询，如 "ip=10.0.0.5 port=25 state=SYN_SENT age>5 bytes<100 limit=50"
+ *
+ * 返回值：false 表示格式错误，error 中是原因
+ */
+bool parse_flow_query(const std::string& line, FlowQuery& q, std::string& error) {
+    q.has_ip = false;
+    q.ip = 0;
+    q.port = -1;
+    q.state = -1;
+    q.min_age = q.min_idle = -1;
+    q.max_age = q.max_idle = 1e300;
+    q.min_bytes = 0;
+    q.max_bytes = ~0ULL;
+    q.limit = ~(size_t)0;
+
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t end = line.find_first_of(" \t", pos);
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        std::string token = line.substr(pos, end - pos);
+        pos = end + 1;
+        if (token.empty()) {
+            continue;
+        }
+        size_t op_pos = token.find_first_of("=<>");
+        if (op_pos == std::string::npos || op_pos == 0 || op_pos + 1 >= token.size()) {
+            error = "无法解析的条件: " + token;
+            return false;
+        }
+        std::string name = token.substr(0, op_pos);
+        char op = token[op_pos];
+        std::string value = token.substr(op_pos + 1);
+        char* rest = NULL;
+
+        if (name == "ip" && op == '=') {
+            if (inet_pton(AF_INET, value.c_str(), &q.ip) != 1) {
+                error = "无效的 IP 地址: " + value;
+                return false;
+            }
+            q.has_ip = true;
+        } else if (name == "port" && op == '=') {
+            q.port = strtol(value.c_str(), &rest, 10);
+        } else if (name == "state" && op == '=') {
+            for (int s = CLOSED; s <= CLOSING; s++) {
+                if (value == state_to_string((TcpState)s)) {
+                    q.state = s;
+                }
+            }
+            if (q.state < 0) {
+                error = "未知的状态: " + value;
+                return false;
+            }
+        } else if (name == "limit" && op == '=') {
+            q.limit = strtoul(value.c_str(), &rest, 10);
+        } else if (name == "age" || name == "idle") {
+            double v = strtod(value.c_str(), &rest);
+            double& lo = name == "age" ? q.min_age : q.min_idle;
+            double& hi = name == "age" ? q.max_age : q.max_idle;
+            if (op == '>') {
+                lo = v;
+            } else if (op == '<') {
+                hi = v;
+            } else {
+                error = name + " 只支持 > 和 <";
+                return false;
+            }
+        } else if (name == "bytes") {
+            unsigned long long v = strtoull(value.c_str(), &rest, 10);
+            if (op == '>') {
+                q.min_bytes = v + 1;
+            } else if (op == '<') {
+                q.max_bytes = v > 0 ? v - 1 : 0;
+            } else {
+                q.min_bytes = q.max_bytes = v;
+            }
+        } else {
+            error = "未知的条件: " + token;
+            return false;
+        }
+        if (rest != NULL && *rest != '\0') {
+            error = "无效的数值: " + token;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool flow_matches(const FlowSnapshotEntry& e, const FlowQuery& q, double now) {
+    if (q.has_ip && e.key.src_ip != q.ip && e.key.dst_ip != q.ip) {
+        return false;
+    }
+    if (q.port >= 0 && e.key.src_port != q.port && e.key.dst_port != q.port) {
+        return false;
+    }
+    if (q.state >= 0 && e.state != q.state) {
+        return false;
+    }
+    double age = now - e.first_seen;
+    double idle = now - e.last_seen;
+    unsigned long long bytes = e.bytes[0] + e.bytes[1];
+    return age > q.min_age && age < q.max_age && idle > q.min_idle && idle < q.max_idle &&
+           bytes >= q.min_bytes && bytes <= q.max_bytes;
+}
+
+/*
+ * 把缓冲区写给客户端（客户端太慢时 SO_SNDTIMEO 超时放弃）
+ */
+bool control_flush(int fd, std::string& out) {
+    size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    out.clear();
+    return true;
+}
+
+/*
+ * 处理一个客户端：读一行查询，对快照筛选，分批写回
+ */
+void control_handle_client(int fd) {
+    struct timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string line;
+    char buf[512];
+    while (line.find('\n') == std::string::npos && line.size() < 4096) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;      // 客户端关闭写端：剩下的内容就是整个查询
+        }
+        line.append(buf, n);
+    }
+    line = line.substr(0, line.find_first_of("\r\n"));
+
+    std::string out;
+    if (line == "help") {
+        out = "# 条件（空格分隔，同时满足）:\n"
+              "#   ip=<地址>  port=<端口>      任一端匹配\n"
+              "#   state=<状态>                如 SYN_SENT, ESTABLISHED, TIME_WAIT\n"
+              "#   age>秒 age<秒 idle>秒 idle<秒  存在时间 / 距最近一个包的时间\n"
+              "#   bytes>N bytes<N bytes=N     两个方向的负载字节之和\n"
+              "#   limit=N                     最多输出的条数\n"
+              "# 空查询列出所有连接; stats 按状态统计\n";
+        control_flush(fd, out);
+        return;
+    }
+    FlowQuery q;
+    std::string error;
+    bool stats_only = line == "stats";
+    if (!stats_only && !parse_flow_query(line, q, error)) {
+        out = "# 错误: " + error + " (发送 help 查看语法)\n";
+        control_flush(fd, out);
+        return;
+    }
+
+    std::shared_ptr<const FlowSnapshot> snap = control_take_snapshot();
+    if (!snap) {
+        out = "# 错误: 捕获线程没有响应\n";
+        control_flush(fd, out);
+        return;
+    }
+    char header[160];
+    snprintf(header, sizeof(header), "# epoch %llu, 快照时间 %.3f s, 复制耗时 %.0f us, 连接 %zu\n",
+             snap->epoch, snap->taken, snap->build_us, snap->flows.size());
+    out = header;
+
+    if (stats_only) {
+        size_t counts[CLOSING + 1] = {0};
+        for (size_t i = 0; i < snap->flows.size(); i++) {
+            counts[snap->flows[i].state]++;
+        }
+        for (int s = CLOSED; s <= CLOSING; s++) {
+            if (counts[s] > 0) {
+                snprintf(buf, sizeof(buf), "%-12s %zu\n", state_to_string((TcpState)s), counts[s]);
+                out += buf;
+            }
+        }
+        control_flush(fd, out);
+        return;
+    }
+
+    size_t matched = 0;
+    for (size_t i = 0; i < snap->flows.size() && matched < q.limit; i++) {
+        const FlowSnapshotEntry& e = snap->flows[i];
+        if (!flow_matches(e, q, snap->taken)) {
+            continue;
+        }
+        matched++;
+        // 知道客户端时按 客户端 -> 服务端 输出，计数也按这个方向排列
+        int c = e.client_dir == 1 ? 1 : 0;
+        uint32_t from_ip = c == 0 ? e.key.src_ip : e.key.dst_ip;
+        uint32_t to_ip = c == 0 ? e.key.dst_ip : e.key.src_ip;
+        uint16_t from_port = c == 0 ? e.key.src_port : e.key.dst_port;
+        uint16_t to_port = c == 0 ? e.key.dst_port : e.key.src_port;
+        char row[256];
+        snprintf(row, sizeof(row), "%s:%d %s %s:%d  %-11s  age %.3f  idle %.3f  pkts %llu/%llu  "
+                 "bytes %llu/%llu  retrans %llu/%llu\n",
+                 ip_to_string(from_ip).c_str(), from_port, e.client_dir >= 0 ? "->" : "<->",
+                 ip_to_string(to_ip).c_str(), to_port, state_to_string(e.state),
+                 snap->taken - e.first_seen, snap->taken - e.last_seen,
+                 e.packets[c], e.packets[1 - c], e.bytes[c], e.bytes[1 - c],
+                 e.retransmits[c], e.retransmits[1 - c]);
+        out += row;
+        if (out.size() >= CONTROL_BATCH_BYTES && !control_flush(fd, out)) {
+            return;
+        }
+    }
+    snprintf(header, sizeof(header), "# 匹配 %zu 条\n", matched);
+    out += header;
+    control_flush(fd, out);
+}
+
+void control_thread() {
+    while (!stop_requested) {
+        struct pollfd pfd;
+        pfd.fd = control.listen_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = accept(control.listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        control.queries++;
+        control_handle_client(fd);
+        close(fd);
+    }
+}
+
+/*
+ * 创建控制套接字并启动查询线程
+ */
+bool control_start(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "控制套接字路径太长: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    control.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control.listen_fd < 0) {
+        perror("创建控制套接字失败");
+        return false;
+    }
+    unlink(path);   // 上次运行残留的套接字文件
+    if (bind(control.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(control.listen_fd, 16) < 0) {
+        perror("绑定控制套接字失败");
+        close(control.listen_fd);
+        return false;
+    }
+    control.enabled = true;
+    control.path = path;
+    control.thread = std::thread(control_thread);
+    return true;
+}
+
+void control_shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(control.lock);
+        control.published.notify_all();
+    }
+    control.thread.join();
+    close(control.listen_fd);
+    unlink(control.path.c_str());
+}
+
+// ======================== DNS 流量分析 ========================
+
+/*
+ * DNS 流量分析（-D）
+ *
+ * UDP/53 和 TCP/53 上的报文交给 nslookup 的 DNS 报文解析器（dns_message.h，与 resolver 共用），
+ * 只解析头部和第一个问题，按 (客户端 IP, 端口, 服务端 IP, 端口, 事务 ID) 把响应与查询配对：
+ * - 待响应表是固定 DNS_PENDING_SLOTS 个槽位的开放寻址表，启动时一次性分配；
+ *   每个查询最多探测 DNS_PENDING_PROBES 个槽位，匹配时不提前结束，所以删除不需要墓碑
+ * - 超过 DNS_TIMEOUT_SEC 没有响应的查询计为超时：periodic_tasks 每 0.1 秒增量扫描 1/16 的表，
+ *   插入时遇到过期槽位也直接回收；探测范围内没有空位时查询计为溢出，不参与配对
+ * - 同一个键再次出现（客户端重发）只计重复，延迟仍从第一次发出算起，即客户端感受到的延迟
+ * - 按服务端 (IP, 端口) 统计查询、响应、NXDOMAIN、SERVFAIL、超时和延迟直方图（与服务延迟同一套直方图）；
+ *   按域名（转小写，兼容 0x20 大小写随机化）统计次数和平均/最大延迟，域名表同样是固定大小，
+ *   满了以后新域名计入 "(其他)"
+ *
+ * TCP 上每条消息前有 2 字节长度。一条消息跨多个段时，首段里的头部和问题照常解析，
+ * 后续段按该方向记录的剩余字节数跳过（乱序和重传会让跳过的位置出错，错位的段计为格式错误）。
+ * 所有状态都在 analyzer_lock 保护下访问。
+ */
+
+const int DNS_PENDING_SLOTS = 65536;        // 待响应查询的槽位数（2 的幂）
+const int DNS_PENDING_PROBES = 16;          // 每个键最多探测的槽位数
+const double DNS_TIMEOUT_SEC = 5.0;         // 与 glibc resolv.conf 的默认超时相同
+const double DNS_SWEEP_SEC = 0.1;           // 增量超时扫描的间隔
+const int DNS_SWEEP_SLOTS = DNS_PENDING_SLOTS / 16;
+const int DNS_NAME_SLOTS = 4096;            // 按域名统计的条目数（2 的幂）
+const int DNS_NAME_PROBES = 16;
+const int DNS_NAME_OTHER = DNS_NAME_SLOTS;  // 域名表满后的汇总条目
+
+struct DnsServerStats {
+    unsigned long long queries;
+    unsigned long long responses;
+    unsigned long long nxdomain;
+    unsigned long long servfail;
+    unsigned long long other_errors;    // 其他非 0 响应码 (FORMERR, REFUSED 等)
+    unsigned long long timeouts;
+    LatencyHistogram latency;
+
+    DnsServerStats() : queries(0), responses(0), nxdomain(0), servfail(0), other_errors(0), timeouts(0) {}
+};
+
+typedef std::map<ServiceKey, DnsServerStats> DnsServerTable;
+
+struct DnsNameStats {
+    bool in_use;
+    uint32_t hash;
+    unsigned long long queries;
+    unsigned long long responses;
+    unsigned long long nxdomain;
+    unsigned long long timeouts;
+    double latency_sum;                 // 秒
+    double latency_max;
+    char name[DNS_MAX_NAME];            // 小写
+};
+
+/*
+ * 等待响应的查询
+ */
+struct DnsPending {
+    bool in_use;
+    uint16_t id;                        // DNS 事务 ID
+    uint16_t client_port;               // 主机字节序
+    uint16_t server_port;
+    uint32_t client_ip;                 // 网络字节序
+    uint32_t server_ip;
+    int name;                           // 域名统计条目的下标
+    DnsServerStats* server;             // 服务端统计项（std::map 的元素地址不变），表满时为 NULL
+    double sent;                        // 第一次看到查询的时间
+};
+
+struct DnsAnalyzer {
+    bool enabled;
+    DnsPending* pending;                // DNS_PENDING_SLOTS 个槽位，main 中分配
+    DnsNameStats* names;                // DNS_NAME_SLOTS + 1 个条目（最后一个是 "(其他)"）
+    DnsServerTable servers;
+    int sweep_cursor;                   // 增量超时扫描的位置
+    double last_sweep;
+    unsigned long long messages;        // 解析成功的 DNS 消息数
+    unsigned long long malformed;       // 解析失败的消息数
+    unsigned long long queries;
+    unsigned long long responses;       // 配对成功的响应数
+    unsigned long long duplicates;      // 重复的查询（客户端重发）
+    unsigned long long unmatched;       // 找不到查询的响应（查询早于捕获开始、已超时或被重复响应）
+    unsigned long long timeouts;
+    unsigned long long overflow;        // 待响应表探测范围已满而未跟踪的查询
+    unsigned long long server_overflow; // 服务端超过 MAX_SERVICES 而未统计的查询
+    unsigned long long truncated;       // 带 TC 标志的响应（客户端会改用 TCP 重查）
+    unsigned long long tcp_messages;    // 其中通过 TCP 传输的消息
+    unsigned long long tcp_split;       // 跨多个 TCP 段的消息
+    int names_used;
+};
+
+DnsAnalyzer dns = {false, NULL, NULL, DnsServerTable(), 0, 0.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+/*
+ * 待响应表的哈希（与 flow_hash 相同的 64 位混合函数）
+ */
+uint32_t dns_pending_hash(uint32_t client_ip, uint16_t client_port, uint32_t server_ip,
+                          uint16_t server_port, uint16_t id) {
+    uint64_t h = ((uint64_t)client_ip << 32 | server_ip) ^
+                 (((uint64_t)client_port << 32 | (uint64_t)server_port << 16 | id) * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+/*
+ * 取域名的统计条目（不存在时创建；探测范围满了返回 "(其他)"）
+ */
+int dns_name_entry(const char* qname) {
+    char name[DNS_MAX_NAME];
+    int n = 0;
+    for (; qname[n] != '\0' && n < DNS_MAX_NAME - 1; n++) {
+        char c = qname[n];
+        name[n] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    if (n == 0) {
+        name[n++] = '.';        // 根域名
+    }
+    name[n] = '\0';
+
+    uint32_t hash = 2166136261u;    // FNV-1a
+    for (int i = 0; i < n; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    for (int p = 0; p < DNS_NAME_PROBES; p++) {
+        int index = (hash + p) & (DNS_NAME_SLOTS - 1);
+        DnsNameStats& e = dns.names[index];
+        if (!e.in_use) {
+            e.in_use = true;
+            e.hash = hash;
+            memcpy(e.name, name, n + 1);
+            dns.names_used++;
+            return index;
+        }
+        if (e.hash == hash && strcmp(e.name, name) == 0) {
+            return index;
+        }
+    }
+    return DNS_NAME_OTHER;
+}
+
+/*
+ * 查询超时：计入服务端和域名，释放槽位
+ */
+void dns_expire_slot(DnsPending& slot) {
+    dns.timeouts++;
+    if (slot.server != NULL) {
+        slot.server->timeouts++;
+    }
+    dns.names[slot.name].timeouts++;
+    slot.in_use = false;
+}
+
+/*
+ * 增量扫描待响应表，回收超时的查询
+ *
+ * 参数：
+ * - full: 扫描整张表（退出时调用）
+ */
+void dns_expire_pending(double now, bool full) {
+    if (!full && now - dns.last_sweep < DNS_SWEEP_SEC) {
+        return;
+    }
+    dns.last_sweep = now;
+    int count = full ? DNS_PENDING_SLOTS : DNS_SWEEP_SLOTS;
+    for (int i = 0; i < count; i++) {
+        DnsPending& slot = dns.pending[dns.sweep_cursor];
+        dns.sweep_cursor = (dns.sweep_cursor + 1) & (DNS_PENDING_SLOTS - 1);
+        if (slot.in_use && now - slot.sent > DNS_TIMEOUT_SEC) {
+            dns_expire_slot(slot);
+        }
+    }
+}
+
+/*
+ * 记录一个查询
+ */
+void dns_record_query(const DNSMessageInfo& msg, uint32_t client_ip, uint16_t client_port,
+                      uint32_t server_ip, uint16_t server_port, double now) {
+    uint32_t hash = dns_pending_hash(client_ip, client_port, server_ip, server_port, msg.id);
+    DnsPending* free_slot = NULL;
+    for (int p = 0; p < DNS_PENDING_PROBES; p++) {
+        DnsPending& slot = dns.pending[(hash + p) & (DNS_PENDING_SLOTS - 1)];
+        if (slot.in_use && now - slot.sent > DNS_TIMEOUT_SEC) {
+            dns_expire_slot(slot);
+        }
+        if (!slot.in_use) {
+            if (free_slot == NULL) {
+                free_slot = &slot;
+            }
+            continue;
+        }
+        if (slot.id == msg.id && slot.client_port == client_port && slot.client_ip == client_ip &&
+            slot.server_port == server_port && slot.server_ip == server_ip) {
+            dns.duplicates++;
+            return;
+        }
+    }
+
+    dns.queries++;
+    ServiceKey s;
+    s.ip = server_ip;
+    s.port = server_port;
+    DnsServerStats* server = NULL;
+    DnsServerTable::iterator it = dns.servers.find(s);
+    if (it != dns.servers.end()) {
+        server = &it->second;
+    } else if (dns.servers.size() < MAX_SERVICES) {
+        server = &dns.servers[s];
+    } else {
+        dns.server_overflow++;
+    }
+    if (server != NULL) {
+        server->queries++;
+    }
+    int name = dns_name_entry(msg.qname);
+    dns.names[name].queries++;
+
+    if (free_slot == NULL) {
+        dns.overflow++;
+        return;
+    }
+    free_slot->in_use = true;
+    free_slot->id = msg.id;
+    free_slot->client_ip = client_ip;
+    free_slot->client_port = client_port;
+    free_slot->server_ip = server_ip;
+    free_slot->server_port = server_port;
+    free_slot->name = name;
+    free_slot->server = server;
+    free_slot->sent = now;
+}
+
+/*
+ * 记录一个响应：找到对应的查询，统计延迟和响应码
+ */
+void dns_record_response(const DNSMessageInfo& msg, uint32_t client_ip, uint16_t client_port,
+                         uint32_t server_ip, uint16_t server_port, double now) {
+    if (msg.flags & DNS_FLAG_TC) {
+        dns.truncated++;
+    }
+    uint32_t hash = dns_pending_hash(client_ip, client_port, server_ip, server_port, msg.id);
+    for (int p = 0; p < DNS_PENDING_PROBES; p++) {
+        DnsPending& slot = dns.pending[(hash + p) & (DNS_PENDING_SLOTS - 1)];
+        if (!slot.in_use || slot.id != msg.id || slot.client_port != client_port ||
+            slot.client_ip != client_ip || slot.server_port != server_port || slot.server_ip != server_ip) {
+            continue;
+        }
+        double latency = now - slot.sent;
+        dns.responses++;
+        if (slot.server != NULL) {
+            DnsServerStats& st = *slot.server;
+            st.responses++;
+            if (msg.rcode == DNS_RCODE_NXDOMAIN) {
+                st.nxdomain++;
+            } else if (msg.rcode == DNS_RCODE_SERVFAIL) {
+                st.servfail++;
+            } else if (msg.rcode != DNS_RCODE_NOERROR) {
+                st.other_errors++;
+            }
+            histogram_record(st.latency, latency);
+        }
+        DnsNameStats& n = dns.names[slot.name];
+        n.responses++;
+        if (msg.rcode == DNS_RCODE_NXDOMAIN) {
+            n.nxdomain++;
+        }
+        n.latency_sum += latency;
+        n.latency_max = std::max(n.latency_max, latency);
+        slot.in_use = false;
+        return;
+    }
+    dns.unmatched++;
+}
+
+/*
+ * 处理一条 DNS 消息（UDP 负载，或去掉长度前缀的 TCP 消息）
+ *
+ * 参数：
+ * - src_ip / dst_ip: 网络字节序；src_port / dst_port: 主机字节序
+ */
+void dns_handle_message(const unsigned char* data, int len, uint32_t src_ip, uint16_t src_port,
+                        uint32_t dst_ip, uint16_t dst_port) {
+    DNSMessageInfo msg;
+    if (!parseDNSMessage(data, len, msg)) {
+        dns.malformed++;
+        return;
+    }
+    dns.messages++;
+    double now = get_timestamp();
+    // 方向按 QR 位判断而不是端口：服务端之间的转发查询两端可能都是 53
+    if (msg.is_response) {
+        dns_record_response(msg, dst_ip, dst_port, src_ip, src_port, now);
+    } else {
+        dns_record_query(msg, src_ip, src_port, dst_ip, dst_port, now);
+    }
+}
+
+/*
+ * 处理 TCP/53 段的负载：逐条取出带 2 字节长度前缀的消息
+ *
+ * 参数：
+ * - skip: 该方向上一条消息还没到达的字节数（跨段消息），没有跟踪的连接传 NULL
+ */
+void dns_handle_tcp_payload(const unsigned char* data, int len, uint32_t src_ip, uint16_t src_port,
+                            uint32_t dst_ip, uint16_t dst_port, uint32_t* skip) {
+    int pos = 0;
+    if (skip != NULL && *skip > 0) {
+        pos = (int)std::min<uint32_t>(*skip, len);
+        *skip -= pos;
+    }
+    while (len - pos >= 2) {
+        int msg_len = data[pos] << 8 | data[pos + 1];
+        pos += 2;
+        int available = std::min(msg_len, len - pos);
+        dns.tcp_messages++;
+        if (available < msg_len) {
+            // 头部和问题在消息开头，首段通常已经包含
+            dns.tcp_split++;
+            if (skip != NULL) {
+                *skip = msg_len - available;
+            }
+        }
+        dns_handle_message(data + pos, available, src_ip, src_port, dst_ip, dst_port);
+        pos += available;
+    }
+}
+
+/*
+ * 打印 DNS 统计：按服务端（查询数从多到少，最多 20 行）和查询最多的 20 个域名
+ */
+void dns_print_report(const char* title) {
+    printf("[%.3f] 🌐 DNS%s: 查询 %llu, 配对响应 %llu, 超时 %llu, 重复查询 %llu, 未配对响应 %llu\n",
+           get_relative_time(), title, dns.queries, dns.responses, dns.timeouts,
+           dns.duplicates, dns.unmatched);
+    if (dns.servers.empty()) {
+        fflush(stdout);
+        return;
+    }
+
+    std::vector<DnsServerTable::const_iterator> servers;
+    for (DnsServerTable::const_iterator it = dns.servers.begin(); it != dns.servers.end(); ++it) {
+        servers.push_back(it);
+    }
+    std::sort(servers.begin(), servers.end(),
+              [](const DnsServerTable::const_iterator& a, const DnsServerTable::const_iterator& b) {
+                  return a->second.queries > b->second.queries;
+              });
+    // 中文字符占两列，表头按显示宽度手工对齐
+    printf("%s\n", "    服务端                   查询     响应 NXDOMAIN SERVFAIL   其他错误   超时   延迟 p50/p99 ms");
+    for (size_t i = 0; i < servers.size() && i < 20; i++) {
+        const DnsServerStats& st = servers[i]->second;
+        char server[32];
+        snprintf(server, sizeof(server), "%s:%d",
+                 ip_to_string(servers[i]->first.ip).c_str(), servers[i]->first.port);
+        printf("    %-21s %7llu %8llu %7.1f%% %8llu %10llu %6llu %9.2f/%-9.2f\n",
+               server, st.queries, st.responses,
+               st.responses > 0 ? 100.0 * st.nxdomain / st.responses : 0.0,
+               st.servfail, st.other_errors, st.timeouts,
+               histogram_percentile(st.latency, 50) / 1e3, histogram_percentile(st.latency, 99) / 1e3);
+    }
+    if (servers.size() > 20) {
+        printf("    ... 共 %zu 个服务端\n", servers.size());
+    }
+
+    std::vector<int> names;
+    for (int i = 0; i <= DNS_NAME_SLOTS; i++) {
+        if (dns.names[i].queries > 0) {
+            names.push_back(i);
+        }
+    }
+    std::sort(names.begin(), names.end(), [](int a, int b) {
+        return dns.names[a].queries > dns.names[b].queries;
+    });
+    printf("%s\n", "    域名                                    查询 NXDOMAIN   超时   延迟 平均/最大 ms");
+    for (size_t i = 0; i < names.size() && i < 20; i++) {
+        const DnsNameStats& n = dns.names[names[i]];
+        printf("    %-36.36s %7llu %8llu %6llu %9.2f/%-9.2f\n",
+               n.name, n.queries, n.nxdomain, n.timeouts,
+               n.responses > 0 ? n.latency_sum / n.responses * 1e3 : 0.0, n.latency_max * 1e3);
+    }
+    if (names.size() > 20) {
+        printf("    ... 共 %d 个域名%s\n", dns.names_used,
+               dns.names[DNS_NAME_OTHER].queries > 0 ? " (表满后的新域名计入 \"(其他)\")" : "");
+    }
+    fflush(stdout);
+}
+
+// ======================== IPv4 分片重组 ========================
+
+/*
+ * 分片重组表
+ *
+ * - 按 (源 IP, 目标 IP, IP ID, 协议) 识别同一个原始数据报
+ * - 固定 FRAG_SLOTS 个槽位，启动时一次性分配，运行中不再申请内存
+ * - 片偏移以 8 字节为单位，用位图记录已收到的 8 字节块，重叠/重复的分片自然去重
+ * - 收到最后一片 (MF = 0) 后才知道总长度；所有块都到齐即重组完成
+ * - 超过 FRAG_TIMEOUT_SEC 未完成的槽位视为超时；表满时淘汰最旧的槽位
+ */
+
+const int FRAG_SLOTS = 64;                      // 同时重组的数据报上限
+const double FRAG_TIMEOUT_SEC = 30.0;           // 与 Linux ipfrag_time 默认值相同
+const int FRAG_MAX_PAYLOAD = 65535 - 20;        // 重组后负载的上限
+const int FRAG_BLOCKS = (FRAG_MAX_PAYLOAD + 7) / 8;
+
+struct FragmentSlot {
+    bool in_use;
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t id;
+    uint8_t protocol;
+    double first_seen;                          // 第一个分片到达的时间
+    int total_len;                              // 负载总长度，-1 表示尚未收到最后一片
+    int received_blocks;                        // 已收到的 8 字节块数
+    int header_len;                             // 首片的 IP 头部长度，0 表示尚未收到首片
+    uint8_t block_map[(FRAG_BLOCKS + 7) / 8];   // 已收到的块
+    unsigned char datagram[60 + FRAG_MAX_PAYLOAD];  // 预留的最长 IP 头部 + 负载
+};
+
+struct FragmentStats {
+    unsigned long long fragments;   // 收到的分片数
+    unsigned long long reassembled; // 重组完成的数据报数
+    unsigned long long timeouts;    // 超时丢弃的数据报数
+    unsigned long long evicted;     // 表满时被淘汰的数据报数
+    unsigned long long invalid;     // 格式错误的分片数
+};
+
+FragmentSlot* frag_table = NULL;                // FRAG_SLOTS 个槽位，main 中分配
+FragmentStats frag_stats = {0, 0, 0, 0, 0};
+
+void handle_ipv4_tcp(const struct iphdr* ip, size_t len, uint32_t csum_status);
+void handle_ipv4_udp(const struct iphdr* ip, size_t len);
+
+/*
+ * 查找分片所属的槽位，没有则分配一个（必要时淘汰最旧的）
+ */
+FragmentSlot* find_fragment_slot(const struct iphdr* ip, double now) {
+    FragmentSlot* free_slot = NULL;
+    FragmentSlot* oldest = NULL;
+
+    for (int i = 0; i < FRAG_SLOTS; i++) {
+        FragmentSlot& slot = frag_table[i];
+        if (slot.in_use && now - slot.first_seen > FRAG_TIMEOUT_SEC) {
+            slot.in_use = false;
+            frag_stats.timeouts++;
+        }
+        if (!slot.in_use) {
+            if (free_slot == NULL) {
+                free_slot = &slot;
+            }
+            continue;
+        }
+        if (slot.id == ip->id && slot.saddr == ip->saddr &&
+            slot.daddr == ip->daddr && slot.protocol == ip->protocol) {
+            return &slot;
+        }
+        if (oldest == NULL || slot.first_seen < oldest->first_seen) {
+            oldest = &slot;
+        }
+    }
+
+    FragmentSlot* slot = free_slot;
+    if (slot == NULL) {
+        slot = oldest;
+        frag_stats.evicted++;
+    }
+    slot->in_use = true;
+    slot->saddr = ip->saddr;
+    slot->daddr = ip->daddr;
+    slot->id = ip->id;
+    slot->protocol = ip->protocol;
+    slot->first_seen = now;
+    slot->total_len = -1;
+    slot->received_blocks = 0;
+    slot->header_len = 0;
+    memset(slot->block_map, 0, sizeof(slot->block_map));
+    return slot;
+}
+
+/*
+ * 处理一个 IPv4 分片；重组完成时把完整数据报交给 handle_ipv4_tcp（-D 时 UDP 交给 handle_ipv4_udp）
+ *
+ * 参数：
+ * - ip: 分片的 IP 头部
+ * - len: 从 IP 头部起的可用长度
+ */
+void reassemble_fragment(const struct iphdr* ip, size_t len) {
+    frag_stats.fragments++;
+
+    int header_len = ip->ihl * 4;
+    int ip_total_len = ntohs(ip->tot_len);
+    int offset = (ntohs(ip->frag_off) & IP_OFFMASK) * 8;
+    int payload_len = ip_total_len - header_len;
+    bool more = ntohs(ip->frag_off) & IP_MF;
+
+    // 除最后一片外，分片负载必须是 8 的倍数
+    if (header_len < (int)sizeof(struct iphdr) || ip_total_len > (int)len || payload_len <= 0 ||
+        offset + payload_len > FRAG_MAX_PAYLOAD || (more && payload_len % 8 != 0)) {
+        frag_stats.invalid++;
+        return;
+    }
+
+    FragmentSlot* slot = find_fragment_slot(ip, get_timestamp());
+
+    // 首片：保存 IP 头部（选项一并保留）
+    if (offset == 0) {
+        slot->header_len = header_len;
+        memcpy(slot->datagram, ip, header_len);
+    }
+    // 最后一片：确定总长度
+    if (!more) {
+        slot->total_len = offset + payload_len;
+    }
+
+    // 负载先按 IP 头部最长 60 字节预留位置，完成时再与实际头部拼接
+    memcpy(slot->datagram + 60 + offset, (const unsigned char*)ip + header_len, payload_len);
+
+    int first_block = offset / 8;
+    int last_block = (offset + payload_len + 7) / 8;
+    for (int b = first_block; b < last_block; b++) {
+        if (!(slot->block_map[b / 8] & (1 << (b % 8)))) {
+            slot->block_map[b / 8] |= (1 << (b % 8));
+            slot->received_blocks++;
+        }
+    }
+
+    int needed_blocks = (slot->total_len + 7) / 8;
+    if (slot->total_len < 0 || slot->header_len == 0 || slot->received_blocks < needed_blocks) {
+        return;  // 还没到齐
+    }
+    // received_blocks 也计入了总长度之外的块（偏移超过最后一片的分片），逐块确认
+    for (int b = 0; b < needed_blocks; b++) {
+        if (!(slot->block_map[b / 8] & (1 << (b % 8)))) {
+            return;
+        }
+    }
+
+    // ==================== 重组完成 ====================
+    int total_len = slot->header_len + slot->total_len;
+    if (total_len > 65535) {
+        frag_stats.invalid++;
+        slot->in_use = false;
+        return;
+    }
+    memmove(slot->datagram + slot->header_len, slot->datagram + 60, slot->total_len);
+    struct iphdr* whole = (struct iphdr*)slot->datagram;
+    whole->tot_len = htons(total_len);
+    whole->frag_off = 0;
+
+    frag_stats.reassembled++;
+    slot->in_use = false;
+    // 网卡的校验和判断针对单个分片，重组后的 TCP 校验和总是自己验证
+    if (whole->protocol == IPPROTO_UDP) {
+        handle_ipv4_udp(whole, total_len);  // 带 EDNS 的大响应会分片
+    } else {
+        handle_ipv4_tcp(whole, total_len, 0);
+    }
+}
+
+/*
+ * 处理一个以太网帧：逐层解析并交给 TCP 状态机
+ *
+ * 参数：
+ * - frame: 帧起始地址（以太网头部）
+ * - len: 帧长度
+ * - csum_status: 内核给出的校验和状态（PACKET_AUXDATA 的 tp_status，没有时为 0）
+ *
+ * 两种捕获后端（AF_PACKET / AF_XDP）拿到帧后都调用这个函数，
+ * 解析和状态跟踪逻辑只有一份
+ */
+void handle_frame(const unsigned char* frame, size_t len, uint32_t csum_status = 0) {
+    capture_stats.packets++;
+    capture_stats.bytes += len;
+    if (current_interface != NULL) {
+        current_interface->packets++;
+        current_interface->bytes += len;
+    }
+
+    if (len < sizeof(struct ethhdr) + sizeof(struct iphdr)) {
+        return;
+    }
+
+    // ==================== Layer 2: 解析以太网头部 ====================
+    const struct ethhdr* eth = (const struct ethhdr*)frame;
+
+    // 检查是否为 IPv4 数据包 (EtherType = 0x0800)
+    if (ntohs(eth->h_proto) != 0x0800) {
+        return;  // 跳过非 IPv4 数据包（如 ARP, IPv6 等）
+    }
+
+    // ==================== Layer 3: 解析 IP 头部 ====================
+    const struct iphdr* ip = (const struct iphdr*)(frame + sizeof(struct ethhdr));
+
+    // 检查是否为 TCP 数据包 (Protocol = 6)；DNS 分析模式下 UDP (Protocol = 17) 也继续解析
+    if (ip->protocol != 6 && !(dns.enabled && ip->protocol == 17)) {
+        return;  // 跳过非 TCP 数据包（如 UDP, ICMP 等）
+    }
+
+    // IP 头部损坏时连协议号、地址和分片字段都不可信，在分片重组之前验证
+    if (checksum.enabled && !verify_ip_header(ip, len - sizeof(struct ethhdr))) {
+        return;
+    }
+
+    /*
+     * 分片检查：MF 置位或片偏移非 0 都说明是分片。只有首片带 TCP 头部，
+     * 后续分片开头就是负载，直接当 TCP 头部解析会得到垃圾端口。
+     * 分片交给重组阶段，重组完成后再从 handle_ipv4_tcp 进入；
+     * 未分片的包只多这一次判断
+     */
+    if (ip->frag_off & htons(IP_MF | IP_OFFMASK)) {
+        reassemble_fragment(ip, len - sizeof(struct ethhdr));
+        return;
+    }
+
+    if (ip->protocol == 17) {
+        handle_ipv4_udp(ip, len - sizeof(struct ethhdr));
+        return;
+    }
+    handle_ipv4_tcp(ip, len - sizeof(struct ethhdr), csum_status);
+}
+
+/*
+ * 处理一个完整的 IPv4 TCP 数据报（未分片的包，或重组完成的数据报）
+ *
+ * 参数：
+ * - ip: IPv4 头部
+ * - len: 数据报的可用长度（从 IP 头部起）
+ * - csum_status: 内核给出的校验和状态（重组的数据报为 0）
+ */
+void handle_ipv4_tcp(const struct iphdr* ip, size_t len, uint32_t csum_status) {
+    // ==================== Layer 4: 解析 TCP 头部 ====================
+
+    /*
+     * 计算 TCP 头部的偏移量
+     *
+     * TCP 头部位置 = IP 头部起始 + IP 头部长度
+     * IP 头部长度 = ip->ihl * 4 (ihl 以 4 字节为单位)
+     */
+    int ip_header_len = ip->ihl * 4;
+    if (len < ip_header_len + sizeof(struct tcphdr)) {
+        return;  // 截断的帧
+    }
+    struct tcphdr* tcp = (struct tcphdr*)((const unsigned char*)ip + ip_header_len);
+
+    // 提取连接信息
+    uint32_t src_ip = ip->saddr;
+    uint32_t dst_ip = ip->daddr;
+    uint16_t src_port = tcp->source;
+    uint16_t dst_port = tcp->dest;
+
+    /*
+     * 计算 TCP 数据部分的长度
+     *
+     * TCP 数据长度 = IP 总长度 - IP 头部长度 - TCP 头部长度
+     * TCP 头部长度 = tcp->doff * 4 (doff 以 4 字节为单位)
+     */
+    int tcp_header_len = tcp->doff * 4;
+    int ip_total_len = ntohs(ip->tot_len);
+    int tcp_data_len = ip_total_len - ip_header_len - tcp_header_len;
+
+    // ==================== 连接规范化 ====================
+    /*
+     * 将 (src, dst) 规范化为统一的连接标识符
+     * 这样无论数据包方向如何，都能映射到同一个连接记录
+     */
+    ConnectionID key = make_canonical_id(src_ip, ntohs(src_port),
+                                         dst_ip, ntohs(dst_port));
+
+    // ==================== 过载采样 ====================
+    if (!overload_admit(key)) {
+        overload.sampled_out++;
+        return;
+    }
+
+    // ==================== 校验和验证 ====================
+    /*
+     * 在采样之后验证：被采样跳过的段不必计算。错误计入已跟踪连接的对应方向
+     * （地址和端口本身可能就是损坏的字段，所以不为它新建连接）
+     */
+    if (checksum.enabled && !verify_tcp_checksum(ip, len, csum_status)) {
+        auto bad = connection_tracker.find(key);
+        if (bad != connection_tracker.end()) {
+            int d = (src_ip == key.src_ip && ntohs(src_port) == key.src_port) ? 0 : 1;
+            bad->second.dir[d].bad_checksums++;
+            timeline_record(bad->second.timeline, TL_BAD_CHECKSUM, d, (uint64_t)(get_relative_time() * 1e6), 0);
+        }
+        return;
+    }
+
+    // ==================== 状态机处理 ====================
+    /*
+     * 调用状态机处理函数
+     * 根据当前状态和 TCP 标志位，更新连接状态并输出事件信息
+     */
+    capture_stats.tcp_packets++;
+    if (current_interface != NULL) {
+        current_interface->tcp_packets++;
+    }
+    process_tcp_packet(key, tcp, src_ip, dst_ip, src_port, dst_port, tcp_data_len);
+
+    // ==================== TCP 选项与连接指标 ====================
+    /*
+     * 对仍在跟踪的连接，解析 20 字节固定头部之后的选项，
+     * 更新 RTT、窗口等指标（连接结束时由 finish_flow 输出诊断）
+     */
+    auto it = connection_tracker.find(key);
+    if (it != connection_tracker.end() && tcp_header_len >= (int)sizeof(struct tcphdr) &&
+        len >= (size_t)(ip_header_len + tcp_header_len)) {
+        TcpOptions opts;
+        parse_tcp_options((const unsigned char*)tcp + sizeof(struct tcphdr),
+                          tcp_header_len - sizeof(struct tcphdr), opts);
+        int d = (src_ip == key.src_ip && ntohs(src_port) == key.src_port) ? 0 : 1;
+        update_flow_metrics(key, it->second, d, tcp, opts, tcp_data_len, ip_total_len);
+    }
+
+    // ==================== DNS over TCP ====================
+    if (dns.enabled && tcp_data_len > 0 && (ntohs(src_port) == 53 || ntohs(dst_port) == 53) &&
+        len >= (size_t)(ip_header_len + tcp_header_len + tcp_data_len)) {
+        // 连接记录可能已在状态机中删除（FIN 段携带数据），此时不记录跨段位置
+        it = connection_tracker.find(key);
+        uint32_t* skip = NULL;
+        if (it != connection_tracker.end()) {
+            int d = (src_ip == key.src_ip && ntohs(src_port) == key.src_port) ? 0 : 1;
+            skip = &it->second.dir[d].dns_skip;
+        }
+        dns_handle_tcp_payload((const unsigned char*)tcp + tcp_header_len, tcp_data_len,
+                               src_ip, ntohs(src_port), dst_ip, ntohs(dst_port), skip);
+    }
+}
+
+/*
+ * 处理一个完整的 IPv4 UDP 数据报（只在 -D 时进入）：端口 53 的负载交给 DNS 分析
+ *
+ * 参数：
+ * - ip: IPv4 头部
+ * - len: 数据报的可用长度（从 IP 头部起）
+ */
+void handle_ipv4_udp(const struct iphdr* ip, size_t len) {
+    int ip_header_len = ip->ihl * 4;
+    if (len < ip_header_len + sizeof(struct udphdr)) {
+        return;  // 截断的帧
+    }
+    const struct udphdr* udp = (const struct udphdr*)((const unsigned char*)ip + ip_header_len);
+    uint16_t src_port = ntohs(udp->source);
+    uint16_t dst_port = ntohs(udp->dest);
+    if (src_port != 53 && dst_port != 53) {
+        return;
+    }
+    int udp_len = ntohs(udp->len);
+    if (udp_len < (int)sizeof(struct udphdr) || ip_header_len + udp_len > (int)len) {
+        dns.malformed++;
+        return;
+    }
+
+    // 与 TCP 相同的按流一致采样：查询和它的响应同进同出
+    ConnectionID key = make_canonical_id(ip->saddr, src_port, ip->daddr, dst_port);
+    if (!overload_admit(key)) {
+        overload.sampled_out++;
+        return;
+    }
+    dns_handle_message((const unsigned char*)(udp + 1), udp_len - sizeof(struct udphdr),
+                       ip->saddr, src_port, ip->daddr, dst_port);
+}
+
+/*
+ * 安静模式下每秒打印一次吞吐，用于比较不同捕获后端的性能
+ * （多个接口时附带各接口的速率）
+ */
+void report_rate() {
+    static double last_time = start_time;
+    static unsigned long long last_packets = 0;
+    double now = get_timestamp();
+    if (now - last_time < 1.0) {
         return;
     }
+    double elapsed = now - last_time;
+    std::string per_interface;
+    if (capture_interfaces.size() > 1) {
+        for (size_t i = 0; i < capture_interfaces.size(); i++) {
+            CaptureInterface& cap = capture_interfaces[i];
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%s%s %.3f", i == 0 ? " [" : ", ", cap.name.c_str(),
+                     (cap.packets - cap.last_report) / elapsed / 1e6);
+            per_interface += buf;
+            cap.last_report = cap.packets;
+        }
+        per_interface += "]";
+    }
+    double pps = (capture_stats.packets - last_packets) / elapsed;
+    printf("[%.3f] 📈 %.3f Mpps%s, 累计 %llu 帧 / %llu TCP 段, 跟踪连接 %zu\n",
+           get_relative_time(), pps / 1e6, per_interface.c_str(), capture_stats.packets,
+           capture_stats.tcp_packets, connection_tracker.size());
+    fflush(stdout);
+    last_time = now;
+    last_packets = capture_stats.packets;
+}
+
+/*
+ * 捕获循环每一轮调用（持有 analyzer_lock）：安静模式下打印吞吐，开启导出时检查连接超时，
+ * 到期时输出服务延迟报告
+ */
+void periodic_tasks() {
+    if (quiet_mode) {
+        report_rate();
+    }
+    if (timeline_dump_requested) {
+        timeline_dump_requested = 0;
+        timeline_dump_all(stdout);
+    }
+    if (control.enabled) {
+        control_publish_snapshot();
+    }
+    if (ipfix.enabled) {
+        ipfix_expire_flows();
+    }
+    if (dns.enabled) {
+        dns_expire_pending(get_timestamp(), false);
+    }
+    if (service_reporter.interval > 0 &&
+        get_relative_time() - service_reporter.last_report >= service_reporter.interval) {
+        service_report(false);
+        if (dns.enabled) {
+            dns_print_report(" (累计)");
+        }
+    }
+}
+
+/*
+ * 获取网络接口索引
+ */
+int get_ifindex(const char* interface) {
+    int ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        perror("获取接口索引失败");
+    }
+    return ifindex;
+}
+
+// ======================== 捕获后端 1: AF_PACKET ========================
+
+/*
+ * AF_PACKET 的过载指标：接收缓冲区占用比例、最近一个包在内核中排队的时间、新增丢弃数
+ *
+ * 参数：
+ * - received: 本轮是否收到了包（没收到说明队列已空，延迟为 0）
+ */
+void packet_overload_check(int sock, CaptureInterface& cap, bool received) {
+    double fill = 0.0;
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t optlen = sizeof(meminfo);
+    if (getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &optlen) == 0 &&
+        meminfo[SK_MEMINFO_RCVBUF] > 0) {
+        fill = (double)meminfo[SK_MEMINFO_RMEM_ALLOC] / meminfo[SK_MEMINFO_RCVBUF];
+    }
+
+    // SIOCGSTAMP 返回最近一个 recv 到的包的内核接收时间（第一次调用时开启时间戳）
+    double lag = 0.0;
+    struct timeval ts;
+    if (received && ioctl(sock, SIOCGSTAMP, &ts) == 0) {
+        lag = std::max(0.0, get_timestamp() - (ts.tv_sec + ts.tv_usec / 1000000.0));
+    }
+
+    // PACKET_STATISTICS 读取后清零，这里读到的就是新增丢弃
+    unsigned long long drops = 0;
+    struct tpacket_stats kstats;
+    optlen = sizeof(kstats);
+    if (getsockopt(sock, SOL_PACKET, PACKET_STATISTICS, &kstats, &optlen) == 0) {
+        drops = kstats.tp_drops;
+        capture_stats.kernel_drops += drops;
+        cap.kernel_drops += drops;
+    }
+
+    overload_update(fill, lag, drops);
+}
+
+/*
+ * 使用 AF_PACKET 原始套接字捕获
+ *
+ * 每个帧都经过内核协议栈的 skb 分配，再 recv 复制到用户态，
+ * 简单通用，但每包开销较大
+ */
+int run_packet_capture(CaptureInterface& cap) {
+    /*
+     * 创建原始套接字 (Raw Socket)
+     *
+     * AF_PACKET: 工作在数据链路层，可以捕获所有以太网帧
+     * SOCK_RAW: 原始套接字，获取完整的数据包（包括头部）
+     * htons(ETH_P_ALL): 捕获所有协议类型的数据包
+     */
+    int sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (sock < 0) {
+        perror("创建套接字失败 (需要 root 权限)");
+        return 1;
+    }
+
+    /*
+     * 绑定到特定的网络接口
+     *
+     * 如果不绑定，会接收所有接口的数据包
+     */
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = cap.ifindex;
+    sll.sll_protocol = htons(ETH_P_ALL);
+
+    if (bind(sock, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+        perror("绑定套接字失败");
+        close(sock);
+        return 1;
+    }
+
+    /*
+     * 多个接口时只接收入方向的帧：路由器转发的包会在入接口和出接口各出现一次，
+     * 只在入接口上计一次，避免重复
+     */
+    if (capture_interfaces.size() > 1) {
+        int ignore = 1;
+        if (setsockopt(sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore)) < 0) {
+            perror("设置 PACKET_IGNORE_OUTGOING 失败 (需要 Linux 4.20+)");
+        }
+    }
+
+    // 校验和验证需要知道网卡是否已经验证过（或者本机发出的包尚未计算），由 PACKET_AUXDATA 给出
+    if (checksum.enabled) {
+        int aux = 1;
+        if (setsockopt(sock, SOL_PACKET, PACKET_AUXDATA, &aux, sizeof(aux)) < 0) {
+            perror("设置 PACKET_AUXDATA 失败");
+        }
+    }
+
+    // 设置接收超时，以便定期打印统计并响应退出信号
+    struct timeval tv = {0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    printf("✅ %s: AF_PACKET 套接字创建成功，开始捕获数据包...\n\n", cap.name.c_str());
+
+    // 数据包缓冲区 (65536 字节足够容纳最大的以太网帧)
+    unsigned char buffer[65536];
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+    } control;
+
+    /*
+     * 主循环：持续捕获和处理数据包
+     */
+    while (!stop_requested) {
+        // 接收一个数据包（附带的控制消息中有 tpacket_auxdata）
+        struct iovec iov = {buffer, sizeof(buffer)};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t packet_size = recvmsg(sock, &msg, 0);
+        if (packet_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("接收数据包失败");
+        }
+        uint32_t csum_status = 0;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); packet_size >= 0 && c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_PACKET && c->cmsg_type == PACKET_AUXDATA) {
+                struct tpacket_auxdata aux;
+                memcpy(&aux, CMSG_DATA(c), sizeof(aux));
+                csum_status = aux.tp_status;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(analyzer_lock);
+        current_interface = &cap;
+        if (packet_size >= 0) {
+            handle_frame(buffer, packet_size, csum_status);
+        }
+        if (overload_check_due(cap.last_overload_check)) {
+            packet_overload_check(sock, cap, packet_size > 0);
+        }
+        periodic_tasks();
+    }
+
+    // 内核丢包统计（读取后清零）
+    struct tpacket_stats kstats;
+    socklen_t kstats_len = sizeof(kstats);
+    if (getsockopt(sock, SOL_PACKET, PACKET_STATISTICS, &kstats, &kstats_len) == 0) {
+        std::lock_guard<std::mutex> guard(analyzer_lock);
+        capture_stats.kernel_drops += kstats.tp_drops;
+        cap.kernel_drops += kstats.tp_drops;
+    }
+
+    close(sock);
+    return 0;
+}
+
+// ======================== 捕获后端 2: AF_XDP ========================
+
+/*
+ * AF_XDP 捕获
+ *
+ * 网卡驱动收到帧后，先运行挂在接口上的 XDP 程序（此时还没有分配 skb）：
+ * - TCP 帧: bpf_redirect_map 重定向到 AF_XDP 套接字，直接写入用户态的 UMEM
+ * - 其他帧: XDP_PASS，照常交给内核协议栈
+ *
+ *            ┌──────────── UMEM（用户态共享内存，按 2KB 分帧）────────────┐
+ *            │  frame 0 │ frame 1 │ frame 2 │ ...                       │
+ *            └──────────────────────────────────────────────────────────┘
+ *   Fill 环:  用户态 → 内核，"这些帧空着，可以往里写"
+ *   RX 环:    内核 → 用户态，"这个帧里有数据 (addr, len)"
+ *   Completion 环: 仅发送使用，这里只为满足绑定要求而创建
+ *
+ * 用户态处理完 RX 环上的帧后，把帧地址放回 Fill 环，整个过程没有复制和 skb 分配。
+ *
+ * 注意：被重定向的 TCP 帧不会再进入内核协议栈，所以 XDP 后端适合镜像端口、
+ *       旁路抓包口或 veth 测试环境，不要用在承载本机 TCP 业务的接口上。
+ *
+ * 不依赖 libbpf：XDP 程序用 BPF 指令直接写出，通过 bpf() 系统调用加载，
+ * 再用 BPF_LINK_CREATE 挂载（进程退出时自动卸载）。需要 Linux 5.9+。
+ */
+
+const uint32_t XDP_NUM_FRAMES = 4096;    // UMEM 帧数
+const uint32_t XDP_FRAME_SIZE = 2048;    // 每帧字节数（需为 2 的幂，容纳一个 1500 MTU 的帧）
+const uint32_t XDP_RING_SIZE = 4096;     // RX / Fill / Completion 环大小（2 的幂，不小于帧数）
+const uint32_t XDP_MAX_QUEUES = 64;      // XSKMAP 容量（按网卡队列号索引）
+
+// 环的用户态视图：生产者/消费者指针和描述符数组都在与内核共享的内存中
+struct XdpRing {
+    uint32_t* producer;
+    uint32_t* consumer;
+    void* descs;
+    uint32_t mask;
+    void* map;          // mmap 的起始地址
+    size_t map_len;
+};
+
+// XDP 挂载模式
+enum XdpAttachMode {
+    XDP_ATTACH_AUTO,    // 先尝试驱动原生模式，不支持时退回通用模式
+    XDP_ATTACH_NATIVE,  // 驱动原生模式 (XDP_FLAGS_DRV_MODE)
+    XDP_ATTACH_GENERIC  // 通用模式 (XDP_FLAGS_SKB_MODE)，任何接口都可用，包括 veth
+};
+
+long sys_bpf(int cmd, union bpf_attr* attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+struct bpf_insn make_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    struct bpf_insn insn;
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+/*
+ * 加载 XDP 程序：TCP 帧（-D 时还有 UDP/53 帧）重定向到 XSKMAP[rx_queue_index]，其他帧 XDP_PASS
+ *
+ * 等价的 C 代码：
+ *   void* data = (void*)(long)ctx->data;
+ *   void* end  = (void*)(long)ctx->data_end;
+ *   if (data + 34 > end) return XDP_PASS;                   // 以太网 14 + IPv4 20
+ *   if (eth->h_proto != htons(ETH_P_IP)) return XDP_PASS;
+ *   if (ip->protocol == IPPROTO_TCP) goto redirect;
+ *   if (!dns || ip->protocol != IPPROTO_UDP) return XDP_PASS;   // 以下只在 dns 为真时生成
+ *   if (data + 38 > end) return XDP_PASS;                   // UDP 端口（按无 IP 选项取偏移）
+ *   if (udp->source != htons(53) && udp->dest != htons(53)) return XDP_PASS;
+ * redirect:
+ *   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ * 只重定向 UDP/53，其他 UDP 流量仍交给内核协议栈。
+ * bpf_redirect_map 的 flags 低位是查找失败时的返回值：
+ * 该队列没有绑定套接字时同样 XDP_PASS
+ */
+int load_xdp_program(int xsks_map_fd, bool dns_udp) {
+    // 跳转偏移按 redirect / pass 两个标签在生成后回填
+    const int16_t TO_REDIRECT = 0x7ffe;
+    const int16_t TO_PASS = 0x7fff;
+    std::vector<struct bpf_insn> prog = {
+        make_insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),                        // r6 = ctx
+        make_insn(BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0),                          // r2 = ctx->data
+        make_insn(BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0),                          // r3 = ctx->data_end
+        make_insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),                        // r4 = r2
+        make_insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 34),                       // r4 += 34
+        make_insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, TO_PASS, 0),                    // if r4 > r3 goto pass
+        make_insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),                         // r5 = eth->h_proto
+        make_insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, TO_PASS, htons(ETH_P_IP)),      // if r5 != IPv4 goto pass
+        make_insn(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0),                         // r5 = ip->protocol
+        make_insn(BPF_JMP | BPF_JEQ | BPF_K, 5, 0, TO_REDIRECT, IPPROTO_TCP),      // if r5 == TCP goto redirect
+    };
+    if (dns_udp) {
+        std::vector<struct bpf_insn> udp = {
+            make_insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, TO_PASS, IPPROTO_UDP),      // if r5 != UDP goto pass
+            make_insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 4),                    // r4 += 4
+            make_insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, TO_PASS, 0),                // if r4 > r3 goto pass
+            make_insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 34, 0),                     // r5 = udp->source
+            make_insn(BPF_JMP | BPF_JEQ | BPF_K, 5, 0, TO_REDIRECT, htons(53)),    // if r5 == 53 goto redirect
+            make_insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0),                     // r5 = udp->dest
+            make_insn(BPF_JMP | BPF_JEQ | BPF_K, 5, 0, TO_REDIRECT, htons(53)),    // if r5 == 53 goto redirect
+        };
+        prog.insert(prog.end(), udp.begin(), udp.end());
+    }
+    prog.push_back(make_insn(BPF_JMP | BPF_JA, 0, 0, TO_PASS, 0));                   // goto pass
+    size_t redirect = prog.size();
+    std::vector<struct bpf_insn> tail = {
+        make_insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index), 0),
+        make_insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, xsks_map_fd), // r1 = &xsks
+        make_insn(0, 0, 0, 0, 0),
+        make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),                 // r3 = XDP_PASS
+        make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),             // r0 = redirect_map(r1, r2, r3)
+        make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),                 // pass: r0 = XDP_PASS
+        make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    prog.insert(prog.end(), tail.begin(), tail.end());
+    size_t pass = prog.size() - 2;
+    for (size_t i = 0; i < redirect; i++) {
+        if (prog[i].off == TO_REDIRECT) {
+            prog[i].off = (int16_t)(redirect - i - 1);
+        } else if (prog[i].off == TO_PASS) {
+            prog[i].off = (int16_t)(pass - i - 1);
+        }
+    }
+
+    static char log_buf[65536];
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(unsigned long)prog.data();
+    attr.insn_cnt = prog.size();
+    attr.license = (uint64_t)(unsigned long)"GPL";
+    attr.log_buf = (uint64_t)(unsigned long)log_buf;
+    attr.log_size = sizeof(log_buf);
+    attr.log_level = 1;
+
+    int prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (prog_fd < 0) {
+        perror("加载 XDP 程序失败");
+        fprintf(stderr, "%s\n", log_buf);
+    }
+    return prog_fd;
+}
+
+/*
+ * 把 XDP 程序挂到接口上，返回 bpf_link 的 fd（关闭即卸载）
+ */
+int attach_xdp_program(int prog_fd, int ifindex, XdpAttachMode mode, bool& native) {
+    const uint32_t flags[2] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    for (int i = 0; i < 2; i++) {
+        if ((i == 0 && mode == XDP_ATTACH_GENERIC) || (i == 1 && mode == XDP_ATTACH_NATIVE)) {
+            continue;
+        }
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = flags[i];
+        int link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+        if (link_fd >= 0) {
+            native = (i == 0);
+            return link_fd;
+        }
+        if (i == 0 && mode == XDP_ATTACH_AUTO) {
+            printf("⚠️  驱动不支持原生 XDP (%s)，退回通用模式\n", strerror(errno));
+        }
+    }
+    perror("挂载 XDP 程序失败");
+    return -1;
+}
+
+/*
+ * 映射一个 AF_XDP 环
+ */
+bool map_xdp_ring(int xsk, const struct xdp_ring_offset& off, size_t desc_size,
+                  off_t pgoff, XdpRing& ring) {
+    ring.map_len = off.desc + XDP_RING_SIZE * desc_size;
+    ring.map = mmap(NULL, ring.map_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, xsk, pgoff);
+    if (ring.map == MAP_FAILED) {
+        perror("映射 AF_XDP 环失败");
+        return false;
+    }
+    char* base = (char*)ring.map;
+    ring.producer = (uint32_t*)(base + off.producer);
+    ring.consumer = (uint32_t*)(base + off.consumer);
+    ring.descs = base + off.desc;
+    ring.mask = XDP_RING_SIZE - 1;
+    return true;
+}
+
+/*
+ * 使用 AF_XDP 捕获指定接口、指定队列上的 TCP 帧
+ */
+int run_xdp_capture(CaptureInterface& cap, uint32_t queue_id, XdpAttachMode mode) {
+    int ifindex = cap.ifindex;
+    if (queue_id >= XDP_MAX_QUEUES) {
+        fprintf(stderr, "队列号必须小于 %u\n", XDP_MAX_QUEUES);
+        return 1;
+    }
+
+    int xsk = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk < 0) {
+        perror("创建 AF_XDP 套接字失败 (需要 root 权限和 Linux 5.9+)");
+        return 1;
+    }
+
+    // ==================== 1. 注册 UMEM ====================
+    size_t umem_len = (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+    void* umem = mmap(NULL, umem_len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED) {
+        perror("分配 UMEM 失败");
+        close(xsk);
+        return 1;
+    }
+
+    struct xdp_umem_reg umem_reg;
+    memset(&umem_reg, 0, sizeof(umem_reg));
+    umem_reg.addr = (uint64_t)(unsigned long)umem;
+    umem_reg.len = umem_len;
+    umem_reg.chunk_size = XDP_FRAME_SIZE;
+    umem_reg.headroom = 0;
+
+    uint32_t ring_size = XDP_RING_SIZE;
+    if (setsockopt(xsk, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) < 0 ||
+        setsockopt(xsk, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(xsk, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(xsk, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0) {
+        perror("配置 UMEM 和环失败");
+        close(xsk);
+        munmap(umem, umem_len);
+        return 1;
+    }
+
+    // ==================== 2. 映射 Fill / Completion / RX 环 ====================
+    struct xdp_mmap_offsets offsets;
+    socklen_t optlen = sizeof(offsets);
+    if (getsockopt(xsk, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &optlen) < 0) {
+        perror("获取环偏移失败");
+        close(xsk);
+        munmap(umem, umem_len);
+        return 1;
+    }
+
+    XdpRing fill, completion, rx;
+    if (!map_xdp_ring(xsk, offsets.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING, fill) ||
+        !map_xdp_ring(xsk, offsets.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING, completion) ||
+        !map_xdp_ring(xsk, offsets.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING, rx)) {
+        close(xsk);
+        munmap(umem, umem_len);
+        return 1;
+    }
+
+    // 所有帧都先交给内核；处理完的帧马上归还，所以 Fill 环不会溢出
+    uint64_t* fill_addrs = (uint64_t*)fill.descs;
+    uint32_t fill_count = XDP_NUM_FRAMES;
+    for (uint32_t i = 0; i < fill_count; i++) {
+        fill_addrs[i] = (uint64_t)i * XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(fill.producer, fill_count, __ATOMIC_RELEASE);
+
+    // ==================== 3. 绑定到接口队列 ====================
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue_id;
+
+    // 优先零拷贝，驱动不支持时退回复制模式
+    sxdp.sxdp_flags = XDP_ZEROCOPY;
+    bool zerocopy = true;
+    if (bind(xsk, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0) {
+        sxdp.sxdp_flags = XDP_COPY;
+        zerocopy = false;
+        if (bind(xsk, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0) {
+            perror("绑定 AF_XDP 套接字失败");
+            close(xsk);
+            munmap(umem, umem_len);
+            return 1;
+        }
+    }
+
+    // ==================== 4. 创建 XSKMAP 并加载、挂载 XDP 程序 ====================
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = XDP_MAX_QUEUES;
+    int map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        perror("创建 XSKMAP 失败");
+        close(xsk);
+        munmap(umem, umem_len);
+        return 1;
+    }
 
-    // ==================== 被动关闭方的状态转换 ====================
+    uint32_t key = queue_id;
+    uint32_t value = xsk;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uint64_t)(unsigned long)&key;
+    attr.value = (uint64_t)(unsigned long)&value;
+    attr.flags = BPF_ANY;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        perror("写入 XSKMAP 失败");
+        close(map_fd);
+        close(xsk);
+        munmap(umem, umem_len);
+        return 1;
+    }
 
-    /*
-     * 状态转换 9: ESTABLISHED -> CLOSE_WAIT
-     * 触发条件：被动方收到对方的 FIN
-     */
-    if (current_state == ESTABLISHED && tcp->fin) {
-        connection_tracker[key] = CLOSE_WAIT;
-        printf("[%.3f] 🔵 收到关闭请求 (FIN): %s:%d <-> %s:%d [ESTABLISHED -> CLOSE_WAIT]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
-        return;
+    int prog_fd = load_xdp_program(map_fd, dns.enabled);
+    bool native = false;
+    int link_fd = prog_fd < 0 ? -1 : attach_xdp_program(prog_fd, ifindex, mode, native);
+    if (link_fd < 0) {
+        if (prog_fd >= 0) {
+            close(prog_fd);
+        }
+        close(map_fd);
+        close(xsk);
+        munmap(umem, umem_len);
+        return 1;
     }
 
-    /*
-     * 状态转换 10: CLOSE_WAIT -> LAST_ACK
-     * 触发条件：被动方也发起关闭（发送 FIN）
-     */
-    if (current_state == CLOSE_WAIT && tcp->fin) {
-        connection_tracker[key] = LAST_ACK;
-        printf("[%.3f] 🔵 被动关闭 (FIN): %s:%d -> %s:%d [CLOSE_WAIT -> LAST_ACK]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
-        return;
+    printf("✅ AF_XDP 套接字已绑定 %s 队列 %u (%s XDP, %s)，开始捕获 TCP 帧...\n\n",
+           cap.name.c_str(), queue_id, native ? "原生" : "通用", zerocopy ? "零拷贝" : "复制模式");
+
+    // ==================== 5. 主循环：消费 RX 环，归还帧到 Fill 环 ====================
+    struct xdp_desc* rx_descs = (struct xdp_desc*)rx.descs;
+    uint32_t rx_cons = *rx.consumer;
+    uint32_t fill_prod = fill_count;
+    unsigned long long reported_drops = 0;      // 过载检查已经看到的内核丢弃数（累计值）
+
+    while (!stop_requested) {
+        uint32_t rx_prod = __atomic_load_n(rx.producer, __ATOMIC_ACQUIRE);
+        uint32_t available = rx_prod - rx_cons;
+
+        std::unique_lock<std::mutex> guard(analyzer_lock);
+        current_interface = &cap;
+
+        // 过载检查：RX 环中待处理描述符的比例和新增丢弃（XDP 帧没有接收时间戳，不测延迟）
+        if (overload_check_due(cap.last_overload_check)) {
+            unsigned long long drops = 0;
+            struct xdp_statistics xstats;
+            optlen = sizeof(xstats);
+            if (getsockopt(xsk, SOL_XDP, XDP_STATISTICS, &xstats, &optlen) == 0) {
+                drops = xstats.rx_dropped + xstats.rx_ring_full - reported_drops;
+                reported_drops = xstats.rx_dropped + xstats.rx_ring_full;
+            }
+            overload_update((double)available / XDP_RING_SIZE, 0.0, drops);
+        }
+
+        if (available == 0) {
+            periodic_tasks();
+            guard.unlock();
+            struct pollfd pfd;
+            pfd.fd = xsk;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 200);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < available; i++) {
+            const struct xdp_desc& desc = rx_descs[(rx_cons + i) & rx.mask];
+            handle_frame((const unsigned char*)umem + desc.addr, desc.len);
+
+            // 处理完立即把帧还给内核（对齐模式下按帧起始地址归还）
+            fill_addrs[fill_prod++ & fill.mask] = desc.addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+        }
+        periodic_tasks();
+        guard.unlock();
+
+        rx_cons += available;
+        __atomic_store_n(rx.consumer, rx_cons, __ATOMIC_RELEASE);
+        __atomic_store_n(fill.producer, fill_prod, __ATOMIC_RELEASE);
     }
 
-    /*
-     * 状态转换 11: LAST_ACK -> CLOSED
-     * 触发条件：收到对最后一个 FIN 的 ACK
-     */
-    if (current_state == LAST_ACK && tcp->ack) {
-        connection_tracker.erase(key);
-        printf("[%.3f] 🔵 连接完全关闭 (ACK): %s:%d <-> %s:%d [LAST_ACK -> CLOSED]\n",
-               timestamp,
-               src_ip_str.c_str(), ntohs(src_port),
-               dst_ip_str.c_str(), ntohs(dst_port));
-        return;
+    // RX 环满或 Fill 环为空时内核丢弃的帧
+    struct xdp_statistics xstats;
+    optlen = sizeof(xstats);
+    if (getsockopt(xsk, SOL_XDP, XDP_STATISTICS, &xstats, &optlen) == 0) {
+        std::lock_guard<std::mutex> guard(analyzer_lock);
+        capture_stats.kernel_drops += xstats.rx_dropped + xstats.rx_ring_full;
+        cap.kernel_drops += xstats.rx_dropped + xstats.rx_ring_full;
     }
+
+    // 关闭 link 即从接口卸载 XDP 程序
+    close(link_fd);
+    close(prog_fd);
+    close(map_fd);
+    close(xsk);
+    munmap(rx.map, rx.map_len);
+    munmap(fill.map, fill.map_len);
+    munmap(completion.map, completion.map_len);
+    munmap(umem, umem_len);
+    return 0;
 }
 
-// ======================== 主程序 ========================
+// ======================== 捕获后端 3: eBPF tracepoint ========================
 
-int main(int argc, char* argv[]) {
-    // 检查命令行参数
-    if (argc < 2) {
-        std::cerr << "用法: sudo " << argv[0] << " <网络接口名>\n";
-        std::cerr << "例如: sudo " << argv[0] << " eth0\n";
-        std::cerr << "      sudo " << argv[0] << " wlan0\n";
-        return 1;
+/*
+ * 本机分析模式 (-b trace)
+ *
+ * 抓包推断状态有很多盲区（丢包、乱序、同时打开、只看到一个方向……），而且每个包
+ * 都要完整复制一份。分析本机连接时，可以直接挂到内核自己的 tracepoint 上：
+ *
+ *   sock:inet_sock_set_state   内核每次修改 socket 状态时触发，给出精确的新旧状态
+ *   tcp:tcp_retransmit_skb     内核每次重传一个段时触发
+ *
+ * 两个 tracepoint 上各挂一个 BPF 程序，只挑出 IPv4 TCP 事件，压缩成 32 字节的
+ * TraceEvent 写入同一个 BPF ring buffer；用户态从 ring buffer 读出事件，更新
+ * 同一张 connection_tracker 并输出同样格式的事件行。每次状态变化只有一条
+ * 32 字节的记录，没有包复制。
+ *
+ * 与 AF_XDP 后端一样不依赖 libbpf：tracepoint 记录中各字段的偏移在不同内核上
+ * 可能不同，所以运行时读取 tracefs 中的 format 文件，再据此生成 BPF 指令。
+ */
+
+const uint32_t TRACE_RINGBUF_SIZE = 1 << 20;    // ring buffer 大小（2 的幂，页对齐）
+
+// 内核 TCP 状态编号 (include/net/tcp_states.h)
+enum KernelTcpState {
+    K_TCP_ESTABLISHED = 1, K_TCP_SYN_SENT, K_TCP_SYN_RECV, K_TCP_FIN_WAIT1,
+    K_TCP_FIN_WAIT2, K_TCP_TIME_WAIT, K_TCP_CLOSE, K_TCP_CLOSE_WAIT,
+    K_TCP_LAST_ACK, K_TCP_LISTEN, K_TCP_CLOSING, K_TCP_NEW_SYN_RECV
+};
+
+// BPF 程序写入 ring buffer 的事件（布局由 build_trace_program 生成的指令决定）
+struct TraceEvent {
+    uint32_t kind;          // TRACE_STATE_CHANGE / TRACE_RETRANSMIT
+    int32_t old_state;      // 旧状态（重传事件为当前状态）
+    int32_t new_state;      // 新状态（重传事件为当前状态）
+    uint32_t saddr;         // 本端 IP（网络字节序）
+    uint32_t daddr;         // 对端 IP（网络字节序）
+    uint16_t sport;         // 本端端口（主机字节序）
+    uint16_t dport;         // 对端端口（主机字节序）
+    uint64_t skaddr;        // 内核 socket 地址，仅用于区分
+};
+
+enum TraceEventKind {
+    TRACE_STATE_CHANGE = 1,
+    TRACE_RETRANSMIT = 2
+};
+
+// tracepoint 记录中一个字段的位置
+struct TraceField {
+    int offset;
+    int size;
+};
+
+/*
+ * 查找 tracefs 挂载点
+ */
+std::string find_tracefs() {
+    const char* candidates[] = {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+    for (const char* dir : candidates) {
+        std::string probe = std::string(dir) + "/events";
+        if (access(probe.c_str(), F_OK) == 0) {
+            return dir;
+        }
     }
+    return "";
+}
 
-    const char* interface = argv[1];
+/*
+ * 读取 tracepoint 的 ID 和各字段偏移
+ *
+ * format 文件中的字段行形如：
+ *   field:__u16 sport;	offset:24;	size:2;	signed:0;
+ */
+bool read_trace_format(const std::string& event_dir, int& id,
+                       std::map<std::string, TraceField>& fields) {
+    FILE* f = fopen((event_dir + "/id").c_str(), "r");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fscanf(f, "%d", &id) == 1;
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
 
-    // 记录程序启动时间
-    start_time = get_timestamp();
+    f = fopen((event_dir + "/format").c_str(), "r");
+    if (f == NULL) {
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char* field = strstr(line, "field:");
+        char* semi = field ? strchr(field, ';') : NULL;
+        char* off = strstr(line, "offset:");
+        char* size = strstr(line, "size:");
+        if (field == NULL || semi == NULL || off == NULL || size == NULL) {
+            continue;
+        }
+        // 字段名是分号前的最后一个单词，去掉数组下标
+        std::string decl(field + 6, semi);
+        size_t bracket = decl.find('[');
+        if (bracket != std::string::npos) {
+            decl.erase(bracket);
+        }
+        size_t space = decl.find_last_of(" *");
+        std::string name = space == std::string::npos ? decl : decl.substr(space + 1);
 
-    printf("====================================================\n");
-    printf("      TCP 协议分析器 - 有状态连接跟踪器\n");
-    printf("====================================================\n");
-    printf("监听接口: %s\n", interface);
-    printf("开始时间: %.3f\n", start_time);
-    printf("====================================================\n\n");
+        TraceField tf;
+        tf.offset = atoi(off + 7);
+        tf.size = atoi(size + 5);
+        fields[name] = tf;
+    }
+    fclose(f);
+    return true;
+}
 
-    /*
-     * 创建原始套接字 (Raw Socket)
-     *
-     * AF_PACKET: 工作在数据链路层，可以捕获所有以太网帧
-     * SOCK_RAW: 原始套接字，获取完整的数据包（包括头部）
-     * htons(ETH_P_ALL): 捕获所有协议类型的数据包
-     */
-    int sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-    if (sock < 0) {
-        perror("创建套接字失败 (需要 root 权限)");
-        return 1;
+/*
+ * 字段大小对应的 BPF 访存宽度
+ */
+uint8_t bpf_size_of(int size) {
+    switch (size) {
+        case 1:  return BPF_B;
+        case 2:  return BPF_H;
+        case 4:  return BPF_W;
+        default: return BPF_DW;
     }
+}
 
-    /*
-     * 绑定到特定的网络接口
-     *
-     * 如果不绑定，会接收所有接口的数据包
-     */
-    struct ifreq ifr;
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+/*
+ * 生成 tracepoint 程序：过滤 IPv4 TCP，压缩为 TraceEvent 写入 ring buffer
+ *
+ * 等价的 C 代码（以 inet_sock_set_state 为例）：
+ *   if (ctx->family != AF_INET || ctx->protocol != IPPROTO_TCP) return 0;
+ *   struct TraceEvent e = {kind, ctx->oldstate, ctx->newstate, ctx->saddr, ...};
+ *   if (bpf_ringbuf_output(&events, &e, sizeof(e), 0) < 0)
+ *       __sync_fetch_and_add(&drops[0], 1);
+ *   return 0;
+ *
+ * tracepoint 上下文只允许按字段宽度对齐访问，所以地址按字节逐个复制
+ */
+std::vector<struct bpf_insn> build_trace_program(uint32_t kind,
+                                                  std::map<std::string, TraceField>& f,
+                                                  int ringbuf_fd, int drops_fd) {
+    std::vector<struct bpf_insn> p;
+    const int ev = -(int)sizeof(TraceEvent);   // 事件在栈上的位置
+    std::vector<size_t> exits;                 // 需要回填到 out 的跳转
 
-    // 获取接口索引
-    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
-        perror("获取接口索引失败");
-        close(sock);
-        return 1;
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));   // r6 = ctx
+
+    // 过滤：只要 IPv4（inet_sock_set_state 还要求是 TCP，不要 SCTP/MPTCP）
+    p.push_back(make_insn(BPF_LDX | BPF_MEM | bpf_size_of(f["family"].size), 0, 6, f["family"].offset, 0));
+    exits.push_back(p.size());
+    p.push_back(make_insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 0, AF_INET));
+    if (f.count("protocol")) {
+        p.push_back(make_insn(BPF_LDX | BPF_MEM | bpf_size_of(f["protocol"].size), 0, 6, f["protocol"].offset, 0));
+        exits.push_back(p.size());
+        p.push_back(make_insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 0, IPPROTO_TCP));
     }
 
-    // 绑定套接字到接口
-    struct sockaddr_ll sll;
-    memset(&sll, 0, sizeof(sll));
-    sll.sll_family = AF_PACKET;
-    sll.sll_ifindex = ifr.ifr_ifindex;
-    sll.sll_protocol = htons(ETH_P_ALL);
+    // 填充栈上的 TraceEvent
+    p.push_back(make_insn(BPF_ST | BPF_MEM | BPF_W, 10, 0, ev + (int)offsetof(TraceEvent, kind), kind));
+    const char* old_name = f.count("oldstate") ? "oldstate" : "state";
+    const char* new_name = f.count("newstate") ? "newstate" : "state";
+    p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_W, 0, 6, f[old_name].offset, 0));
+    p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_W, 10, 0, ev + (int)offsetof(TraceEvent, old_state), 0));
+    p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_W, 0, 6, f[new_name].offset, 0));
+    p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_W, 10, 0, ev + (int)offsetof(TraceEvent, new_state), 0));
+    for (int i = 0; i < 4; i++) {
+        p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_B, 0, 6, f["saddr"].offset + i, 0));
+        p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_B, 10, 0, ev + (int)offsetof(TraceEvent, saddr) + i, 0));
+        p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_B, 0, 6, f["daddr"].offset + i, 0));
+        p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_B, 10, 0, ev + (int)offsetof(TraceEvent, daddr) + i, 0));
+    }
+    p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_H, 0, 6, f["sport"].offset, 0));
+    p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_H, 10, 0, ev + (int)offsetof(TraceEvent, sport), 0));
+    p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_H, 0, 6, f["dport"].offset, 0));
+    p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_H, 10, 0, ev + (int)offsetof(TraceEvent, dport), 0));
+    p.push_back(make_insn(BPF_LDX | BPF_MEM | BPF_DW, 0, 6, f["skaddr"].offset, 0));
+    p.push_back(make_insn(BPF_STX | BPF_MEM | BPF_DW, 10, 0, ev + (int)offsetof(TraceEvent, skaddr), 0));
 
-    if (bind(sock, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
-        perror("绑定套接字失败");
-        close(sock);
+    // bpf_ringbuf_output(&events, &e, sizeof(e), 0)
+    p.push_back(make_insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, ringbuf_fd));
+    p.push_back(make_insn(0, 0, 0, 0, 0));
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+    p.push_back(make_insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, ev));
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, sizeof(TraceEvent)));
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 0));
+    p.push_back(make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ringbuf_output));
+    exits.push_back(p.size());
+    p.push_back(make_insn(BPF_JMP | BPF_JSGE | BPF_K, 0, 0, 0, 0));   // 写入成功 -> out
+
+    // ring buffer 已满：drops[0] += 1
+    p.push_back(make_insn(BPF_ST | BPF_MEM | BPF_W, 10, 0, ev - 4, 0));
+    p.push_back(make_insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, drops_fd));
+    p.push_back(make_insn(0, 0, 0, 0, 0));
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+    p.push_back(make_insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, ev - 4));
+    p.push_back(make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+    exits.push_back(p.size());
+    p.push_back(make_insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0, 0));
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 1));
+    p.push_back(make_insn(BPF_STX | BPF_ATOMIC | BPF_DW, 0, 1, 0, BPF_ADD));
+
+    // out: return 0
+    size_t out = p.size();
+    p.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0));
+    p.push_back(make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+    for (size_t at : exits) {
+        p[at].off = (int16_t)(out - at - 1);
+    }
+    return p;
+}
+
+/*
+ * 加载 tracepoint 程序并在每个 CPU 上挂载
+ *
+ * 返回值：成功挂载的 perf 事件 fd（关闭即卸载）
+ */
+bool attach_trace_program(const std::string& tracefs, const char* event, uint32_t kind,
+                          int ringbuf_fd, int drops_fd, std::vector<int>& fds) {
+    std::string event_dir = tracefs + "/events/" + event;
+    int id;
+    std::map<std::string, TraceField> fields;
+    if (!read_trace_format(event_dir, id, fields)) {
+        fprintf(stderr, "读取 tracepoint %s 失败: %s\n", event, strerror(errno));
+        return false;
+    }
+
+    std::vector<struct bpf_insn> prog = build_trace_program(kind, fields, ringbuf_fd, drops_fd);
+
+    static char log_buf[65536];
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+    attr.insns = (uint64_t)(unsigned long)prog.data();
+    attr.insn_cnt = prog.size();
+    attr.license = (uint64_t)(unsigned long)"GPL";
+    attr.log_buf = (uint64_t)(unsigned long)log_buf;
+    attr.log_size = sizeof(log_buf);
+    attr.log_level = 1;
+    int prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (prog_fd < 0) {
+        fprintf(stderr, "加载 %s 程序失败: %s\n%s\n", event, strerror(errno), log_buf);
+        return false;
+    }
+    fds.push_back(prog_fd);
+
+    // tracepoint 类型的 perf 事件要求按 CPU 分别打开
+    int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (int cpu = 0; cpu < ncpus; cpu++) {
+        struct perf_event_attr pattr;
+        memset(&pattr, 0, sizeof(pattr));
+        pattr.type = PERF_TYPE_TRACEPOINT;
+        pattr.size = sizeof(pattr);
+        pattr.config = id;
+        pattr.sample_period = 1;
+        int pfd = syscall(__NR_perf_event_open, &pattr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (pfd < 0) {
+            if (errno == ENODEV) {
+                continue;  // 离线的 CPU
+            }
+            fprintf(stderr, "打开 %s 的 perf 事件失败 (CPU %d): %s\n", event, cpu, strerror(errno));
+            return false;
+        }
+        fds.push_back(pfd);
+        if (ioctl(pfd, PERF_EVENT_IOC_SET_BPF, prog_fd) < 0 ||
+            ioctl(pfd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+            fprintf(stderr, "挂载 %s 程序失败: %s\n", event, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * 内核 TCP 状态映射到本程序的 TcpState
+ *
+ * 返回值：false 表示不跟踪（LISTEN / NEW_SYN_RECV 没有确定的对端）
+ */
+bool map_kernel_state(int kstate, TcpState& state) {
+    switch (kstate) {
+        case K_TCP_ESTABLISHED: state = ESTABLISHED; return true;
+        case K_TCP_SYN_SENT:    state = SYN_SENT; return true;
+        case K_TCP_SYN_RECV:    state = SYN_RECEIVED; return true;
+        case K_TCP_FIN_WAIT1:   state = FIN_WAIT_1; return true;
+        case K_TCP_FIN_WAIT2:   state = FIN_WAIT_2; return true;
+        case K_TCP_TIME_WAIT:   state = TIME_WAIT; return true;
+        case K_TCP_CLOSE:       state = CLOSED; return true;
+        case K_TCP_CLOSE_WAIT:  state = CLOSE_WAIT; return true;
+        case K_TCP_LAST_ACK:    state = LAST_ACK; return true;
+        case K_TCP_CLOSING:     state = CLOSING; return true;
+        default:                return false;
+    }
+}
+
+// 内核 socket 地址 -> 连接标识符
+// 主动连接进入 SYN_SENT 时本端端口可能还没分配（为 0），之后的事件才带上真实端口，
+// 按 socket 记住上一次的 key，端口变化时把跟踪表中的记录迁移过去
+std::map<uint64_t, ConnectionID> trace_sockets;
+
+/*
+ * 把一条 tracepoint 事件应用到连接跟踪表
+ */
+void handle_trace_event(const TraceEvent& e) {
+    capture_stats.trace_events++;
+    if (e.dport == 0) {
+        return;  // 监听 socket，没有对端
+    }
+
+    ConnectionID key = make_canonical_id(e.saddr, e.sport, e.daddr, e.dport);
+    std::string src_ip_str = ip_to_string(e.saddr);
+    std::string dst_ip_str = ip_to_string(e.daddr);
+    double timestamp = get_relative_time();
+
+    if (e.kind == TRACE_RETRANSMIT) {
+        capture_stats.retransmits++;
+        auto it = connection_tracker.find(key);
+        if (it != connection_tracker.end()) {
+            int d = (e.saddr == key.src_ip && e.sport == key.src_port) ? 0 : 1;
+            it->second.dir[d].retransmits++;
+            timeline_record(it->second.timeline, TL_RETRANSMIT, d, (uint64_t)(timestamp * 1e6), 0);
+        }
+        TcpState state;
+        log_event("[%.3f] 🟠 重传 (tracepoint): %s:%d -> %s:%d [%s]\n",
+                  timestamp,
+                  src_ip_str.c_str(), e.sport,
+                  dst_ip_str.c_str(), e.dport,
+                  map_kernel_state(e.new_state, state) ? state_to_string(state) : "UNKNOWN");
+        return;
+    }
+
+    TcpState old_state, new_state;
+    if (!map_kernel_state(e.new_state, new_state)) {
+        return;
+    }
+    if (!map_kernel_state(e.old_state, old_state)) {
+        old_state = CLOSED;  // 从 LISTEN 派生出的连接
+    }
+
+    auto sit = trace_sockets.find(e.skaddr);
+    if (sit != trace_sockets.end() && (sit->second < key || key < sit->second)) {
+        auto stale = connection_tracker.find(sit->second);
+        if (stale != connection_tracker.end()) {
+            timeline_release(stale->second.timeline);
+            connection_tracker.erase(stale);
+        }
+    }
+
+    if (new_state == CLOSED) {
+        finish_flow(key);
+        if (sit != trace_sockets.end()) {
+            trace_sockets.erase(sit);
+        }
+    } else {
+        FlowRecord& flow = connection_tracker[key];
+        flow.state = new_state;
+        int d = (e.saddr == key.src_ip && e.sport == key.src_port) ? 0 : 1;
+        timeline_record(flow.timeline, TL_STATE, d, (uint64_t)(timestamp * 1e6), new_state);
+        flow.timeline.last_state = new_state;
+        trace_sockets[e.skaddr] = key;
+    }
+
+    log_event("[%.3f] 🟣 状态变化 (tracepoint): %s:%d -> %s:%d [%s -> %s]\n",
+              timestamp,
+              src_ip_str.c_str(), e.sport,
+              dst_ip_str.c_str(), e.dport,
+              state_to_string(old_state), state_to_string(new_state));
+}
+
+/*
+ * 本机分析模式：从 tracepoint 事件跟踪所有本机 IPv4 TCP 连接
+ */
+int run_trace_capture() {
+    std::string tracefs = find_tracefs();
+    if (tracefs.empty()) {
+        fprintf(stderr, "未找到 tracefs，请先挂载: mount -t tracefs nodev /sys/kernel/tracing\n");
         return 1;
     }
 
-    printf("✅ 套接字创建成功，开始捕获数据包...\n\n");
+    // ==================== 1. 创建 ring buffer 和丢弃计数 ====================
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_RINGBUF;
+    attr.max_entries = TRACE_RINGBUF_SIZE;
+    int ringbuf_fd = sys_bpf(BPF_MAP_CREATE, &attr);
 
-    // 数据包缓冲区 (65536 字节足够容纳最大的以太网帧)
-    unsigned char buffer[65536];
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_ARRAY;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint64_t);
+    attr.max_entries = 1;
+    int drops_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+
+    if (ringbuf_fd < 0 || drops_fd < 0) {
+        perror("创建 BPF map 失败 (需要 root 权限和 Linux 5.8+)");
+        return 1;
+    }
+
+    // ==================== 2. 加载并挂载两个 tracepoint 程序 ====================
+    std::vector<int> fds;
+    if (!attach_trace_program(tracefs, "sock/inet_sock_set_state", TRACE_STATE_CHANGE,
+                              ringbuf_fd, drops_fd, fds) ||
+        !attach_trace_program(tracefs, "tcp/tcp_retransmit_skb", TRACE_RETRANSMIT,
+                              ringbuf_fd, drops_fd, fds)) {
+        for (int fd : fds) {
+            close(fd);
+        }
+        close(ringbuf_fd);
+        close(drops_fd);
+        return 1;
+    }
 
+    // ==================== 3. 映射 ring buffer ====================
     /*
-     * 主循环：持续捕获和处理数据包
+     * 第 1 页: consumer_pos（用户态可写）
+     * 第 2 页: producer_pos（只读），之后是数据区，数据区映射两次，
+     *          跨越末尾的记录也能连续读取
      */
-    while (true) {
-        // 接收一个数据包
-        ssize_t packet_size = recv(sock, buffer, sizeof(buffer), 0);
-        if (packet_size < 0) {
-            perror("接收数据包失败");
+    long page = sysconf(_SC_PAGESIZE);
+    void* consumer_map = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, ringbuf_fd, 0);
+    void* producer_map = mmap(NULL, page + 2 * (size_t)TRACE_RINGBUF_SIZE, PROT_READ,
+                              MAP_SHARED, ringbuf_fd, page);
+    if (consumer_map == MAP_FAILED || producer_map == MAP_FAILED) {
+        perror("映射 ring buffer 失败");
+        return 1;
+    }
+    uint64_t* consumer_pos = (uint64_t*)consumer_map;
+    uint64_t* producer_pos = (uint64_t*)producer_map;
+    const char* data = (const char*)producer_map + page;
+
+    printf("✅ 已挂载 sock:inet_sock_set_state 和 tcp:tcp_retransmit_skb，开始跟踪本机 TCP 连接...\n\n");
+
+    // ==================== 4. 主循环：消费 ring buffer ====================
+
+    while (!stop_requested) {
+        uint64_t cons = *consumer_pos;
+        uint64_t prod = __atomic_load_n(producer_pos, __ATOMIC_ACQUIRE);
+
+        if (cons == prod) {
+            struct pollfd pfd;
+            pfd.fd = ringbuf_fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 200);
+            std::lock_guard<std::mutex> guard(analyzer_lock);
+            periodic_tasks();
             continue;
         }
 
-        // ==================== Layer 2: 解析以太网头部 ====================
-        struct ethhdr* eth = (struct ethhdr*)buffer;
+        // 与包捕获后端一样，每一批事件在 analyzer_lock 下处理（控制套接字线程读取同一份状态）
+        std::lock_guard<std::mutex> guard(analyzer_lock);
+        while (cons < prod) {
+            const uint32_t* header = (const uint32_t*)(data + (cons & (TRACE_RINGBUF_SIZE - 1)));
+            uint32_t len = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+            if (len & BPF_RINGBUF_BUSY_BIT) {
+                break;  // 内核还在写这条记录
+            }
+            uint32_t payload_len = len & ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+            if (!(len & BPF_RINGBUF_DISCARD_BIT) && payload_len >= sizeof(TraceEvent)) {
+                TraceEvent e;
+                memcpy(&e, (const char*)header + BPF_RINGBUF_HDR_SZ, sizeof(e));
+                capture_stats.packets++;
+                handle_trace_event(e);
+            }
+            cons += (payload_len + BPF_RINGBUF_HDR_SZ + 7) & ~7ULL;
+            __atomic_store_n(consumer_pos, cons, __ATOMIC_RELEASE);
+        }
+
+        periodic_tasks();
+    }
+
+    // ring buffer 满时 BPF 程序计入的丢弃数
+    uint32_t key = 0;
+    uint64_t drops = 0;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = drops_fd;
+    attr.key = (uint64_t)(unsigned long)&key;
+    attr.value = (uint64_t)(unsigned long)&drops;
+    if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) == 0) {
+        std::lock_guard<std::mutex> guard(analyzer_lock);
+        capture_stats.kernel_drops += drops;
+    }
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    munmap(consumer_map, page);
+    munmap(producer_map, page + 2 * (size_t)TRACE_RINGBUF_SIZE);
+    close(ringbuf_fd);
+    close(drops_fd);
+    return 0;
+}
+
+// ======================== 主程序 ========================
+
+void print_usage(const char* prog) {
+    std::cerr << "用法: sudo " << prog << " [-b packet|xdp] [-Q 队列号] [-M auto|native|generic] [-q]\n"
+              << "            [-S 最大采样率] [-P 秒] [-H 文件] [-C] [-T] [-U 套接字路径] [-D]\n"
+              << "            [-E 采集器IP:端口 [-A 秒] [-I 秒] [-R 消息数]] <网络接口名>...\n";
+    std::cerr << "      sudo " << prog << " -b trace [-q]\n";
+    std::cerr << "  -b  捕获后端: packet = AF_PACKET (默认), xdp = AF_XDP,\n";
+    std::cerr << "      trace = 本机分析，从内核 tracepoint 获取精确状态变化（不需要接口名）\n";
+    std::cerr << "  -Q  AF_XDP 绑定的网卡队列号 (默认 0)\n";
+    std::cerr << "  -M  XDP 挂载模式: auto (默认，先原生后通用), native, generic\n";
+    std::cerr << "  -q  安静模式: 不打印逐个事件，每秒打印吞吐 (用于性能对比)\n";
+    std::cerr << "  -S  过载时按流采样的最大采样率 N (2 的幂，默认 1024；1 表示关闭采样)\n";
+    std::cerr << "  -P  每隔多少秒打印一次按服务端 (IP, 端口) 聚合的延迟统计 (默认 0: 只在退出时打印累计)\n";
+    std::cerr << "  -H  把每个周期的服务延迟直方图以 JSON 行追加到文件 (未指定 -P 时周期为 10 秒)\n";
+    std::cerr << "  -C  验证 IP / TCP 校验和，丢弃校验和错误的帧 (网卡已验证的包跳过)\n";
+    std::cerr << "  -T  连接结束时打印事件时间线 (状态变化、重传、窗口事件；运行中 kill -USR1 导出所有连接)\n";
+    std::cerr << "  -U  在 Unix 套接字上接受流查询 (如 echo 'port=25 state=SYN_SENT' | socat - UNIX-CONNECT:路径)\n";
+    std::cerr << "  -D  DNS 分析: 解析 UDP/TCP 53 端口的报文，配对查询与响应，按服务端和域名统计延迟、NXDOMAIN 和超时\n";
+    std::cerr << "  -E  以 IPFIX 格式把流记录通过 UDP 导出到采集器\n";
+    std::cerr << "  -A  活跃超时: 长连接每隔多少秒导出一次增量 (默认 60)\n";
+    std::cerr << "  -I  不活跃超时: 多少秒没有包即导出并删除连接 (默认 15)\n";
+    std::cerr << "  -R  每秒最多发送的 IPFIX 消息数 (默认 1000，0 表示不限)\n";
+    std::cerr << "例如: sudo " << prog << " eth0\n";
+    std::cerr << "      sudo " << prog << " wlan0\n";
+    std::cerr << "      sudo " << prog << " -b xdp -M generic -q veth0\n";
+    std::cerr << "      sudo " << prog << " -E 127.0.0.1:4739 eth0\n";
+    std::cerr << "      sudo " << prog << " eth0 eth1   # 多个接口：非对称路径合并到同一个连接\n";
+}
+
+int main(int argc, char* argv[]) {
+    bool use_xdp = false;
+    bool use_trace = false;
+    uint32_t queue_id = 0;
+    XdpAttachMode xdp_mode = XDP_ATTACH_AUTO;
+    const char* collector = NULL;
+    const char* service_json = NULL;
+    const char* control_path = NULL;
+    ipfix.active_timeout = 60;
+    ipfix.inactive_timeout = 15;
+    ipfix.max_messages_per_sec = 1000;
 
-        // 检查是否为 IPv4 数据包 (EtherType = 0x0800)
-        if (ntohs(eth->h_proto) != 0x0800) {
-            continue;  // 跳过非 IPv4 数据包（如 ARP, IPv6 等）
+    // 解析命令行参数
+    int opt;
+    while ((opt = getopt(argc, argv, "b:Q:M:qS:P:H:E:A:I:R:CTU:Dh")) != -1) {
+        switch (opt) {
+            case 'b':
+                if (strcmp(optarg, "xdp") == 0) {
+                    use_xdp = true;
+                } else if (strcmp(optarg, "trace") == 0) {
+                    use_trace = true;
+                } else if (strcmp(optarg, "packet") != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'Q': queue_id = atoi(optarg); break;
+            case 'M':
+                if (strcmp(optarg, "native") == 0) {
+                    xdp_mode = XDP_ATTACH_NATIVE;
+                } else if (strcmp(optarg, "generic") == 0) {
+                    xdp_mode = XDP_ATTACH_GENERIC;
+                } else if (strcmp(optarg, "auto") != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'q': quiet_mode = true; break;
+            case 'S':
+                // 向下取整到 2 的幂，保证不同采样率选中的流互为子集
+                overload.max_sample_rate = 1;
+                while (overload.max_sample_rate * 2 <= (uint32_t)std::max(atoi(optarg), 1)) {
+                    overload.max_sample_rate *= 2;
+                }
+                break;
+            case 'P': service_reporter.interval = atof(optarg); break;
+            case 'H': service_json = optarg; break;
+            case 'E': collector = optarg; break;
+            case 'A': ipfix.active_timeout = atof(optarg); break;
+            case 'I': ipfix.inactive_timeout = atof(optarg); break;
+            case 'R': ipfix.max_messages_per_sec = atoi(optarg); break;
+            case 'C': checksum.enabled = true; break;
+            case 'T': show_timeline = true; break;
+            case 'U': control_path = optarg; break;
+            case 'D': dns.enabled = true; break;
+            default:
+                print_usage(argv[0]);
+                return 1;
         }
+    }
 
-        // ==================== Layer 3: 解析 IP 头部 ====================
-        struct iphdr* ip = (struct iphdr*)(buffer + sizeof(struct ethhdr));
+    // 检查命令行参数
+    if (optind >= argc && !use_trace) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // tracepoint 后端没有逐包计数，连接也不会因为没有包而结束
+    if (collector != NULL && use_trace) {
+        fprintf(stderr, "IPFIX 导出需要报文捕获后端 (packet 或 xdp)\n");
+        return 1;
+    }
+    if (checksum.enabled && use_trace) {
+        fprintf(stderr, "校验和验证需要报文捕获后端 (packet 或 xdp)\n");
+        return 1;
+    }
+    if (dns.enabled && use_trace) {
+        fprintf(stderr, "DNS 分析需要报文捕获后端 (packet 或 xdp)\n");
+        return 1;
+    }
+    if (collector != NULL && !ipfix_open(collector)) {
+        return 1;
+    }
+    if (service_json != NULL) {
+        service_reporter.json = fopen(service_json, "a");
+        if (service_reporter.json == NULL) {
+            perror("打开服务统计文件失败");
+            return 1;
+        }
+        if (service_reporter.interval <= 0) {
+            service_reporter.interval = 10;
+        }
+    }
 
-        // 检查是否为 TCP 数据包 (Protocol = 6)
-        if (ip->protocol != 6) {
-            continue;  // 跳过非 TCP 数据包（如 UDP, ICMP 等）
+    /*
+     * 每个接口名对应一个捕获线程
+     * 先解析出所有接口索引，有错误时在启动任何线程之前退出
+     */
+    std::string interface_list = use_trace ? "(本机)" : "";
+    if (!use_trace) {
+        capture_interfaces.resize(argc - optind);
+        for (int i = optind; i < argc; i++) {
+            CaptureInterface& cap = capture_interfaces[i - optind];
+            cap.name = argv[i];
+            cap.ifindex = get_ifindex(argv[i]);
+            if (cap.ifindex == 0) {
+                return 1;
+            }
+            for (int j = optind; j < i; j++) {
+                if (capture_interfaces[j - optind].ifindex == cap.ifindex) {
+                    fprintf(stderr, "接口 %s 重复指定\n", argv[i]);
+                    return 1;
+                }
+            }
+            interface_list += (i == optind ? "" : ", ") + cap.name;
         }
+    }
 
-        // ==================== Layer 4: 解析 TCP 头部 ====================
+    double checksum_gbps = checksum.enabled ? checksum_init() : 0.0;
 
-        /*
-         * 计算 TCP 头部的偏移量
-         *
-         * TCP 头部位置 = 以太网头部 + IP 头部
-         * IP 头部长度 = ip->ihl * 4 (ihl 以 4 字节为单位)
-         */
-        int ip_header_len = ip->ihl * 4;
-        struct tcphdr* tcp = (struct tcphdr*)(buffer + sizeof(struct ethhdr) + ip_header_len);
+    // 记录程序启动时间
+    start_time = get_timestamp();
+
+    printf("====================================================\n");
+    printf("      TCP 协议分析器 - 有状态连接跟踪器\n");
+    printf("====================================================\n");
+    printf("监听接口: %s\n", interface_list.c_str());
+    printf("捕获后端: %s\n", use_trace ? "eBPF tracepoint" : use_xdp ? "AF_XDP" : "AF_PACKET");
+    if (checksum.enabled) {
+        printf("校验和:   验证 IP / TCP (%s, %.1f GB/s)\n", checksum.impl, checksum_gbps);
+    }
+    if (dns.enabled) {
+        printf("DNS 分析: UDP/TCP 53 端口, 查询超时 %.0f s\n", DNS_TIMEOUT_SEC);
+    }
+    printf("开始时间: %.3f\n", start_time);
+    printf("====================================================\n\n");
+
+    // 分片重组表一次性分配，运行中不再申请内存
+    frag_table = new FragmentSlot[FRAG_SLOTS]();
+    if (dns.enabled) {
+        dns.pending = new DnsPending[DNS_PENDING_SLOTS]();
+        dns.names = new DnsNameStats[DNS_NAME_SLOTS + 1]();
+        dns.names[DNS_NAME_OTHER].in_use = true;
+        strcpy(dns.names[DNS_NAME_OTHER].name, "(其他)");
+    }
 
-        // 提取连接信息
-        uint32_t src_ip = ip->saddr;
-        uint32_t dst_ip = ip->daddr;
-        uint16_t src_port = tcp->source;
-        uint16_t dst_port = tcp->dest;
+    // 在启动其他线程之前创建，失败时可以直接退出
+    if (control_path != NULL) {
+        if (!control_start(control_path)) {
+            return 1;
+        }
+        printf("🔎 流查询: 在 %s 上接受查询 (发送 help 查看语法)\n\n", control_path);
+    }
+    if (ipfix.enabled) {
+        ipfix_start();
+    }
 
-        /*
-         * 计算 TCP 数据部分的长度
-         *
-         * TCP 数据长度 = IP 总长度 - IP 头部长度 - TCP 头部长度
-         * TCP 头部长度 = tcp->doff * 4 (doff 以 4 字节为单位)
-         */
-        int tcp_header_len = tcp->doff * 4;
-        int ip_total_len = ntohs(ip->tot_len);
-        int tcp_data_len = ip_total_len - ip_header_len - tcp_header_len;
+    // Ctrl+C 退出时打印统计
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+    signal(SIGUSR1, handle_timeline_signal);
 
-        // ==================== 连接规范化 ====================
-        /*
-         * 将 (src, dst) 规范化为统一的连接标识符
-         * 这样无论数据包方向如何，都能映射到同一个连接记录
-         */
-        ConnectionID key = make_canonical_id(src_ip, ntohs(src_port),
-                                             dst_ip, ntohs(dst_port));
+    int ret = 0;
+    if (use_trace) {
+        ret = run_trace_capture();
+    } else {
+        // 任一接口启动失败时通知其他线程一起退出
+        for (size_t i = 0; i < capture_interfaces.size(); i++) {
+            CaptureInterface* cap = &capture_interfaces[i];
+            cap->thread = std::thread([cap, use_xdp, queue_id, xdp_mode]() {
+                cap->result = use_xdp ? run_xdp_capture(*cap, queue_id, xdp_mode)
+                                      : run_packet_capture(*cap);
+                if (cap->result != 0) {
+                    stop_requested = 1;
+                }
+            });
+        }
+        for (size_t i = 0; i < capture_interfaces.size(); i++) {
+            capture_interfaces[i].thread.join();
+            if (capture_interfaces[i].result != 0) {
+                ret = capture_interfaces[i].result;
+            }
+        }
+    }
 
-        // ==================== 状态机处理 ====================
-        /*
-         * 调用状态机处理函数
-         * 根据当前状态和 TCP 标志位，更新连接状态并输出事件信息
-         */
-        process_tcp_packet(key, tcp, src_ip, dst_ip, src_port, dst_port, tcp_data_len);
+    size_t tracked = connection_tracker.size();
+    if (control.enabled) {
+        control_shutdown();
+    }
+    if (ipfix.enabled) {
+        ipfix_shutdown();
+    }
+    service_report(true);
+    if (service_reporter.json != NULL) {
+        fclose(service_reporter.json);
+    }
+    if (dns.enabled) {
+        dns_expire_pending(get_timestamp(), true);
+        dns_print_report(" (累计)");
     }
 
-    // 关闭套接字（实际上这里永远不会执行，因为是无限循环）
-    close(sock);
-    return 0;
+    double elapsed = get_relative_time();
+    printf("\n====================================================\n");
+    printf("捕获帧数:   %llu (%llu 字节)\n", capture_stats.packets, capture_stats.bytes);
+    printf("TCP 段数:   %llu\n", capture_stats.tcp_packets);
+    if (use_trace) {
+        printf("内核事件:   %llu (重传 %llu)\n", capture_stats.trace_events, capture_stats.retransmits);
+    }
+    printf("内核丢弃:   %llu\n", capture_stats.kernel_drops);
+    for (size_t i = 0; i < capture_interfaces.size() && capture_interfaces.size() > 1; i++) {
+        const CaptureInterface& cap = capture_interfaces[i];
+        printf("  %-8s  %llu 帧 (%llu 字节), TCP 段 %llu, 内核丢弃 %llu", cap.name.c_str(),
+               cap.packets, cap.bytes, cap.tcp_packets, cap.kernel_drops);
+        if (checksum.enabled) {
+            printf(", 校验和错误 IP %llu / TCP %llu", cap.bad_ip_checksums, cap.bad_tcp_checksums);
+        }
+        printf("\n");
+    }
+    printf("IP 分片:    %llu (重组 %llu, 超时 %llu, 淘汰 %llu, 无效 %llu)\n",
+           frag_stats.fragments, frag_stats.reassembled, frag_stats.timeouts,
+           frag_stats.evicted, frag_stats.invalid);
+    if (overload.rate_changes > 0 || overload.sampled_out > 0) {
+        printf("过载采样:   跳过 %llu 个 TCP 段, 调整采样率 %llu 次, 当前 1/%u\n",
+               overload.sampled_out, overload.rate_changes, overload.sample_rate);
+        printf("新连接:     跟踪 %llu 个, 按采样率估计共 %llu 个\n",
+               overload.admitted_flows, overload.estimated_flows);
+    }
+    if (checksum.enabled) {
+        printf("校验和:     验证 IP 头部 %llu / TCP 段 %llu, 卸载跳过 %llu, 截断未验证 %llu\n",
+               checksum.ip_verified, checksum.tcp_verified, checksum.offloaded, checksum.unverifiable);
+        printf("校验和错误: IP 头部 %llu, TCP %llu (已丢弃)\n", checksum.bad_ip, checksum.bad_tcp);
+    }
+    printf("平均速率:   %.3f Mpps\n", elapsed > 0 ? capture_stats.packets / elapsed / 1e6 : 0.0);
+    printf("跟踪连接:   %zu\n", tracked);
+    if (ipfix.enabled) {
+        printf("IPFIX 导出: %llu 条记录 / %llu 个消息 (含模板 %llu), 队列丢弃 %llu, 发送失败 %llu 个消息\n",
+               ipfix.records_sent, ipfix.messages_sent, ipfix.templates_sent,
+               ipfix.records_dropped, ipfix.send_errors);
+    }
+    if (dns.enabled) {
+        printf("DNS 消息:   %llu (TCP %llu, 跨段 %llu), 格式错误 %llu, 截断响应 %llu\n",
+               dns.messages, dns.tcp_messages, dns.tcp_split, dns.malformed, dns.truncated);
+        int in_flight = 0;
+        for (int i = 0; i < DNS_PENDING_SLOTS; i++) {
+            in_flight += dns.pending[i].in_use;
+        }
+        printf("DNS 配对:   查询 %llu, 响应 %llu, 超时 %llu, 未到超时 %d, 待响应表溢出 %llu, 服务端表溢出 %llu\n",
+               dns.queries, dns.responses, dns.timeouts, in_flight, dns.overflow, dns.server_overflow);
+    }
+    printf("====================================================\n");
+    return ret;
 }
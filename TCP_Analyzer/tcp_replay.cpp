@@ -0,0 +1,743 @@
+/*
+ * TCP 报文回放器 - 通过 AF_PACKET TX 环高速回放 pcap 文件
+ *
+ * 功能：把抓包文件中的以太网帧按原始时间间隔（可加速）或最高速度从指定接口发出，
+ *       可改写 MAC / IPv4 地址，用于对聊天室、邮件服务器重现生产流量
+ * 平台：Linux (AF_PACKET + PACKET_TX_RING)
+ * 编译：g++ -O2 -o tcp_replay tcp_replay.cpp
+ * 运行：sudo ./tcp_replay [-x 倍速 | -T] [-n 次数] [-M MAC] [-D MAC] [-r 旧IP=新IP]... <pcap 文件> <接口>
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+
+// ======================== pcap 文件格式 ========================
+
+/*
+ * pcap 文件 = 全局头部 + 若干 (记录头部 + 帧数据)
+ *
+ * magic 决定字节序和时间戳精度：
+ * - 0xa1b2c3d4: 微秒时间戳     0xa1b23c4d: 纳秒时间戳
+ * - 读出来是反序的值，说明文件由另一种字节序的机器写入，所有字段都要字节交换
+ */
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;      // 1 = 以太网
+};
+
+struct PcapRecordHeader {
+    uint32_t ts_sec;
+    uint32_t ts_frac;       // 微秒或纳秒
+    uint32_t incl_len;      // 文件中保存的长度
+    uint32_t orig_len;      // 线路上的原始长度
+};
+
+const uint32_t PCAP_MAGIC_US = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+const uint32_t LINKTYPE_ETHERNET = 1;
+
+/*
+ * 一个待发送的帧（指向 mmap 的文件内容，不复制）
+ */
+struct ReplayPacket {
+    const unsigned char* data;
+    uint32_t len;
+    uint64_t ts_ns;         // 相对第一个帧的时间（纳秒）
+};
+
+// ======================== 配置与统计 ========================
+
+/*
+ * IP 地址改写规则（网络字节序）
+ */
+struct IpRewrite {
+    uint32_t from;
+    uint32_t to;
+};
+
+struct ReplayConfig {
+    double speed;                   // 倍速，1.0 = 原始时间间隔
+    bool top_speed;                 // 忽略时间戳，尽快发送
+    int loops;                      // 回放次数
+    bool rewrite_src_mac;
+    bool rewrite_dst_mac;
+    unsigned char src_mac[6];
+    unsigned char dst_mac[6];
+    std::vector<IpRewrite> ip_rewrites;
+    bool qdisc_bypass;              // PACKET_QDISC_BYPASS：跳过流量控制层
+};
+
+struct ReplayStats {
+    unsigned long long packets;         // 交给内核的帧数
+    unsigned long long bytes;
+    unsigned long long skipped;         // 超过接口 MTU 而跳过的帧
+    unsigned long long rewritten;       // 改写过 IP 地址的帧
+    unsigned long long send_errors;     // send() 失败次数
+    unsigned long long ring_full;       // 等待空闲帧的次数（环满）
+    // 定时模式：每个帧相对计划时间的延迟（秒）。平均和最大值按全部帧精确统计，
+    // 分位数取自固定大小的蓄水池样本，-n 回放很多次时内存不随帧数增长
+    std::vector<double> lateness;       // 蓄水池样本，最多 LATENESS_SAMPLES 个
+    unsigned long long lateness_count;
+    double lateness_sum;
+    double lateness_max;
+};
+
+const size_t LATENESS_SAMPLES = 1000000;
+
+ReplayStats stats;
+volatile sig_atomic_t stop_requested = 0;
+
+void handle_stop_signal(int) {
+    stop_requested = 1;
+}
+
+/*
+ * 单调时钟（纳秒）
+ */
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ======================== 读取 pcap ========================
+
+/*
+ * mmap 整个 pcap 文件并建立帧索引
+ *
+ * 返回值：文件映射的起始地址（失败返回 NULL），map_len 返回映射长度
+ */
+const unsigned char* load_pcap(const char* path, std::vector<ReplayPacket>& packets, size_t& map_len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("打开 pcap 文件失败");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(PcapFileHeader)) {
+        fprintf(stderr, "pcap 文件太短\n");
+        close(fd);
+        return NULL;
+    }
+    map_len = st.st_size;
+    void* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("映射 pcap 文件失败");
+        return NULL;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+    const unsigned char* base = (const unsigned char*)map;
+
+    PcapFileHeader header;
+    memcpy(&header, base, sizeof(header));
+    bool swapped = false;
+    bool nanosecond = false;
+    if (header.magic == PCAP_MAGIC_US || header.magic == PCAP_MAGIC_NS) {
+        nanosecond = header.magic == PCAP_MAGIC_NS;
+    } else if (header.magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+               header.magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+        swapped = true;
+        nanosecond = header.magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    } else {
+        fprintf(stderr, "不是 pcap 文件 (magic 0x%08x；pcapng 需先用 editcap -F pcap 转换)\n", header.magic);
+        munmap(map, map_len);
+        return NULL;
+    }
+    uint32_t linktype = swapped ? __builtin_bswap32(header.linktype) : header.linktype;
+    if ((linktype & 0xffff) != LINKTYPE_ETHERNET) {
+        fprintf(stderr, "只支持以太网链路类型 (文件为 %u)\n", linktype);
+        munmap(map, map_len);
+        return NULL;
+    }
+
+    size_t pos = sizeof(PcapFileHeader);
+    uint64_t first_ts = 0;
+    while (pos + sizeof(PcapRecordHeader) <= map_len) {
+        PcapRecordHeader rec;
+        memcpy(&rec, base + pos, sizeof(rec));
+        if (swapped) {
+            rec.ts_sec = __builtin_bswap32(rec.ts_sec);
+            rec.ts_frac = __builtin_bswap32(rec.ts_frac);
+            rec.incl_len = __builtin_bswap32(rec.incl_len);
+        }
+        pos += sizeof(rec);
+        if (rec.incl_len > map_len - pos) {
+            fprintf(stderr, "⚠️  第 %zu 个帧被截断，忽略文件剩余部分\n", packets.size() + 1);
+            break;
+        }
+        uint64_t ts = (uint64_t)rec.ts_sec * 1000000000ULL +
+                      (nanosecond ? rec.ts_frac : (uint64_t)rec.ts_frac * 1000);
+        if (packets.empty()) {
+            first_ts = ts;
+        }
+        ReplayPacket p;
+        p.data = base + pos;
+        p.len = rec.incl_len;
+        // 时间戳回退（多队列抓包常见）时按同一时刻发送
+        p.ts_ns = ts > first_ts ? ts - first_ts : 0;
+        if (!packets.empty() && p.ts_ns < packets.back().ts_ns) {
+            p.ts_ns = packets.back().ts_ns;
+        }
+        packets.push_back(p);
+        pos += rec.incl_len;
+    }
+    return base;
+}
+
+// ======================== 地址改写 ========================
+
+/*
+ * 解析 "aa:bb:cc:dd:ee:ff"
+ */
+bool parse_mac(const char* text, unsigned char mac[6]) {
+    unsigned int b[6];
+    if (sscanf(text, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        if (b[i] > 0xff) {
+            return false;
+        }
+        mac[i] = b[i];
+    }
+    return true;
+}
+
+/*
+ * 增量更新 16 位反码校验和 (RFC 1624)：一个 32 位字段从 old_value 改为 new_value
+ */
+uint16_t checksum_adjust(uint16_t checksum, uint32_t old_value, uint32_t new_value) {
+    uint32_t sum = (uint16_t)~checksum;
+    sum += (uint16_t)~(old_value >> 16) + (uint16_t)~(old_value & 0xffff);
+    sum += (new_value >> 16) + (new_value & 0xffff);
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/*
+ * 改写帧中的 IPv4 地址，增量更新 IP 头部和 TCP/UDP 校验和（校验和都是按网络字节序计算的）
+ *
+ * 返回值：是否改写了地址
+ */
+bool rewrite_ipv4(unsigned char* frame, uint32_t len, const std::vector<IpRewrite>& rules) {
+    uint32_t offset = sizeof(struct ethhdr);
+    if (len < offset) {
+        return false;
+    }
+    uint16_t proto = ntohs(((struct ethhdr*)frame)->h_proto);
+    if (proto == ETH_P_8021Q && len >= offset + 4) {
+        proto = ntohs(*(uint16_t*)(frame + offset + 2));
+        offset += 4;
+    }
+    if (proto != ETH_P_IP || len < offset + sizeof(struct iphdr)) {
+        return false;
+    }
+
+    struct iphdr* ip = (struct iphdr*)(frame + offset);
+    uint32_t ip_header_len = ip->ihl * 4;
+    uint16_t* l4_check = NULL;
+    bool first_fragment = (ntohs(ip->frag_off) & IP_OFFMASK) == 0;
+    if (first_fragment && ip->protocol == IPPROTO_TCP &&
+        len >= offset + ip_header_len + sizeof(struct tcphdr)) {
+        l4_check = &((struct tcphdr*)(frame + offset + ip_header_len))->check;
+    } else if (first_fragment && ip->protocol == IPPROTO_UDP &&
+               len >= offset + ip_header_len + sizeof(struct udphdr)) {
+        l4_check = &((struct udphdr*)(frame + offset + ip_header_len))->check;
+        if (*l4_check == 0) {
+            l4_check = NULL;    // UDP 校验和为 0 表示未使用
+        }
+    }
+
+    bool changed = false;
+    uint32_t* addrs[2] = {&ip->saddr, &ip->daddr};
+    for (int a = 0; a < 2; a++) {
+        for (size_t i = 0; i < rules.size(); i++) {
+            if (*addrs[a] != rules[i].from) {
+                continue;
+            }
+            uint32_t old_value = ntohl(rules[i].from);
+            uint32_t new_value = ntohl(rules[i].to);
+            ip->check = htons(checksum_adjust(ntohs(ip->check), old_value, new_value));
+            if (l4_check != NULL) {
+                // 伪首部包含源/目的地址，TCP/UDP 校验和也要随之调整
+                *l4_check = htons(checksum_adjust(ntohs(*l4_check), old_value, new_value));
+            }
+            *addrs[a] = rules[i].to;
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+// ======================== TX 环 ========================
+
+/*
+ * PACKET_TX_RING (TPACKET_V2)
+ *
+ * 用户态和内核共享一块环形内存，每个槽位 = tpacket2_hdr + 帧数据：
+ * 1. 用户态找到 tp_status == TP_STATUS_AVAILABLE 的槽位，写入帧，置为 TP_STATUS_SEND_REQUEST
+ * 2. 调用一次 send(sock, NULL, 0)，内核把所有 SEND_REQUEST 的槽位依次发出
+ * 3. 发送完成后内核把槽位改回 TP_STATUS_AVAILABLE
+ * 一次系统调用发送一批帧，帧数据也不需要经过 sendto 的复制路径
+ */
+struct TxRing {
+    int sock;
+    unsigned char* map;
+    size_t map_len;
+    uint32_t frame_size;
+    uint32_t frame_count;
+    uint32_t next;              // 下一个要使用的槽位
+    uint32_t pending;           // 已写入但尚未 send() 的槽位数
+    uint32_t data_offset;       // 帧数据相对槽位起始的偏移
+};
+
+const uint32_t TX_RING_BLOCK_SIZE = 1 << 16;
+const uint32_t TX_RING_FRAMES = 4096;
+const uint32_t TX_BATCH = 64;           // 最高速模式下每批 send() 的帧数
+
+/*
+ * 创建绑定到接口的 TX 环
+ *
+ * 参数：
+ * - max_frame: 最大帧长度，决定槽位大小
+ */
+bool open_tx_ring(TxRing& ring, int ifindex, uint32_t max_frame, bool qdisc_bypass) {
+    ring.sock = socket(AF_PACKET, SOCK_RAW, 0);    // 协议为 0：只发送，不接收
+    if (ring.sock < 0) {
+        perror("创建套接字失败 (需要 root 权限)");
+        return false;
+    }
+
+    int version = TPACKET_V2;
+    if (setsockopt(ring.sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("设置 TPACKET_V2 失败");
+        close(ring.sock);
+        return false;
+    }
+    // 格式错误的帧直接丢弃并继续发送后面的帧，而不是让整个环停下来
+    int loss = 1;
+    setsockopt(ring.sock, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss));
+    if (qdisc_bypass) {
+        int one = 1;
+        if (setsockopt(ring.sock, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0) {
+            perror("设置 PACKET_QDISC_BYPASS 失败");
+        }
+    }
+
+    // 槽位大小：容纳头部 + 最大帧，向上取 2 的幂（需整除块大小）
+    ring.data_offset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+    ring.frame_size = TPACKET_ALIGNMENT;
+    while (ring.frame_size < ring.data_offset + max_frame) {
+        ring.frame_size <<= 1;
+    }
+    uint32_t block_size = std::max(TX_RING_BLOCK_SIZE, ring.frame_size);
+    uint32_t frames_per_block = block_size / ring.frame_size;
+    uint32_t block_count = (TX_RING_FRAMES + frames_per_block - 1) / frames_per_block;
+
+    struct tpacket_req req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_count;
+    req.tp_frame_size = ring.frame_size;
+    req.tp_frame_nr = block_count * frames_per_block;
+    if (setsockopt(ring.sock, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        perror("创建 PACKET_TX_RING 失败");
+        close(ring.sock);
+        return false;
+    }
+    ring.frame_count = req.tp_frame_nr;
+    ring.map_len = (size_t)block_size * block_count;
+    ring.map = (unsigned char*)mmap(NULL, ring.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring.sock, 0);
+    if (ring.map == MAP_FAILED) {
+        perror("映射 TX 环失败");
+        close(ring.sock);
+        return false;
+    }
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(ring.sock, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+        perror("绑定接口失败");
+        munmap(ring.map, ring.map_len);
+        close(ring.sock);
+        return false;
+    }
+    ring.next = 0;
+    ring.pending = 0;
+    return true;
+}
+
+struct tpacket2_hdr* ring_slot(TxRing& ring, uint32_t index) {
+    // 槽位在块内连续排列，块大小是槽位大小的整数倍，所以可以直接按槽位大小寻址
+    return (struct tpacket2_hdr*)(ring.map + (size_t)index * ring.frame_size);
+}
+
+/*
+ * 让内核发送所有已提交的槽位
+ */
+void ring_flush(TxRing& ring) {
+    if (ring.pending == 0) {
+        return;
+    }
+    if (send(ring.sock, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        stats.send_errors++;
+    }
+    ring.pending = 0;
+}
+
+/*
+ * 取下一个空闲槽位；环满时先提交已写入的帧，再等待内核发送完成
+ */
+struct tpacket2_hdr* ring_acquire(TxRing& ring) {
+    struct tpacket2_hdr* slot = ring_slot(ring, ring.next);
+    if (__atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+        stats.ring_full++;
+        ring_flush(ring);
+        while (__atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            if (stop_requested) {
+                return NULL;
+            }
+            struct pollfd pfd;
+            pfd.fd = ring.sock;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, 10);
+        }
+    }
+    return slot;
+}
+
+/*
+ * 提交一个已写入帧的槽位
+ */
+void ring_commit(TxRing& ring, struct tpacket2_hdr* slot, uint32_t len) {
+    slot->tp_len = len;
+    __atomic_store_n(&slot->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    ring.next = (ring.next + 1) % ring.frame_count;
+    ring.pending++;
+}
+
+/*
+ * 等待环中所有帧发送完成
+ */
+void ring_drain(TxRing& ring) {
+    ring_flush(ring);
+    for (uint32_t i = 0; i < ring.frame_count && !stop_requested; i++) {
+        struct tpacket2_hdr* slot = ring_slot(ring, i);
+        int spins = 0;
+        while (__atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE &&
+               !stop_requested && spins++ < 1000) {
+            if (__atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE) == TP_STATUS_SEND_REQUEST) {
+                send(ring.sock, NULL, 0, MSG_DONTWAIT);
+            }
+            usleep(1000);
+        }
+    }
+}
+
+// ======================== 定时 ========================
+
+/*
+ * 等到单调时钟的 deadline（纳秒）
+ *
+ * 距离较远时先 nanosleep 到 deadline 前 SPIN_NS，剩下的忙等，
+ * 把唤醒延迟（通常 50~100 us）从定时误差中去掉
+ */
+const uint64_t SPIN_NS = 100000;
+
+void wait_until(uint64_t deadline) {
+    uint64_t now = now_ns();
+    if (deadline > now + SPIN_NS) {
+        uint64_t sleep_ns = deadline - now - SPIN_NS;
+        struct timespec ts;
+        ts.tv_sec = sleep_ns / 1000000000ULL;
+        ts.tv_nsec = sleep_ns % 1000000000ULL;
+        nanosleep(&ts, NULL);
+    }
+    while (now_ns() < deadline && !stop_requested) {
+    }
+}
+
+/*
+ * 记录一个帧的延迟：前 LATENESS_SAMPLES 个全部保存，之后按蓄水池抽样 (Algorithm R) 替换，
+ * 每个帧进入样本的概率相同
+ */
+void record_lateness(double lateness) {
+    static std::mt19937_64 rng(now_ns());
+    stats.lateness_count++;
+    stats.lateness_sum += lateness;
+    stats.lateness_max = stats.lateness_count == 1 ? lateness : std::max(stats.lateness_max, lateness);
+    if (stats.lateness.size() < LATENESS_SAMPLES) {
+        stats.lateness.push_back(lateness);
+        return;
+    }
+    unsigned long long j = rng() % stats.lateness_count;
+    if (j < LATENESS_SAMPLES) {
+        stats.lateness[j] = lateness;
+    }
+}
+
+double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+// ======================== 主程序 ========================
+
+void print_usage(const char* prog) {
+    std::cerr << "用法: sudo " << prog << " [-x 倍速 | -T] [-n 次数] [-M 源MAC] [-D 目的MAC]"
+              << " [-r 旧IP=新IP]... [-B] <pcap 文件> <网络接口名>\n";
+    std::cerr << "  -x  按原始时间间隔的倍速回放 (默认 1.0；2 表示两倍速)\n";
+    std::cerr << "  -T  忽略时间戳，以最高速度发送\n";
+    std::cerr << "  -n  回放次数 (默认 1)\n";
+    std::cerr << "  -M  把所有帧的源 MAC 改为指定值\n";
+    std::cerr << "  -D  把所有帧的目的 MAC 改为指定值\n";
+    std::cerr << "  -r  把源/目的 IPv4 地址中的 旧IP 改为 新IP (可重复；自动更新校验和)\n";
+    std::cerr << "  -B  绕过 qdisc 直接交给网卡驱动 (PACKET_QDISC_BYPASS，更快但队列满时会丢帧)\n";
+    std::cerr << "例如: sudo " << prog << " -x 10 -D 02:00:00:00:00:02 -r 192.168.1.5=10.0.0.2 mail.pcap veth0\n";
+}
+
+int main(int argc, char* argv[]) {
+    ReplayConfig config;
+    config.speed = 1.0;
+    config.top_speed = false;
+    config.loops = 1;
+    config.rewrite_src_mac = false;
+    config.rewrite_dst_mac = false;
+    config.qdisc_bypass = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "x:Tn:M:D:r:Bh")) != -1) {
+        switch (opt) {
+            case 'x': config.speed = atof(optarg); break;
+            case 'T': config.top_speed = true; break;
+            case 'n': config.loops = atoi(optarg); break;
+            case 'M':
+                if (!parse_mac(optarg, config.src_mac)) {
+                    fprintf(stderr, "无效的 MAC 地址: %s\n", optarg);
+                    return 1;
+                }
+                config.rewrite_src_mac = true;
+                break;
+            case 'D':
+                if (!parse_mac(optarg, config.dst_mac)) {
+                    fprintf(stderr, "无效的 MAC 地址: %s\n", optarg);
+                    return 1;
+                }
+                config.rewrite_dst_mac = true;
+                break;
+            case 'r': {
+                std::string rule = optarg;
+                size_t eq = rule.find('=');
+                IpRewrite r;
+                if (eq == std::string::npos ||
+                    inet_pton(AF_INET, rule.substr(0, eq).c_str(), &r.from) != 1 ||
+                    inet_pton(AF_INET, rule.substr(eq + 1).c_str(), &r.to) != 1) {
+                    fprintf(stderr, "无效的改写规则: %s (应为 旧IP=新IP)\n", optarg);
+                    return 1;
+                }
+                config.ip_rewrites.push_back(r);
+                break;
+            }
+            case 'B': config.qdisc_bypass = true; break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 2 != argc || config.speed <= 0 || config.loops <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char* pcap_path = argv[optind];
+    const char* interface = argv[optind + 1];
+
+    // ==================== 1. 读取 pcap ====================
+    std::vector<ReplayPacket> packets;
+    size_t map_len = 0;
+    const unsigned char* map = load_pcap(pcap_path, packets, map_len);
+    if (map == NULL) {
+        return 1;
+    }
+    if (packets.empty()) {
+        fprintf(stderr, "pcap 文件中没有帧\n");
+        return 1;
+    }
+
+    // ==================== 2. 接口与 TX 环 ====================
+    int ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        perror("获取接口索引失败");
+        return 1;
+    }
+    // 超过接口 MTU 的帧（例如抓包时网卡做了 TSO/GRO 合并）无法发出，跳过
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    uint32_t max_frame = 1514;
+    if (probe >= 0 && ioctl(probe, SIOCGIFMTU, &ifr) == 0) {
+        max_frame = ifr.ifr_mtu + sizeof(struct ethhdr) + 4;    // 允许一个 VLAN 标签
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+
+    TxRing ring;
+    if (!open_tx_ring(ring, ifindex, max_frame, config.qdisc_bypass)) {
+        return 1;
+    }
+
+    uint64_t capture_ns = packets.back().ts_ns;
+    printf("====================================================\n");
+    printf("      TCP 报文回放器 (PACKET_TX_RING)\n");
+    printf("====================================================\n");
+    printf("文件:       %s (%zu 帧, 时长 %.3f s)\n", pcap_path, packets.size(), capture_ns / 1e9);
+    printf("接口:       %s (最大帧 %u 字节)\n", interface, max_frame);
+    printf("TX 环:      %u 个槽位 x %u 字节%s\n", ring.frame_count, ring.frame_size,
+           config.qdisc_bypass ? ", 绕过 qdisc" : "");
+    if (config.top_speed) {
+        printf("速度:       最高速\n");
+    } else {
+        printf("速度:       %.2fx 原始时间间隔\n", config.speed);
+    }
+    printf("回放次数:   %d\n", config.loops);
+    printf("====================================================\n\n");
+
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+
+    // ==================== 3. 发送 ====================
+    if (!config.top_speed) {
+        stats.lateness.reserve(std::min((size_t)packets.size() * config.loops, LATENESS_SAMPLES));
+    }
+    uint64_t start = now_ns();
+    uint64_t loop_offset = 0;      // 前几轮回放占用的时间（纳秒，已按倍速换算）
+
+    for (int loop = 0; loop < config.loops && !stop_requested; loop++) {
+        for (size_t i = 0; i < packets.size() && !stop_requested; i++) {
+            const ReplayPacket& p = packets[i];
+            if (p.len > max_frame || p.len < sizeof(struct ethhdr)) {
+                stats.skipped++;
+                continue;
+            }
+
+            uint64_t target = 0;
+            if (!config.top_speed) {
+                target = start + loop_offset + (uint64_t)(p.ts_ns / config.speed);
+                if (target > now_ns()) {
+                    // 下一个帧还没到时间：先把已写入的帧发出去，再等待
+                    ring_flush(ring);
+                    wait_until(target);
+                }
+            }
+
+            struct tpacket2_hdr* slot = ring_acquire(ring);
+            if (slot == NULL) {
+                break;
+            }
+            unsigned char* frame = (unsigned char*)slot + ring.data_offset;
+            memcpy(frame, p.data, p.len);
+            if (config.rewrite_dst_mac) {
+                memcpy(frame, config.dst_mac, 6);
+            }
+            if (config.rewrite_src_mac) {
+                memcpy(frame + 6, config.src_mac, 6);
+            }
+            if (!config.ip_rewrites.empty() && rewrite_ipv4(frame, p.len, config.ip_rewrites)) {
+                stats.rewritten++;
+            }
+            ring_commit(ring, slot, p.len);
+
+            if (config.top_speed) {
+                if (ring.pending >= TX_BATCH) {
+                    ring_flush(ring);
+                }
+            } else {
+                // 定时模式：下一个帧时间未到时在循环开头提交；同一时刻的帧攒成一批
+                record_lateness(((double)now_ns() - (double)target) / 1e9);
+                if (i + 1 == packets.size() || ring.pending >= TX_BATCH) {
+                    ring_flush(ring);
+                }
+            }
+            stats.packets++;
+            stats.bytes += p.len;
+        }
+        loop_offset += (uint64_t)(capture_ns / config.speed);
+        if (config.top_speed) {
+            loop_offset = now_ns() - start;
+        }
+    }
+    ring_drain(ring);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    // ==================== 4. 报告 ====================
+    printf("====================================================\n");
+    printf("发送帧数:   %llu (%llu 字节)\n", stats.packets, stats.bytes);
+    if (stats.skipped > 0) {
+        printf("跳过:       %llu 个超过接口 MTU 的帧\n", stats.skipped);
+    }
+    if (!config.ip_rewrites.empty()) {
+        printf("IP 改写:    %llu 帧\n", stats.rewritten);
+    }
+    if (config.top_speed) {
+        printf("耗时:       %.3f s\n", elapsed);
+    } else {
+        printf("耗时:       %.3f s (原始时长 x 次数 / 倍速 = %.3f s)\n", elapsed,
+               capture_ns / 1e9 * config.loops / config.speed);
+    }
+    printf("速率:       %.0f pps (%.3f Mpps), %.1f Mbps\n",
+           elapsed > 0 ? stats.packets / elapsed : 0.0,
+           elapsed > 0 ? stats.packets / elapsed / 1e6 : 0.0,
+           elapsed > 0 ? stats.bytes * 8 / elapsed / 1e6 : 0.0);
+    printf("环满等待:   %llu 次, send 失败 %llu 次\n", stats.ring_full, stats.send_errors);
+    if (stats.lateness_count > 0) {
+        std::sort(stats.lateness.begin(), stats.lateness.end());
+        printf("定时误差:   平均 %.1f us, p50 %.1f us, p99 %.1f us, 最大 %.1f us (相对计划发送时间的延迟)\n",
+               stats.lateness_sum / stats.lateness_count * 1e6, percentile(stats.lateness, 50) * 1e6,
+               percentile(stats.lateness, 99) * 1e6, stats.lateness_max * 1e6);
+    }
+    printf("====================================================\n");
+
+    munmap(ring.map, ring.map_len);
+    close(ring.sock);
+    munmap((void*)map, map_len);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# ============================================================================
+# 文件名: bench_cluster.sh
+# 描述: 在本机启动 N 个聊天室节点（全互联），用 chat_bench 测量跨节点扇出
+# 用法: ./bench_cluster.sh [节点数(默认3)] [chat_bench 的其他参数...]
+# 示例: ./bench_cluster.sh 5 -c 500 -S 5 -n 2000
+# ============================================================================
+
+NODES=${1:-3}
+shift
+BASE_PORT=18888      # 节点 i 的客户端端口: BASE_PORT + i
+BASE_CLUSTER=19888   # 节点 i 的集群端口:   BASE_CLUSTER + i
+
+PIDS=()
+cleanup() {
+    kill "${PIDS[@]}" 2>/dev/null
+    wait 2>/dev/null
+}
+trap cleanup EXIT
+
+SERVERS=()
+for ((i = 0; i < NODES; i++)); do
+    # 节点 i 主动拨号到所有编号更小的节点，组成全互联拓扑
+    PEERS=()
+    for ((j = 0; j < i; j++)); do
+        PEERS+=(-P "127.0.0.1:$((BASE_CLUSTER + j))")
+    done
+    ./epoll_server -p $((BASE_PORT + i)) -n $((i + 1)) -c $((BASE_CLUSTER + i)) "${PEERS[@]}" > /dev/null 2>&1 &
+    PIDS+=($!)
+    SERVERS+=(-s "127.0.0.1:$((BASE_PORT + i))")
+done
+
+# 等待节点启动并完成互联
+sleep 1.5
+
+./chat_bench "${SERVERS[@]}" -S "$NODES" "$@"
@@ -0,0 +1,25 @@
+#!/bin/bash
+# ============================================================================
+# 文件名: bench_coro.sh
+# 描述: 用同一组 chat_bench 参数分别压测回调版 (epoll_server) 和
+#       协程版 (coro_server) 服务器，对比吞吐与延迟
+# 用法: ./bench_coro.sh [chat_bench 参数...]
+# 示例: ./bench_coro.sh -c 200 -S 4 -n 2000 -R 0
+# ============================================================================
+
+PORT=18988
+
+run_one() {
+    local name=$1
+    "./$name" -p $PORT > /dev/null 2>&1 &
+    local pid=$!
+    sleep 0.5
+    echo ">>> $name"
+    ./chat_bench -s 127.0.0.1:$PORT "${@:2}" | grep -E "送达|耗时|吞吐|延迟"
+    kill $pid 2>/dev/null
+    wait $pid 2>/dev/null
+    sleep 0.5
+}
+
+run_one epoll_server "$@"
+run_one coro_server "$@"
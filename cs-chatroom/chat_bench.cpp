@@ -0,0 +1,302 @@
+/*
+ * ============================================================================
+ * 文件名: chat_bench.cpp
+ * 描述: 聊天室压测工具，测量（跨节点）房间扇出的吞吐量和延迟
+ * 架构: 单线程 + epoll，同时驱动大量客户端连接
+ * 平台: 仅限 Linux
+ *
+ * 工作方式:
+ *   1. 按轮询方式把 -c 个客户端分布到所有 -s 指定的服务器（节点）上
+ *   2. 所有客户端 /join 到同一个压测房间
+ *   3. 前 -S 个客户端作为发送者，按 -R 的速率各发送 -n 条带时间戳的消息
+ *   4. 其余每个客户端都应收到每条消息：统计送达率、吞吐量和端到端延迟
+ * ============================================================================
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// 配置常量
+const int MAX_EVENTS = 256;         // epoll_wait 一次最多返回的事件数
+const int BUFFER_SIZE = 65536;      // 接收缓冲区大小
+const int IDLE_TIMEOUT_MS = 3000;   // 发送结束后多久没有新消息即认为结束
+
+// 压测客户端
+struct BenchClient {
+    int fd;
+    int server_index;               // 连接的是哪个节点
+    std::string inbuf;              // 未凑成整行的数据
+    std::string outbuf;             // 因 EAGAIN 暂未发出的数据
+    int sent;                       // 已发送的消息数（仅发送者）
+};
+
+/*
+ * 获取单调时钟的纳秒数
+ */
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * 阻塞连接到服务器，成功后切换为非阻塞模式
+ */
+int connect_to(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 ||
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+/*
+ * 尽量发送客户端的待发数据，返回 false 表示连接出错
+ */
+bool flush_client(BenchClient& c) {
+    while (!c.outbuf.empty()) {
+        ssize_t n = send(c.fd, c.outbuf.data(), c.outbuf.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            c.outbuf.erase(0, n);
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * 计算百分位数（输入已排序）
+ */
+double percentile_us(const std::vector<long long>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1));
+    return sorted[idx] / 1000.0;
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "用法: " << prog << " [-s IP:端口]... [-c 客户端总数] [-S 发送者数]"
+              << " [-n 每个发送者的消息数] [-R 每个发送者每秒消息数] [-r 房间名]\n"
+              << "示例: " << prog << " -s 127.0.0.1:8888 -s 127.0.0.1:8889 -s 127.0.0.1:8890 -c 300 -S 3\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<std::string, int> > servers;
+    int total_clients = 100;
+    int senders = 1;
+    int messages = 1000;
+    int rate = 2000;
+    std::string room = "bench";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:S:n:R:r:h")) != -1) {
+        switch (opt) {
+            case 's': {
+                std::string spec = optarg;
+                size_t colon = spec.rfind(':');
+                if (colon == std::string::npos) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                servers.push_back(std::make_pair(spec.substr(0, colon), atoi(spec.c_str() + colon + 1)));
+                break;
+            }
+            case 'c': total_clients = atoi(optarg); break;
+            case 'S': senders = atoi(optarg); break;
+            case 'n': messages = atoi(optarg); break;
+            case 'R': rate = atoi(optarg); break;
+            case 'r': room = optarg; break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (servers.empty()) {
+        servers.push_back(std::make_pair(std::string("127.0.0.1"), 8888));
+    }
+    if (senders > total_clients) {
+        senders = total_clients;
+    }
+
+    // ========================================================================
+    // 1. 建立连接并加入压测房间
+    // ========================================================================
+    int epoll_fd = epoll_create1(0);
+    std::vector<BenchClient> clients;
+    clients.reserve(total_clients);
+
+    for (int i = 0; i < total_clients; i++) {
+        int server_index = i % servers.size();
+        int fd = connect_to(servers[server_index].first, servers[server_index].second);
+        if (fd == -1) {
+            std::cerr << "[错误] 连接 " << servers[server_index].first << ":"
+                      << servers[server_index].second << " 失败: " << strerror(errno) << std::endl;
+            return 1;
+        }
+
+        BenchClient c;
+        c.fd = fd;
+        c.server_index = server_index;
+        c.sent = 0;
+        c.outbuf = "/join " + room + "\n";
+        clients.push_back(c);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    std::cout << "[压测] " << total_clients << " 个客户端已连接到 " << servers.size()
+              << " 个节点，等待房间成员关系同步..." << std::endl;
+
+    // 给 gossip 留出传播时间，同时丢弃欢迎消息和加入通知
+    struct epoll_event events[MAX_EVENTS];
+    char buffer[BUFFER_SIZE];
+    long long settle_until = now_ns() + 1000000000LL;
+    while (now_ns() < settle_until) {
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 50);
+        for (int i = 0; i < nfds; i++) {
+            BenchClient& c = clients[events[i].data.u32];
+            flush_client(c);
+            while (recv(c.fd, buffer, sizeof(buffer), 0) > 0) {
+            }
+        }
+    }
+
+    // ========================================================================
+    // 2. 发送并接收：消息格式 "BENCH <发送时间ns>"
+    // ========================================================================
+    long long expected = (long long)senders * messages * (total_clients - 1);
+    long long received = 0;
+    std::vector<long long> latencies;
+    latencies.reserve(std::min(expected, 20000000LL));
+
+    long long start = now_ns();
+    long long interval = rate > 0 ? 1000000000LL / rate : 0;
+    long long last_activity = start;
+    bool sending_done = false;
+
+    while (received < expected) {
+        long long now = now_ns();
+
+        // 按速率为每个发送者生成到期的消息
+        if (!sending_done) {
+            sending_done = true;
+            for (int s = 0; s < senders; s++) {
+                BenchClient& c = clients[s];
+                while (c.sent < messages && (interval == 0 || start + c.sent * interval <= now)) {
+                    c.outbuf += "BENCH " + std::to_string(now_ns()) + "\n";
+                    c.sent++;
+                    if (interval == 0 && c.outbuf.size() > 16384) {
+                        break;  // 全速模式下分批写入，给接收留出机会
+                    }
+                }
+                if (!flush_client(c)) {
+                    std::cerr << "[错误] 发送者连接断开" << std::endl;
+                    return 1;
+                }
+                if (c.sent < messages || !c.outbuf.empty()) {
+                    sending_done = false;
+                }
+            }
+            if (sending_done) {
+                last_activity = now_ns();
+            }
+        }
+
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 1);
+        for (int i = 0; i < nfds; i++) {
+            BenchClient& c = clients[events[i].data.u32];
+            while (true) {
+                ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    break;
+                }
+                c.inbuf.append(buffer, n);
+            }
+
+            long long recv_time = now_ns();
+            size_t start_pos = 0;
+            size_t nl;
+            while ((nl = c.inbuf.find('\n', start_pos)) != std::string::npos) {
+                size_t tag = c.inbuf.find("BENCH ", start_pos);
+                if (tag != std::string::npos && tag < nl) {
+                    long long sent_at = atoll(c.inbuf.c_str() + tag + 6);
+                    if (latencies.size() < latencies.capacity()) {
+                        latencies.push_back(recv_time - sent_at);
+                    }
+                    received++;
+                }
+                start_pos = nl + 1;
+            }
+            c.inbuf.erase(0, start_pos);
+            last_activity = recv_time;
+        }
+
+        if (sending_done && now_ns() - last_activity > IDLE_TIMEOUT_MS * 1000000LL) {
+            break;  // 剩余消息已被服务器丢弃
+        }
+    }
+
+    long long elapsed = (sending_done ? last_activity : now_ns()) - start;
+
+    // ========================================================================
+    // 3. 输出结果
+    // ========================================================================
+    std::sort(latencies.begin(), latencies.end());
+    double seconds = elapsed / 1e9;
+
+    printf("\n==================== 压测结果 ====================\n");
+    printf("节点数:         %zu\n", servers.size());
+    printf("客户端数:       %d (发送者 %d)\n", total_clients, senders);
+    printf("每发送者消息数: %d (速率 %d/s)\n", messages, rate);
+    printf("应送达:         %lld\n", expected);
+    printf("实际送达:       %lld (%.2f%%)\n", received, expected ? 100.0 * received / expected : 0.0);
+    printf("耗时:           %.3f s\n", seconds);
+    printf("扇出吞吐:       %.0f 条/秒\n", seconds > 0 ? received / seconds : 0.0);
+    printf("延迟 p50:       %.1f us\n", percentile_us(latencies, 50));
+    printf("延迟 p99:       %.1f us\n", percentile_us(latencies, 99));
+    printf("延迟 max:       %.1f us\n", percentile_us(latencies, 100));
+    printf("==================================================\n");
+
+    for (auto& c : clients) {
+        close(c.fd);
+    }
+    close(epoll_fd);
+    return 0;
+}
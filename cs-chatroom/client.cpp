@@ -2,61 +2,336 @@
  * ============================================================================
  * 文件名: client.cpp
  * 描述: 聊天室客户端（双线程模型）
- * 架构: 主线程发送消息 + 接收线程接收消息
+ * 架构: 主线程读取输入并发送 + 连接线程负责接收、渲染和断线重连
  * 平台: Linux / macOS
+ *
+ * 渲染:
+ *   接收到的数据先按行缓冲，只输出完整的行（不会把多字节 UTF-8 字符截断），
+ *   每 RENDER_INTERVAL_MS 用一次 write 批量刷到终端。消息来得比终端能显示的
+ *   还快时，只保留最近 MAX_PENDING_LINES 行，并提示跳过了多少条，
+ *   终端不会成为瓶颈拖慢接收。
+ *
+ * 断线重连:
+ *   连接断开后按带抖动的指数退避重连（RECONNECT_BASE_MS 起，每次翻倍，
+ *   上限 RECONNECT_MAX_MS，实际等待在 [d/2, d] 中随机）。
+ *   重连成功后恢复会话：重新设置昵称、回到原房间、用 /who 拉取名单快照，
+ *   再发出断线期间缓存的消息。
  * ============================================================================
  */
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 // 配置常量
 const int BUFFER_SIZE = 4096;
+const int RENDER_INTERVAL_MS = 50;          // 终端刷新间隔（最多 20 次/秒）
+const size_t MAX_PENDING_LINES = 1000;      // 待显示行数上限，超出时丢弃最旧的行
+const size_t MAX_PARTIAL_BYTES = 64 * 1024; // 未凑成整行的数据上限，超出时按 UTF-8 边界强制输出
+const int RECONNECT_BASE_MS = 500;          // 首次重连等待
+const int RECONNECT_MAX_MS = 30000;         // 重连等待上限
+const size_t MAX_OUTBOX = 100;              // 断线期间最多缓存的待发消息数
 
 // 全局变量
 std::atomic<bool> g_running(true);  // 程序运行标志
 
+// 待显示的输出（连接线程和主线程都会写入，只由连接线程刷到终端）
+struct RenderQueue {
+    std::mutex mutex;
+    std::deque<std::string> lines;  // 完整的行（含换行符）
+    size_t skipped;                 // 因积压过多被丢弃的行数
+};
+RenderQueue g_render;
+
+// 当前连接和恢复会话所需的状态（由 g_session.mutex 保护）
+struct Session {
+    std::mutex mutex;
+    int sock_fd;                    // 当前连接，-1 表示未连接
+    std::string nickname;           // 用户最近一次 /nick 设置的昵称
+    std::string room;               // 用户最近一次 /join 的房间
+    std::deque<std::string> outbox; // 断线期间缓存的消息
+};
+Session g_session;
+
+long long now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * ============================================================================
+ * 函数名: post_line
+ * 功能: 把一行文本加入待显示队列（积压过多时丢弃最旧的行）
+ * ============================================================================
+ */
+void post_line(const std::string& line) {
+    std::lock_guard<std::mutex> lock(g_render.mutex);
+    g_render.lines.push_back(line);
+    if (g_render.lines.size() > MAX_PENDING_LINES) {
+        g_render.lines.pop_front();
+        g_render.skipped++;
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: render
+ * 功能: 把待显示队列一次性写到终端
+ * ============================================================================
+ */
+void render() {
+    std::string frame;
+    {
+        std::lock_guard<std::mutex> lock(g_render.mutex);
+        if (g_render.lines.empty() && g_render.skipped == 0) {
+            return;
+        }
+        if (g_render.skipped > 0) {
+            frame = "[系统] 消息过多，已跳过 " + std::to_string(g_render.skipped) + " 条\n";
+            g_render.skipped = 0;
+        }
+        for (const std::string& line : g_render.lines) {
+            frame += line;
+        }
+        g_render.lines.clear();
+    }
+
+    size_t written = 0;
+    while (written < frame.size()) {
+        ssize_t n = write(STDOUT_FILENO, frame.data() + written, frame.size() - written);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += n;
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: utf8_safe_length
+ * 功能: 返回不超过 len 且不会截断多字节 UTF-8 字符的最大长度
+ * ============================================================================
+ */
+size_t utf8_safe_length(const std::string& data, size_t len) {
+    // 从末尾往前找最后一个字符的起始字节，检查它是否完整
+    size_t start = len;
+    while (start > 0 && len - start < 4) {
+        start--;
+        unsigned char c = (unsigned char)data[start];
+        if ((c & 0xC0) != 0x80) {
+            size_t need = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : 4;
+            return start + need <= len ? len : start;
+        }
+    }
+    return len;
+}
+
 /*
  * ============================================================================
- * 函数名: receive_thread
- * 功能: 接收线程函数，持续接收服务器消息并显示
+ * 函数名: connect_to_server
+ * 功能: 建立到服务器的 TCP 连接
+ * 返回值: 套接字，失败返回 -1
+ * ============================================================================
+ */
+int connect_to_server(const struct sockaddr_in& server_addr) {
+    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock_fd == -1) {
+        return -1;
+    }
+    if (connect(sock_fd, (const struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+/*
+ * ============================================================================
+ * 函数名: send_all
+ * 功能: 完整发送一段数据（调用方持有 g_session.mutex）
+ * ============================================================================
+ */
+bool send_all(int sock_fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(sock_fd, data.data() + sent, data.size() - sent, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+/*
+ * ============================================================================
+ * 函数名: resume_session
+ * 功能: 重连成功后恢复会话：昵称、房间、名单，以及断线期间缓存的消息
+ * ============================================================================
+ */
+void resume_session(int sock_fd) {
+    std::lock_guard<std::mutex> lock(g_session.mutex);
+
+    std::string commands;
+    if (!g_session.nickname.empty()) {
+        commands += "/nick " + g_session.nickname + "\n";
+    }
+    if (!g_session.room.empty()) {
+        commands += "/join " + g_session.room + "\n";
+    }
+    commands += "/who\n";
+    for (const std::string& line : g_session.outbox) {
+        commands += line;
+    }
+    g_session.outbox.clear();
+
+    send_all(sock_fd, commands);
+    g_session.sock_fd = sock_fd;
+}
+
+/*
+ * ============================================================================
+ * 函数名: wait_and_render
+ * 功能: 等待 ms 毫秒，期间保持终端刷新；程序退出时提前返回
+ * ============================================================================
+ */
+void wait_and_render(int ms) {
+    long long deadline = now_ms() + ms;
+    while (g_running && now_ms() < deadline) {
+        render();
+        long long left = deadline - now_ms();
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+            left < RENDER_INTERVAL_MS ? (left > 0 ? left : 0) : RENDER_INTERVAL_MS));
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: receive_loop
+ * 功能: 在一条已建立的连接上接收数据，按行缓冲并定时批量渲染
  * 参数: sock_fd - 套接字文件描述符
  * ============================================================================
  */
-void receive_thread(int sock_fd) {
+void receive_loop(int sock_fd) {
     char buffer[BUFFER_SIZE];
+    std::string partial;            // 尚未凑成整行的数据
+    long long next_render = now_ms() + RENDER_INTERVAL_MS;
 
     while (g_running) {
-        memset(buffer, 0, BUFFER_SIZE);
+        struct pollfd pfd;
+        pfd.fd = sock_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        long long wait = next_render - now_ms();
+        int ready = poll(&pfd, 1, wait > 0 ? (int)wait : 0);
+
+        if (ready > 0) {
+            ssize_t bytes_received = recv(sock_fd, buffer, sizeof(buffer), 0);
+            if (bytes_received > 0) {
+                partial.append(buffer, bytes_received);
 
-        // 接收服务器消息
-        ssize_t bytes_received = recv(sock_fd, buffer, BUFFER_SIZE - 1, 0);
+                // 只把完整的行交给渲染，避免截断多字节字符
+                size_t start = 0;
+                size_t nl;
+                while ((nl = partial.find('\n', start)) != std::string::npos) {
+                    post_line(partial.substr(start, nl + 1 - start));
+                    start = nl + 1;
+                }
+                partial.erase(0, start);
+
+                if (partial.size() > MAX_PARTIAL_BYTES) {
+                    size_t len = utf8_safe_length(partial, partial.size());
+                    post_line(partial.substr(0, len));
+                    partial.erase(0, len);
+                }
+            } else if (bytes_received == 0) {
+                if (g_running) {
+                    post_line("[系统] 服务器已断开连接\n");
+                }
+                break;
+            } else if (errno != EINTR) {
+                if (g_running) {  // 只有在运行状态才报错
+                    post_line(std::string("[错误] 接收消息失败: ") + strerror(errno) + "\n");
+                }
+                break;
+            }
+        }
+
+        if (now_ms() >= next_render) {
+            render();
+            next_render = now_ms() + RENDER_INTERVAL_MS;
+        }
+    }
+    render();
+}
+
+/*
+ * ============================================================================
+ * 函数名: connection_thread
+ * 功能: 连接线程：接收消息，断线后按带抖动的指数退避重连并恢复会话
+ * 参数: server_addr - 服务器地址, sock_fd - 主线程已建立的首个连接
+ * ============================================================================
+ */
+void connection_thread(struct sockaddr_in server_addr, int sock_fd) {
+    std::mt19937 rng((unsigned)now_ms() ^ (unsigned)getpid());
+    int attempt = 0;
+
+    while (g_running) {
+        receive_loop(sock_fd);
 
-        if (bytes_received > 0) {
-            // 成功接收消息，打印到控制台
-            std::cout << buffer << std::flush;
+        {
+            std::lock_guard<std::mutex> lock(g_session.mutex);
+            g_session.sock_fd = -1;
         }
-        else if (bytes_received == 0) {
-            // 服务器关闭连接
-            std::cout << "\n[系统] 服务器已断开连接" << std::endl;
-            g_running = false;
+        close(sock_fd);
+        if (!g_running) {
             break;
         }
-        else {
-            // 接收错误
-            if (g_running) {  // 只有在运行状态才报错
-                std::cerr << "[错误] 接收消息失败: " << strerror(errno) << std::endl;
-                g_running = false;
+
+        // 带抖动的指数退避，避免大量客户端在服务器重启后同时涌入
+        while (g_running) {
+            int delay = RECONNECT_BASE_MS << std::min(attempt, 6);
+            delay = std::min(delay, RECONNECT_MAX_MS);
+            delay = delay / 2 + (int)(rng() % (delay / 2 + 1));
+            attempt++;
+
+            post_line("[系统] " + std::to_string(delay) + " 毫秒后尝试第 "
+                      + std::to_string(attempt) + " 次重连...\n");
+            wait_and_render(delay);
+            if (!g_running) {
+                break;
+            }
+
+            sock_fd = connect_to_server(server_addr);
+            if (sock_fd != -1) {
+                post_line("[系统] 已重新连接，正在恢复会话\n");
+                attempt = 0;
+                resume_session(sock_fd);
+                break;
             }
-            break;
         }
     }
+    render();
 }
 
 /*
@@ -78,21 +353,12 @@ int main(int argc, char* argv[]) {
 
     std::cout << R"(
 ╔════════════════════════════════════════╗
-║         聊天室客户端 v1.0            ║
+║         聊天室客户端 v1.1            ║
 ╚════════════════════════════════════════╝
 )" << std::endl;
 
     // ========================================================================
-    // 1. 创建套接字
-    // ========================================================================
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_fd == -1) {
-        std::cerr << "[错误] socket 创建失败: " << strerror(errno) << std::endl;
-        return 1;
-    }
-
-    // ========================================================================
-    // 2. 连接到服务器
+    // 1. 解析服务器地址
     // ========================================================================
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
@@ -101,24 +367,30 @@ int main(int argc, char* argv[]) {
 
     if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
         std::cerr << "[错误] 无效的 IP 地址: " << server_ip << std::endl;
-        close(sock_fd);
         return 1;
     }
 
+    // ========================================================================
+    // 2. 连接到服务器（首次连接失败直接退出，之后的断线自动重连）
+    // ========================================================================
+    // 服务器断开后 send 不应让进程被 SIGPIPE 杀死，由重连逻辑处理
+    signal(SIGPIPE, SIG_IGN);
+
     std::cout << "[连接] 正在连接到服务器 " << server_ip << ":" << server_port << "..." << std::endl;
 
-    if (connect(sock_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+    int sock_fd = connect_to_server(server_addr);
+    if (sock_fd == -1) {
         std::cerr << "[错误] 连接服务器失败: " << strerror(errno) << std::endl;
-        close(sock_fd);
         return 1;
     }
+    g_session.sock_fd = sock_fd;
 
     std::cout << "[成功] 已连接到服务器\n" << std::endl;
 
     // ========================================================================
-    // 3. 启动接收线程
+    // 3. 启动连接线程（接收、渲染、重连）
     // ========================================================================
-    std::thread recv_thread(receive_thread, sock_fd);
+    std::thread conn_thread(connection_thread, server_addr, sock_fd);
 
     // ========================================================================
     // 4. 主线程：读取用户输入并发送到服务器
@@ -134,7 +406,7 @@ int main(int argc, char* argv[]) {
 
         // 检查是否退出命令
         if (input == "/quit" || input == "/exit") {
-            std::cout << "[系统] 正在退出..." << std::endl;
+            post_line("[系统] 正在退出...\n");
             break;
         }
 
@@ -143,15 +415,32 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
+        std::lock_guard<std::mutex> lock(g_session.mutex);
+
+        // 记录恢复会话所需的状态
+        if (input.compare(0, 6, "/join ") == 0 && input.size() > 6) {
+            g_session.room = input.substr(6);
+        } else if (input.compare(0, 6, "/nick ") == 0 && input.size() > 6) {
+            g_session.nickname = input.substr(6);
+        }
+
         // 添加换行符
         input += "\n";
 
-        // 发送消息到服务器
-        ssize_t bytes_sent = send(sock_fd, input.c_str(), input.length(), 0);
+        // 断线期间先缓存，重连后再发送
+        if (g_session.sock_fd == -1) {
+            if (g_session.outbox.size() < MAX_OUTBOX) {
+                g_session.outbox.push_back(input);
+                post_line("[系统] 未连接，消息将在重连后发送\n");
+            } else {
+                post_line("[系统] 未连接且待发消息过多，消息已丢弃\n");
+            }
+            continue;
+        }
 
-        if (bytes_sent == -1) {
-            std::cerr << "[错误] 发送消息失败: " << strerror(errno) << std::endl;
-            break;
+        // 发送失败由连接线程发现断线并重连
+        if (!send_all(g_session.sock_fd, input)) {
+            post_line(std::string("[错误] 发送消息失败: ") + strerror(errno) + "\n");
         }
     }
 
@@ -160,13 +449,17 @@ int main(int argc, char* argv[]) {
     // ========================================================================
     g_running = false;
 
-    // 关闭套接字（这会让接收线程退出）
-    shutdown(sock_fd, SHUT_RDWR);
-    close(sock_fd);
+    // 关闭套接字的读写方向（这会让连接线程退出）
+    {
+        std::lock_guard<std::mutex> lock(g_session.mutex);
+        if (g_session.sock_fd != -1) {
+            shutdown(g_session.sock_fd, SHUT_RDWR);
+        }
+    }
 
-    // 等待接收线程结束
-    if (recv_thread.joinable()) {
-        recv_thread.join();
+    // 等待连接线程结束
+    if (conn_thread.joinable()) {
+        conn_thread.join();
     }
 
     std::cout << "\n客户端已退出" << std::endl;
@@ -0,0 +1,852 @@
+/*
+ * ============================================================================
+ * 文件名: coro_server.cpp
+ * 描述: 基于 C++20 协程的聊天室服务器
+ * 架构: 单线程 + epoll 事件循环 + 协程 (co_await)
+ * 平台: 仅限 Linux，需要 g++ 11+ (-std=c++20)
+ *
+ * 与 epoll_server.cpp 的区别:
+ *   epoll_server 把一个连接的处理逻辑拆散在 handle_new_connection、
+ *   handle_client_message、close_client_connection 三个回调中，连接状态
+ *   只能放在全局表里。这里每个连接是一个顺序执行的协程：
+ *
+ *       Task session_main(session) {
+ *           deliver(...欢迎消息...);
+ *           while (true) {
+ *               n = co_await loop.read(conn, buf, len);   // 挂起直到可读
+ *               ...逐行处理...
+ *           }
+ *       }
+ *
+ *   协程在等待 I/O 时挂起，事件循环收到 epoll 事件后恢复它。
+ *   认证、昵称、断线恢复这类"有状态协议"可以直接写成顺序代码。
+ *
+ * 组成:
+ *   - FramePool:  协程帧内存池（按 64 字节分级的空闲链表，避免每个协程 malloc）
+ *   - Task:       协程任务类型，可 co_await（对称转移）也可 spawn 为独立任务
+ *   - EventLoop:  epoll 事件循环，提供 read/write/accept/sleep 四种 awaitable
+ *   - Event:      单等待者事件，用于唤醒连接的发送协程
+ * ============================================================================
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctime>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <map>
+#include <set>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <string>
+
+// 配置常量（与 epoll_server.cpp 保持一致）
+const int PORT = 8888;                      // 服务器默认监听端口（可用 -p 覆盖）
+const int MAX_EVENTS = 100;                 // epoll_wait 一次最多返回的事件数
+const int BUFFER_SIZE = 4096;               // 接收缓冲区大小
+const int MAX_CLIENTS = 1000;               // 最大客户端连接数
+const char* const DEFAULT_ROOM = "大厅";     // 新用户默认进入的房间
+const size_t MAX_OUTQ = 1024 * 1024;        // 单个连接的发送队列上限，超过则丢弃消息
+const int IDLE_CHECK_MS = 30 * 1000;        // 空闲检测周期
+const int IDLE_TIMEOUT_SEC = 30 * 60;       // 超过该时长无输入则断开
+const int ACCEPT_BACKOFF_MS = 100;          // accept 遇到资源不足等错误后的等待时间
+
+// ======================== 协程帧内存池 ========================
+
+/*
+ * 协程帧内存池
+ *
+ * 每次调用协程函数，编译器都会为它的局部变量和挂起点分配一个"协程帧"。
+ * 默认用 ::operator new，高连接数下频繁 malloc/free 会成为瓶颈。
+ * promise_type 可以自定义 operator new/delete，这里按 64 字节分级，
+ * 每级维护一个空闲链表，释放的帧直接复用。
+ */
+class FramePool {
+public:
+    static const size_t GRANULE = 64;           // 分级粒度
+    static const size_t MAX_POOLED = 16384;     // 超过此大小的帧直接走 ::operator new
+
+    void* allocate(size_t size) {
+        size_t cls = size_class(size);
+        if (cls >= NUM_CLASSES) {
+            return ::operator new(size);
+        }
+        FreeNode* node = free_lists_[cls];
+        if (node != nullptr) {
+            free_lists_[cls] = node->next;
+            reused_++;
+            return node;
+        }
+        allocated_++;
+        return ::operator new((cls + 1) * GRANULE);
+    }
+
+    void deallocate(void* p, size_t size) {
+        size_t cls = size_class(size);
+        if (cls >= NUM_CLASSES) {
+            ::operator delete(p);
+            return;
+        }
+        FreeNode* node = static_cast<FreeNode*>(p);
+        node->next = free_lists_[cls];
+        free_lists_[cls] = node;
+    }
+
+    unsigned long long allocated() const { return allocated_; }
+    unsigned long long reused() const { return reused_; }
+
+private:
+    struct FreeNode { FreeNode* next; };
+    static const size_t NUM_CLASSES = MAX_POOLED / GRANULE;
+
+    static size_t size_class(size_t size) { return (size + GRANULE - 1) / GRANULE - 1; }
+
+    FreeNode* free_lists_[NUM_CLASSES] = {};
+    unsigned long long allocated_ = 0;      // 向系统申请的帧数
+    unsigned long long reused_ = 0;         // 从空闲链表复用的帧数
+};
+
+FramePool g_frame_pool;
+
+// ======================== 协程任务类型 ========================
+
+/*
+ * Task: 惰性启动的协程任务
+ *
+ * 两种用法:
+ *   1. co_await sub_task(...);  父协程挂起，子任务完成后通过对称转移恢复父协程
+ *   2. spawn(task);             作为独立任务运行，结束时自行销毁协程帧
+ */
+class Task {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;   // co_await 本任务的父协程
+        bool detached = false;                  // 是否由 spawn 启动
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // 结束时：有父协程则转移过去；独立任务则销毁自身
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                promise_type& p = h.promise();
+                if (p.continuation) {
+                    return p.continuation;
+                }
+                if (p.detached) {
+                    h.destroy();
+                }
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        // 协程帧从内存池分配
+        static void* operator new(size_t size) { return g_frame_pool.allocate(size); }
+        static void operator delete(void* p, size_t size) { g_frame_pool.deallocate(p, size); }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle_(h) {}
+    Task(Task&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    // 作为 awaitable：启动子任务，并记录父协程
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) noexcept {
+        handle_.promise().continuation = parent;
+        return handle_;
+    }
+    void await_resume() const noexcept {}
+
+    // 作为独立任务启动，所有权交给协程自身
+    friend void spawn(Task task) {
+        std::coroutine_handle<promise_type> h = task.handle_;
+        task.handle_ = nullptr;
+        h.promise().detached = true;
+        h.resume();
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// ======================== 事件循环 ========================
+
+/*
+ * 连接对象：记录在该 fd 上挂起的读/写协程
+ * 边缘触发模式下 fd 一次性注册 EPOLLIN | EPOLLOUT，事件到来时恢复对应协程
+ */
+struct Conn {
+    int fd = -1;
+    bool closed = false;
+    std::coroutine_handle<> reader;     // 等待可读的协程
+    std::coroutine_handle<> writer;     // 等待可写的协程
+};
+
+class EventLoop {
+public:
+    EventLoop() : epoll_fd_(epoll_create1(0)) {}
+    ~EventLoop() { close(epoll_fd_); }
+
+    bool ok() const { return epoll_fd_ != -1; }
+
+    // 将连接加入 epoll（边缘触发，读写事件一次注册）
+    bool add(Conn& conn) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = &conn;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn.fd, &ev) == 0;
+    }
+
+    // 关闭连接：挂起在该连接上的协程会在下一轮被恢复，并看到 closed 标志
+    void close_conn(Conn& conn) {
+        if (conn.closed) {
+            return;
+        }
+        conn.closed = true;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        post(conn.reader);
+        post(conn.writer);
+        conn.reader = nullptr;
+        conn.writer = nullptr;
+    }
+
+    // 延迟释放：本轮 epoll 事件中可能仍有指向该对象的 data.ptr，下一轮再释放
+    void retire(std::shared_ptr<void> obj) {
+        graveyard_.push_back(std::move(obj));
+    }
+
+    // 投递一个待恢复的协程，在当前回调返回后由事件循环执行
+    void post(std::coroutine_handle<> h) {
+        if (h) {
+            ready_.push_back(h);
+        }
+    }
+
+    // ---------------- awaitable: 读 ----------------
+    struct ReadAwaiter {
+        Conn& conn;
+        char* buf;
+        size_t len;
+        ssize_t result = -1;
+        int err = 0;        // 挂起期间其他代码可能改写 errno，这里单独保存
+
+        // 先直接尝试 recv，有数据就不挂起
+        bool await_ready() {
+            return try_recv();
+        }
+        void await_suspend(std::coroutine_handle<> h) { conn.reader = h; }
+        ssize_t await_resume() {
+            if (conn.closed) {
+                errno = ECONNABORTED;
+                return -1;
+            }
+            if (result == -1 && err == EAGAIN) {
+                try_recv();  // 被 EPOLLIN 唤醒后重试
+            }
+            errno = err;
+            return result;
+        }
+
+        bool try_recv() {
+            if (conn.closed) {
+                return true;
+            }
+            while (true) {
+                result = recv(conn.fd, buf, len, 0);
+                err = result == -1 ? errno : 0;
+                if (err == EINTR) {
+                    continue;
+                }
+                return err != EAGAIN && err != EWOULDBLOCK;
+            }
+        }
+    };
+    ReadAwaiter read(Conn& conn, char* buf, size_t len) { return ReadAwaiter{conn, buf, len}; }
+
+    // ---------------- awaitable: 写 ----------------
+    struct WriteAwaiter {
+        Conn& conn;
+        const char* data;
+        size_t len;
+        ssize_t result = -1;
+        int err = 0;
+
+        bool await_ready() {
+            return try_send();
+        }
+        void await_suspend(std::coroutine_handle<> h) { conn.writer = h; }
+        ssize_t await_resume() {
+            if (conn.closed) {
+                errno = ECONNABORTED;
+                return -1;
+            }
+            if (result == -1 && err == EAGAIN) {
+                try_send();  // 被 EPOLLOUT 唤醒后重试
+            }
+            errno = err;
+            return result;
+        }
+
+        bool try_send() {
+            if (conn.closed) {
+                return true;
+            }
+            while (true) {
+                result = send(conn.fd, data, len, MSG_NOSIGNAL);
+                err = result == -1 ? errno : 0;
+                if (err == EINTR) {
+                    continue;
+                }
+                return err != EAGAIN && err != EWOULDBLOCK;
+            }
+        }
+    };
+    WriteAwaiter write(Conn& conn, const char* data, size_t len) { return WriteAwaiter{conn, data, len}; }
+
+    // ---------------- awaitable: accept ----------------
+    struct AcceptAwaiter {
+        Conn& conn;
+        struct sockaddr_in* addr;
+        int result = -1;
+        int err = 0;
+
+        bool await_ready() { return try_accept(); }
+        void await_suspend(std::coroutine_handle<> h) { conn.reader = h; }
+        int await_resume() {
+            if (result == -1 && err == EAGAIN && !conn.closed) {
+                try_accept();
+            }
+            errno = err;
+            return result;
+        }
+
+        bool try_accept() {
+            socklen_t addr_len = sizeof(*addr);
+            result = accept(conn.fd, (struct sockaddr*)addr, &addr_len);
+            err = result == -1 ? errno : 0;
+            return err != EAGAIN && err != EWOULDBLOCK;
+        }
+    };
+    AcceptAwaiter accept_conn(Conn& listen_conn, struct sockaddr_in* addr) {
+        return AcceptAwaiter{listen_conn, addr};
+    }
+
+    // ---------------- awaitable: 定时器 ----------------
+    struct SleepAwaiter {
+        EventLoop& loop;
+        long long deadline_ms;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            loop.timers_.push(Timer{deadline_ms, loop.timer_seq_++, h});
+        }
+        void await_resume() const {}
+    };
+    SleepAwaiter sleep(int ms) { return SleepAwaiter{*this, now_ms() + ms}; }
+
+    static long long now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // 主循环：恢复就绪协程 -> 计算定时器超时 -> epoll_wait -> 恢复 I/O 协程 -> 触发到期定时器
+    void run() {
+        struct epoll_event events[MAX_EVENTS];
+
+        while (true) {
+            run_ready();
+            graveyard_.clear();
+
+            int timeout = -1;
+            if (!timers_.empty()) {
+                long long wait = timers_.top().deadline_ms - now_ms();
+                timeout = wait > 0 ? (int)wait : 0;
+            }
+
+            int nfds = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+            if (nfds == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "[错误] epoll_wait 失败: " << strerror(errno) << std::endl;
+                break;
+            }
+
+            for (int i = 0; i < nfds; i++) {
+                Conn* conn = static_cast<Conn*>(events[i].data.ptr);
+                uint32_t ev = events[i].events;
+
+                // 错误/挂断时读写两侧都唤醒，由 recv/send 返回具体错误
+                if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+                    resume_waiter(conn->reader);
+                }
+                if (conn->closed) {
+                    continue;  // 读协程已经关闭了连接
+                }
+                if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                    resume_waiter(conn->writer);
+                }
+            }
+
+            long long now = now_ms();
+            while (!timers_.empty() && timers_.top().deadline_ms <= now) {
+                std::coroutine_handle<> h = timers_.top().handle;
+                timers_.pop();
+                h.resume();
+            }
+        }
+    }
+
+private:
+    struct Timer {
+        long long deadline_ms;
+        unsigned long long seq;         // 相同到期时间按加入顺序触发
+        std::coroutine_handle<> handle;
+        bool operator>(const Timer& other) const {
+            if (deadline_ms != other.deadline_ms) return deadline_ms > other.deadline_ms;
+            return seq > other.seq;
+        }
+    };
+
+    static void resume_waiter(std::coroutine_handle<>& waiter) {
+        if (waiter) {
+            std::coroutine_handle<> h = waiter;
+            waiter = nullptr;
+            h.resume();
+        }
+    }
+
+    void run_ready() {
+        while (!ready_.empty()) {
+            std::coroutine_handle<> h = ready_.front();
+            ready_.pop_front();
+            h.resume();
+        }
+    }
+
+    int epoll_fd_;
+    std::deque<std::coroutine_handle<> > ready_;
+    std::vector<std::shared_ptr<void> > graveyard_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers_;
+    unsigned long long timer_seq_ = 0;
+};
+
+EventLoop g_loop;
+
+/*
+ * 单等待者事件：发送协程在队列为空时 co_await，广播方 notify 唤醒它
+ */
+struct Event {
+    std::coroutine_handle<> waiter;
+    bool signaled = false;
+
+    void notify() {
+        if (waiter) {
+            std::coroutine_handle<> h = waiter;
+            waiter = nullptr;
+            g_loop.post(h);
+        } else {
+            signaled = true;
+        }
+    }
+
+    bool await_ready() {
+        if (signaled) {
+            signaled = false;
+            return true;
+        }
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> h) { waiter = h; }
+    void await_resume() {}
+};
+
+// ======================== 聊天会话 ========================
+
+// 会话状态：所有字段都属于这个连接的协程，不再散落在全局回调里
+struct Session {
+    Conn conn;
+    std::string nickname;
+    std::string ip;
+    int port = 0;
+    std::string room;
+    std::string outq;                   // 待发送数据
+    bool writing = false;               // 发送协程是否正在 write_all
+    Event out_ready;                    // outq 有新数据
+    time_t last_active = 0;
+};
+
+// 客户端表 (fd -> 会话)，与房间成员表
+std::map<int, std::shared_ptr<Session> > g_sessions;
+std::map<std::string, std::set<Session*> > g_rooms;
+
+/*
+ * ============================================================================
+ * 函数名: write_all
+ * 功能: 协程：把一段数据完整写出，必要时挂起等待 EPOLLOUT
+ * 返回: 通过 ok 输出是否成功
+ * ============================================================================
+ */
+Task write_all(Conn& conn, std::string data, bool& ok) {
+    size_t off = 0;
+    ok = true;
+    while (off < data.size()) {
+        ssize_t n = co_await g_loop.write(conn, data.data() + off, data.size() - off);
+        if (n > 0) {
+            off += n;
+        } else if (n == -1 && errno == EAGAIN) {
+            continue;  // 伪唤醒，重新等待
+        } else {
+            ok = false;
+            co_return;
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: deliver
+ * 功能: 把消息投递给一个会话
+ * 说明: 发送队列为空时直接尝试 send（与回调版本相同的快速路径），
+ *       剩余部分进入队列并唤醒该会话的发送协程；队列超过上限则丢弃
+ * ============================================================================
+ */
+void deliver(Session& s, const std::string& message) {
+    if (s.conn.closed) {
+        return;
+    }
+
+    size_t off = 0;
+    if (!s.writing && s.outq.empty()) {
+        ssize_t n = send(s.conn.fd, message.data(), message.size(), MSG_NOSIGNAL);
+        if (n == (ssize_t)message.size()) {
+            return;
+        }
+        if (n > 0) {
+            off = n;
+        }
+    }
+
+    if (s.outq.size() + message.size() - off > MAX_OUTQ) {
+        std::cerr << "[警告] 发送队列已满，客户端 fd=" << s.conn.fd << " 消息丢失" << std::endl;
+        return;
+    }
+    s.outq.append(message, off, std::string::npos);
+    s.out_ready.notify();
+}
+
+void broadcast_to_room(const std::string& room, Session* sender, const std::string& message) {
+    auto rit = g_rooms.find(room);
+    if (rit == g_rooms.end()) {
+        return;
+    }
+    for (Session* member : rit->second) {
+        if (member != sender) {
+            deliver(*member, message);
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: writer_loop
+ * 功能: 协程：每个会话一个，负责把 outq 中积压的数据写出
+ * ============================================================================
+ */
+Task writer_loop(std::shared_ptr<Session> s) {
+    while (!s->conn.closed) {
+        if (s->outq.empty()) {
+            co_await s->out_ready;
+            continue;
+        }
+
+        std::string chunk;
+        chunk.swap(s->outq);
+        s->writing = true;
+        bool ok = false;
+        co_await write_all(s->conn, std::move(chunk), ok);
+        s->writing = false;
+        if (!ok) {
+            break;
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: idle_watchdog
+ * 功能: 协程：周期性检查会话空闲时间，超时则断开
+ * 说明: 演示定时器 awaitable；断开连接后读协程会被唤醒并完成清理
+ * ============================================================================
+ */
+Task idle_watchdog(std::shared_ptr<Session> s) {
+    while (!s->conn.closed) {
+        co_await g_loop.sleep(IDLE_CHECK_MS);
+        if (!s->conn.closed && time(nullptr) - s->last_active > IDLE_TIMEOUT_SEC) {
+            std::cout << "[超时] " << s->nickname << " 长时间无输入，断开连接" << std::endl;
+            shutdown(s->conn.fd, SHUT_RDWR);
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_line
+ * 功能: 处理一行输入（命令或聊天消息）
+ * 支持的命令:
+ *   /join <房间名> - 切换房间
+ *   /nick <昵称>   - 修改昵称
+ * ============================================================================
+ */
+void handle_line(Session& s, const std::string& line) {
+    if (line.compare(0, 6, "/join ") == 0) {
+        std::string room = line.substr(6);
+        if (room.empty() || room == s.room) {
+            return;
+        }
+        broadcast_to_room(s.room, &s, "[系统] " + s.nickname + " 离开了房间 " + s.room + "\n");
+        g_rooms[s.room].erase(&s);
+        if (g_rooms[s.room].empty()) {
+            g_rooms.erase(s.room);
+        }
+        s.room = room;
+        g_rooms[room].insert(&s);
+        broadcast_to_room(room, &s, "[系统] " + s.nickname + " 进入了房间 " + room + "\n");
+        deliver(s, "[系统] 已进入房间: " + room + "\n");
+        return;
+    }
+
+    if (line.compare(0, 6, "/nick ") == 0) {
+        std::string nickname = line.substr(6);
+        if (nickname.empty()) {
+            return;
+        }
+        broadcast_to_room(s.room, &s, "[系统] " + s.nickname + " 改名为 " + nickname + "\n");
+        s.nickname = nickname;
+        deliver(s, "[系统] 昵称已修改为: " + nickname + "\n");
+        return;
+    }
+
+    // 格式化消息: [昵称] 消息内容
+    std::string formatted_msg = "[" + s.nickname + "] " + line + "\n";
+    std::cout << "[消息] fd=" << s.conn.fd << " " << formatted_msg;
+    broadcast_to_room(s.room, &s, formatted_msg);
+}
+
+/*
+ * ============================================================================
+ * 函数名: session_main
+ * 功能: 协程：一个客户端连接的完整生命周期
+ *   连接 -> 欢迎 -> 循环读取并处理 -> 断开清理
+ * ============================================================================
+ */
+Task session_main(std::shared_ptr<Session> s) {
+    int fd = s->conn.fd;
+    s->room = DEFAULT_ROOM;
+    g_rooms[s->room].insert(s.get());
+
+    std::cout << "[连接] 新客户端 fd=" << fd
+              << " (" << s->ip << ":" << s->port << ")"
+              << " 当前在线: " << g_sessions.size() << std::endl;
+
+    spawn(writer_loop(s));
+    spawn(idle_watchdog(s));
+
+    deliver(*s, "=== 欢迎来到聊天室 ===\n"
+                "当前在线人数: " + std::to_string(g_sessions.size()) + "\n"
+                "当前房间: " + s->room + "\n"
+                "输入消息即可发送，/join <房间名> 切换房间，/nick <昵称> 修改昵称\n"
+                "====================\n");
+    broadcast_to_room(s->room, s.get(), "[系统] " + s->nickname + " 加入了聊天室\n");
+
+    // 读循环：TCP 是字节流，按 '\n' 拆分成行
+    char buffer[BUFFER_SIZE];
+    std::string inbuf;
+    while (true) {
+        ssize_t n = co_await g_loop.read(s->conn, buffer, sizeof(buffer));
+        if (n > 0) {
+            s->last_active = time(nullptr);
+            inbuf.append(buffer, n);
+
+            size_t start = 0;
+            size_t nl;
+            while ((nl = inbuf.find('\n', start)) != std::string::npos) {
+                std::string line = inbuf.substr(start, nl - start);
+                if (!line.empty() && line[line.size() - 1] == '\r') {
+                    line.erase(line.size() - 1);
+                }
+                start = nl + 1;
+                if (!line.empty()) {
+                    handle_line(*s, line);
+                }
+            }
+            inbuf.erase(0, start);
+        } else if (n == -1 && errno == EAGAIN) {
+            continue;  // 伪唤醒
+        } else {
+            if (n == 0) {
+                std::cout << "[断开] 客户端 fd=" << fd << " 正常断开连接" << std::endl;
+            }
+            break;
+        }
+    }
+
+    // 清理：离开房间、关闭连接（唤醒发送协程使其退出）
+    auto rit = g_rooms.find(s->room);
+    if (rit != g_rooms.end()) {
+        rit->second.erase(s.get());
+        if (rit->second.empty()) {
+            g_rooms.erase(rit);
+        }
+    }
+    s->out_ready.notify();
+    g_loop.close_conn(s->conn);
+    g_loop.retire(s);
+    g_sessions.erase(fd);
+
+    std::cout << "[离线] " << s->nickname << " fd=" << fd
+              << " 已断开，当前在线: " << g_sessions.size() << std::endl;
+    broadcast_to_room(s->room, nullptr, "[系统] " + s->nickname + " 离开了聊天室\n");
+}
+
+/*
+ * ============================================================================
+ * 函数名: accept_loop
+ * 功能: 协程：接受新连接，为每个连接 spawn 一个 session_main
+ * 说明: EMFILE/ENFILE/ENOBUFS 等错误下连接仍在监听队列里，立即重试只会空转，
+ *       先睡 ACCEPT_BACKOFF_MS 再试（EINTR、ECONNABORTED 是单个连接的问题，直接重试）
+ * ============================================================================
+ */
+Task accept_loop(Conn& listen_conn) {
+    while (true) {
+        struct sockaddr_in client_addr;
+        int client_sock = co_await g_loop.accept_conn(listen_conn, &client_addr);
+        if (client_sock == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "[错误] accept 失败: " << strerror(errno) << std::endl;
+                co_await g_loop.sleep(ACCEPT_BACKOFF_MS);
+            }
+            continue;
+        }
+
+        if (g_sessions.size() >= (size_t)MAX_CLIENTS) {
+            std::cerr << "[警告] 客户端数量已达上限，拒绝连接" << std::endl;
+            const char* msg = "服务器已满，请稍后再试\n";
+            send(client_sock, msg, strlen(msg), MSG_NOSIGNAL);
+            close(client_sock);
+            continue;
+        }
+
+        fcntl(client_sock, F_SETFL, fcntl(client_sock, F_GETFL, 0) | O_NONBLOCK);
+
+        std::shared_ptr<Session> s = std::make_shared<Session>();
+        s->conn.fd = client_sock;
+        if (!g_loop.add(s->conn)) {
+            std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD 失败: " << strerror(errno) << std::endl;
+            close(client_sock);
+            continue;
+        }
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        s->ip = client_ip;
+        s->port = ntohs(client_addr.sin_port);
+        s->nickname = "用户" + std::to_string(client_sock);
+        s->last_active = time(nullptr);
+        g_sessions[client_sock] = s;
+
+        spawn(session_main(s));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int port = PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:h")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            default:
+                std::cerr << "用法: " << argv[0] << " [-p 端口]" << std::endl;
+                return 1;
+        }
+    }
+
+    std::cout << R"(
+╔════════════════════════════════════════╗
+║   基于 C++20 协程的聊天室服务器      ║
+║   架构: 单线程 + epoll + co_await    ║
+╚════════════════════════════════════════╝
+)" << std::endl;
+
+    if (!g_loop.ok()) {
+        std::cerr << "[错误] epoll_create1 失败: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // 创建非阻塞监听套接字
+    int listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_sock == -1) {
+        std::cerr << "[错误] socket 创建失败: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(listen_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1 ||
+        listen(listen_sock, SOMAXCONN) == -1) {
+        std::cerr << "[错误] bind/listen 失败: " << strerror(errno) << std::endl;
+        close(listen_sock);
+        return 1;
+    }
+
+    Conn listen_conn;
+    listen_conn.fd = listen_sock;
+    if (!g_loop.add(listen_conn)) {
+        std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD listen_sock 失败: " << strerror(errno) << std::endl;
+        close(listen_sock);
+        return 1;
+    }
+
+    std::cout << "[成功] 服务器启动，监听端口: " << port << std::endl;
+    std::cout << "\n服务器运行中，等待客户端连接...\n" << std::endl;
+
+    spawn(accept_loop(listen_conn));
+    g_loop.run();
+
+    std::cout << "[协程帧池] 分配 " << g_frame_pool.allocated()
+              << " 次, 复用 " << g_frame_pool.reused() << " 次" << std::endl;
+    close(listen_sock);
+    return 0;
+}
@@ -3,28 +3,41 @@
  * 文件名: epoll_server.cpp
  * 描述: 基于 epoll 的高性能多人聊天室服务器
  * 架构: 单线程 + I/O 多路复用 (epoll)
+ *       可选集群模式：多个节点通过持久 TCP 链路组成中继总线
+ *       可选 UDP 旁路：输入提示和心跳不经过 TCP 队列
  * 平台: 仅限 Linux
  * ============================================================================
  */
 
 #include <iostream>
+#include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/random.h>
+#include <endian.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <map>
+#include <set>
+#include <vector>
+#include <deque>
 #include <string>
 #include <ctime>
+#include <algorithm>
 
 // 配置常量
-const int PORT = 8888;              // 服务器监听端口
+const int PORT = 8888;              // 服务器默认监听端口（可用 -p 覆盖）
 const int MAX_EVENTS = 100;         // epoll_wait 一次最多返回的事件数
 const int BUFFER_SIZE = 4096;       // 接收缓冲区大小
 const int MAX_CLIENTS = 1000;       // 最大客户端连接数
+const char* const DEFAULT_ROOM = "大厅";  // 新用户默认进入的房间
+const int TICK_MS = 250;            // 定时任务周期（集群重连、内存档位检查）
 
 // 客户端信息结构体
 struct ClientInfo {
@@ -33,11 +46,246 @@ struct ClientInfo {
     std::string ip;                 // 客户端 IP 地址
     int port;                       // 客户端端口
     time_t connect_time;            // 连接时间
+    std::string room;               // 当前所在房间
+    std::string inbuf;              // 尚未凑成完整一行的接收数据
+    std::string outbuf;             // 发送缓冲区满时积压的数据，等待 EPOLLOUT
+    size_t mem_bytes;               // 计入本连接的内存（见内存记账）
+    unsigned long long recent_in;   // 最近一段时间的输入字节数（按 tick 衰减）
+    bool read_paused;               // 过载保护：暂停读取该连接
+    uint64_t udp_token;             // UDP 旁路令牌（未启用时为 0）
+    bool udp_bound;                 // 是否已从 UDP 旁路收到过该连接的数据报
+    struct sockaddr_in udp_addr;    // UDP 回送地址（最近一次的源地址）
+    long long last_typing_ms;       // 最近一次转发输入提示的时间
+    bool overflowed;                // 不能丢弃的消息超出积压上限，本轮事件循环结束时断开
 };
 
 // 全局变量：客户端映射表 (fd -> ClientInfo)
 std::map<int, ClientInfo> g_clients;
 
+// 全局变量：本节点房间成员表 (房间名 -> 本地成员 fd 集合)
+std::map<std::string, std::set<int> > g_rooms;
+
+// ======================== 内存记账与过载保护 ========================
+
+/*
+ * 每个连接的缓冲区（未成行的输入 inbuf、积压的输出 outbuf）以及连接本身的
+ * 固定开销都记到该连接名下，同时累加到全局预算中：
+ *
+ *   used = Σ 连接内存 + 节点链路缓冲区
+ *
+ * 全局用量越过阈值时按档位逐级处理（带回差，低于进入阈值 10 个百分点才降档）：
+ *
+ *   档位 1 (>= 60%): 暂停读取最重的发送者（最近输入字节最多的 10%）
+ *   档位 2 (>= 80%): 丢弃大块流量：大消息直接丢弃，已积压的连接不再接收聊天消息
+ *   档位 3 (>= 95%): 断开内存占用最大的连接，直到回落到档位 2 以下
+ *
+ * 另有单连接硬上限：超长的未成行输入直接断开，超大的输出积压丢弃新消息。
+ */
+
+const size_t DEFAULT_MEM_BUDGET = 256 * 1024 * 1024;  // 默认全局预算（可用 -m 覆盖，单位 MB）
+const size_t CLIENT_OVERHEAD = 512;                    // 每个连接的固定开销估算（结构体 + map 节点）
+const size_t MAX_LINE_BYTES = 64 * 1024;               // 单行最大长度
+const size_t MAX_CLIENT_OUTBUF = 4 * 1024 * 1024;      // 单连接输出积压上限
+const size_t BULK_MSG_BYTES = 512;                     // 档位 2 下视为"大块"的消息长度
+const size_t MAX_REPLY_BACKLOG = 64 * 1024;            // 积压超过此值仍在发命令的连接直接断开
+const unsigned long long PAUSE_MIN_RECENT_IN = 16 * 1024;  // 最近输入低于此值的连接不算"重发送者"
+const int MEM_TIER_PERCENT[4] = {0, 60, 80, 95};       // 各档位的进入阈值
+const int MEM_HYSTERESIS_PERCENT = 10;                 // 回差：低于进入阈值 10 个百分点才降档
+
+struct MemoryStats {
+    size_t budget;                      // 全局预算
+    size_t client_bytes;                // 所有连接的内存
+    size_t peer_bytes;                  // 节点链路缓冲区
+    size_t peak;                        // 历史峰值
+    int tier;                           // 当前档位 0-3
+    unsigned long long paused;          // 累计暂停读取次数
+    unsigned long long dropped;         // 累计丢弃的消息数
+    unsigned long long evicted;         // 累计因过载断开的连接数
+};
+
+MemoryStats g_mem = {DEFAULT_MEM_BUDGET, 0, 0, 0, 0, 0, 0, 0};
+
+size_t mem_used() {
+    return g_mem.client_bytes + g_mem.peer_bytes;
+}
+
+/*
+ * ============================================================================
+ * 函数名: recharge_client
+ * 功能: 缓冲区变化后重新计算连接的内存，并把差值计入全局用量
+ * ============================================================================
+ */
+void recharge_client(ClientInfo& client) {
+    size_t bytes = CLIENT_OVERHEAD + client.inbuf.size() + client.outbuf.size();
+    g_mem.client_bytes = g_mem.client_bytes - client.mem_bytes + bytes;
+    client.mem_bytes = bytes;
+    if (mem_used() > g_mem.peak) {
+        g_mem.peak = mem_used();
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: update_memory_tier
+ * 功能: 根据当前全局用量重新计算档位（只计算不执行动作，开销很小，
+ *       在发送和接收的热路径上随时调用）
+ * 返回值: 更新前的档位
+ * ============================================================================
+ */
+int update_memory_tier() {
+    int percent = (int)(mem_used() * 100 / g_mem.budget);
+
+    int target = 0;
+    for (int t = 3; t >= 1; t--) {
+        if (percent >= MEM_TIER_PERCENT[t]) {
+            target = t;
+            break;
+        }
+    }
+
+    int old_tier = g_mem.tier;
+    if (target > g_mem.tier) {
+        g_mem.tier = target;
+    } else {
+        // 带回差逐级降档，避免在阈值附近反复抖动
+        while (g_mem.tier > target &&
+               percent < MEM_TIER_PERCENT[g_mem.tier] - MEM_HYSTERESIS_PERCENT) {
+            g_mem.tier--;
+        }
+    }
+
+    if (g_mem.tier != old_tier) {
+        std::cout << "[过载] 内存档位 " << old_tier << " -> " << g_mem.tier
+                  << " (使用 " << mem_used() / 1024 << " KB, " << percent << "%)" << std::endl;
+    }
+    return old_tier;
+}
+
+/*
+ * 消息的来源，由调用方显式给出（不按文本前缀判断，用户的昵称和消息可以伪造任何前缀）：
+ *
+ *   MSG_CHAT   - 用户聊天（包括其他节点转发来的房间消息）：档位 2 下可丢弃，积压超过上限时丢弃
+ *   MSG_NOTICE - 服务器发往房间的通知和名单增量：不能丢（名单会与服务器不一致），
+ *                积压超过 MAX_CLIENT_OUTBUF 时断开该连接
+ *   MSG_REPLY  - 对本连接命令的回复（/who、/stats 等）：积压已超过 MAX_REPLY_BACKLOG
+ *                仍在发命令的连接（只发不收）直接断开
+ */
+enum MessageKind {
+    MSG_CHAT,
+    MSG_NOTICE,
+    MSG_REPLY
+};
+
+/*
+ * ============================================================================
+ * 函数名: format_memory_stats
+ * 功能: 生成当前内存用量报告（/stats 命令）
+ * 参数: client - 附带该连接自身的用量，可为 nullptr
+ * ============================================================================
+ */
+std::string format_memory_stats(const ClientInfo* client) {
+    size_t used = mem_used();
+    std::string report = "[系统] 内存: 使用 " + std::to_string(used / 1024) + " KB / 预算 "
+                       + std::to_string(g_mem.budget / 1024) + " KB ("
+                       + std::to_string(used * 100 / g_mem.budget) + "%), 峰值 "
+                       + std::to_string(g_mem.peak / 1024) + " KB, 档位 "
+                       + std::to_string(g_mem.tier) + ", 暂停读取 "
+                       + std::to_string(g_mem.paused) + " 次, 丢弃 "
+                       + std::to_string(g_mem.dropped) + " 条, 断开 "
+                       + std::to_string(g_mem.evicted) + " 个\n";
+    if (client != nullptr) {
+        report += "[系统] 本连接: " + std::to_string(client->mem_bytes) + " 字节 (输入 "
+                + std::to_string(client->inbuf.size()) + ", 输出积压 "
+                + std::to_string(client->outbuf.size()) + ")\n";
+    }
+    return report;
+}
+
+// ======================== 集群中继总线 (Cluster Relay Bus) ========================
+
+/*
+ * 集群模式说明：
+ *   每个节点除了客户端端口外，还监听一个集群端口 (-c)，并主动拨号到 -P 指定的对端。
+ *   节点之间是持久 TCP 链路，链路上传输长度前缀的二进制帧：
+ *
+ *     +----------------+----------+------------------+
+ *     | len (4 字节)   | type (1) | payload (len-1)  |
+ *     +----------------+----------+------------------+
+ *
+ *   - HELLO:      携带节点 ID，用于识别对端、去除重复链路
+ *   - ROOM_JOIN:  "本节点在该房间有了第一个成员"（成员关系 gossip）
+ *   - ROOM_LEAVE: "本节点在该房间的最后一个成员离开了"
+ *   - CHAT:       房间名 + 已格式化的消息文本
+ *   - PRESENCE:   在线名单变化（加入/离开/改名），见"在线名单"一节
+ *
+ *   由于每个节点都知道对端关心哪些房间，一条消息只会向"有成员的节点"各转发一次，
+ *   而不是对每个远端用户各发一次。收到的 CHAT 只投递给本地成员，不再二次转发，
+ *   因此全互联 (full mesh) 拓扑下不会形成环路。
+ *
+ *   所有帧先追加到链路的发送缓冲区，在每轮事件循环结束时统一 flush，
+ *   同一轮中产生的多帧合并为一次 send（批量发送）。
+ */
+
+const int CLUSTER_RECONNECT_MS = 1000;              // 拨号失败后的重连间隔
+const uint32_t PEER_MAX_FRAME = 1024 * 1024;        // 单帧最大长度
+const size_t PEER_MAX_OUTBUF = 16 * 1024 * 1024;    // 链路发送缓冲区上限
+
+// 节点间帧类型
+enum FrameType {
+    FRAME_HELLO      = 1,
+    FRAME_ROOM_JOIN  = 2,
+    FRAME_ROOM_LEAVE = 3,
+    FRAME_CHAT       = 4,
+    FRAME_PRESENCE   = 5
+};
+
+// 节点间链路
+struct PeerLink {
+    int fd;                         // 链路套接字
+    int node_id;                    // 对端节点 ID（收到 HELLO 之前为 -1）
+    bool outgoing;                  // true: 本节点主动拨出; false: 对端接入
+    bool connecting;                // 非阻塞 connect 是否仍在进行
+    int dial_index;                 // 对应 g_peer_addrs 的下标（接入链路为 -1）
+    std::string inbuf;              // 未解析完的接收数据
+    std::string outbuf;             // 待批量发送的帧
+    std::set<std::string> rooms;    // 对端节点上有成员的房间
+};
+
+// 需要主动拨号的对端地址
+struct PeerAddr {
+    std::string host;
+    int port;
+    int fd;                         // 当前链路 fd，未连接为 -1
+    long long next_dial_ms;         // 下次允许拨号的时间
+    int served_by_fd;               // 拨出链路因去重让给了对端拨入的链路时为那条链路的 fd，期间不重拨；否则为 -1
+};
+
+// 集群统计，用于观察批量效果
+struct ClusterStats {
+    unsigned long long frames_out;      // 发出的帧数
+    unsigned long long batches_out;     // 发出的批次数（send 调用次数）
+    unsigned long long bytes_out;       // 发出的字节数
+    unsigned long long frames_in;       // 收到的帧数
+};
+
+int g_node_id = 0;                              // 本节点 ID (-n)
+int g_cluster_sock = -1;                        // 集群监听套接字
+std::map<int, PeerLink> g_peers;                // 链路表 (fd -> PeerLink)
+std::vector<PeerAddr> g_peer_addrs;             // 拨号目标
+ClusterStats g_cluster_stats = {0, 0, 0, 0};
+
+/*
+ * ============================================================================
+ * 函数名: now_ms
+ * 功能: 获取单调时钟的毫秒数，用于定时器
+ * ============================================================================
+ */
+long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /*
  * ============================================================================
  * 函数名: set_nonblocking
@@ -69,10 +317,11 @@ bool set_nonblocking(int fd) {
  * ============================================================================
  * 函数名: create_listen_socket
  * 功能: 创建并初始化监听套接字
+ * 参数: port - 监听端口
  * 返回值: 监听套接字的文件描述符，失败返回 -1
  * ============================================================================
  */
-int create_listen_socket() {
+int create_listen_socket(int port) {
     // 1. 创建套接字
     int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_sock == -1) {
@@ -97,7 +346,7 @@ int create_listen_socket() {
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;  // 监听所有网络接口
-    server_addr.sin_port = htons(PORT);
+    server_addr.sin_port = htons(port);
 
     if (bind(listen_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         std::cerr << "[错误] bind 失败: " << strerror(errno) << std::endl;
@@ -112,251 +361,1718 @@ int create_listen_socket() {
         return -1;
     }
 
-    std::cout << "[成功] 服务器启动，监听端口: " << PORT << std::endl;
-    return listen_sock;
+    std::cout << "[成功] 服务器启动，监听端口: " << port << std::endl;
+    return listen_sock;
+}
+
+/*
+ * ============================================================================
+ * 函数名: flush_client
+ * 功能: 尽量发送连接积压的 outbuf
+ * 返回值: false 表示连接出错，需要关闭
+ * ============================================================================
+ */
+bool flush_client(ClientInfo& client) {
+    while (!client.outbuf.empty()) {
+        ssize_t sent = send(client.sock_fd, client.outbuf.data(), client.outbuf.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            client.outbuf.erase(0, sent);
+        } else if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+            break;  // 等待下一次 EPOLLOUT
+        } else {
+            return false;
+        }
+    }
+    if (client.outbuf.empty() && client.outbuf.capacity() > BUFFER_SIZE * 16) {
+        std::string().swap(client.outbuf);  // 积压清空后归还大块内存
+    }
+    recharge_client(client);
+    return true;
+}
+
+/*
+ * ============================================================================
+ * 函数名: send_to_client
+ * 功能: 向一个客户端发送消息
+ * 参数:
+ *   client - 目标客户端
+ *   message - 要发送的消息
+ * 说明:
+ *   1. 没有积压时直接非阻塞 send（快速路径）
+ *   2. 发送缓冲区满（EWOULDBLOCK/EAGAIN）时，剩余部分进入 outbuf，等待 EPOLLOUT
+ *   3. 过载档位 2 及以上，或积压超过单连接上限时，丢弃聊天消息；
+ *      通知和命令回复不丢弃，超过各自的上限时标记连接，本轮结束时断开（见 MessageKind）
+ * ============================================================================
+ */
+void send_to_client(ClientInfo& client, const std::string& message, MessageKind kind) {
+    if (client.overflowed) {
+        return;
+    }
+    if (kind == MSG_CHAT) {
+        update_memory_tier();
+        bool shed = g_mem.tier >= 2 && (message.size() >= BULK_MSG_BYTES || !client.outbuf.empty());
+        if (shed || client.outbuf.size() + message.size() > MAX_CLIENT_OUTBUF) {
+            g_mem.dropped++;
+            return;
+        }
+    } else if ((kind == MSG_REPLY && client.outbuf.size() > MAX_REPLY_BACKLOG) ||
+               client.outbuf.size() + message.size() > MAX_CLIENT_OUTBUF) {
+        client.overflowed = true;
+        return;
+    }
+
+    size_t off = 0;
+    if (client.outbuf.empty()) {
+        ssize_t sent = send(client.sock_fd, message.c_str(), message.length(), MSG_NOSIGNAL);
+        if (sent == (ssize_t)message.length()) {
+            return;
+        }
+        if (sent > 0) {
+            off = sent;
+        } else if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) {
+            // 连接已出错，等 EPOLLERR/EPOLLHUP 统一关闭
+            return;
+        }
+    }
+
+    client.outbuf.append(message, off, std::string::npos);
+    recharge_client(client);
+}
+
+/*
+ * ============================================================================
+ * 函数名: broadcast_message
+ * 功能: 广播消息给所有客户端（除了发送者自己）
+ * 参数:
+ *   sender_fd - 发送者的文件描述符（-1 表示系统消息，发给所有人）
+ *   message - 要广播的消息
+ *   kind - 消息来源（见 MessageKind）
+ * 说明: 发送缓冲区满时数据进入连接的 outbuf，由 EPOLLOUT 继续发送
+ * ============================================================================
+ */
+void broadcast_message(int sender_fd, const std::string& message, MessageKind kind) {
+    // 遍历所有连接的客户端
+    for (auto& pair : g_clients) {
+        int client_fd = pair.first;
+
+        // 不发送给自己
+        if (client_fd == sender_fd) {
+            continue;
+        }
+
+        send_to_client(pair.second, message, kind);
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: broadcast_to_room
+ * 功能: 把消息投递给本节点某个房间内的成员（除了发送者自己）
+ * 参数:
+ *   room - 房间名
+ *   sender_fd - 发送者 fd（-1 表示系统消息或来自其他节点的消息）
+ *   message - 要投递的消息
+ *   kind - 消息来源（见 MessageKind）
+ * 说明: 只遍历房间成员而不是整个 g_clients
+ * ============================================================================
+ */
+void broadcast_to_room(const std::string& room, int sender_fd, const std::string& message,
+                       MessageKind kind) {
+    auto rit = g_rooms.find(room);
+    if (rit == g_rooms.end()) {
+        return;  // 本节点没有该房间的成员
+    }
+
+    for (int client_fd : rit->second) {
+        if (client_fd == sender_fd) {
+            continue;
+        }
+
+        auto it = g_clients.find(client_fd);
+        if (it != g_clients.end()) {
+            send_to_client(it->second, message, kind);
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: append_frame
+ * 功能: 将一帧追加到链路的发送缓冲区（不立即发送，等待批量 flush）
+ * 参数:
+ *   link - 目标链路
+ *   type - 帧类型
+ *   payload - 帧内容
+ * ============================================================================
+ */
+void append_frame(PeerLink& link, uint8_t type, const std::string& payload) {
+    uint32_t len = htonl((uint32_t)payload.size() + 1);
+    link.outbuf.append((const char*)&len, sizeof(len));
+    link.outbuf.push_back((char)type);
+    link.outbuf.append(payload);
+    g_cluster_stats.frames_out++;
+}
+
+// ======================== 在线名单 (Presence) ========================
+
+/*
+ * 每个房间维护一份带版本号的名单（包括集群中其他节点上的成员）：
+ *   - 每次加入/离开/改名，版本号 +1，并把这条变化记入最近 ROSTER_HISTORY 条历史
+ *   - 变化不立即推送，而是每个 tick 合并一次：同一成员在一个 tick 内
+ *     先加入后离开会被抵消，多次改名只保留最终结果
+ *   - 房间成员每个 tick 最多收到一条 "[名单]" 增量消息，流量与变化数成正比，
+ *     不会因为加入风暴而对每个新成员重发整份名单
+ *   - 客户端用 /who 获取全量快照（带版本号），之后用 /who <版本号> 补齐增量；
+ *     版本太旧（已不在历史中）时退化为全量快照
+ *
+ * 消息格式:
+ *   [名单] 大厅 v3->v5 +alice -bob ~carol>dave     (增量)
+ *   [名单] 大厅 v5 全量 3 人: alice carol erin     (快照)
+ *
+ * 集群模式下，本地成员的变化通过 PRESENCE 帧广播给所有对端，
+ * 链路断开时移除该节点上的所有成员。
+ */
+
+const size_t ROSTER_HISTORY = 1024;     // 每个房间保留的历史变化条数
+const size_t MAX_NICKNAME_BYTES = 32;   // 昵称最大长度
+const char* const RESERVED_NICK_PREFIXES[] = {"系统", "名单"};  // 服务器消息的标签，不能用作昵称
+
+// 一条名单变化
+struct RosterDelta {
+    unsigned long long version;     // 变化后的版本号
+    char op;                        // '+' 加入, '-' 离开, '~' 改名
+    std::string member;             // 成员 ID: "节点ID:fd"，集群内唯一
+    std::string nickname;           // 加入/改名后的昵称；离开时为离开前的昵称
+    std::string old_nickname;       // 改名前的昵称（仅 '~'）
+};
+
+// 一个房间的名单
+struct Roster {
+    unsigned long long version;                     // 当前版本号
+    unsigned long long pushed_version;              // 已推送给本地成员的版本号
+    std::map<std::string, std::string> members;     // 成员 ID -> 昵称
+    std::deque<RosterDelta> history;                // 最近的变化
+};
+
+std::map<std::string, Roster> g_rosters;
+
+std::string local_member_id(const ClientInfo& client) {
+    return std::to_string(g_node_id) + ":" + std::to_string(client.sock_fd);
+}
+
+/*
+ * ============================================================================
+ * 函数名: roster_apply
+ * 功能: 把一条变化应用到房间名单并记入历史（重复的变化会被忽略）
+ * ============================================================================
+ */
+void roster_apply(const std::string& room, char op,
+                  const std::string& member, const std::string& nickname) {
+    auto rit = g_rosters.find(room);
+    if (rit == g_rosters.end()) {
+        if (op != '+') {
+            return;
+        }
+        Roster roster;
+        roster.version = 0;
+        roster.pushed_version = 0;
+        rit = g_rosters.insert(std::make_pair(room, roster)).first;
+    }
+    Roster& roster = rit->second;
+
+    RosterDelta delta;
+    delta.op = op;
+    delta.member = member;
+    delta.nickname = nickname;
+
+    auto mit = roster.members.find(member);
+    if (op == '+') {
+        if (mit != roster.members.end()) {
+            return;  // 已在名单中（例如重复链路上收到的同一条变化）
+        }
+        roster.members[member] = nickname;
+    } else if (op == '-') {
+        if (mit == roster.members.end()) {
+            return;
+        }
+        delta.nickname = mit->second;
+        roster.members.erase(mit);
+    } else {
+        if (mit == roster.members.end() || mit->second == nickname) {
+            return;
+        }
+        delta.old_nickname = mit->second;
+        mit->second = nickname;
+    }
+
+    delta.version = ++roster.version;
+    roster.history.push_back(delta);
+    if (roster.history.size() > ROSTER_HISTORY) {
+        roster.history.pop_front();
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: broadcast_presence
+ * 功能: 把本地成员的名单变化通过 PRESENCE 帧发给所有对端节点
+ * 帧内容: op(1) + room_len(2) + room + id_len(1) + 成员ID + 昵称
+ * ============================================================================
+ */
+void append_presence_frame(PeerLink& link, char op, const std::string& room,
+                           const std::string& member, const std::string& nickname) {
+    std::string payload(1, op);
+    uint16_t room_len = htons((uint16_t)room.size());
+    payload.append((const char*)&room_len, sizeof(room_len));
+    payload.append(room);
+    payload.push_back((char)member.size());
+    payload.append(member);
+    payload.append(nickname);
+    append_frame(link, FRAME_PRESENCE, payload);
+}
+
+void broadcast_presence(char op, const std::string& room,
+                        const std::string& member, const std::string& nickname) {
+    for (auto& pair : g_peers) {
+        if (!pair.second.connecting) {
+            append_presence_frame(pair.second, op, room, member, nickname);
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: presence_change
+ * 功能: 本地成员的名单变化：更新本节点名单并通知其他节点
+ * ============================================================================
+ */
+void presence_change(const std::string& room, char op, const ClientInfo& client) {
+    std::string member = local_member_id(client);
+    roster_apply(room, op, member, client.nickname);
+    broadcast_presence(op, room, member, client.nickname);
+}
+
+/*
+ * ============================================================================
+ * 函数名: presence_purge_node
+ * 功能: 与某节点的链路断开后，从所有名单中移除该节点上的成员
+ * ============================================================================
+ */
+void presence_purge_node(int node_id) {
+    std::string prefix = std::to_string(node_id) + ":";
+    for (auto& pair : g_rosters) {
+        std::vector<std::string> gone;
+        for (auto& member : pair.second.members) {
+            if (member.first.compare(0, prefix.size(), prefix) == 0) {
+                gone.push_back(member.first);
+            }
+        }
+        for (const std::string& member : gone) {
+            roster_apply(pair.first, '-', member, "");
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: format_roster_snapshot
+ * 功能: 生成房间的全量名单
+ * ============================================================================
+ */
+std::string format_roster_snapshot(const std::string& room, const Roster& roster) {
+    std::string msg = "[名单] " + room + " v" + std::to_string(roster.version)
+                    + " 全量 " + std::to_string(roster.members.size()) + " 人:";
+    for (auto& member : roster.members) {
+        msg += " " + member.second;
+    }
+    return msg + "\n";
+}
+
+/*
+ * ============================================================================
+ * 函数名: format_roster_deltas
+ * 功能: 生成从 since 版本到当前版本的合并增量
+ * 返回值: 增量消息；历史不足以覆盖 since 时返回全量快照
+ * 说明: 按成员合并：只比较"起点状态"和"终点状态"，
+ *       中间的加入又离开、多次改名都会被折叠
+ * ============================================================================
+ */
+std::string format_roster_deltas(const std::string& room, const Roster& roster,
+                                 unsigned long long since) {
+    if (since > roster.version ||
+        (!roster.history.empty() && since + 1 < roster.history.front().version) ||
+        (roster.history.empty() && since < roster.version)) {
+        return format_roster_snapshot(room, roster);
+    }
+
+    // 每个成员的起点/终点状态
+    struct NetChange {
+        bool before;
+        bool after;
+        std::string before_nick;
+        std::string after_nick;
+    };
+    std::map<std::string, NetChange> net;
+    std::vector<std::string> order;
+
+    for (const RosterDelta& d : roster.history) {
+        if (d.version <= since) {
+            continue;
+        }
+        auto it = net.find(d.member);
+        if (it == net.end()) {
+            NetChange change;
+            change.before = d.op != '+';
+            change.before_nick = d.op == '~' ? d.old_nickname : d.nickname;
+            it = net.insert(std::make_pair(d.member, change)).first;
+            order.push_back(d.member);
+        }
+        it->second.after = d.op != '-';
+        it->second.after_nick = d.nickname;
+    }
+
+    std::string changes;
+    for (const std::string& member : order) {
+        const NetChange& c = net[member];
+        if (!c.before && c.after) {
+            changes += " +" + c.after_nick;
+        } else if (c.before && !c.after) {
+            changes += " -" + c.before_nick;
+        } else if (c.before && c.after && c.before_nick != c.after_nick) {
+            changes += " ~" + c.before_nick + ">" + c.after_nick;
+        }
+    }
+
+    return "[名单] " + room + " v" + std::to_string(since) + "->v"
+         + std::to_string(roster.version) + changes + "\n";
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_who_command
+ * 功能: /who [版本号]：无参数返回全量快照，带版本号返回之后的增量
+ * ============================================================================
+ */
+void handle_who_command(ClientInfo& client, const std::string& arg) {
+    auto rit = g_rosters.find(client.room);
+    if (rit == g_rosters.end()) {
+        return;
+    }
+    const Roster& roster = rit->second;
+
+    if (arg.empty()) {
+        send_to_client(client, format_roster_snapshot(client.room, roster), MSG_REPLY);
+        return;
+    }
+
+    unsigned long long since = strtoull(arg.c_str(), nullptr, 10);
+    if (since == roster.version) {
+        send_to_client(client, "[名单] " + client.room + " v" + std::to_string(since) + " 已是最新\n", MSG_REPLY);
+        return;
+    }
+    send_to_client(client, format_roster_deltas(client.room, roster, since), MSG_REPLY);
+}
+
+/*
+ * ============================================================================
+ * 函数名: presence_tick
+ * 功能: 每个 tick 把各房间积累的名单变化合并成一条增量，推送给本地成员
+ * ============================================================================
+ */
+void presence_tick() {
+    for (auto it = g_rosters.begin(); it != g_rosters.end(); ) {
+        Roster& roster = it->second;
+        if (roster.version > roster.pushed_version) {
+            std::string msg = format_roster_deltas(it->first, roster, roster.pushed_version);
+            std::string empty = "[名单] " + it->first + " v" + std::to_string(roster.pushed_version)
+                              + "->v" + std::to_string(roster.version) + "\n";
+            roster.pushed_version = roster.version;
+            // 净变化为空（例如加入后立即离开）时不推送
+            if (msg != empty) {
+                broadcast_to_room(it->first, -1, msg, MSG_NOTICE);
+            }
+        }
+
+        // 所有成员都已离开的房间不再保留名单
+        if (roster.members.empty()) {
+            it = g_rosters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: send_hello
+ * 功能: 链路建立后发送 HELLO、本节点关心的房间以及本地成员名单
+ * 说明: 对端据此重建"本节点关心哪些房间"和名单，链路断开重连后也能自动恢复
+ * ============================================================================
+ */
+void send_hello(PeerLink& link) {
+    uint32_t id = htonl((uint32_t)g_node_id);
+    append_frame(link, FRAME_HELLO, std::string((const char*)&id, sizeof(id)));
+
+    for (auto& pair : g_rooms) {
+        if (!pair.second.empty()) {
+            append_frame(link, FRAME_ROOM_JOIN, pair.first);
+        }
+    }
+
+    // 本地成员的名单快照
+    std::string prefix = std::to_string(g_node_id) + ":";
+    for (auto& pair : g_rosters) {
+        for (auto& member : pair.second.members) {
+            if (member.first.compare(0, prefix.size(), prefix) == 0) {
+                append_presence_frame(link, '+', pair.first, member.first, member.second);
+            }
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: gossip_room_interest
+ * 功能: 向所有对端通告本节点对某房间的兴趣变化
+ * 参数:
+ *   room - 房间名
+ *   joined - true: 第一个本地成员加入; false: 最后一个本地成员离开
+ * ============================================================================
+ */
+void gossip_room_interest(const std::string& room, bool joined) {
+    for (auto& pair : g_peers) {
+        PeerLink& link = pair.second;
+        if (link.connecting) {
+            continue;  // 连接建立后会通过 send_hello 发送完整快照
+        }
+        append_frame(link, joined ? FRAME_ROOM_JOIN : FRAME_ROOM_LEAVE, room);
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: relay_to_peers
+ * 功能: 把房间消息转发给所有"在该房间有成员"的对端节点，每个节点一次
+ * ============================================================================
+ */
+void relay_to_peers(const std::string& room, const std::string& message) {
+    std::string payload;
+    uint16_t room_len = htons((uint16_t)room.size());
+    payload.append((const char*)&room_len, sizeof(room_len));
+    payload.append(room);
+    payload.append(message);
+
+    for (auto& pair : g_peers) {
+        PeerLink& link = pair.second;
+        if (link.node_id < 0 || link.rooms.count(room) == 0) {
+            continue;  // 对端尚未握手，或对端没有该房间的成员
+        }
+        append_frame(link, FRAME_CHAT, payload);
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: publish_to_room
+ * 功能: 房间消息的统一出口：投递给本地成员，并经中继总线转发给其他节点
+ * ============================================================================
+ */
+void publish_to_room(const std::string& room, int sender_fd, const std::string& message,
+                     MessageKind kind) {
+    broadcast_to_room(room, sender_fd, message, kind);
+    relay_to_peers(room, message);
+}
+
+/*
+ * ============================================================================
+ * 函数名: join_room / leave_room
+ * 功能: 维护本地房间成员表，并在房间"从无到有/从有到无"时 gossip 给对端；
+ *       同时记录在线名单的变化
+ * ============================================================================
+ */
+void join_room(ClientInfo& client, const std::string& room) {
+    client.room = room;
+    std::set<int>& members = g_rooms[room];
+    members.insert(client.sock_fd);
+    if (members.size() == 1) {
+        gossip_room_interest(room, true);
+    }
+    presence_change(room, '+', client);
+}
+
+void leave_room(ClientInfo& client) {
+    presence_change(client.room, '-', client);
+
+    auto rit = g_rooms.find(client.room);
+    if (rit == g_rooms.end()) {
+        return;
+    }
+    rit->second.erase(client.sock_fd);
+    if (rit->second.empty()) {
+        g_rooms.erase(rit);
+        gossip_room_interest(client.room, false);
+    }
+}
+
+// ======================== UDP 旁路 (输入提示 / 心跳) ========================
+
+/*
+ * "正在输入"提示和心跳都是转瞬即逝的事件：丢几个无所谓，但如果走 TCP 广播路径，
+ * 它们会排在真正的聊天消息后面（队头阻塞），还会占用连接的输出积压。
+ * 启用 -u <端口> 后，服务器额外监听一个 UDP 端口专门承载这类事件：
+ *
+ *   - 每个 TCP 连接在欢迎消息中拿到一个随机 64 位令牌。UDP 数据报携带正确的令牌
+ *     才会被处理，服务器据此把数据报关联到 TCP 会话，并记下其源地址作为回送地址
+ *   - 接收用 recvmmsg 一次取一批数据报；本批产生的所有回包先攒起来，
+ *     再用 sendmmsg 一次发出
+ *   - 发送缓冲区满 (EAGAIN) 时直接丢弃剩余回包，从不排队；TCP 队列看不到这类流量
+ *   - 只在本节点内扇出，不经过集群链路
+ *
+ * 客户端 -> 服务器:  token(8, 网络字节序) + type(1) + 载荷
+ *   UDP_TYPING: 载荷 1 字节，1 = 开始输入，0 = 停止输入
+ *   UDP_PING:   载荷任意（不超过 UDP_MAX_PING_PAYLOAD 字节），原样回显为 PONG
+ * 服务器 -> 客户端:  type(1) + 载荷
+ *   UDP_TYPING: state(1) + 昵称    （发给同房间其他已登记 UDP 地址的成员）
+ *   UDP_PONG:   PING 的载荷
+ */
+
+const int UDP_BATCH = 64;                       // recvmmsg / sendmmsg 每批的数据报数
+const size_t UDP_MAX_DATAGRAM = 512;            // 单个数据报上限
+const size_t UDP_MAX_PING_PAYLOAD = 64;         // PING 载荷上限
+const long long UDP_TYPING_MIN_MS = 100;        // 同一连接输入提示的最小间隔，防止被用来放大流量
+
+enum UdpType {
+    UDP_TYPING = 1,
+    UDP_PING   = 2,
+    UDP_PONG   = 3
+};
+
+struct UdpStats {
+    unsigned long long received;    // 收到的数据报
+    unsigned long long rejected;    // 令牌无效或格式错误
+    unsigned long long sent;        // 发出的数据报
+    unsigned long long dropped;     // 发送缓冲区满而丢弃的数据报
+};
+
+int g_udp_sock = -1;                            // UDP 旁路套接字，-1 表示未启用
+int g_udp_port = 0;
+std::map<uint64_t, int> g_udp_tokens;           // 令牌 -> 客户端 fd
+UdpStats g_udp_stats = {0, 0, 0, 0};
+
+// 待发数据报批次
+struct mmsghdr g_udp_out_msgs[UDP_BATCH];
+struct iovec g_udp_out_iovs[UDP_BATCH];
+struct sockaddr_in g_udp_out_addrs[UDP_BATCH];
+char g_udp_out_bufs[UDP_BATCH][UDP_MAX_DATAGRAM];
+int g_udp_out_count = 0;
+
+/*
+ * ============================================================================
+ * 函数名: issue_udp_token
+ * 功能: 为新连接生成一个随机且不重复的 UDP 令牌
+ * ============================================================================
+ */
+void issue_udp_token(ClientInfo& client) {
+    uint64_t token = 0;
+    while (token == 0 || g_udp_tokens.count(token)) {
+        if (getrandom(&token, sizeof(token), 0) != (ssize_t)sizeof(token)) {
+            token = ((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ (uint64_t)now_ms();
+        }
+    }
+    client.udp_token = token;
+    g_udp_tokens[token] = client.sock_fd;
+}
+
+/*
+ * ============================================================================
+ * 函数名: flush_udp
+ * 功能: 用 sendmmsg 发出本批攒下的所有数据报；发不出去的直接丢弃
+ * ============================================================================
+ */
+void flush_udp() {
+    int offset = 0;
+    while (offset < g_udp_out_count) {
+        int n = sendmmsg(g_udp_sock, g_udp_out_msgs + offset, g_udp_out_count - offset, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN 或其他错误：丢弃剩余数据报，尽力而为
+            g_udp_stats.dropped += g_udp_out_count - offset;
+            break;
+        }
+        g_udp_stats.sent += n;
+        offset += n;
+    }
+    g_udp_out_count = 0;
+}
+
+/*
+ * ============================================================================
+ * 函数名: queue_udp
+ * 功能: 把一个数据报加入待发批次，批次满时先发出
+ * ============================================================================
+ */
+void queue_udp(const struct sockaddr_in& addr, uint8_t type, const std::string& payload) {
+    if (1 + payload.size() > UDP_MAX_DATAGRAM) {
+        return;
+    }
+    if (g_udp_out_count == UDP_BATCH) {
+        flush_udp();
+    }
+
+    int i = g_udp_out_count++;
+    g_udp_out_bufs[i][0] = (char)type;
+    memcpy(g_udp_out_bufs[i] + 1, payload.data(), payload.size());
+    g_udp_out_addrs[i] = addr;
+    g_udp_out_iovs[i].iov_base = g_udp_out_bufs[i];
+    g_udp_out_iovs[i].iov_len = 1 + payload.size();
+    memset(&g_udp_out_msgs[i], 0, sizeof(g_udp_out_msgs[i]));
+    g_udp_out_msgs[i].msg_hdr.msg_name = &g_udp_out_addrs[i];
+    g_udp_out_msgs[i].msg_hdr.msg_namelen = sizeof(g_udp_out_addrs[i]);
+    g_udp_out_msgs[i].msg_hdr.msg_iov = &g_udp_out_iovs[i];
+    g_udp_out_msgs[i].msg_hdr.msg_iovlen = 1;
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_udp_datagram
+ * 功能: 校验令牌并处理一个 UDP 数据报
+ * ============================================================================
+ */
+void handle_udp_datagram(const char* data, size_t len, const struct sockaddr_in& from) {
+    if (len < sizeof(uint64_t) + 1) {
+        g_udp_stats.rejected++;
+        return;
+    }
+
+    uint64_t token;
+    memcpy(&token, data, sizeof(token));
+    token = be64toh(token);
+    auto tit = g_udp_tokens.find(token);
+    if (tit == g_udp_tokens.end()) {
+        g_udp_stats.rejected++;
+        return;
+    }
+    ClientInfo& client = g_clients[tit->second];
+
+    // 以最近一次的源地址为准（客户端换了端口或经过 NAT 重新映射）
+    client.udp_addr = from;
+    client.udp_bound = true;
+
+    uint8_t type = (uint8_t)data[sizeof(uint64_t)];
+    const char* payload = data + sizeof(uint64_t) + 1;
+    size_t payload_len = len - sizeof(uint64_t) - 1;
+
+    if (type == UDP_PING) {
+        if (payload_len <= UDP_MAX_PING_PAYLOAD) {
+            queue_udp(from, UDP_PONG, std::string(payload, payload_len));
+        }
+        return;
+    }
+
+    if (type == UDP_TYPING && payload_len == 1) {
+        long long now = now_ms();
+        if (now - client.last_typing_ms < UDP_TYPING_MIN_MS) {
+            return;
+        }
+        client.last_typing_ms = now;
+
+        auto rit = g_rooms.find(client.room);
+        if (rit == g_rooms.end()) {
+            return;
+        }
+        std::string event = std::string(1, payload[0] ? 1 : 0) + client.nickname;
+        for (int fd : rit->second) {
+            if (fd == client.sock_fd) {
+                continue;
+            }
+            auto cit = g_clients.find(fd);
+            if (cit != g_clients.end() && cit->second.udp_bound) {
+                queue_udp(cit->second.udp_addr, UDP_TYPING, event);
+            }
+        }
+        return;
+    }
+
+    g_udp_stats.rejected++;
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_udp_readable
+ * 功能: 用 recvmmsg 批量读取数据报直到读空，最后把产生的回包一次发出
+ * ============================================================================
+ */
+void handle_udp_readable() {
+    static struct mmsghdr msgs[UDP_BATCH];
+    static struct iovec iovs[UDP_BATCH];
+    static struct sockaddr_in addrs[UDP_BATCH];
+    static char bufs[UDP_BATCH][UDP_MAX_DATAGRAM];
+
+    while (true) {
+        for (int i = 0; i < UDP_BATCH; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = UDP_MAX_DATAGRAM;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = recvmmsg(g_udp_sock, msgs, UDP_BATCH, MSG_DONTWAIT, nullptr);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;  // EAGAIN：已读空
+        }
+
+        for (int i = 0; i < n; i++) {
+            g_udp_stats.received++;
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                g_udp_stats.rejected++;
+                continue;
+            }
+            handle_udp_datagram(bufs[i], msgs[i].msg_len, addrs[i]);
+        }
+        if (n < UDP_BATCH) {
+            break;
+        }
+    }
+
+    flush_udp();
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_new_connection
+ * 功能: 处理新的客户端连接 (Case 1)
+ * 参数:
+ *   listen_sock - 监听套接字
+ *   epoll_fd - epoll 实例的文件描述符
+ * 说明:
+ *   1. 使用 accept 接受新连接
+ *   2. 将新连接设置为非阻塞
+ *   3. 将新连接添加到 epoll 实例中，监听 EPOLLIN | EPOLLET
+ * ============================================================================
+ */
+void handle_new_connection(int listen_sock, int epoll_fd) {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+
+    // 循环 accept，因为边缘触发模式下可能有多个连接等待
+    while (true) {
+        int client_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &addr_len);
+
+        if (client_sock == -1) {
+            // EWOULDBLOCK/EAGAIN: 没有更多连接了（正常情况）
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                break;  // 所有连接都处理完了
+            }
+            // 其他错误
+            std::cerr << "[错误] accept 失败: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        // 检查客户端数量限制
+        if (g_clients.size() >= MAX_CLIENTS) {
+            std::cerr << "[警告] 客户端数量已达上限，拒绝连接" << std::endl;
+            const char* msg = "服务器已满，请稍后再试\n";
+            send(client_sock, msg, strlen(msg), 0);
+            close(client_sock);
+            continue;
+        }
+
+        // 【关键】将客户端套接字设置为非阻塞
+        if (!set_nonblocking(client_sock)) {
+            close(client_sock);
+            continue;
+        }
+
+        // 准备 epoll 事件
+        // 可读 + 可写 + 边缘触发：EPOLLOUT 只在发送缓冲区"满 -> 可写"时通知，
+        // 用于继续发送 outbuf 中积压的数据
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.fd = client_sock;
+
+        // 【关键】使用 epoll_ctl 的 EPOLL_CTL_ADD 将客户端套接字添加到 epoll 实例
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &ev) == -1) {
+            std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD 失败: "
+                      << strerror(errno) << std::endl;
+            close(client_sock);
+            continue;
+        }
+
+        // 获取客户端 IP 和端口
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        int client_port = ntohs(client_addr.sin_port);
+
+        // 创建客户端信息
+        ClientInfo client_info;
+        client_info.sock_fd = client_sock;
+        client_info.nickname = "用户" + std::to_string(client_sock);  // 默认昵称
+        if (!g_peer_addrs.empty() || g_cluster_sock != -1) {
+            // 集群模式下加上节点 ID，避免不同节点的默认昵称冲突
+            client_info.nickname = "用户" + std::to_string(g_node_id) + "-" + std::to_string(client_sock);
+        }
+        client_info.ip = client_ip;
+        client_info.port = client_port;
+        client_info.connect_time = time(nullptr);
+        client_info.mem_bytes = 0;
+        client_info.recent_in = 0;
+        client_info.read_paused = false;
+        client_info.udp_token = 0;
+        client_info.udp_bound = false;
+        memset(&client_info.udp_addr, 0, sizeof(client_info.udp_addr));
+        client_info.last_typing_ms = 0;
+        client_info.overflowed = false;
+
+        // 添加到客户端列表，并进入默认房间
+        ClientInfo& client = g_clients[client_sock] = client_info;
+        recharge_client(client);
+        join_room(client, DEFAULT_ROOM);
+
+        std::cout << "[连接] 新客户端 fd=" << client_sock
+                  << " (" << client_ip << ":" << client_port << ")"
+                  << " 当前在线: " << g_clients.size() << std::endl;
+
+        // 向新客户端发送欢迎消息
+        std::string welcome = "=== 欢迎来到聊天室 ===\n"
+                             "当前在线人数: " + std::to_string(g_clients.size()) + "\n"
+                             "当前房间: " + client.room + "\n"
+                             "输入消息即可发送，/join <房间名> 切换房间，/nick <昵称> 改名，\n"
+                             "/who [版本号] 查看在线名单，/stats 查看内存用量\n";
+        if (g_udp_sock != -1) {
+            // UDP 旁路：客户端凭此令牌发送输入提示和心跳
+            issue_udp_token(client);
+            char token_hex[17];
+            snprintf(token_hex, sizeof(token_hex), "%016llx", (unsigned long long)client.udp_token);
+            welcome += "UDP 旁路: 端口 " + std::to_string(g_udp_port) + " 令牌 " + token_hex + "\n";
+        }
+        welcome += "====================\n";
+        send_to_client(client, welcome, MSG_REPLY);
+
+        // 广播新用户加入消息
+        std::string join_msg = "[系统] " + client.nickname + " 加入了聊天室\n";
+        publish_to_room(client.room, client_sock, join_msg, MSG_NOTICE);
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: valid_nickname
+ * 功能: 昵称不能为空、不能含空白，最长 MAX_NICKNAME_BYTES 字节；
+ *       不能含 '[' ']'（聊天行以 "[昵称]" 开头）和 '>'（名单增量用 "~旧名>新名" 表示改名），
+ *       也不能以服务器消息的标签开头，否则聊天行看起来就像 "[系统]" 通知
+ * ============================================================================
+ */
+bool valid_nickname(const std::string& nickname) {
+    if (nickname.empty() || nickname.size() > MAX_NICKNAME_BYTES ||
+        nickname.find_first_of(" \t[]>") != std::string::npos) {
+        return false;
+    }
+    for (const char* prefix : RESERVED_NICK_PREFIXES) {
+        if (nickname.compare(0, strlen(prefix), prefix) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_client_line
+ * 功能: 处理客户端发来的一行完整输入（命令或聊天消息）
+ * 参数:
+ *   client - 客户端信息
+ *   line - 不含换行符的一行文本
+ * 支持的命令:
+ *   /join <房间名> - 离开当前房间并加入新房间
+ *   /nick <昵称>   - 修改昵称（见 valid_nickname）
+ *   /who [版本号]  - 当前房间的在线名单：全量快照，或指定版本之后的增量
+ *   /stats         - 内存用量
+ * ============================================================================
+ */
+void handle_client_line(ClientInfo& client, const std::string& line) {
+    if (line.compare(0, 6, "/join ") == 0) {
+        std::string room = line.substr(6);
+        if (room.empty() || room == client.room) {
+            return;
+        }
+
+        std::string leave_msg = "[系统] " + client.nickname + " 离开了房间 " + client.room + "\n";
+        publish_to_room(client.room, client.sock_fd, leave_msg, MSG_NOTICE);
+        leave_room(client);
+
+        join_room(client, room);
+        std::string join_msg = "[系统] " + client.nickname + " 进入了房间 " + room + "\n";
+        publish_to_room(room, client.sock_fd, join_msg, MSG_NOTICE);
+
+        send_to_client(client, "[系统] 已进入房间: " + room + "\n", MSG_REPLY);
+        return;
+    }
+
+    if (line.compare(0, 6, "/nick ") == 0) {
+        std::string nickname = line.substr(6);
+        if (!valid_nickname(nickname)) {
+            send_to_client(client, "[系统] 昵称不能为空、不能含空白或 [ ] >、不能以\"系统\"\"名单\"开头，且不超过 "
+                                   + std::to_string(MAX_NICKNAME_BYTES) + " 字节\n", MSG_REPLY);
+            return;
+        }
+        if (nickname == client.nickname) {
+            return;
+        }
+
+        std::string rename_msg = "[系统] " + client.nickname + " 改名为 " + nickname + "\n";
+        client.nickname = nickname;
+        presence_change(client.room, '~', client);
+        publish_to_room(client.room, client.sock_fd, rename_msg, MSG_NOTICE);
+        send_to_client(client, "[系统] 昵称已改为: " + nickname + "\n", MSG_REPLY);
+        return;
+    }
+
+    if (line == "/who" || line.compare(0, 5, "/who ") == 0) {
+        handle_who_command(client, line.size() > 5 ? line.substr(5) : "");
+        return;
+    }
+
+    if (line == "/stats") {
+        send_to_client(client, format_memory_stats(&client), MSG_REPLY);
+        return;
+    }
+
+    // 格式化消息: [昵称] 消息内容
+    std::string formatted_msg = "[" + client.nickname + "] " + line + "\n";
+
+    std::cout << "[消息] fd=" << client.sock_fd << " " << formatted_msg;
+
+    // 广播消息给房间内所有其他成员（包括其他节点上的成员）
+    publish_to_room(client.room, client.sock_fd, formatted_msg, MSG_CHAT);
+}
+
+/*
+ * ============================================================================
+ * 函数名: process_client_lines
+ * 功能: 从连接的 inbuf 中拆出完整的行并逐行处理
+ * 返回值: false 表示未成行的数据超过 MAX_LINE_BYTES，或命令回复积压超限，需要关闭连接
+ * ============================================================================
+ */
+bool process_client_lines(ClientInfo& client) {
+    // TCP 是字节流，一次 recv 可能包含多行或半行，按 '\n' 拆分
+    size_t start = 0;
+    size_t nl;
+    while ((nl = client.inbuf.find('\n', start)) != std::string::npos) {
+        std::string line = client.inbuf.substr(start, nl - start);
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        start = nl + 1;
+        if (!line.empty()) {
+            handle_client_line(client, line);
+        }
+        if (client.overflowed) {
+            std::cerr << "[警告] 客户端 fd=" << client.sock_fd << " 只发命令不接收，积压超限，断开连接"
+                      << std::endl;
+            return false;
+        }
+    }
+    client.inbuf.erase(0, start);
+    recharge_client(client);
+
+    if (client.inbuf.size() > MAX_LINE_BYTES) {
+        std::cerr << "[警告] 客户端 fd=" << client.sock_fd << " 单行超过 "
+                  << MAX_LINE_BYTES << " 字节，断开连接" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * ============================================================================
+ * 函数名: handle_client_message
+ * 功能: 处理客户端发来的消息 (Case 2)
+ * 参数:
+ *   client_sock - 客户端套接字
+ *   epoll_fd - epoll 实例的文件描述符
+ * 返回值: true 继续保持连接, false 需要关闭连接
+ * 说明:
+ *   1. 非阻塞 recv，循环读取直到 EWOULDBLOCK
+ *   2. 处理客户端断开（recv 返回 0 或错误）
+ *   3. 每读到一块就按行处理，内存中只保留未成行的部分
+ *   4. 被过载保护暂停读取的连接直接返回，数据留在内核接收缓冲区，
+ *      TCP 流量控制会让对端自然减速
+ * ============================================================================
+ */
+bool handle_client_message(int client_sock, int epoll_fd) {
+    (void)epoll_fd;
+    auto it = g_clients.find(client_sock);
+    if (it == g_clients.end()) {
+        return false;
+    }
+    ClientInfo& client = it->second;
+    if (client.read_paused) {
+        return true;
+    }
+
+    char buffer[BUFFER_SIZE];
+
+    // 【关键】边缘触发模式下，必须循环 recv 直到 EWOULDBLOCK
+    // 因为边缘触发只在状态变化时通知一次
+    while (true) {
+        ssize_t bytes_read = recv(client_sock, buffer, BUFFER_SIZE, 0);
+
+        if (bytes_read > 0) {
+            // 成功读取数据，立即处理完整的行
+            client.recent_in += bytes_read;
+            client.inbuf.append(buffer, bytes_read);
+            if (!process_client_lines(client)) {
+                return false;
+            }
+            // 越过档位 1 时由本轮事件循环结束时的 enforce_memory_budget 挑选最重的发送者暂停，
+            // 这里不暂停：偶尔发几句话的连接碰巧在这时可读，不应当被当作重发送者
+
+            // 继续读取，直到读完所有数据
+        }
+        else if (bytes_read == 0) {
+            // 客户端正常关闭连接
+            std::cout << "[断开] 客户端 fd=" << client_sock
+                      << " 正常断开连接" << std::endl;
+            return false;  // 需要关闭连接
+        }
+        else {  // bytes_read == -1
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                // 【正常情况】没有更多数据可读了
+                break;
+            }
+            else if (errno == EINTR) {
+                // 被信号中断，继续读取
+                continue;
+            }
+            else {
+                // 其他错误，连接异常
+                std::cerr << "[错误] recv 失败 fd=" << client_sock
+                          << ": " << strerror(errno) << std::endl;
+                return false;  // 需要关闭连接
+            }
+        }
+    }
+
+    return true;  // 保持连接
+}
+
+/*
+ * ============================================================================
+ * 函数名: close_client_connection
+ * 功能: 关闭客户端连接并清理资源
+ * 参数:
+ *   client_sock - 客户端套接字
+ *   epoll_fd - epoll 实例的文件描述符
+ * 说明:
+ *   1. 使用 epoll_ctl 的 EPOLL_CTL_DEL 从 epoll 实例中移除
+ *   2. 关闭套接字
+ *   3. 从客户端列表和房间中删除
+ *   4. 广播用户离开消息
+ * ============================================================================
+ */
+void close_client_connection(int client_sock, int epoll_fd) {
+    auto it = g_clients.find(client_sock);
+    if (it == g_clients.end()) {
+        return;  // 客户端不存在
+    }
+
+    std::string nickname = it->second.nickname;
+    std::string room = it->second.room;
+
+    // 【关键】使用 epoll_ctl 的 EPOLL_CTL_DEL 将客户端从 epoll 实例中移除
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_sock, nullptr) == -1) {
+        std::cerr << "[警告] epoll_ctl EPOLL_CTL_DEL 失败 fd=" << client_sock
+                  << ": " << strerror(errno) << std::endl;
+    }
+
+    // 关闭套接字
+    close(client_sock);
+
+    // 从房间和客户端列表中删除，并释放记在该连接名下的内存
+    leave_room(it->second);
+    if (it->second.udp_token != 0) {
+        g_udp_tokens.erase(it->second.udp_token);
+    }
+    g_mem.client_bytes -= it->second.mem_bytes;
+    g_clients.erase(it);
+
+    std::cout << "[离线] " << nickname << " fd=" << client_sock
+              << " 已断开，当前在线: " << g_clients.size() << std::endl;
+
+    // 广播用户离开消息
+    std::string leave_msg = "[系统] " + nickname + " 离开了聊天室\n";
+    publish_to_room(room, -1, leave_msg, MSG_NOTICE);  // -1 表示发送给房间内所有人
+}
+
+// ======================== 过载保护动作 ========================
+
+/*
+ * ============================================================================
+ * 函数名: pause_heaviest_senders
+ * 功能: 档位 1：暂停读取最近输入字节最多的 10% 发送者（至少 1 个），
+ *       偶尔发几句话的普通用户（低于 PAUSE_MIN_RECENT_IN）不受影响
+ * ============================================================================
+ */
+void pause_heaviest_senders() {
+    std::vector<std::pair<unsigned long long, int> > senders;
+    for (auto& pair : g_clients) {
+        if (!pair.second.read_paused && pair.second.recent_in >= PAUSE_MIN_RECENT_IN) {
+            senders.push_back(std::make_pair(pair.second.recent_in, pair.first));
+        }
+    }
+    if (senders.empty()) {
+        return;
+    }
+
+    size_t count = std::max<size_t>(1, g_clients.size() / 10);
+    count = std::min(count, senders.size());
+    std::partial_sort(senders.begin(), senders.begin() + count, senders.end(),
+                      std::greater<std::pair<unsigned long long, int> >());
+
+    for (size_t i = 0; i < count; i++) {
+        ClientInfo& client = g_clients[senders[i].second];
+        client.read_paused = true;
+        g_mem.paused++;
+        std::cout << "[过载] 暂停读取 " << client.nickname << " fd=" << client.sock_fd
+                  << " (最近输入 " << senders[i].first << " 字节)" << std::endl;
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: resume_paused_readers
+ * 功能: 回到档位 0 后恢复所有被暂停的连接
+ * 说明: 边缘触发下暂停期间到达的数据不会再有新通知，必须主动读一次
+ * ============================================================================
+ */
+void resume_paused_readers(int epoll_fd) {
+    std::vector<int> paused;
+    for (auto& pair : g_clients) {
+        if (pair.second.read_paused) {
+            pair.second.read_paused = false;
+            paused.push_back(pair.first);
+        }
+    }
+    for (int fd : paused) {
+        if (g_clients.count(fd) && !handle_client_message(fd, epoll_fd)) {
+            close_client_connection(fd, epoll_fd);
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: close_overflowed_clients
+ * 功能: 断开通知积压超限的连接（send_to_client 中只做标记，遍历房间时不能直接关闭）
+ * 说明: 断开时发给房间的离开通知可能让其他连接也超限，循环到没有为止
+ * ============================================================================
+ */
+void close_overflowed_clients(int epoll_fd) {
+    while (true) {
+        std::vector<int> overflowed;
+        for (auto& pair : g_clients) {
+            if (pair.second.overflowed) {
+                overflowed.push_back(pair.first);
+            }
+        }
+        if (overflowed.empty()) {
+            return;
+        }
+        for (int fd : overflowed) {
+            auto it = g_clients.find(fd);
+            if (it == g_clients.end()) {
+                continue;
+            }
+            std::cerr << "[警告] 客户端 fd=" << fd << " 输出积压超过 " << MAX_CLIENT_OUTBUF
+                      << " 字节，断开连接" << std::endl;
+            g_mem.evicted++;
+            close_client_connection(fd, epoll_fd);
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: evict_worst_offenders
+ * 功能: 档位 3：按内存占用从大到小断开连接，直到回落到档位 2 的阈值以下
+ * ============================================================================
+ */
+void evict_worst_offenders(int epoll_fd) {
+    std::vector<std::pair<size_t, int> > offenders;
+    for (auto& pair : g_clients) {
+        offenders.push_back(std::make_pair(pair.second.mem_bytes, pair.first));
+    }
+    std::sort(offenders.begin(), offenders.end(), std::greater<std::pair<size_t, int> >());
+
+    size_t limit = g_mem.budget / 100 * MEM_TIER_PERCENT[2];
+    for (size_t i = 0; i < offenders.size() && mem_used() >= limit; i++) {
+        int fd = offenders[i].second;
+        auto it = g_clients.find(fd);
+        if (it == g_clients.end()) {
+            continue;
+        }
+        std::cout << "[过载] 断开 " << it->second.nickname << " fd=" << fd
+                  << " (占用 " << offenders[i].first << " 字节)" << std::endl;
+        const char* msg = "[系统] 服务器内存紧张，你的连接已被断开\n";
+        send(fd, msg, strlen(msg), MSG_NOSIGNAL);
+        g_mem.evicted++;
+        close_client_connection(fd, epoll_fd);
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: enforce_memory_budget
+ * 功能: 根据全局用量调整档位并执行对应动作（每轮事件循环结束时调用）
+ * 参数: tick - 是否为定时调用（定时调用时档位 1 会重新挑选最重的发送者）
+ * ============================================================================
+ */
+void enforce_memory_budget(int epoll_fd, bool tick) {
+    static int last_tier = 0;  // 上一次执行动作时的档位
+    update_memory_tier();
+    int old_tier = last_tier;
+    last_tier = g_mem.tier;
+
+    if (g_mem.tier >= 1 && (tick || g_mem.tier > old_tier)) {
+        pause_heaviest_senders();
+    }
+    if (g_mem.tier == 0 && old_tier > 0) {
+        resume_paused_readers(epoll_fd);
+    }
+    if (g_mem.tier >= 3) {
+        evict_worst_offenders(epoll_fd);
+    }
+}
+
+/*
+ * ============================================================================
+ * 函数名: memory_tick
+ * 功能: 内存记账定时任务：衰减"最近输入"计数，统计节点链路缓冲区
+ * ============================================================================
+ */
+void memory_tick(int epoll_fd) {
+    for (auto& pair : g_clients) {
+        pair.second.recent_in /= 2;
+    }
+
+    size_t peer_bytes = 0;
+    for (auto& pair : g_peers) {
+        peer_bytes += pair.second.inbuf.size() + pair.second.outbuf.size();
+    }
+    g_mem.peer_bytes = peer_bytes;
+
+    enforce_memory_budget(epoll_fd, true);
+}
+
+// ======================== 集群链路管理 ========================
+
+/*
+ * ============================================================================
+ * 函数名: register_peer_link
+ * 功能: 把一条节点链路加入 epoll 和链路表
+ * 说明: 链路固定监听 EPOLLIN | EPOLLOUT | EPOLLET，边缘触发下 EPOLLOUT
+ *       只在"不可写 -> 可写"时通知一次，无需反复 EPOLL_CTL_MOD
+ * ============================================================================
+ */
+bool register_peer_link(int fd, int epoll_fd, bool outgoing, bool connecting, int dial_index) {
+    // 节点链路上的帧很小且已批量合并，关闭 Nagle 避免额外延迟
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD 节点链路失败: "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+
+    PeerLink link;
+    link.fd = fd;
+    link.node_id = -1;
+    link.outgoing = outgoing;
+    link.connecting = connecting;
+    link.dial_index = dial_index;
+    g_peers[fd] = link;
+
+    if (!connecting) {
+        send_hello(g_peers[fd]);
+    }
+    return true;
+}
+
+/*
+ * ============================================================================
+ * 函数名: dial_peer
+ * 功能: 非阻塞地拨号到一个对端节点
+ * 参数: index - g_peer_addrs 下标
+ * ============================================================================
+ */
+void dial_peer(size_t index, int epoll_fd) {
+    PeerAddr& addr = g_peer_addrs[index];
+    addr.next_dial_ms = now_ms() + CLUSTER_RECONNECT_MS;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        std::cerr << "[错误] 节点链路 socket 创建失败: " << strerror(errno) << std::endl;
+        return;
+    }
+    if (!set_nonblocking(fd)) {
+        close(fd);
+        return;
+    }
+
+    struct sockaddr_in peer_addr;
+    memset(&peer_addr, 0, sizeof(peer_addr));
+    peer_addr.sin_family = AF_INET;
+    peer_addr.sin_port = htons(addr.port);
+    if (inet_pton(AF_INET, addr.host.c_str(), &peer_addr.sin_addr) <= 0) {
+        std::cerr << "[错误] 无效的节点地址: " << addr.host << std::endl;
+        close(fd);
+        return;
+    }
+
+    // 非阻塞 connect 通常返回 EINPROGRESS，完成后会触发 EPOLLOUT
+    bool connecting = false;
+    if (connect(fd, (struct sockaddr*)&peer_addr, sizeof(peer_addr)) == -1) {
+        if (errno != EINPROGRESS) {
+            close(fd);
+            return;
+        }
+        connecting = true;
+    }
+
+    if (!register_peer_link(fd, epoll_fd, true, connecting, (int)index)) {
+        close(fd);
+        return;
+    }
+    addr.fd = fd;
 }
 
 /*
  * ============================================================================
- * 函数名: broadcast_message
- * 功能: 广播消息给所有客户端（除了发送者自己）
- * 参数:
- *   sender_fd - 发送者的文件描述符（-1 表示系统消息，发给所有人）
- *   message - 要广播的消息
- * 说明: 非阻塞 send 可能返回 EWOULDBLOCK，这里简化处理，实际生产环境
- *       应该使用发送缓冲队列处理
+ * 函数名: close_peer_link
+ * 功能: 关闭节点链路；主动拨出的链路会在 CLUSTER_RECONNECT_MS 后重连，
+ *       代替拨出链路的拨入链路断开时立即恢复拨号，
+ *       与该节点的最后一条链路断开时清除其成员的在线名单
  * ============================================================================
  */
-void broadcast_message(int sender_fd, const std::string& message) {
-    // 遍历所有连接的客户端
-    for (auto& pair : g_clients) {
-        int client_fd = pair.first;
+void close_peer_link(int fd, int epoll_fd) {
+    auto it = g_peers.find(fd);
+    if (it == g_peers.end()) {
+        return;
+    }
 
-        // 不发送给自己
-        if (client_fd == sender_fd) {
-            continue;
+    int node_id = it->second.node_id;
+    if (node_id >= 0) {
+        std::cout << "[集群] 与节点 " << node_id << " 的链路断开 fd=" << fd << std::endl;
+    }
+    if (it->second.dial_index >= 0) {
+        g_peer_addrs[it->second.dial_index].fd = -1;
+    }
+    for (auto& addr : g_peer_addrs) {
+        if (addr.served_by_fd == fd) {
+            addr.served_by_fd = -1;
+            addr.next_dial_ms = 0;
         }
+    }
 
-        // 非阻塞发送
-        ssize_t sent = send(client_fd, message.c_str(), message.length(), MSG_NOSIGNAL);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    g_peers.erase(it);
 
-        if (sent == -1) {
-            // EWOULDBLOCK/EAGAIN: 发送缓冲区满，数据暂时无法发送
-            // 生产环境应该将数据加入发送队列，等待 EPOLLOUT 事件再发送
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                std::cerr << "[警告] 发送缓冲区满，客户端 fd=" << client_fd
-                          << " 消息丢失" << std::endl;
-            } else {
-                std::cerr << "[错误] 发送失败 fd=" << client_fd
-                          << ": " << strerror(errno) << std::endl;
+    // 与该节点已没有其他链路时，它上面的成员从名单中移除
+    if (node_id >= 0) {
+        for (auto& pair : g_peers) {
+            if (pair.second.node_id == node_id) {
+                return;
             }
         }
+        presence_purge_node(node_id);
     }
 }
 
 /*
  * ============================================================================
- * 函数名: handle_new_connection
- * 功能: 处理新的客户端连接 (Case 1)
- * 参数:
- *   listen_sock - 监听套接字
- *   epoll_fd - epoll 实例的文件描述符
- * 说明:
- *   1. 使用 accept 接受新连接
- *   2. 将新连接设置为非阻塞
- *   3. 将新连接添加到 epoll 实例中，监听 EPOLLIN | EPOLLET
+ * 函数名: handle_peer_accept
+ * 功能: 接受其他节点拨入的链路
  * ============================================================================
  */
-void handle_new_connection(int listen_sock, int epoll_fd) {
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-
-    // 循环 accept，因为边缘触发模式下可能有多个连接等待
+void handle_peer_accept(int cluster_sock, int epoll_fd) {
     while (true) {
-        int client_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &addr_len);
-
-        if (client_sock == -1) {
-            // EWOULDBLOCK/EAGAIN: 没有更多连接了（正常情况）
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                break;  // 所有连接都处理完了
+        int fd = accept(cluster_sock, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                std::cerr << "[错误] 节点链路 accept 失败: " << strerror(errno) << std::endl;
             }
-            // 其他错误
-            std::cerr << "[错误] accept 失败: " << strerror(errno) << std::endl;
             break;
         }
-
-        // 检查客户端数量限制
-        if (g_clients.size() >= MAX_CLIENTS) {
-            std::cerr << "[警告] 客户端数量已达上限，拒绝连接" << std::endl;
-            const char* msg = "服务器已满，请稍后再试\n";
-            send(client_sock, msg, strlen(msg), 0);
-            close(client_sock);
-            continue;
-        }
-
-        // 【关键】将客户端套接字设置为非阻塞
-        if (!set_nonblocking(client_sock)) {
-            close(client_sock);
-            continue;
-        }
-
-        // 准备 epoll 事件
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;  // 监听可读事件 + 边缘触发模式
-        ev.data.fd = client_sock;
-
-        // 【关键】使用 epoll_ctl 的 EPOLL_CTL_ADD 将客户端套接字添加到 epoll 实例
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &ev) == -1) {
-            std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD 失败: "
-                      << strerror(errno) << std::endl;
-            close(client_sock);
-            continue;
+        if (!set_nonblocking(fd) || !register_peer_link(fd, epoll_fd, false, false, -1)) {
+            close(fd);
         }
+    }
+}
 
-        // 获取客户端 IP 和端口
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        int client_port = ntohs(client_addr.sin_port);
+/*
+ * ============================================================================
+ * 函数名: process_peer_frame
+ * 功能: 处理一帧节点间消息
+ * 返回值: false 表示链路应当关闭（协议错误或重复链路）
+ * ============================================================================
+ */
+bool process_peer_frame(PeerLink& link, uint8_t type, const std::string& payload) {
+    g_cluster_stats.frames_in++;
 
-        // 创建客户端信息
-        ClientInfo client_info;
-        client_info.sock_fd = client_sock;
-        client_info.nickname = "用户" + std::to_string(client_sock);  // 默认昵称
-        client_info.ip = client_ip;
-        client_info.port = client_port;
-        client_info.connect_time = time(nullptr);
+    switch (type) {
+        case FRAME_HELLO: {
+            if (payload.size() != sizeof(uint32_t)) {
+                return false;
+            }
+            uint32_t id;
+            memcpy(&id, payload.data(), sizeof(id));
+            int node_id = (int)ntohl(id);
+            if (node_id == g_node_id) {
+                std::cerr << "[集群] 拒绝与自身 (节点 " << node_id << ") 的链路" << std::endl;
+                return false;
+            }
 
-        // 添加到客户端列表
-        g_clients[client_sock] = client_info;
+            // 双方同时拨号会产生两条链路：约定保留"由较小节点 ID 拨出"的那一条，
+            // 两端按同一规则裁决，结果一致
+            int preferred_dialer = node_id < g_node_id ? node_id : g_node_id;
+            int this_dialer = link.outgoing ? g_node_id : node_id;
+            for (auto& pair : g_peers) {
+                PeerLink& other = pair.second;
+                if (&other == &link || other.node_id != node_id) {
+                    continue;
+                }
+                if (this_dialer != preferred_dialer) {
+                    // 关闭当前这条；让出的是拨出链路时，记下由哪条拨入链路代替，避免定时重拨
+                    if (link.dial_index >= 0) {
+                        g_peer_addrs[link.dial_index].served_by_fd = other.fd;
+                    }
+                    return false;
+                }
+                if (other.dial_index >= 0) {
+                    g_peer_addrs[other.dial_index].served_by_fd = link.fd;
+                }
+                other.node_id = -2;  // 标记旧链路，由调用方关闭
+            }
 
-        std::cout << "[连接] 新客户端 fd=" << client_sock
-                  << " (" << client_ip << ":" << client_port << ")"
-                  << " 当前在线: " << g_clients.size() << std::endl;
+            link.node_id = node_id;
+            std::cout << "[集群] 已与节点 " << node_id << " 建立链路 fd=" << link.fd
+                      << (link.outgoing ? " (拨出)" : " (接入)") << std::endl;
+            return true;
+        }
+        case FRAME_ROOM_JOIN:
+            link.rooms.insert(payload);
+            return true;
+        case FRAME_ROOM_LEAVE:
+            link.rooms.erase(payload);
+            return true;
+        case FRAME_CHAT: {
+            if (payload.size() < sizeof(uint16_t)) {
+                return false;
+            }
+            uint16_t room_len;
+            memcpy(&room_len, payload.data(), sizeof(room_len));
+            room_len = ntohs(room_len);
+            if (payload.size() < sizeof(uint16_t) + room_len) {
+                return false;
+            }
+            std::string room = payload.substr(sizeof(uint16_t), room_len);
+            std::string message = payload.substr(sizeof(uint16_t) + room_len);
 
-        // 向新客户端发送欢迎消息
-        std::string welcome = "=== 欢迎来到聊天室 ===\n"
-                             "当前在线人数: " + std::to_string(g_clients.size()) + "\n"
-                             "输入消息即可发送\n"
-                             "====================\n";
-        send(client_sock, welcome.c_str(), welcome.length(), MSG_NOSIGNAL);
+            // 只投递给本地成员，不再转发，避免环路。
+            // 帧中不带消息来源，转发来的消息（包括对端的通知）一律按聊天处理，过载时可丢弃
+            broadcast_to_room(room, -1, message, MSG_CHAT);
+            return true;
+        }
+        case FRAME_PRESENCE: {
+            // op(1) + room_len(2) + room + id_len(1) + 成员ID + 昵称
+            if (link.node_id < 0 || payload.size() < 1 + sizeof(uint16_t)) {
+                return false;
+            }
+            char op = payload[0];
+            uint16_t room_len;
+            memcpy(&room_len, payload.data() + 1, sizeof(room_len));
+            room_len = ntohs(room_len);
+            size_t pos = 1 + sizeof(uint16_t) + room_len;
+            if ((op != '+' && op != '-' && op != '~') || payload.size() < pos + 1) {
+                return false;
+            }
+            std::string room = payload.substr(1 + sizeof(uint16_t), room_len);
+            size_t id_len = (uint8_t)payload[pos];
+            if (payload.size() < pos + 1 + id_len) {
+                return false;
+            }
+            std::string member = payload.substr(pos + 1, id_len);
+            std::string nickname = payload.substr(pos + 1 + id_len);
 
-        // 广播新用户加入消息
-        std::string join_msg = "[系统] " + client_info.nickname + " 加入了聊天室\n";
-        broadcast_message(client_sock, join_msg);
+            // 对端只能报告它自己的成员
+            std::string prefix = std::to_string(link.node_id) + ":";
+            if (member.compare(0, prefix.size(), prefix) != 0) {
+                return false;
+            }
+            roster_apply(room, op, member, nickname);
+            return true;
+        }
+        default:
+            std::cerr << "[集群] 未知帧类型 " << (int)type << std::endl;
+            return false;
     }
 }
 
 /*
  * ============================================================================
- * 函数名: handle_client_message
- * 功能: 处理客户端发来的消息 (Case 2)
- * 参数:
- *   client_sock - 客户端套接字
- *   epoll_fd - epoll 实例的文件描述符
- * 返回值: true 继续保持连接, false 需要关闭连接
- * 说明:
- *   1. 非阻塞 recv，循环读取直到 EWOULDBLOCK
- *   2. 处理客户端断开（recv 返回 0 或错误）
- *   3. 广播消息给其他客户端
+ * 函数名: handle_peer_event
+ * 功能: 处理节点链路上的读写事件
+ * 返回值: false 表示链路应当关闭
  * ============================================================================
  */
-bool handle_client_message(int client_sock, int epoll_fd) {
-    char buffer[BUFFER_SIZE];
-    std::string full_message;
-
-    // 【关键】边缘触发模式下，必须循环 recv 直到 EWOULDBLOCK
-    // 因为边缘触发只在状态变化时通知一次
-    while (true) {
-        memset(buffer, 0, BUFFER_SIZE);
-        ssize_t bytes_read = recv(client_sock, buffer, BUFFER_SIZE - 1, 0);
+bool handle_peer_event(int fd, uint32_t events) {
+    PeerLink& link = g_peers[fd];
 
-        if (bytes_read > 0) {
-            // 成功读取数据
-            full_message.append(buffer, bytes_read);
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        return false;
+    }
 
-            // 继续读取，直到读完所有数据
-        }
-        else if (bytes_read == 0) {
-            // 客户端正常关闭连接
-            std::cout << "[断开] 客户端 fd=" << client_sock
-                      << " 正常断开连接" << std::endl;
-            return false;  // 需要关闭连接
+    // 非阻塞 connect 完成：检查结果并发送 HELLO
+    if (link.connecting && (events & EPOLLOUT)) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+            return false;
         }
-        else {  // bytes_read == -1
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                // 【正常情况】没有更多数据可读了
+        link.connecting = false;
+        send_hello(link);
+    }
+
+    if (events & EPOLLIN) {
+        char buffer[BUFFER_SIZE * 4];
+        while (true) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                link.inbuf.append(buffer, n);
+            } else if (n == 0) {
+                return false;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
                 break;
+            } else {
+                return false;
             }
-            else if (errno == EINTR) {
-                // 被信号中断，继续读取
-                continue;
+        }
+
+        // 解析所有完整的帧，最后统一删除已消费的前缀
+        size_t pos = 0;
+        while (link.inbuf.size() - pos >= sizeof(uint32_t) + 1) {
+            uint32_t len;
+            memcpy(&len, link.inbuf.data() + pos, sizeof(len));
+            len = ntohl(len);
+            if (len == 0 || len > PEER_MAX_FRAME) {
+                std::cerr << "[集群] 非法帧长度 " << len << "，关闭链路" << std::endl;
+                return false;
             }
-            else {
-                // 其他错误，连接异常
-                std::cerr << "[错误] recv 失败 fd=" << client_sock
-                          << ": " << strerror(errno) << std::endl;
-                return false;  // 需要关闭连接
+            if (link.inbuf.size() - pos < sizeof(uint32_t) + len) {
+                break;  // 半帧，等待更多数据
+            }
+            uint8_t type = (uint8_t)link.inbuf[pos + sizeof(uint32_t)];
+            std::string payload = link.inbuf.substr(pos + sizeof(uint32_t) + 1, len - 1);
+            pos += sizeof(uint32_t) + len;
+            if (!process_peer_frame(link, type, payload)) {
+                return false;
             }
         }
+        link.inbuf.erase(0, pos);
     }
 
-    // 如果读取到了数据，进行处理
-    if (!full_message.empty()) {
-        auto it = g_clients.find(client_sock);
-        if (it != g_clients.end()) {
-            // 格式化消息: [昵称] 消息内容
-            std::string formatted_msg = "[" + it->second.nickname + "] " + full_message;
+    // EPOLLOUT 的实际发送统一放到 flush_peer_links 中
+    return true;
+}
+
+/*
+ * ============================================================================
+ * 函数名: flush_peer_links
+ * 功能: 每轮事件循环结束时，把各链路积累的帧一次性发出（批量发送）
+ * 说明: 发不完的部分留在 outbuf，等下一次 EPOLLOUT 或下一轮循环继续发送；
+ *       若对端长期不读导致积压超过上限，关闭链路，重连后由快照恢复状态
+ * ============================================================================
+ */
+void flush_peer_links(int epoll_fd) {
+    std::vector<int> dead;
+
+    for (auto& pair : g_peers) {
+        PeerLink& link = pair.second;
+        if (link.node_id == -2) {
+            dead.push_back(link.fd);  // 被去重裁决淘汰的旧链路
+            continue;
+        }
+        if (link.connecting || link.outbuf.empty()) {
+            continue;
+        }
 
-            std::cout << "[消息] fd=" << client_sock << " " << formatted_msg;
+        ssize_t n = send(link.fd, link.outbuf.data(), link.outbuf.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            g_cluster_stats.batches_out++;
+            g_cluster_stats.bytes_out += n;
+            link.outbuf.erase(0, n);
+        } else if (n == -1 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) {
+            dead.push_back(link.fd);
+            continue;
+        }
 
-            // 广播消息给所有其他客户端
-            broadcast_message(client_sock, formatted_msg);
+        if (link.outbuf.size() > PEER_MAX_OUTBUF) {
+            std::cerr << "[集群] 链路 fd=" << link.fd << " 发送积压过多，断开重连" << std::endl;
+            dead.push_back(link.fd);
         }
     }
 
-    return true;  // 保持连接
+    for (int fd : dead) {
+        close_peer_link(fd, epoll_fd);
+    }
 }
 
 /*
  * ============================================================================
- * 函数名: close_client_connection
- * 功能: 关闭客户端连接并清理资源
- * 参数:
- *   client_sock - 客户端套接字
- *   epoll_fd - epoll 实例的文件描述符
- * 说明:
- *   1. 使用 epoll_ctl 的 EPOLL_CTL_DEL 从 epoll 实例中移除
- *   2. 关闭套接字
- *   3. 从客户端列表中删除
- *   4. 广播用户离开消息
+ * 函数名: cluster_tick
+ * 功能: 集群定时任务：为断开的拨出链路重新拨号（已由对端拨入的链路代替的除外）
  * ============================================================================
  */
-void close_client_connection(int client_sock, int epoll_fd) {
-    auto it = g_clients.find(client_sock);
-    if (it == g_clients.end()) {
-        return;  // 客户端不存在
-    }
-
-    std::string nickname = it->second.nickname;
-
-    // 【关键】使用 epoll_ctl 的 EPOLL_CTL_DEL 将客户端从 epoll 实例中移除
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_sock, nullptr) == -1) {
-        std::cerr << "[警告] epoll_ctl EPOLL_CTL_DEL 失败 fd=" << client_sock
-                  << ": " << strerror(errno) << std::endl;
+void cluster_tick(int epoll_fd) {
+    long long now = now_ms();
+    for (size_t i = 0; i < g_peer_addrs.size(); i++) {
+        if (g_peer_addrs[i].fd == -1 && g_peer_addrs[i].served_by_fd == -1 &&
+            now >= g_peer_addrs[i].next_dial_ms) {
+            dial_peer(i, epoll_fd);
+        }
     }
+}
 
-    // 关闭套接字
-    close(client_sock);
-
-    // 从客户端列表中删除
-    g_clients.erase(it);
-
-    std::cout << "[离线] " << nickname << " fd=" << client_sock
-              << " 已断开，当前在线: " << g_clients.size() << std::endl;
-
-    // 广播用户离开消息
-    std::string leave_msg = "[系统] " + nickname + " 离开了聊天室\n";
-    broadcast_message(-1, leave_msg);  // -1 表示发送给所有人
+/*
+ * ============================================================================
+ * 函数名: print_usage
+ * 功能: 打印命令行用法
+ * ============================================================================
+ */
+void print_usage(const char* prog) {
+    std::cerr << "用法: " << prog << " [-p 客户端端口] [-m 内存预算MB] [-u UDP旁路端口] [-n 节点ID] [-c 集群端口] [-P 对端IP:集群端口]...\n"
+              << "  单机:     " << prog << "\n"
+              << "  三节点集群（本机测试）:\n"
+              << "    " << prog << " -p 8888 -n 1 -c 9888\n"
+              << "    " << prog << " -p 8889 -n 2 -c 9889 -P 127.0.0.1:9888\n"
+              << "    " << prog << " -p 8890 -n 3 -c 9890 -P 127.0.0.1:9888 -P 127.0.0.1:9889\n";
 }
 
 /*
@@ -364,7 +2080,43 @@ void close_client_connection(int client_sock, int epoll_fd) {
  * 主函数：事件循环 (Event Loop)
  * ============================================================================
  */
-int main() {
+int main(int argc, char* argv[]) {
+    // ========================================================================
+    // 0. 解析命令行参数
+    // ========================================================================
+    int port = PORT;
+    int cluster_port = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:m:u:n:c:P:h")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'm': g_mem.budget = (size_t)std::max(1, atoi(optarg)) * 1024 * 1024; break;
+            case 'u': g_udp_port = atoi(optarg); break;
+            case 'n': g_node_id = atoi(optarg); break;
+            case 'c': cluster_port = atoi(optarg); break;
+            case 'P': {
+                std::string spec = optarg;
+                size_t colon = spec.rfind(':');
+                if (colon == std::string::npos) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                PeerAddr addr;
+                addr.host = spec.substr(0, colon);
+                addr.port = atoi(spec.c_str() + colon + 1);
+                addr.fd = -1;
+                addr.next_dial_ms = 0;
+                addr.served_by_fd = -1;
+                g_peer_addrs.push_back(addr);
+                break;
+            }
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
     std::cout << R"(
 ╔════════════════════════════════════════╗
 ║   基于 Epoll 的高性能聊天室服务器    ║
@@ -376,7 +2128,7 @@ int main() {
     // ========================================================================
     // 1. 创建监听套接字（已设置为非阻塞）
     // ========================================================================
-    int listen_sock = create_listen_socket();
+    int listen_sock = create_listen_socket(port);
     if (listen_sock == -1) {
         return 1;
     }
@@ -407,18 +2159,68 @@ int main() {
         return 1;
     }
     std::cout << "[成功] 监听套接字已添加到 epoll 实例" << std::endl;
+    std::cout << "[成功] 内存预算: " << g_mem.budget / 1024 / 1024 << " MB" << std::endl;
+
+    // ========================================================================
+    // 3b. 集群模式：监听集群端口并拨号到对端
+    // ========================================================================
+    if (cluster_port > 0) {
+        g_cluster_sock = create_listen_socket(cluster_port);
+        if (g_cluster_sock == -1) {
+            close(epoll_fd);
+            close(listen_sock);
+            return 1;
+        }
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = g_cluster_sock;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_cluster_sock, &ev) == -1) {
+            std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD cluster_sock 失败: "
+                      << strerror(errno) << std::endl;
+            return 1;
+        }
+        std::cout << "[集群] 节点 " << g_node_id << " 集群端口: " << cluster_port << std::endl;
+    }
+    cluster_tick(epoll_fd);
+
+    // ========================================================================
+    // 3c. UDP 旁路：输入提示和心跳
+    // ========================================================================
+    if (g_udp_port > 0) {
+        g_udp_sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_in udp_addr;
+        memset(&udp_addr, 0, sizeof(udp_addr));
+        udp_addr.sin_family = AF_INET;
+        udp_addr.sin_addr.s_addr = INADDR_ANY;
+        udp_addr.sin_port = htons(g_udp_port);
+        if (g_udp_sock == -1 ||
+            bind(g_udp_sock, (struct sockaddr*)&udp_addr, sizeof(udp_addr)) == -1) {
+            std::cerr << "[错误] UDP 旁路端口 " << g_udp_port << " 绑定失败: "
+                      << strerror(errno) << std::endl;
+            return 1;
+        }
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = g_udp_sock;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_udp_sock, &ev) == -1) {
+            std::cerr << "[错误] epoll_ctl EPOLL_CTL_ADD udp_sock 失败: "
+                      << strerror(errno) << std::endl;
+            return 1;
+        }
+        std::cout << "[成功] UDP 旁路端口: " << g_udp_port << std::endl;
+    }
 
     // ========================================================================
     // 4. 【关键点 2】主事件循环 (Event Loop)
     // ========================================================================
     struct epoll_event events[MAX_EVENTS];
+    bool clustered = g_cluster_sock != -1 || !g_peer_addrs.empty();
+    long long next_tick_ms = now_ms() + TICK_MS;
 
     std::cout << "\n服务器运行中，等待客户端连接...\n" << std::endl;
 
     while (true) {
-        // 等待事件发生（阻塞调用，-1 表示无限等待）
-        // 返回值：就绪的文件描述符数量
-        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        // 等待事件发生
+        // 设置超时以便定时执行集群重连、内存档位检查等任务
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, TICK_MS);
 
         if (nfds == -1) {
             if (errno == EINTR) {
@@ -440,6 +2242,20 @@ int main() {
                 handle_new_connection(listen_sock, epoll_fd);
             }
             // ================================================================
+            // Case 3: UDP 旁路 / 集群监听套接字 / 节点链路有事件
+            // ================================================================
+            else if (fd == g_udp_sock) {
+                handle_udp_readable();
+            }
+            else if (fd == g_cluster_sock) {
+                handle_peer_accept(g_cluster_sock, epoll_fd);
+            }
+            else if (g_peers.count(fd)) {
+                if (!handle_peer_event(fd, events[i].events)) {
+                    close_peer_link(fd, epoll_fd);
+                }
+            }
+            // ================================================================
             // Case 2: 客户端套接字有事件 -> 客户端发来数据
             // ================================================================
             else {
@@ -457,10 +2273,38 @@ int main() {
                     if (!keep_alive) {
                         // 客户端断开或发生错误，关闭连接
                         close_client_connection(fd, epoll_fd);
+                        continue;
+                    }
+                }
+
+                // 发送缓冲区重新可写，继续发送积压数据
+                if (events[i].events & EPOLLOUT) {
+                    auto it = g_clients.find(fd);
+                    if (it != g_clients.end() && !flush_client(it->second)) {
+                        close_client_connection(fd, epoll_fd);
                     }
                 }
             }
         }
+
+        close_overflowed_clients(epoll_fd);
+
+        // 本轮产生的所有节点间帧合并发送
+        if (clustered) {
+            flush_peer_links(epoll_fd);
+        }
+
+        // 过载保护：每轮检查档位，定时任务另外衰减统计并重新挑选最重的发送者
+        if (now_ms() >= next_tick_ms) {
+            if (clustered) {
+                cluster_tick(epoll_fd);
+            }
+            memory_tick(epoll_fd);
+            presence_tick();
+            next_tick_ms = now_ms() + TICK_MS;
+        } else {
+            enforce_memory_budget(epoll_fd, false);
+        }
     }
 
     // ========================================================================
@@ -474,9 +2318,29 @@ int main() {
     }
     g_clients.clear();
 
+    // 关闭所有节点链路
+    for (auto& pair : g_peers) {
+        close(pair.first);
+    }
+    g_peers.clear();
+
+    std::cout << "[集群] 发出 " << g_cluster_stats.frames_out << " 帧 / "
+              << g_cluster_stats.batches_out << " 批, 收到 "
+              << g_cluster_stats.frames_in << " 帧" << std::endl;
+
+    if (g_udp_sock != -1) {
+        std::cout << "[UDP] 收到 " << g_udp_stats.received << " 个数据报 (拒绝 "
+                  << g_udp_stats.rejected << "), 发出 " << g_udp_stats.sent
+                  << ", 丢弃 " << g_udp_stats.dropped << std::endl;
+        close(g_udp_sock);
+    }
+
     // 关闭 epoll 和监听套接字
     close(epoll_fd);
     close(listen_sock);
+    if (g_cluster_sock != -1) {
+        close(g_cluster_sock);
+    }
 
     std::cout << "服务器已关闭" << std::endl;
     return 0;
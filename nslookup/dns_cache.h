@@ -0,0 +1,349 @@
+/**
+ * 共享内存 DNS 缓存 - 同一台主机上的所有进程共用一份解析结果
+ *
+ * 缓存是 /dev/shm 下的一个内存映射文件，每个进程 mmap 同一个文件：
+ * - 查询结果按 (域名, 类型) 存放在固定大小的槽位里，开放寻址，每个键最多探测 DNS_CACHE_PROBES 个槽位
+ * - 读者不加锁：每个槽位带一个版本号 (seqlock)，写入前后各加一，
+ *   读者先读版本号（奇数表示正在写，等待），复制内容后再读一次，两次相同才算读到一致的数据
+ * - 写者之间用文件锁 (flock) 串行化，任一时刻只有一个写者，读者永远不会被文件锁阻塞。
+ *   flock 按打开的文件描述串行化，同一进程中共用 fd 的线程互不排斥，所以进程内再加一把互斥锁
+ * - 过期时间存绝对时间（Unix 秒），文件在进程退出后保留（直到重启或手动删除），
+ *   新进程启动时直接命中上一个进程留下的结果
+ *
+ * 文件权限 0644：其他用户的进程只能读。/dev/shm 任何人都能创建文件，所以打开时不跟随符号链接，
+ * 并且只使用当前用户或 root 拥有、组和其他人不能写的文件，防止其他本地用户预先创建缓存写入伪造的结果。
+ * 与 dns_message.h 一样只有头文件，函数都是 inline。
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ============================================================================
+// 缓存文件布局
+// ============================================================================
+
+const char* const DNS_CACHE_PATH = "/dev/shm/nslookup_dns_cache";
+const uint32_t DNS_CACHE_MAGIC = 0x434e4453;        // "SDNC"
+const uint32_t DNS_CACHE_VERSION = 1;
+const uint32_t DNS_CACHE_SLOTS = 65536;             // 2 的幂；每个槽位 256 字节，共 16 MB
+const int DNS_CACHE_PROBES = 8;                     // 每个键最多探测的槽位数
+const int DNS_CACHE_MAX_NAME = 200;                 // 可缓存的最长域名（含结尾 '\0'）
+const int DNS_CACHE_MAX_ADDRS = 8;                  // 每个结果最多保存的地址数
+const uint32_t DNS_CACHE_NEGATIVE_TTL = 60;         // NXDOMAIN 的缓存时间（秒）
+const size_t DNS_CACHE_HEADER_SIZE = 4096;          // 槽位从第二页开始
+const int DNS_CACHE_READ_RETRIES = 1000;            // 读者等待一个槽位写完的最多次数（写者中途退出时不会卡死）
+
+/**
+ * 文件头部（第一页）
+ * magic 最后写入：读者看到正确的 magic 时其他字段已经就绪
+ */
+struct DNSCacheHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    int64_t created;                    // 文件初始化的时间（Unix 秒）
+    std::atomic<uint64_t> inserts;      // 写入次数（写者持锁更新）
+    std::atomic<uint64_t> evictions;    // 探测范围已满、淘汰未过期结果的次数
+};
+
+/**
+ * 一个缓存槽位 (256 字节)
+ *
+ * seq 为偶数时内容稳定，为奇数时写者正在修改。hash 为 0 表示空槽位。
+ */
+struct DNSCacheSlot {
+    std::atomic<uint32_t> seq;          // 版本号 (seqlock)
+    uint32_t hash;                      // 键的哈希，0 = 空
+    int64_t expires;                    // 过期时间（Unix 秒）
+    uint16_t qtype;                     // 查询类型 (1 = A)
+    uint8_t name_len;
+    uint8_t addr_count;
+    uint8_t rcode;                      // 0 = 正常结果，3 = NXDOMAIN（否定缓存）
+    uint8_t reserved[3];
+    uint32_t addrs[DNS_CACHE_MAX_ADDRS];    // IPv4 地址（网络字节序）
+    char name[DNS_CACHE_MAX_NAME];      // 小写、去掉末尾 '.'
+};
+
+static_assert(sizeof(DNSCacheSlot) == 256, "缓存槽位应为 256 字节");
+static_assert(sizeof(DNSCacheHeader) <= DNS_CACHE_HEADER_SIZE, "缓存头部超过一页");
+
+/**
+ * 一个进程打开的缓存
+ */
+struct DNSCache {
+    int fd;
+    bool writable;                      // 没有写权限时只读（store 什么也不做）
+    unsigned char* base;
+    size_t size;
+    DNSCacheHeader* header;
+    DNSCacheSlot* slots;
+};
+
+/**
+ * 查询结果（lookup 的输出 / store 的输入）
+ */
+struct DNSCacheEntry {
+    uint8_t rcode;
+    int addr_count;
+    uint32_t addrs[DNS_CACHE_MAX_ADDRS];
+    uint32_t ttl;                       // lookup: 剩余秒数；store: 生存时间
+};
+
+// ============================================================================
+// 内部函数
+// ============================================================================
+
+/**
+ * 规范化域名（转小写、去掉末尾 '.'），返回长度；太长无法缓存时返回 -1
+ */
+inline int dns_cache_normalize(const char* name, char* out) {
+    int n = 0;
+    for (; name[n] != '\0'; n++) {
+        if (n >= DNS_CACHE_MAX_NAME - 1) {
+            return -1;
+        }
+        char c = name[n];
+        out[n] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    if (n > 0 && out[n - 1] == '.') {
+        n--;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/**
+ * 键的哈希（FNV-1a，再混入查询类型），保证不为 0
+ */
+inline uint32_t dns_cache_hash(const char* name, int len, uint16_t qtype) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    h = (h ^ qtype) * 16777619u;
+    h ^= h >> 15;
+    return h != 0 ? h : 1;
+}
+
+/**
+ * 初始化（或重建）缓存文件，调用者持有写锁
+ */
+inline bool dns_cache_format(int fd, size_t size) {
+    // 先截断为 0 再扩展：内核把新扩展的部分填 0，所有槽位都是空的
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0) {
+        return false;
+    }
+    DNSCacheHeader header;
+    memset((void*)&header, 0, sizeof(header));
+    header.version = DNS_CACHE_VERSION;
+    header.slot_count = DNS_CACHE_SLOTS;
+    header.slot_size = sizeof(DNSCacheSlot);
+    header.created = time(NULL);
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        return false;
+    }
+    uint32_t magic = DNS_CACHE_MAGIC;
+    return pwrite(fd, &magic, sizeof(magic), offsetof(DNSCacheHeader, magic)) == (ssize_t)sizeof(magic);
+}
+
+// ============================================================================
+// 公共接口
+// ============================================================================
+
+/**
+ * 打开（必要时创建）共享缓存
+ *
+ * 文件不存在、大小不对或版本不同时，在写锁下重新初始化。
+ * 没有写权限（root 创建的缓存）时以只读方式映射。不是普通文件、属于其他用户
+ * 或组和其他人可写时拒绝使用（检查在初始化之前，不会截断别人的文件）。
+ *
+ * @return 是否成功；失败时调用者应当不使用缓存
+ */
+inline bool dns_cache_open(DNSCache& cache, const char* path = DNS_CACHE_PATH) {
+    memset(&cache, 0, sizeof(cache));
+    cache.size = DNS_CACHE_HEADER_SIZE + (size_t)DNS_CACHE_SLOTS * sizeof(DNSCacheSlot);
+    cache.writable = true;
+    cache.fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (cache.fd < 0) {
+        cache.writable = false;
+        cache.fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (cache.fd < 0) {
+            return false;
+        }
+    }
+
+    struct stat st;
+    if (fstat(cache.fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        (st.st_uid != geteuid() && st.st_uid != 0) || (st.st_mode & 022)) {
+        close(cache.fd);
+        return false;
+    }
+    if (cache.writable) {
+        flock(cache.fd, LOCK_EX);
+        DNSCacheHeader header;
+        bool valid = fstat(cache.fd, &st) == 0 && (size_t)st.st_size == cache.size &&
+                     pread(cache.fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                     header.magic.load() == DNS_CACHE_MAGIC && header.version == DNS_CACHE_VERSION &&
+                     header.slot_count == DNS_CACHE_SLOTS && header.slot_size == sizeof(DNSCacheSlot);
+        if (!valid && !dns_cache_format(cache.fd, cache.size)) {
+            flock(cache.fd, LOCK_UN);
+            close(cache.fd);
+            return false;
+        }
+        flock(cache.fd, LOCK_UN);
+    } else if (fstat(cache.fd, &st) < 0 || (size_t)st.st_size != cache.size) {
+        close(cache.fd);
+        return false;
+    }
+
+    void* p = mmap(NULL, cache.size, cache.writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, cache.fd, 0);
+    if (p == MAP_FAILED) {
+        close(cache.fd);
+        return false;
+    }
+    cache.base = (unsigned char*)p;
+    cache.header = (DNSCacheHeader*)cache.base;
+    cache.slots = (DNSCacheSlot*)(cache.base + DNS_CACHE_HEADER_SIZE);
+    if (cache.header->magic.load(std::memory_order_acquire) != DNS_CACHE_MAGIC ||
+        cache.header->version != DNS_CACHE_VERSION) {
+        munmap(cache.base, cache.size);
+        close(cache.fd);
+        return false;
+    }
+    return true;
+}
+
+inline void dns_cache_close(DNSCache& cache) {
+    if (cache.base != NULL) {
+        munmap(cache.base, cache.size);
+        close(cache.fd);
+        cache.base = NULL;
+    }
+}
+
+/**
+ * 查找 (域名, 类型)，不加锁、不分配内存
+ *
+ * seqlock 读：先比较哈希（读到写了一半的哈希最多导致误判，后面的版本号检查会发现），
+ * 哈希相同时复制整个槽位，版本号前后一致且键完全相同才算命中。
+ *
+ * @param now 当前时间（Unix 秒）
+ * @return 是否命中未过期的结果；命中时 out.ttl 为剩余秒数
+ */
+inline bool dns_cache_lookup(const DNSCache& cache, const char* name, uint16_t qtype,
+                             DNSCacheEntry& out, int64_t now) {
+    char key[DNS_CACHE_MAX_NAME];
+    int len = dns_cache_normalize(name, key);
+    if (len < 0) {
+        return false;
+    }
+    uint32_t hash = dns_cache_hash(key, len, qtype);
+
+    for (int p = 0; p < DNS_CACHE_PROBES; p++) {
+        const DNSCacheSlot& slot = cache.slots[(hash + p) & (DNS_CACHE_SLOTS - 1)];
+        DNSCacheSlot copy;
+        bool consistent = false;
+        for (int attempt = 0; attempt < DNS_CACHE_READ_RETRIES; attempt++) {
+            uint32_t before = slot.seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;               // 写者正在修改这个槽位
+            }
+            if (slot.hash != hash) {
+                break;                  // 不是这个键
+            }
+            memcpy((char*)&copy + sizeof(copy.seq), (const char*)&slot + sizeof(slot.seq),
+                   sizeof(copy) - sizeof(copy.seq));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == before) {
+                consistent = true;
+                break;
+            }
+        }
+        if (!consistent || copy.hash != hash || copy.qtype != qtype || copy.name_len != len ||
+            memcmp(copy.name, key, len) != 0) {
+            continue;
+        }
+        if (copy.expires <= now) {
+            return false;
+        }
+        out.rcode = copy.rcode;
+        out.addr_count = std::min((int)copy.addr_count, DNS_CACHE_MAX_ADDRS);
+        memcpy(out.addrs, copy.addrs, sizeof(out.addrs));
+        out.ttl = (uint32_t)(copy.expires - now);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * 写入 (域名, 类型) 的结果
+ *
+ * 进程内的写者用互斥锁、进程之间用 flock 串行化。探测范围内依次选择：同一个键、空槽位、已过期的槽位，
+ * 都没有时淘汰最早过期的结果。
+ *
+ * @param entry 结果，entry.ttl 为生存时间（秒）；为 0 时不缓存
+ */
+inline void dns_cache_store(DNSCache& cache, const char* name, uint16_t qtype,
+                            const DNSCacheEntry& entry, int64_t now) {
+    char key[DNS_CACHE_MAX_NAME];
+    int len = dns_cache_normalize(name, key);
+    if (!cache.writable || len < 0 || entry.ttl == 0) {
+        return;
+    }
+    uint32_t hash = dns_cache_hash(key, len, qtype);
+
+    static std::mutex writers;          // inline 函数中的静态变量，整个进程只有一个
+    std::lock_guard<std::mutex> guard(writers);
+    flock(cache.fd, LOCK_EX);
+    DNSCacheSlot* target = NULL;
+    DNSCacheSlot* oldest = NULL;
+    for (int p = 0; p < DNS_CACHE_PROBES && target == NULL; p++) {
+        DNSCacheSlot& slot = cache.slots[(hash + p) & (DNS_CACHE_SLOTS - 1)];
+        bool same = slot.hash == hash && slot.qtype == qtype && slot.name_len == len &&
+                    memcmp(slot.name, key, len) == 0;
+        if (same || slot.hash == 0 || slot.expires <= now) {
+            target = &slot;
+        } else if (oldest == NULL || slot.expires < oldest->expires) {
+            oldest = &slot;
+        }
+    }
+    if (target == NULL) {
+        target = oldest;
+        cache.header->evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // seqlock 写：版本号变为奇数 -> 修改内容 -> 版本号变为偶数
+    // （上一个写者中途退出时版本号停在奇数，先取整到偶数）
+    uint32_t seq = target->seq.load(std::memory_order_relaxed) & ~1u;
+    target->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    target->hash = hash;
+    target->expires = now + entry.ttl;
+    target->qtype = qtype;
+    target->name_len = (uint8_t)len;
+    target->rcode = entry.rcode;
+    target->addr_count = (uint8_t)std::min(entry.addr_count, DNS_CACHE_MAX_ADDRS);
+    memcpy(target->addrs, entry.addrs, sizeof(target->addrs));
+    memcpy(target->name, key, len + 1);
+    target->seq.store(seq + 2, std::memory_order_release);
+
+    cache.header->inserts.fetch_add(1, std::memory_order_relaxed);
+    flock(cache.fd, LOCK_UN);
+}
+
+#endif // DNS_CACHE_H
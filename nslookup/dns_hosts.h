@@ -0,0 +1,222 @@
+/**
+ * 静态覆盖表 - 内存映射的完美哈希文件，把固定的 域名 -> IPv4 地址 映射直接返回，不走网络
+ *
+ * 文件由 hosts_build 离线生成（输入为 /etc/hosts 格式的文本，可以有几百万条），运行时只读 mmap：
+ * - 完美哈希 (hash and displace)：键先按哈希分到桶里，每个桶存一个位移值 d，
+ *   桶内每个键用 (哈希, d) 算出各不相同的槽位。查找只需要算一次哈希、读一个位移值、比较一个槽位，
+ *   O(1)、不加锁、不分配内存
+ * - 槽位只存偏移，域名和地址分别连续存放在文件末尾，每个键约 23 字节（加上域名本身）
+ * - 生成器先写临时文件再 rename，读者看到的要么是旧文件要么是完整的新文件
+ *
+ * 文件可能被换成任意内容，打开时检查大小与头部一致，查找时检查每个偏移都在文件内。
+ * 与 dns_cache.h 一样只有头文件，函数都是 inline。
+ */
+
+#ifndef DNS_HOSTS_H
+#define DNS_HOSTS_H
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dns_cache.h"       // 域名规范化、DNSCacheEntry
+
+// ============================================================================
+// 文件布局
+// ============================================================================
+
+const char* const DNS_HOSTS_PATH = "/etc/nslookup/overrides.phf";
+const uint32_t DNS_HOSTS_MAGIC = 0x46485344;        // "DSHF"
+const uint32_t DNS_HOSTS_VERSION = 1;
+
+/**
+ * 文件头部 (64 字节)，之后依次是：
+ *   uint32_t       displacements[bucket_count]
+ *   DNSHostsSlot   slots[slot_count]
+ *   uint32_t       addrs[addr_count]          IPv4 地址（网络字节序）
+ *   char           names[names_size]          规范化的域名，不含 '\0'
+ */
+struct DNSHostsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;                      // 哈希种子（生成器找不到完美哈希时换种子重试）
+    uint32_t entry_count;
+    uint32_t bucket_count;
+    uint32_t slot_count;
+    uint32_t addr_count;
+    uint64_t names_size;
+    int64_t built;                      // 生成时间（Unix 秒）
+    uint8_t reserved[16];
+};
+
+/**
+ * 一个槽位 (16 字节)，name_len 为 0 表示空槽位
+ */
+struct DNSHostsSlot {
+    uint32_t name_off;
+    uint32_t addr_off;
+    uint16_t name_len;
+    uint16_t addr_count;
+    uint32_t hash;                      // 完整哈希的低 32 位，不同时不必比较域名
+};
+
+static_assert(sizeof(DNSHostsHeader) == 64, "覆盖表头部应为 64 字节");
+static_assert(sizeof(DNSHostsSlot) == 16, "覆盖表槽位应为 16 字节");
+
+/**
+ * 一个进程打开的覆盖表
+ */
+struct DNSHostsTable {
+    unsigned char* base;
+    size_t size;
+    const DNSHostsHeader* header;
+    const uint32_t* displacements;
+    const DNSHostsSlot* slots;
+    const uint32_t* addrs;
+    const char* names;
+};
+
+// ============================================================================
+// 哈希（生成器和查找共用）
+// ============================================================================
+
+inline uint64_t dns_hosts_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * 域名（已规范化）的 64 位哈希：每次取 8 字节相乘混合，最后再整体混合一次
+ * （逐字节的 FNV 在长域名上是查找的主要开销）
+ */
+inline uint64_t dns_hosts_hash(const char* name, int len, uint64_t seed) {
+    uint64_t h = seed ^ ((uint64_t)len * 0x9e3779b97f4a7c15ULL);
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, name + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, name + i, len - i);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+    return dns_hosts_mix(h);
+}
+
+/**
+ * 把 32 位值均匀映射到 [0, n)（乘法代替取模）
+ */
+inline uint32_t dns_hosts_range(uint32_t x, uint32_t n) {
+    return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+inline uint32_t dns_hosts_bucket(uint64_t h, uint32_t bucket_count) {
+    return dns_hosts_range((uint32_t)(h >> 32), bucket_count);
+}
+
+/**
+ * 桶的位移值为 d 时键所在的槽位
+ */
+inline uint32_t dns_hosts_slot(uint64_t h, uint32_t d, uint32_t slot_count) {
+    return dns_hosts_range((uint32_t)dns_hosts_mix(h ^ ((uint64_t)(d + 1) * 0x9e3779b97f4a7c15ULL)), slot_count);
+}
+
+/**
+ * 按头部中的数量计算文件应有的大小
+ */
+inline uint64_t dns_hosts_file_size(const DNSHostsHeader& h) {
+    return sizeof(DNSHostsHeader) + (uint64_t)h.bucket_count * sizeof(uint32_t) +
+           (uint64_t)h.slot_count * sizeof(DNSHostsSlot) + (uint64_t)h.addr_count * sizeof(uint32_t) +
+           h.names_size;
+}
+
+// ============================================================================
+// 公共接口
+// ============================================================================
+
+/**
+ * 只读映射覆盖表
+ *
+ * @return 是否成功；文件不存在或格式不对时返回 false
+ */
+inline bool dns_hosts_open(DNSHostsTable& table, const char* path = DNS_HOSTS_PATH) {
+    memset(&table, 0, sizeof(table));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    DNSHostsHeader header;
+    bool valid = fstat(fd, &st) == 0 &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 header.magic == DNS_HOSTS_MAGIC && header.version == DNS_HOSTS_VERSION &&
+                 header.bucket_count > 0 && header.slot_count > 0 &&
+                 dns_hosts_file_size(header) == (uint64_t)st.st_size;
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+    // 映射之后就不需要文件描述符了；文件被 rename 替换后旧映射仍然有效
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    table.base = (unsigned char*)p;
+    table.size = st.st_size;
+    table.header = (const DNSHostsHeader*)table.base;
+    table.displacements = (const uint32_t*)(table.header + 1);
+    table.slots = (const DNSHostsSlot*)(table.displacements + header.bucket_count);
+    table.addrs = (const uint32_t*)(table.slots + header.slot_count);
+    table.names = (const char*)(table.addrs + header.addr_count);
+    return true;
+}
+
+inline void dns_hosts_close(DNSHostsTable& table) {
+    if (table.base != NULL) {
+        munmap(table.base, table.size);
+        table.base = NULL;
+    }
+}
+
+/**
+ * 查找域名，不加锁、不分配内存
+ *
+ * @return 是否在覆盖表中；命中时 out 中是地址（最多 DNS_CACHE_MAX_ADDRS 个），ttl 为 0
+ */
+inline bool dns_hosts_lookup(const DNSHostsTable& table, const char* name, DNSCacheEntry& out) {
+    if (table.base == NULL) {
+        return false;
+    }
+    char key[DNS_CACHE_MAX_NAME];
+    int len = dns_cache_normalize(name, key);
+    if (len <= 0) {
+        return false;
+    }
+    const DNSHostsHeader& header = *table.header;
+    uint64_t h = dns_hosts_hash(key, len, header.seed);
+    uint32_t d = table.displacements[dns_hosts_bucket(h, header.bucket_count)];
+    const DNSHostsSlot& slot = table.slots[dns_hosts_slot(h, d, header.slot_count)];
+    if (slot.name_len != len || slot.hash != (uint32_t)h ||
+        (uint64_t)slot.name_off + slot.name_len > header.names_size ||
+        (uint64_t)slot.addr_off + slot.addr_count > header.addr_count ||
+        memcmp(table.names + slot.name_off, key, len) != 0) {
+        return false;
+    }
+    out.rcode = 0;
+    out.addr_count = std::min((int)slot.addr_count, DNS_CACHE_MAX_ADDRS);
+    memcpy(out.addrs, table.addrs + slot.addr_off, out.addr_count * sizeof(uint32_t));
+    out.ttl = 0;
+    return true;
+}
+
+#endif // DNS_HOSTS_H
@@ -0,0 +1,420 @@
+/**
+ * DNS 报文格式 (RFC 1035) - 结构定义、查询构建与解析函数
+ *
+ * resolver.cpp、dns_preload.cpp（getaddrinfo 预加载库）和
+ * TCP_Analyzer/tcp_analyzer.cpp（DNS 流量分析模式）共用这份代码。
+ * 只有头文件，函数都是 inline，直接 #include 即可，不需要额外的编译单元。
+ *
+ * 解析函数会处理来自网络的任意数据，所有读取都检查报文边界，
+ * 不合法的报文返回 false 而不是越界读取。
+ */
+
+#ifndef DNS_MESSAGE_H
+#define DNS_MESSAGE_H
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+// ============================================================================
+// DNS 协议数据结构定义
+// ============================================================================
+
+/**
+ * DNS 头部结构 (12 字节)
+ * 注意: 使用 __attribute__((packed)) 防止编译器自动对齐，确保结构体大小正确
+ *
+ * 字段说明:
+ * - id: 事务ID，用于匹配请求和响应
+ * - flags: 标志位（QR, Opcode, AA, TC, RD, RA, Z, RCODE）
+ * - qdcount: 问题数量（Questions Count）
+ * - ancount: 回答数量（Answer RRs Count）
+ * - nscount: 授权记录数量（Authority RRs Count）
+ * - arcount: 附加记录数量（Additional RRs Count）
+ */
+struct DNSHeader {
+    uint16_t id;        // 事务ID (2字节)
+    uint16_t flags;     // 标志位 (2字节)
+    uint16_t qdcount;   // 问题计数 (2字节)
+    uint16_t ancount;   // 回答计数 (2字节)
+    uint16_t nscount;   // 授权记录计数 (2字节)
+    uint16_t arcount;   // 附加记录计数 (2字节)
+} __attribute__((packed));
+
+/**
+ * DNS 问题部分的尾部 (4 字节)
+ * QNAME 之后紧跟的字段
+ *
+ * 字段说明:
+ * - qtype: 查询类型 (1=A记录, 2=NS, 5=CNAME, 等等)
+ * - qclass: 查询类 (1=IN互联网)
+ */
+struct DNSQuestion {
+    uint16_t qtype;     // 查询类型 (2字节)
+    uint16_t qclass;    // 查询类 (2字节)
+} __attribute__((packed));
+
+/**
+ * DNS 资源记录头部 (不包括 NAME 字段)
+ * 出现在 Answer, Authority, Additional 部分
+ */
+struct DNSResourceRecord {
+    uint16_t type;      // 记录类型 (2字节)
+    uint16_t class_;    // 记录类 (2字节)
+    uint32_t ttl;       // 生存时间 (4字节)
+    uint16_t rdlength;  // 数据长度 (2字节)
+} __attribute__((packed));
+
+// 标志位
+const uint16_t DNS_FLAG_QR = 0x8000;        // 1 = 响应
+const uint16_t DNS_FLAG_TC = 0x0200;        // 截断（需要改用 TCP）
+const uint16_t DNS_RCODE_MASK = 0x000F;
+
+// 响应码 (RCODE)
+const int DNS_RCODE_NOERROR = 0;
+const int DNS_RCODE_FORMERR = 1;
+const int DNS_RCODE_SERVFAIL = 2;
+const int DNS_RCODE_NXDOMAIN = 3;
+const int DNS_RCODE_NOTIMP = 4;
+const int DNS_RCODE_REFUSED = 5;
+
+// EDNS0 (RFC 6891)
+const uint16_t DNS_TYPE_OPT = 41;
+const uint16_t DNS_EDNS_DO = 0x8000;        // DNSSEC OK：请服务器在响应中附带 RRSIG 等记录
+const int DNS_EDNS_OPT_SIZE = 11;           // 不带选项的 OPT 记录长度
+
+const int DNS_MAX_NAME = 256;               // 文本形式域名的缓冲区大小（最长 253 字符 + 结尾）
+const int DNS_MAX_QUERY = 12 + 256 + 4;     // 一个问题的查询包最大长度（头部 + QNAME + QTYPE/QCLASS）
+
+// ============================================================================
+// DNS 查询包构建函数
+// ============================================================================
+
+/**
+ * 将域名编码为 DNS QNAME 格式
+ *
+ * DNS QNAME 格式说明:
+ * 域名 "google.com" 编码为: [6]google[3]com[0]
+ * - 每段前面加上长度字节
+ * - 最后以 0x00 结尾
+ *
+ * 例如:
+ * google.com -> \x06google\x03com\x00
+ * www.example.org -> \x03www\x07example\x03org\x00
+ *
+ * @param domain 原始域名字符串 (例如 "google.com")
+ * @param buffer 输出缓冲区（至少 DNS_MAX_NAME 字节）
+ * @return 编码后的长度；标签超过 63 字节或总长超过 255 字节时返回 -1
+ */
+inline int encodeDomainName(const char* domain, unsigned char* buffer) {
+    unsigned char* ptr = buffer;
+    const char* label_start = domain;
+
+    // 遍历域名的每个字符
+    for (const char* p = domain; ; p++) {
+        // 遇到 '.' 或字符串结尾
+        if (*p == '.' || *p == '\0') {
+            int label_len = p - label_start;  // 计算当前标签长度
+
+            if (label_len > 63 || (ptr - buffer) + label_len + 2 > 255) {
+                return -1;
+            }
+            if (label_len > 0) {
+                *ptr++ = (unsigned char)label_len;  // 写入长度字节
+                memcpy(ptr, label_start, label_len);  // 写入标签内容
+                ptr += label_len;
+            }
+
+            // 如果到达字符串结尾，写入终止符 0x00
+            if (*p == '\0') {
+                *ptr++ = 0x00;
+                break;
+            }
+
+            // 移动到下一个标签
+            label_start = p + 1;
+        }
+    }
+
+    return ptr - buffer;  // 返回总长度
+}
+
+/**
+ * 构建 DNS 查询包
+ *
+ * DNS 查询包结构:
+ * +---------------------------+
+ * |   Header (12 bytes)       |  DNS头部
+ * +---------------------------+
+ * |   Question Section        |  问题部分
+ * |   - QNAME (variable)      |    - 域名（可变长度）
+ * |   - QTYPE (2 bytes)       |    - 查询类型
+ * |   - QCLASS (2 bytes)      |    - 查询类
+ * +---------------------------+
+ *
+ * @param domain 要查询的域名
+ * @param id 事务ID (用于匹配请求和响应，应当随机生成)
+ * @param qtype 查询类型 (1 = A)
+ * @param buffer 输出缓冲区（至少 DNS_MAX_QUERY 字节）
+ * @return 查询包的总长度；域名不合法时返回 -1
+ */
+inline int buildDNSQuery(const char* domain, uint16_t id, uint16_t qtype, unsigned char* buffer) {
+    // ========================================
+    // 1. 构建 DNS 头部 (12 字节)
+    // ========================================
+    DNSHeader* header = (DNSHeader*)buffer;
+
+    // 事务ID (用于匹配请求和响应)
+    header->id = htons(id);
+
+    // 设置标志位: 0x0100
+    // - QR=0 (查询)
+    // - Opcode=0 (标准查询)
+    // - RD=1 (期望递归查询，Recursion Desired)
+    // 0x0100 = 0000 0001 0000 0000
+    //          ^^^^ ^^^^ ^^^^ ^^^^
+    //          QR Opcode AA TC RD RA Z RCODE
+    header->flags = htons(0x0100);
+
+    // 设置计数字段
+    header->qdcount = htons(1);  // 1个问题
+    header->ancount = htons(0);  // 0个回答
+    header->nscount = htons(0);  // 0个授权记录
+    header->arcount = htons(0);  // 0个附加记录
+
+    // ========================================
+    // 2. 构建问题部分
+    // ========================================
+    unsigned char* qname_ptr = buffer + sizeof(DNSHeader);
+
+    // 编码域名为 QNAME 格式
+    int qname_len = encodeDomainName(domain, qname_ptr);
+    if (qname_len < 0) {
+        return -1;
+    }
+
+    // 添加 QTYPE 和 QCLASS
+    DNSQuestion* question = (DNSQuestion*)(qname_ptr + qname_len);
+    question->qtype = htons(qtype);   // 例如 Type A (IPv4 地址)
+    question->qclass = htons(1);  // Class IN (互联网)
+
+    // 返回总长度
+    int total_len = sizeof(DNSHeader) + qname_len + sizeof(DNSQuestion);
+    return total_len;
+}
+
+/**
+ * 在查询包末尾附加 EDNS0 OPT 伪记录 (RFC 6891)
+ *
+ * OPT 记录: NAME=根(0) TYPE=41 CLASS=可接收的 UDP 大小 TTL=扩展RCODE/版本/标志 RDLEN=0
+ * 不带 OPT 的服务器只会返回 512 字节以内的 UDP 响应，DNSSEC 的签名和密钥通常放不下。
+ *
+ * @param buffer 已由 buildDNSQuery 构建的查询包（之后至少还有 DNS_EDNS_OPT_SIZE 字节空间）
+ * @param len 当前长度
+ * @param udp_size 通告的 UDP 响应缓冲区大小
+ * @param dnssec_ok 是否设置 DO 位
+ * @return 新的长度
+ */
+inline int appendEDNS0(unsigned char* buffer, int len, uint16_t udp_size, bool dnssec_ok) {
+    unsigned char* p = buffer + len;
+    p[0] = 0;                                   // 根域名
+    p[1] = DNS_TYPE_OPT >> 8;
+    p[2] = DNS_TYPE_OPT & 0xFF;
+    p[3] = udp_size >> 8;
+    p[4] = udp_size & 0xFF;
+    p[5] = 0;                                   // 扩展 RCODE
+    p[6] = 0;                                   // EDNS 版本 0
+    uint16_t flags = dnssec_ok ? DNS_EDNS_DO : 0;
+    p[7] = flags >> 8;
+    p[8] = flags & 0xFF;
+    p[9] = 0;                                   // RDLEN = 0
+    p[10] = 0;
+    DNSHeader* header = (DNSHeader*)buffer;
+    header->arcount = htons(ntohs(header->arcount) + 1);
+    return len + DNS_EDNS_OPT_SIZE;
+}
+
+// ============================================================================
+// DNS 报文解析函数
+// ============================================================================
+
+/**
+ * 解析 DNS 报文中的域名（支持指针压缩）
+ *
+ * DNS 消息压缩 (RFC 1035 Section 4.1.4):
+ * 为了减少消息大小，DNS 使用指针来引用之前出现过的域名
+ *
+ * 格式:
+ * - 普通标签: 长度字节 (0-63) + 标签内容
+ * - 压缩指针: 前2位为11 (0xC0) + 14位偏移量
+ *
+ * 例如: 0xC0 0x0C 表示指向数据包偏移量 12 (0x000C) 的位置
+ *
+ * @param buffer 整个DNS报文的起始位置
+ * @param len 报文长度
+ * @param pos 当前要解析的位置（成功时更新为名称之后的位置）
+ * @param name 输出的域名字符串（至少 DNS_MAX_NAME 字节）
+ * @return 是否解析成功（越界、指针循环、名称过长都返回 false）
+ */
+inline bool parseDomainName(const unsigned char* buffer, int len, int& pos, char* name) {
+    int name_pos = 0;
+    int cur = pos;
+    int end_pos = -1;       // 第一次跳转前的位置（名称在原位置占用的字节到此为止）
+    int jumps = 0;
+    const int max_jumps = 10;  // 防止无限循环
+
+    while (true) {
+        if (cur < 0 || cur >= len) {
+            return false;
+        }
+        // 读取长度字节
+        unsigned char label_len = buffer[cur];
+
+        // 情况1: 结束标志 (0x00)
+        if (label_len == 0) {
+            cur++;
+            break;
+        }
+
+        // 情况2: 指针压缩 (前2位为11，即 >= 0xC0)
+        if ((label_len & 0xC0) == 0xC0) {
+            if (cur + 1 >= len || ++jumps > max_jumps) {
+                return false;
+            }
+            if (end_pos < 0) {
+                end_pos = cur + 2;  // 记录跳转前的位置
+            }
+            cur = ((label_len & 0x3F) << 8) | buffer[cur + 1];
+            continue;
+        }
+        if (label_len > 63) {
+            return false;   // 0x40 / 0x80 开头的标签类型已废弃
+        }
+
+        // 情况3: 普通标签
+        cur++;  // 跳过长度字节
+        if (cur + label_len > len || name_pos + label_len + 2 > DNS_MAX_NAME) {
+            return false;
+        }
+        // 添加标签分隔符 '.'
+        if (name_pos > 0) {
+            name[name_pos++] = '.';
+        }
+        memcpy(name + name_pos, buffer + cur, label_len);
+        name_pos += label_len;
+        cur += label_len;
+    }
+
+    name[name_pos] = '\0';
+    pos = end_pos >= 0 ? end_pos : cur;
+    return true;
+}
+
+/**
+ * DNS 报文概要：头部和第一个问题（流量分析只需要这些）
+ */
+struct DNSMessageInfo {
+    uint16_t id;
+    uint16_t flags;
+    bool is_response;
+    int rcode;
+    uint16_t qdcount;
+    uint16_t ancount;
+    char qname[DNS_MAX_NAME];   // 第一个问题的域名（qdcount 为 0 时为空串）
+    uint16_t qtype;
+};
+
+/**
+ * 解析 DNS 报文的头部和第一个问题
+ *
+ * @param buffer DNS 报文（UDP 负载，或 TCP 中去掉 2 字节长度前缀之后的部分）
+ * @param len 报文长度
+ * @param info 输出
+ * @return 报文是否合法
+ */
+inline bool parseDNSMessage(const unsigned char* buffer, int len, DNSMessageInfo& info) {
+    if (len < (int)sizeof(DNSHeader)) {
+        return false;
+    }
+    DNSHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    info.id = ntohs(header.id);
+    info.flags = ntohs(header.flags);
+    info.is_response = (info.flags & DNS_FLAG_QR) != 0;
+    info.rcode = info.flags & DNS_RCODE_MASK;
+    info.qdcount = ntohs(header.qdcount);
+    info.ancount = ntohs(header.ancount);
+    info.qname[0] = '\0';
+    info.qtype = 0;
+
+    if (info.qdcount == 0) {
+        return true;
+    }
+    int pos = sizeof(DNSHeader);
+    if (!parseDomainName(buffer, len, pos, info.qname) || pos + (int)sizeof(DNSQuestion) > len) {
+        return false;
+    }
+    DNSQuestion question;
+    memcpy(&question, buffer + pos, sizeof(question));
+    info.qtype = ntohs(question.qtype);
+    return true;
+}
+
+/**
+ * 提取响应中回答部分的 IPv4 地址 (A 记录)
+ *
+ * 递归服务器把 CNAME 链和最终的 A 记录都放在回答部分，按类型挑出 A 记录即可。
+ *
+ * @param buffer 响应报文
+ * @param len 报文长度
+ * @param info 输出头部和第一个问题
+ * @param addrs 输出地址（网络字节序），最多 max_addrs 个
+ * @param count 输出地址数
+ * @param min_ttl 输出回答部分（含 CNAME）中最小的 TTL；没有回答时为 0
+ * @return 报文是否合法
+ */
+inline bool parseDNSAddresses(const unsigned char* buffer, int len, DNSMessageInfo& info,
+                              uint32_t* addrs, int max_addrs, int& count, uint32_t& min_ttl) {
+    count = 0;
+    min_ttl = 0;
+    if (!parseDNSMessage(buffer, len, info)) {
+        return false;
+    }
+    // 跳过问题部分
+    int pos = sizeof(DNSHeader);
+    char name[DNS_MAX_NAME];
+    for (int i = 0; i < info.qdcount; i++) {
+        if (!parseDomainName(buffer, len, pos, name) || pos + (int)sizeof(DNSQuestion) > len) {
+            return false;
+        }
+        pos += sizeof(DNSQuestion);
+    }
+
+    bool first = true;
+    for (int i = 0; i < info.ancount; i++) {
+        if (!parseDomainName(buffer, len, pos, name) || pos + (int)sizeof(DNSResourceRecord) > len) {
+            return false;
+        }
+        DNSResourceRecord rr;
+        memcpy(&rr, buffer + pos, sizeof(rr));
+        pos += sizeof(rr);
+        uint16_t type = ntohs(rr.type);
+        uint32_t ttl = ntohl(rr.ttl);
+        uint16_t rdlength = ntohs(rr.rdlength);
+        if (pos + rdlength > len) {
+            return false;
+        }
+        if (type == 1 || type == 5) {
+            min_ttl = first ? ttl : std::min(min_ttl, ttl);
+            first = false;
+        }
+        if (type == 1 && rdlength == 4 && count < max_addrs) {
+            memcpy(&addrs[count++], buffer + pos, 4);
+        }
+        pos += rdlength;
+    }
+    return true;
+}
+
+#endif // DNS_MESSAGE_H
@@ -0,0 +1,668 @@
+/**
+ * DNS 预加载库 - 让未修改的程序使用共享 DNS 缓存
+ *
+ * 通过 LD_PRELOAD 替换 glibc 的 getaddrinfo / gethostbyname / gethostbyname2：
+ * - 先查静态覆盖表 (dns_hosts.h)，再查 /dev/shm 中的共享缓存 (dns_cache.h)，命中时不发任何网络请求
+ * - 未命中时自己构建查询 (dns_message.h) 发给上游服务器，结果按 TTL 写入共享缓存
+ * - 同一进程中多个线程同时查询同一个域名时只发一次上游查询 (singleflight)，其他线程等待结果；
+ *   不同域名的查询各自在调用线程中并行进行
+ * - 处理不了的情况（IPv6、数字地址、没有点的主机名、/etc/hosts 中的名称、服务名、上游失败）
+ *   原样交给 glibc，不会比原来更差。缓存中只有 A 记录，所以 getaddrinfo 只在调用者指定 AF_INET 时
+ *   走缓存；AF_UNSPEC 还要 AAAA 结果，除覆盖表外都交给 glibc
+ *
+ * 编译: make（生成 libdnscache.so）
+ * 运行: LD_PRELOAD=./libdnscache.so ../SMTP/smtp_client
+ *
+ * 环境变量:
+ *   DNSCACHE_SERVER  上游服务器 IP[:端口]（默认取 /etc/resolv.conf 中第一个 IPv4 nameserver），
+ *                    或加密上游 tls://host[:853]、https://host[:443]/dns-query (dns_transport.h)
+ *   DNSCACHE_CA      校验加密上游证书的 CA 文件（默认使用系统的 CA）
+ *   DNSCACHE_PATH    共享缓存文件（默认 /dev/shm/nslookup_dns_cache）
+ *   DNSCACHE_HOSTS   静态覆盖表（默认 /etc/nslookup/overrides.phf），被 hosts_build 替换后自动重新加载
+ *   DNSCACHE_STATS   设置后在进程退出时向 stderr 打印统计
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <dlfcn.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <sys/inotify.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dns_message.h"     // 查询构建与响应解析（与 resolver 共用）
+#include "dns_cache.h"       // 共享内存 DNS 缓存
+#include "dns_hosts.h"       // 静态覆盖表
+#include "dns_transport.h"   // DoT / DoH 上游
+
+// ============================================================================
+// 配置与 glibc 原函数
+// ============================================================================
+
+const int UPSTREAM_TIMEOUT_MS = 2000;   // 每次尝试的等待时间
+const int UPSTREAM_ATTEMPTS = 2;
+const int HOSTS_CHECK_INTERVAL_MS = 100;    // 查找路径上最多每隔这么久读一次 inotify
+
+typedef int (*getaddrinfo_fn)(const char*, const char*, const struct addrinfo*, struct addrinfo**);
+typedef struct hostent* (*gethostbyname_fn)(const char*);
+typedef struct hostent* (*gethostbyname2_fn)(const char*, int);
+
+/**
+ * 进程内的全局状态（第一次调用时初始化）
+ */
+struct PreloadState {
+    getaddrinfo_fn real_getaddrinfo;
+    gethostbyname_fn real_gethostbyname;
+    gethostbyname2_fn real_gethostbyname2;
+    struct sockaddr_in server;          // 上游服务器
+    std::string tls_url;                // 加密上游（为空时用 UDP）
+    DNSTLSClient* tls;                  // 第一次查询时创建，进程退出时不释放（I/O 线程还在运行）
+    pid_t tls_pid;                      // fork 之后子进程没有 I/O 线程，需要重新创建
+    std::mutex tls_lock;
+    DNSCache cache;
+    bool cache_ok;
+    std::set<std::string> hosts;        // /etc/hosts 中的名称（小写），交给 glibc 处理
+    bool stats;
+
+    // 静态覆盖表：读者用 std::atomic_load 取得当前表的引用，重新加载时 std::atomic_store 换成新表，
+    // 旧表在最后一个读者放手后才 munmap
+    std::string overrides_path;
+    std::string overrides_name;         // 文件名部分，用于匹配 inotify 事件
+    std::shared_ptr<DNSHostsTable> overrides;
+    int overrides_watch;                // 监视所在目录的 inotify（非阻塞），-1 = 不监视
+    std::atomic<int64_t> overrides_next_check;
+    std::mutex overrides_reload_lock;
+
+    // 统计
+    std::atomic<unsigned long> override_hits;
+    std::atomic<unsigned long> cache_hits;
+    std::atomic<unsigned long> upstream_queries;
+    std::atomic<unsigned long> coalesced;       // 等待其他线程的同名查询
+    std::atomic<unsigned long> passthrough;     // 交给 glibc 的调用
+    std::atomic<unsigned long> upstream_failures;
+};
+
+PreloadState state;
+std::once_flag state_once;
+
+/**
+ * 一次进行中的上游查询 (singleflight)
+ */
+struct Flight {
+    bool done;
+    int status;
+    DNSCacheEntry result;
+};
+
+std::mutex flights_lock;
+std::condition_variable flights_cv;
+std::map<std::string, std::shared_ptr<Flight> > flights;
+
+enum ResolveStatus {
+    RESOLVE_OK,
+    RESOLVE_NXDOMAIN,
+    RESOLVE_FAILED          // 上游不可用或响应无法解析：交给 glibc
+};
+
+/**
+ * 解析 IP[:端口]
+ */
+bool parse_server(const char* spec, struct sockaddr_in& addr) {
+    char host[64];
+    snprintf(host, sizeof(host), "%s", spec);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(53);
+    char* colon = strchr(host, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        addr.sin_port = htons(atoi(colon + 1));
+    }
+    return inet_pton(AF_INET, host, &addr.sin_addr) == 1;
+}
+
+void lowercase(std::string& s) {
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] >= 'A' && s[i] <= 'Z') {
+            s[i] = s[i] - 'A' + 'a';
+        }
+    }
+}
+
+/**
+ * 读取 /etc/resolv.conf 的第一个 IPv4 nameserver 和 /etc/hosts 中的名称
+ */
+void load_system_config() {
+    bool have_server = false;
+    const char* env = getenv("DNSCACHE_SERVER");
+    if (env != NULL && (strncmp(env, "tls://", 6) == 0 || strncmp(env, "https://", 8) == 0)) {
+        state.tls_url = env;
+    } else if (env != NULL) {
+        have_server = parse_server(env, state.server);
+    }
+    char line[512];
+    FILE* f = fopen("/etc/resolv.conf", "re");
+    if (f != NULL) {
+        while (!have_server && fgets(line, sizeof(line), f) != NULL) {
+            char ip[64];
+            if (sscanf(line, " nameserver %63s", ip) == 1) {
+                have_server = parse_server(ip, state.server);
+            }
+        }
+        fclose(f);
+    }
+    if (!have_server) {
+        parse_server("127.0.0.1", state.server);     // 与 glibc 没有配置时的默认值相同
+    }
+
+    f = fopen("/etc/hosts", "re");
+    if (f != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            char* comment = strchr(line, '#');
+            if (comment != NULL) {
+                *comment = '\0';
+            }
+            char* save = NULL;
+            char* tok = strtok_r(line, " \t\r\n", &save);    // 地址
+            while (tok != NULL && (tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+                std::string name(tok);
+                lowercase(name);
+                state.hosts.insert(name);
+            }
+        }
+        fclose(f);
+    }
+}
+
+void print_stats() {
+    fprintf(stderr, "dnscache: 覆盖表命中 %lu, 缓存命中 %lu, 上游查询 %lu (失败 %lu), 合并等待 %lu, 交给 glibc %lu\n",
+            state.override_hits.load(), state.cache_hits.load(), state.upstream_queries.load(),
+            state.upstream_failures.load(), state.coalesced.load(), state.passthrough.load());
+}
+
+/**
+ * 映射覆盖表；文件不存在或格式不对时返回空指针
+ */
+std::shared_ptr<DNSHostsTable> open_overrides() {
+    std::shared_ptr<DNSHostsTable> table(new DNSHostsTable, [](DNSHostsTable* t) {
+        dns_hosts_close(*t);
+        delete t;
+    });
+    if (!dns_hosts_open(*table, state.overrides_path.c_str())) {
+        return std::shared_ptr<DNSHostsTable>();
+    }
+    return table;
+}
+
+/**
+ * 打开覆盖表，并监视所在目录：hosts_build 写完临时文件后 rename 过来时触发 IN_MOVED_TO
+ *
+ * 监视目录而不是文件本身，因为 rename 之后原来的 inode 已经不是这个路径了。
+ * 不用后台线程：查找时顺便读一下非阻塞的 inotify，fork 出的子进程也照常工作。
+ */
+void init_overrides() {
+    const char* env = getenv("DNSCACHE_HOSTS");
+    state.overrides_path = env != NULL ? env : DNS_HOSTS_PATH;
+    size_t slash = state.overrides_path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : state.overrides_path.substr(0, std::max<size_t>(slash, 1));
+    state.overrides_name = slash == std::string::npos ? state.overrides_path : state.overrides_path.substr(slash + 1);
+
+    state.overrides_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state.overrides_watch >= 0 &&
+        inotify_add_watch(state.overrides_watch, dir.c_str(),
+                          IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM) < 0) {
+        close(state.overrides_watch);       // 目录不存在：不监视，也没有表
+        state.overrides_watch = -1;
+    }
+    state.overrides = open_overrides();
+}
+
+/**
+ * 覆盖表文件有变化时重新加载（由查找路径调用，最多每 HOSTS_CHECK_INTERVAL_MS 读一次 inotify）
+ */
+void check_overrides_reload() {
+    if (state.overrides_watch < 0) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    int64_t now_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (now_ms < state.overrides_next_check.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(state.overrides_reload_lock, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;     // 其他线程正在检查
+    }
+    state.overrides_next_check.store(now_ms + HOSTS_CHECK_INTERVAL_MS, std::memory_order_relaxed);
+
+    bool changed = false;
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t n;
+    while ((n = read(state.overrides_watch, buf, sizeof(buf))) > 0) {
+        for (ssize_t off = 0; off < n; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)(buf + off);
+            if (ev->len > 0 && strcmp(ev->name, state.overrides_name.c_str()) == 0) {
+                changed = true;
+            }
+            off += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (changed) {
+        // 文件被删除时换成空表
+        std::atomic_store(&state.overrides, open_overrides());
+    }
+}
+
+/**
+ * 在覆盖表中查找，不分配内存
+ */
+bool lookup_overrides(const char* name, DNSCacheEntry& out) {
+    check_overrides_reload();
+    std::shared_ptr<DNSHostsTable> table = std::atomic_load(&state.overrides);
+    if (table == NULL || !dns_hosts_lookup(*table, name, out)) {
+        return false;
+    }
+    state.override_hits++;
+    return true;
+}
+
+void init_state() {
+    state.real_getaddrinfo = (getaddrinfo_fn)dlsym(RTLD_NEXT, "getaddrinfo");
+    state.real_gethostbyname = (gethostbyname_fn)dlsym(RTLD_NEXT, "gethostbyname");
+    state.real_gethostbyname2 = (gethostbyname2_fn)dlsym(RTLD_NEXT, "gethostbyname2");
+    load_system_config();
+    const char* path = getenv("DNSCACHE_PATH");
+    state.cache_ok = dns_cache_open(state.cache, path != NULL ? path : DNS_CACHE_PATH);
+    init_overrides();
+    state.stats = getenv("DNSCACHE_STATS") != NULL;
+    if (state.stats) {
+        atexit(print_stats);
+    }
+}
+
+// ============================================================================
+// 解析
+// ============================================================================
+
+/**
+ * 是否由本库处理：含点、不是数字地址、不在 /etc/hosts 中、能放进缓存
+ *
+ * 没有点的名称依赖 resolv.conf 的 search 列表，交给 glibc
+ */
+bool cacheable_name(const char* name) {
+    struct in_addr addr;
+    if (strchr(name, '.') == NULL || strchr(name, ':') != NULL || inet_aton(name, &addr) != 0 ||
+        strlen(name) >= (size_t)DNS_CACHE_MAX_NAME - 1) {
+        return false;
+    }
+    std::string key(name);
+    lowercase(key);
+    if (!key.empty() && key[key.size() - 1] == '.') {
+        key.erase(key.size() - 1);
+    }
+    return state.hosts.count(key) == 0;
+}
+
+/**
+ * 检查上游响应并取出地址
+ * @return ResolveStatus；-1 表示不是这次查询的响应
+ */
+int parse_upstream_response(const unsigned char* response, int len, uint16_t id, const char* name,
+                            DNSCacheEntry& out) {
+    DNSMessageInfo info;
+    int count;
+    uint32_t ttl;
+    // 问题中的域名规范化后再比较：查询的名称可以带结尾的点，上游回显的不带
+    char expected[DNS_CACHE_MAX_NAME];
+    char answered[DNS_CACHE_MAX_NAME];
+    if (!parseDNSAddresses(response, len, info, out.addrs, DNS_CACHE_MAX_ADDRS, count, ttl) ||
+        !info.is_response || info.id != id || dns_cache_normalize(name, expected) < 0 ||
+        dns_cache_normalize(info.qname, answered) < 0 || strcmp(answered, expected) != 0) {
+        return -1;
+    }
+    if (info.rcode == DNS_RCODE_NXDOMAIN) {
+        out.rcode = DNS_RCODE_NXDOMAIN;
+        out.ttl = DNS_CACHE_NEGATIVE_TTL;
+        return RESOLVE_NXDOMAIN;
+    }
+    if (info.rcode == DNS_RCODE_NOERROR && !(info.flags & DNS_FLAG_TC) && count > 0) {
+        out.addr_count = count;
+        out.ttl = ttl;
+        return RESOLVE_OK;
+    }
+    // SERVFAIL、截断（需要 TCP）、没有地址：交给 glibc
+    return RESOLVE_FAILED;
+}
+
+/**
+ * 当前进程的加密上游客户端；所有线程的查询复用同一条连接
+ */
+DNSTLSClient* tls_client() {
+    std::lock_guard<std::mutex> lock(state.tls_lock);
+    if (state.tls == NULL || state.tls_pid != getpid()) {
+        // fork 出的子进程中旧客户端的 I/O 线程不存在，直接丢弃
+        DNSTLSClient* client = new DNSTLSClient;
+        const char* ca = getenv("DNSCACHE_CA");
+        // 上游的主机名用 glibc 解析，不能再进入本库
+        DNSTLSResolveFn resolve = [](const char* host, uint16_t port, struct sockaddr_in& addr) {
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if (inet_pton(AF_INET, host, &addr.sin_addr) == 1) {
+                return true;
+            }
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            struct addrinfo* res = NULL;
+            if (state.real_getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL) {
+                return false;
+            }
+            addr.sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+            freeaddrinfo(res);
+            return true;
+        };
+        if (!dns_tls_open(*client, state.tls_url.c_str(), ca, resolve)) {
+            delete client;
+            return NULL;
+        }
+        state.tls = client;
+        state.tls_pid = getpid();
+    }
+    return state.tls;
+}
+
+/**
+ * 通过 DoT / DoH 查询（I/O 线程负责超时和断线重发）
+ */
+int query_upstream_tls(const char* name, DNSCacheEntry& out) {
+    DNSTLSClient* client = tls_client();
+    unsigned char query[DNS_MAX_QUERY];
+    int query_len = buildDNSQuery(name, 0, 1, query);
+    std::vector<unsigned char> response;
+    if (client == NULL || query_len < 0 ||
+        dns_tls_query(*client, query, query_len, response, UPSTREAM_TIMEOUT_MS * UPSTREAM_ATTEMPTS) != DNS_TLS_OK) {
+        return RESOLVE_FAILED;
+    }
+    int status = parse_upstream_response(response.data(), response.size(), 0, name, out);
+    return status < 0 ? RESOLVE_FAILED : status;
+}
+
+/**
+ * 向上游发送一次 A 查询并等待响应（超时重试）
+ */
+int query_upstream(const char* name, DNSCacheEntry& out) {
+    memset(&out, 0, sizeof(out));
+    state.upstream_queries++;
+    if (!state.tls_url.empty()) {
+        int status = query_upstream_tls(name, out);
+        if (status == RESOLVE_FAILED) {
+            state.upstream_failures++;
+        }
+        return status;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return RESOLVE_FAILED;
+    }
+    // connect 之后内核只交付来自上游地址的报文
+    if (connect(sock, (struct sockaddr*)&state.server, sizeof(state.server)) < 0) {
+        close(sock);
+        return RESOLVE_FAILED;
+    }
+
+    int status = RESOLVE_FAILED;
+    for (int attempt = 0; attempt < UPSTREAM_ATTEMPTS && status == RESOLVE_FAILED; attempt++) {
+        // 随机事务ID（加上内核随机的源端口）防止伪造响应
+        uint16_t id;
+        if (getrandom(&id, sizeof(id), 0) != (ssize_t)sizeof(id)) {
+            id = (uint16_t)(rand() ^ getpid());
+        }
+        unsigned char query[DNS_MAX_QUERY];
+        int query_len = buildDNSQuery(name, id, 1, query);
+        if (query_len < 0 || send(sock, query, query_len, 0) != query_len) {
+            break;
+        }
+
+        struct pollfd pfd = {sock, POLLIN, 0};
+        while (poll(&pfd, 1, UPSTREAM_TIMEOUT_MS) > 0) {
+            unsigned char response[4096];
+            ssize_t n = recv(sock, response, sizeof(response), 0);
+            if (n < 0) {
+                break;
+            }
+            int result = parse_upstream_response(response, n, id, name, out);
+            if (result < 0) {
+                continue;   // 不是这次查询的响应，继续等
+            }
+            status = result;
+            break;
+        }
+    }
+    close(sock);
+    if (status == RESOLVE_FAILED) {
+        state.upstream_failures++;
+    }
+    return status;
+}
+
+/**
+ * 解析一个域名的 IPv4 地址：共享缓存 -> 进行中的同名查询 -> 上游
+ */
+int resolve_ipv4(const char* name, DNSCacheEntry& out) {
+    if (state.cache_ok && dns_cache_lookup(state.cache, name, 1, out, time(NULL))) {
+        state.cache_hits++;
+        return out.rcode == DNS_RCODE_NXDOMAIN ? RESOLVE_NXDOMAIN : RESOLVE_OK;
+    }
+
+    std::string key(name);
+    lowercase(key);
+    std::shared_ptr<Flight> flight;
+    {
+        std::unique_lock<std::mutex> lock(flights_lock);
+        std::map<std::string, std::shared_ptr<Flight> >::iterator it = flights.find(key);
+        if (it != flights.end()) {
+            // 已有线程在查询同一个域名：等它的结果
+            state.coalesced++;
+            flight = it->second;
+            flights_cv.wait(lock, [&flight]() { return flight->done; });
+            out = flight->result;
+            return flight->status;
+        }
+        flight = std::make_shared<Flight>();
+        flight->done = false;
+        flights[key] = flight;
+    }
+
+    int status = query_upstream(name, out);
+    if (status != RESOLVE_FAILED && state.cache_ok) {
+        dns_cache_store(state.cache, name, 1, out, time(NULL));
+    }
+
+    std::lock_guard<std::mutex> lock(flights_lock);
+    flight->status = status;
+    flight->result = out;
+    flight->done = true;
+    flights.erase(key);
+    flights_cv.notify_all();
+    return status;
+}
+
+/**
+ * 本库负责的解析：覆盖表 -> 共享缓存 / 上游；RESOLVE_FAILED 表示交给 glibc
+ */
+int resolve_name(const char* name, DNSCacheEntry& out) {
+    if (lookup_overrides(name, out)) {
+        return RESOLVE_OK;
+    }
+    if (!cacheable_name(name)) {
+        return RESOLVE_FAILED;
+    }
+    return resolve_ipv4(name, out);
+}
+
+// ============================================================================
+// 替换的 glibc 函数
+// ============================================================================
+
+/**
+ * 与 glibc 相同的内存布局：每个 addrinfo 和它的地址在同一块内存中，
+ * ai_canonname 单独分配，所以程序调用 glibc 的 freeaddrinfo 就能正确释放
+ */
+struct addrinfo* make_addrinfo(uint32_t addr, uint16_t port, int socktype, int protocol) {
+    struct addrinfo* ai = (struct addrinfo*)calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in));
+    if (ai == NULL) {
+        return NULL;
+    }
+    struct sockaddr_in* sin = (struct sockaddr_in*)(ai + 1);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    sin->sin_addr.s_addr = addr;
+    ai->ai_family = AF_INET;
+    ai->ai_socktype = socktype;
+    ai->ai_protocol = protocol;
+    ai->ai_addrlen = sizeof(struct sockaddr_in);
+    ai->ai_addr = (struct sockaddr*)sin;
+    return ai;
+}
+
+extern "C" int getaddrinfo(const char* node, const char* service,
+                           const struct addrinfo* hints, struct addrinfo** res) {
+    std::call_once(state_once, init_state);
+    int family = hints != NULL ? hints->ai_family : AF_UNSPEC;
+    int flags = hints != NULL ? hints->ai_flags : 0;
+    int socktype = hints != NULL ? hints->ai_socktype : 0;
+    int protocol = hints != NULL ? hints->ai_protocol : 0;
+
+    // 端口只处理数字和空；服务名（"smtp"）交给 glibc 查 /etc/services
+    char* end = NULL;
+    unsigned long port = service != NULL ? strtoul(service, &end, 10) : 0;
+    bool numeric_service = service == NULL || (*service != '\0' && *end == '\0' && port <= 65535);
+
+    if (node == NULL || (family != AF_UNSPEC && family != AF_INET) || (flags & AI_NUMERICHOST) ||
+        !numeric_service || (socktype != 0 && socktype != SOCK_STREAM && socktype != SOCK_DGRAM &&
+        socktype != SOCK_RAW)) {
+        state.passthrough++;
+        return state.real_getaddrinfo(node, service, hints, res);
+    }
+
+    // AF_UNSPEC 的调用者也要 IPv6 地址，只返回缓存中的 IPv4 地址会丢掉双栈主机的 AAAA 结果；
+    // 只有覆盖表（与 /etc/hosts 一样是固定的权威地址）在这里直接回答
+    DNSCacheEntry entry;
+    int status;
+    if (family == AF_UNSPEC) {
+        status = lookup_overrides(node, entry) ? RESOLVE_OK : RESOLVE_FAILED;
+    } else {
+        status = resolve_name(node, entry);
+    }
+    if (status == RESOLVE_FAILED) {
+        state.passthrough++;
+        return state.real_getaddrinfo(node, service, hints, res);
+    }
+    if (status == RESOLVE_NXDOMAIN) {
+        return EAI_NONAME;
+    }
+
+    // 没有指定套接字类型时与 glibc 一样每个地址返回 TCP、UDP、RAW 三项
+    static const int all_types[][2] = {{SOCK_STREAM, IPPROTO_TCP}, {SOCK_DGRAM, IPPROTO_UDP}, {SOCK_RAW, 0}};
+    int types[3][2];
+    int type_count = 0;
+    for (int t = 0; t < 3; t++) {
+        if (socktype == 0 || socktype == all_types[t][0]) {
+            types[type_count][0] = all_types[t][0];
+            types[type_count][1] = protocol != 0 ? protocol : all_types[t][1];
+            type_count++;
+        }
+    }
+
+    struct addrinfo* head = NULL;
+    struct addrinfo** tail = &head;
+    for (int i = 0; i < entry.addr_count; i++) {
+        for (int t = 0; t < type_count; t++) {
+            struct addrinfo* ai = make_addrinfo(entry.addrs[i], (uint16_t)port, types[t][0], types[t][1]);
+            if (ai == NULL) {
+                freeaddrinfo(head);
+                return EAI_MEMORY;
+            }
+            *tail = ai;
+            tail = &ai->ai_next;
+        }
+    }
+    if (head != NULL && (flags & AI_CANONNAME)) {
+        head->ai_canonname = strdup(node);
+    }
+    *res = head;
+    return 0;
+}
+
+/**
+ * gethostbyname 的返回值（每个线程一份；glibc 的版本是全进程共享的静态缓冲区）
+ */
+struct HostentBuffer {
+    struct hostent host;
+    char name[DNS_CACHE_MAX_NAME];
+    char* aliases[1];
+    char* addr_list[DNS_CACHE_MAX_ADDRS + 1];
+    uint32_t addrs[DNS_CACHE_MAX_ADDRS];
+};
+
+thread_local HostentBuffer hostent_buffer;
+
+extern "C" struct hostent* gethostbyname2(const char* name, int af) {
+    std::call_once(state_once, init_state);
+    if (name == NULL || af != AF_INET) {
+        state.passthrough++;
+        return state.real_gethostbyname2(name, af);
+    }
+    DNSCacheEntry entry;
+    int status = resolve_name(name, entry);
+    if (status == RESOLVE_FAILED) {
+        state.passthrough++;
+        return state.real_gethostbyname2(name, af);
+    }
+    if (status == RESOLVE_NXDOMAIN) {
+        h_errno = HOST_NOT_FOUND;
+        return NULL;
+    }
+
+    HostentBuffer& b = hostent_buffer;
+    snprintf(b.name, sizeof(b.name), "%s", name);
+    b.aliases[0] = NULL;
+    for (int i = 0; i < entry.addr_count; i++) {
+        b.addrs[i] = entry.addrs[i];
+        b.addr_list[i] = (char*)&b.addrs[i];
+    }
+    b.addr_list[entry.addr_count] = NULL;
+    b.host.h_name = b.name;
+    b.host.h_aliases = b.aliases;
+    b.host.h_addrtype = AF_INET;
+    b.host.h_length = 4;
+    b.host.h_addr_list = b.addr_list;
+    return &b.host;
+}
+
+extern "C" struct hostent* gethostbyname(const char* name) {
+    std::call_once(state_once, init_state);
+    if (name == NULL) {
+        state.passthrough++;
+        return state.real_gethostbyname(name);
+    }
+    return gethostbyname2(name, AF_INET);
+}
@@ -0,0 +1,1041 @@
+/**
+ * 加密的 DNS 上游 - DNS over TLS (RFC 7858) 与 DNS over HTTPS (RFC 8484, HTTP/2)
+ *
+ * 两种传输都只用一条持久的 TLS 连接，所有并发查询在上面复用：
+ * - DoT：每个查询前加 2 字节长度，流水线发送，响应按 DNS 事务ID匹配（可以乱序返回）
+ * - DoH：每个查询是一个 HTTP/2 流 (POST /dns-query, application/dns-message)，
+ *   流的数量受服务器的 SETTINGS_MAX_CONCURRENT_STREAMS 限制，超出的查询排队
+ *
+ * HTTP/2 只实现 DoH 客户端需要的部分：
+ * - HPACK 编码器复用动态表：第一个请求把 :path、:authority、content-type、accept 以“增量索引”
+ *   方式发送，之后的请求这些头部各只需 1 字节，每个请求的头部块约 14 字节
+ * - 通告 SETTINGS_HEADER_TABLE_SIZE = 0，服务器的响应头部不使用动态表，
+ *   解码只需要静态表；只解析 :status，其他头部跳过
+ * - 连接级流量控制：开始时把接收窗口加到 1 GB，用掉一半时再补
+ * - PING 应答、RST_STREAM、GOAWAY（未处理的流在新连接上重发）
+ *
+ * 一个 I/O 线程负责连接、发送、接收和超时，调用者从任意线程提交查询：
+ * dns_tls_submit 异步（回调在 I/O 线程中执行），dns_tls_query 阻塞等待结果。
+ * 连接断开后在下一个查询到来时重新建立；断开时还没收到响应的查询在新连接上重发（DNS 查询是幂等的）。
+ *
+ * 与 dns_message.h 一样只有头文件，函数都是 inline；使用者需要链接 -lssl -lcrypto -pthread。
+ */
+
+#ifndef DNS_TRANSPORT_H
+#define DNS_TRANSPORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+// ============================================================================
+// 常量与数据结构
+// ============================================================================
+
+const int DNS_TRANSPORT_DOT = 1;
+const int DNS_TRANSPORT_DOH = 2;
+
+const int DNS_TLS_CONNECT_TIMEOUT_MS = 3000;
+const uint32_t DNS_TLS_MAX_INFLIGHT = 4096;         // DoT 同时等待响应的查询上限
+const uint32_t H2_RECV_WINDOW = 1u << 30;           // 连接级接收窗口
+const uint32_t H2_MAX_STREAM_ID = 0x7FFFFFFF;
+
+// HTTP/2 帧类型与标志
+const uint8_t H2_DATA = 0x0;
+const uint8_t H2_HEADERS = 0x1;
+const uint8_t H2_RST_STREAM = 0x3;
+const uint8_t H2_SETTINGS = 0x4;
+const uint8_t H2_PUSH_PROMISE = 0x5;
+const uint8_t H2_PING = 0x6;
+const uint8_t H2_GOAWAY = 0x7;
+const uint8_t H2_WINDOW_UPDATE = 0x8;
+const uint8_t H2_CONTINUATION = 0x9;
+const uint8_t H2_FLAG_END_STREAM = 0x1;
+const uint8_t H2_FLAG_ACK = 0x1;
+const uint8_t H2_FLAG_END_HEADERS = 0x4;
+const uint8_t H2_FLAG_PADDED = 0x8;
+const uint8_t H2_FLAG_PRIORITY = 0x20;
+
+/**
+ * 查询结果
+ */
+enum DNSTLSResult {
+    DNS_TLS_OK,
+    DNS_TLS_TIMEOUT,
+    DNS_TLS_FAILED          // 连接失败、HTTP 状态不是 200、流被重置
+};
+
+typedef std::function<void(int result, const unsigned char* response, int len)> DNSTLSCallback;
+
+/**
+ * 把主机名解析成地址；预加载库传入 glibc 原来的 getaddrinfo，避免解析 DoH 服务器时递归进入自己
+ */
+typedef std::function<bool(const char* host, uint16_t port, struct sockaddr_in& addr)> DNSTLSResolveFn;
+
+struct DNSTLSRequest {
+    std::vector<unsigned char> query;
+    uint16_t original_id;               // 发送时改写了事务ID，响应中恢复成调用者的
+    int64_t deadline_ms;                // CLOCK_MONOTONIC
+    DNSTLSCallback callback;
+};
+
+/**
+ * 已发送、等待响应的查询
+ */
+struct DNSTLSPending {
+    DNSTLSRequest request;
+    int status;                         // DoH: HTTP :status（0 = 还没收到头部）
+    std::vector<unsigned char> body;
+};
+
+struct DNSTLSClient {
+    // 配置
+    int mode;
+    std::string host;
+    uint16_t port;
+    std::string path;                   // DoH 路径，如 /dns-query
+    std::string authority;              // host[:port]
+    SSL_CTX* ctx;
+    DNSTLSResolveFn resolve;
+
+    // 连接（只由 I/O 线程访问）
+    int fd;
+    SSL* ssl;
+    bool connected;
+    bool goaway;                        // 不再在这条连接上开始新的查询
+    std::string out;                    // 待发送
+    std::string in;                     // 已接收、尚未处理
+    std::deque<DNSTLSRequest> waiting;  // 等待发送（并发数或流量控制窗口已满）
+    std::map<uint32_t, DNSTLSPending> pending;  // DoH: 流 ID；DoT: 事务ID
+    uint32_t next_stream_id;
+    uint16_t next_dns_id;
+
+    // HTTP/2 连接状态
+    uint32_t max_concurrent;            // 服务器的 SETTINGS_MAX_CONCURRENT_STREAMS
+    int64_t send_window;                // 连接级发送窗口
+    int64_t stream_window;              // 服务器的 SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t encoder_table_size;        // 服务器的 SETTINGS_HEADER_TABLE_SIZE（HPACK 编码器可用的动态表大小）
+    bool table_size_changed;            // 下一个头部块开头要发送动态表大小更新
+    bool hpack_indexed;                 // 固定的请求头部已经在服务器的动态表中
+    uint64_t received_unacked;          // 收到但还没有用 WINDOW_UPDATE 补回的字节
+    std::string header_block;           // HEADERS + CONTINUATION 拼接中的头部块
+    uint32_t header_stream;
+
+    // 提交队列
+    std::mutex lock;
+    std::deque<DNSTLSRequest> queue;
+    int wake_fd;                        // eventfd：提交时唤醒 I/O 线程
+    bool stopping;
+    std::thread io;
+
+    // 统计
+    std::atomic<uint64_t> connects;
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> answered;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> retried;
+    std::atomic<uint64_t> header_bytes; // DoH 请求头部块的总字节数
+};
+
+inline int64_t dns_tls_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// ============================================================================
+// HTTP/2 帧与 HPACK
+// ============================================================================
+
+inline void h2_frame(std::string& out, uint8_t type, uint8_t flags, uint32_t stream,
+                     const void* payload, size_t len) {
+    unsigned char head[9] = {
+        (unsigned char)(len >> 16), (unsigned char)(len >> 8), (unsigned char)len, type, flags,
+        (unsigned char)(stream >> 24), (unsigned char)(stream >> 16), (unsigned char)(stream >> 8),
+        (unsigned char)stream};
+    out.append((const char*)head, sizeof(head));
+    out.append((const char*)payload, len);
+}
+
+inline void h2_u32(unsigned char* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+inline uint32_t h2_read_u32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * HPACK 整数 (RFC 7541 5.1)：first 为首字节中前缀之外的高位
+ */
+inline void hpack_int(std::string& out, uint8_t first, int prefix_bits, uint32_t value) {
+    uint32_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out += (char)(first | value);
+        return;
+    }
+    out += (char)(first | max_prefix);
+    value -= max_prefix;
+    while (value >= 128) {
+        out += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+inline bool hpack_read_int(const std::string& in, size_t& pos, int prefix_bits, uint32_t& value) {
+    uint32_t max_prefix = (1u << prefix_bits) - 1;
+    value = (unsigned char)in[pos++] & max_prefix;
+    if (value < max_prefix) {
+        return true;
+    }
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (pos >= in.size()) {
+            return false;
+        }
+        unsigned char b = in[pos++];
+        value += (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 不使用 Huffman 编码的字符串
+ */
+inline void hpack_string(std::string& out, const std::string& s) {
+    hpack_int(out, 0x00, 7, s.size());
+    out += s;
+}
+
+/**
+ * 读一个字符串；Huffman 编码时只解码数字（:status 的值），遇到其他字符返回 "?"
+ *
+ * 数字的 Huffman 码 (RFC 7541 附录 B)：'0'-'2' 为 5 位的 0-2，'3'-'9' 为 6 位的 0x19-0x1f
+ */
+inline bool hpack_read_string(const std::string& in, size_t& pos, std::string& s) {
+    if (pos >= in.size()) {
+        return false;
+    }
+    bool huffman = ((unsigned char)in[pos] & 0x80) != 0;
+    uint32_t len;
+    if (!hpack_read_int(in, pos, 7, len) || len > in.size() - pos) {
+        return false;
+    }
+    s.clear();
+    if (!huffman) {
+        s.assign(in, pos, len);
+        pos += len;
+        return true;
+    }
+    uint64_t bits = 0;
+    int nbits = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        bits = (bits << 8) | (unsigned char)in[pos + i];
+        nbits += 8;
+        while (nbits >= 6 || (nbits >= 5 && i + 1 == len)) {
+            uint32_t code5 = (bits >> (nbits - 5)) & 0x1F;
+            if (code5 <= 2) {
+                s += (char)('0' + code5);
+                nbits -= 5;
+                continue;
+            }
+            if (nbits < 6) {
+                break;
+            }
+            uint32_t code6 = (bits >> (nbits - 6)) & 0x3F;
+            if (code6 >= 0x19 && code6 <= 0x1F) {
+                s += (char)('3' + code6 - 0x19);
+                nbits -= 6;
+                continue;
+            }
+            break;
+        }
+    }
+    // 剩余的位必须是 EOS 填充（全 1，少于 8 位）
+    if (nbits >= 8 || (bits & ((1u << nbits) - 1)) != (1u << nbits) - 1) {
+        s = "?";
+    }
+    pos += len;
+    return true;
+}
+
+/**
+ * 从响应头部块中找出 :status
+ *
+ * 我们通告的动态表大小为 0，服务器只能使用静态表（索引 8-14 是 :status 的常见值）和字面量。
+ * @return 状态码；没有 :status 或无法解析时返回 -1
+ */
+inline int hpack_response_status(const std::string& block) {
+    static const int static_status[] = {200, 204, 206, 304, 400, 404, 500};
+    size_t pos = 0;
+    int status = -1;
+    while (pos < block.size()) {
+        unsigned char b = block[pos];
+        uint32_t index;
+        if (b & 0x80) {                                  // 索引的头部字段
+            if (!hpack_read_int(block, pos, 7, index)) {
+                return -1;
+            }
+            if (index >= 8 && index <= 14) {
+                status = static_status[index - 8];
+            }
+            continue;
+        }
+        if ((b & 0xE0) == 0x20) {                        // 动态表大小更新
+            if (!hpack_read_int(block, pos, 5, index)) {
+                return -1;
+            }
+            continue;
+        }
+        // 字面量（增量索引 01xxxxxx，或不索引/永不索引 000xxxxx）
+        if (!hpack_read_int(block, pos, (b & 0xC0) == 0x40 ? 6 : 4, index)) {
+            return -1;
+        }
+        std::string name, value;
+        if ((index == 0 && !hpack_read_string(block, pos, name)) || !hpack_read_string(block, pos, value)) {
+            return -1;
+        }
+        if ((index >= 8 && index <= 14) || name == ":status") {
+            status = atoi(value.c_str());
+        }
+    }
+    return status;
+}
+
+/**
+ * 请求的头部块
+ *
+ * :method POST 与 :scheme https 在静态表中 (3, 7)。其余四个固定头部第一次以增量索引发送，
+ * 按插入顺序在动态表中的位置是 :path=65、:authority=64、content-type=63、accept=62，
+ * 之后的请求直接引用。content-length 随查询长度变化，不索引。
+ */
+inline std::string h2_request_headers(DNSTLSClient& c, size_t body_len) {
+    std::string block;
+    if (c.table_size_changed) {
+        hpack_int(block, 0x20, 5, c.encoder_table_size);
+        c.table_size_changed = false;
+    }
+    block += (char)0x83;
+    block += (char)0x87;
+    static const std::string dns_message = "application/dns-message";
+    size_t table_needed = (5 + c.path.size() + 32) + (10 + c.authority.size() + 32) +
+                          (12 + dns_message.size() + 32) + (6 + dns_message.size() + 32);
+    if (c.hpack_indexed) {
+        block += (char)0xC1;
+        block += (char)0xC0;
+        block += (char)0xBF;
+        block += (char)0xBE;
+    } else if (table_needed <= c.encoder_table_size) {
+        block += (char)0x44;
+        hpack_string(block, c.path);
+        block += (char)0x41;
+        hpack_string(block, c.authority);
+        block += (char)0x5F;
+        hpack_string(block, dns_message);
+        block += (char)0x53;
+        hpack_string(block, dns_message);
+        c.hpack_indexed = true;
+    } else {
+        // 服务器不允许足够大的动态表：每次都发送不索引的字面量
+        block += (char)0x04;
+        hpack_string(block, c.path);
+        block += (char)0x01;
+        hpack_string(block, c.authority);
+        hpack_int(block, 0x00, 4, 31);
+        hpack_string(block, dns_message);
+        hpack_int(block, 0x00, 4, 19);
+        hpack_string(block, dns_message);
+    }
+    hpack_int(block, 0x00, 4, 28);
+    hpack_string(block, std::to_string(body_len));
+    return block;
+}
+
+// ============================================================================
+// 连接
+// ============================================================================
+
+/**
+ * 建立 TCP + TLS 连接（阻塞，带超时），之后把套接字设为非阻塞交给 I/O 循环
+ */
+inline bool dns_tls_connect(DNSTLSClient& c) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    if (!c.resolve(c.host.c_str(), c.port, addr)) {
+        return false;
+    }
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int64_t deadline = dns_tls_now_ms() + DNS_TLS_CONNECT_TIMEOUT_MS;
+    bool ok = connect(c.fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 || errno == EINPROGRESS;
+    if (ok) {
+        struct pollfd pfd = {c.fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ok = poll(&pfd, 1, DNS_TLS_CONNECT_TIMEOUT_MS) == 1 &&
+             getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+    }
+
+    c.ssl = ok ? SSL_new(c.ctx) : NULL;
+    ok = c.ssl != NULL && SSL_set_fd(c.ssl, c.fd) == 1;
+    if (ok) {
+        // 证书必须对 host 有效：IP 地址按 subjectAltName IP 校验，名称同时用于 SNI
+        struct in_addr ip;
+        if (inet_pton(AF_INET, c.host.c_str(), &ip) == 1) {
+            ok = X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(c.ssl), c.host.c_str()) == 1;
+        } else {
+            ok = SSL_set_tlsext_host_name(c.ssl, c.host.c_str()) == 1 && SSL_set1_host(c.ssl, c.host.c_str()) == 1;
+        }
+    }
+    while (ok) {
+        int r = SSL_connect(c.ssl);
+        if (r == 1) {
+            break;
+        }
+        int err = SSL_get_error(c.ssl, r);
+        int remaining = (int)(deadline - dns_tls_now_ms());
+        struct pollfd pfd = {c.fd, (short)(err == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN), 0};
+        ok = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) && remaining > 0 &&
+             poll(&pfd, 1, remaining) == 1;
+    }
+    if (ok && c.mode == DNS_TRANSPORT_DOH) {
+        const unsigned char* alpn = NULL;
+        unsigned int alpn_len = 0;
+        SSL_get0_alpn_selected(c.ssl, &alpn, &alpn_len);
+        ok = alpn_len == 2 && memcmp(alpn, "h2", 2) == 0;
+    }
+    if (!ok) {
+        if (c.ssl != NULL) {
+            SSL_free(c.ssl);
+            c.ssl = NULL;
+        }
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+
+    c.connected = true;
+    c.goaway = false;
+    c.out.clear();
+    c.in.clear();
+    c.next_stream_id = 1;
+    c.next_dns_id = 1;
+    c.max_concurrent = 100;             // 收到服务器的 SETTINGS 之前的保守值
+    c.send_window = 65535;
+    c.stream_window = 65535;
+    c.encoder_table_size = 4096;
+    c.table_size_changed = false;
+    c.hpack_indexed = false;
+    c.received_unacked = 0;
+    c.header_block.clear();
+    c.connects++;
+
+    if (c.mode == DNS_TRANSPORT_DOH) {
+        // 连接前言 + SETTINGS（动态表 0、禁止推送）+ 扩大连接级接收窗口
+        c.out = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        unsigned char settings[12] = {0, 0x1, 0, 0, 0, 0, 0, 0x2, 0, 0, 0, 0};
+        h2_frame(c.out, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+        unsigned char increment[4];
+        h2_u32(increment, H2_RECV_WINDOW - 65535);
+        h2_frame(c.out, H2_WINDOW_UPDATE, 0, 0, increment, sizeof(increment));
+    }
+    return true;
+}
+
+/**
+ * 关闭连接；还没收到响应的查询放回等待队列，在新连接上重发
+ */
+inline void dns_tls_disconnect(DNSTLSClient& c) {
+    if (!c.connected) {
+        return;
+    }
+    for (std::map<uint32_t, DNSTLSPending>::reverse_iterator it = c.pending.rbegin(); it != c.pending.rend(); ++it) {
+        c.waiting.push_front(it->second.request);
+        c.retried++;
+    }
+    c.pending.clear();
+    SSL_free(c.ssl);
+    close(c.fd);
+    c.ssl = NULL;
+    c.fd = -1;
+    c.connected = false;
+}
+
+inline void dns_tls_finish(DNSTLSClient& c, DNSTLSRequest& request, int result,
+                           std::vector<unsigned char>* response) {
+    if (result == DNS_TLS_OK) {
+        (*response)[0] = request.original_id >> 8;
+        (*response)[1] = request.original_id & 0xFF;
+        c.answered++;
+        request.callback(result, response->data(), response->size());
+        return;
+    }
+    if (result == DNS_TLS_TIMEOUT) {
+        c.timeouts++;
+    } else {
+        c.failures++;
+    }
+    request.callback(result, NULL, 0);
+}
+
+// ============================================================================
+// 发送与接收
+// ============================================================================
+
+/**
+ * 把等待队列中的查询写入发送缓冲区，直到并发数或流量控制窗口用完
+ */
+inline void dns_tls_dispatch(DNSTLSClient& c) {
+    while (c.connected && !c.goaway && !c.waiting.empty()) {
+        DNSTLSRequest& request = c.waiting.front();
+        size_t body_len = request.query.size();
+        if (c.mode == DNS_TRANSPORT_DOT) {
+            if (c.pending.size() >= DNS_TLS_MAX_INFLIGHT) {
+                break;
+            }
+            while (c.pending.count(c.next_dns_id) != 0) {
+                c.next_dns_id++;
+            }
+            uint16_t id = c.next_dns_id++;
+            request.query[0] = id >> 8;
+            request.query[1] = id & 0xFF;
+            c.out += (char)(body_len >> 8);
+            c.out += (char)(body_len & 0xFF);
+            c.out.append((const char*)request.query.data(), body_len);
+            DNSTLSPending& p = c.pending[id];
+            p.request = request;
+            p.status = 0;
+        } else {
+            if (c.pending.size() >= c.max_concurrent || (int64_t)body_len > c.send_window ||
+                (int64_t)body_len > c.stream_window) {
+                break;
+            }
+            if (c.next_stream_id > H2_MAX_STREAM_ID - 2) {
+                c.goaway = true;        // 流 ID 用完：等现有的流结束后换一条连接
+                break;
+            }
+            // RFC 8484 建议 DoH 查询的事务ID为 0（便于 HTTP 缓存）
+            request.query[0] = 0;
+            request.query[1] = 0;
+            uint32_t stream = c.next_stream_id;
+            c.next_stream_id += 2;
+            std::string block = h2_request_headers(c, body_len);
+            c.header_bytes += block.size();
+            h2_frame(c.out, H2_HEADERS, H2_FLAG_END_HEADERS, stream, block.data(), block.size());
+            h2_frame(c.out, H2_DATA, H2_FLAG_END_STREAM, stream, request.query.data(), body_len);
+            c.send_window -= body_len;
+            DNSTLSPending& p = c.pending[stream];
+            p.request = request;
+            p.status = 0;
+        }
+        c.sent++;
+        c.waiting.pop_front();
+    }
+}
+
+/**
+ * 一个 DoH 流结束：状态 200 且响应体是 DNS 报文时成功
+ */
+inline void h2_complete(DNSTLSClient& c, uint32_t stream) {
+    std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.find(stream);
+    if (it == c.pending.end()) {
+        return;
+    }
+    DNSTLSPending p = it->second;
+    c.pending.erase(it);
+    bool ok = p.status == 200 && p.body.size() >= 12;
+    dns_tls_finish(c, p.request, ok ? DNS_TLS_OK : DNS_TLS_FAILED, &p.body);
+}
+
+/**
+ * 处理一个 HTTP/2 帧
+ * @return false 表示协议错误，需要关闭连接
+ */
+inline bool h2_handle_frame(DNSTLSClient& c, uint8_t type, uint8_t flags, uint32_t stream,
+                            const unsigned char* payload, uint32_t len) {
+    // DATA / HEADERS 的填充与优先级字段
+    uint32_t pad = 0;
+    if ((type == H2_DATA || type == H2_HEADERS) && (flags & H2_FLAG_PADDED)) {
+        if (len < 1) {
+            return false;
+        }
+        pad = payload[0] + 1;
+    }
+    uint32_t skip = pad > 0 ? 1 : 0;
+    if (type == H2_HEADERS && (flags & H2_FLAG_PRIORITY)) {
+        skip += 5;
+    }
+    if ((type == H2_DATA || type == H2_HEADERS) && skip + (pad > 0 ? pad - 1 : 0) > len) {
+        return false;
+    }
+    const unsigned char* data = payload + skip;
+    uint32_t data_len = len - skip - (pad > 0 ? pad - 1 : 0);
+
+    switch (type) {
+        case H2_SETTINGS:
+            if (flags & H2_FLAG_ACK) {
+                return true;
+            }
+            for (uint32_t i = 0; i + 6 <= len; i += 6) {
+                uint16_t id = (payload[i] << 8) | payload[i + 1];
+                uint32_t value = h2_read_u32(payload + i + 2);
+                if (id == 0x1) {
+                    // 动态表大小变化：发送大小更新，并重新插入固定头部
+                    c.encoder_table_size = std::min<uint32_t>(value, 4096);
+                    c.table_size_changed = true;
+                    c.hpack_indexed = false;
+                } else if (id == 0x3) {
+                    c.max_concurrent = value;
+                } else if (id == 0x4) {
+                    c.stream_window = value;
+                }
+            }
+            h2_frame(c.out, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+            return true;
+        case H2_PING:
+            if (!(flags & H2_FLAG_ACK) && len == 8) {
+                h2_frame(c.out, H2_PING, H2_FLAG_ACK, 0, payload, 8);
+            }
+            return true;
+        case H2_WINDOW_UPDATE:
+            if (stream == 0 && len == 4) {
+                c.send_window += h2_read_u32(payload) & 0x7FFFFFFF;
+            }
+            return true;
+        case H2_HEADERS:
+            c.header_block.assign((const char*)data, data_len);
+            c.header_stream = stream;
+            // fall through
+        case H2_CONTINUATION:
+            if (type == H2_CONTINUATION) {
+                if (stream != c.header_stream) {
+                    return false;
+                }
+                c.header_block.append((const char*)payload, len);
+            }
+            if (flags & H2_FLAG_END_HEADERS) {
+                std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.find(stream);
+                if (it != c.pending.end() && it->second.status == 0) {
+                    it->second.status = hpack_response_status(c.header_block);
+                }
+            }
+            if (type == H2_HEADERS && (flags & H2_FLAG_END_STREAM)) {
+                h2_complete(c, stream);
+            }
+            return true;
+        case H2_DATA: {
+            c.received_unacked += len;
+            std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.find(stream);
+            if (it != c.pending.end() && it->second.body.size() + data_len <= 65535) {
+                it->second.body.insert(it->second.body.end(), data, data + data_len);
+            }
+            if (flags & H2_FLAG_END_STREAM) {
+                h2_complete(c, stream);
+            }
+            return true;
+        }
+        case H2_RST_STREAM: {
+            std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.find(stream);
+            if (it != c.pending.end()) {
+                DNSTLSPending p = it->second;
+                c.pending.erase(it);
+                dns_tls_finish(c, p.request, DNS_TLS_FAILED, NULL);
+            }
+            return true;
+        }
+        case H2_GOAWAY: {
+            // 编号大于 last_stream 的流服务器没有处理，放回等待队列在新连接上重发
+            if (len < 8) {
+                return false;
+            }
+            uint32_t last_stream = h2_read_u32(payload) & 0x7FFFFFFF;
+            std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.upper_bound(last_stream);
+            std::vector<DNSTLSRequest> unprocessed;
+            for (; it != c.pending.end(); ++it) {
+                unprocessed.push_back(it->second.request);
+            }
+            c.pending.erase(c.pending.upper_bound(last_stream), c.pending.end());
+            for (size_t i = unprocessed.size(); i-- > 0; ) {
+                c.waiting.push_front(unprocessed[i]);
+                c.retried++;
+            }
+            c.goaway = true;
+            return true;
+        }
+        case H2_PUSH_PROMISE:
+            return false;               // 已通过 SETTINGS_ENABLE_PUSH = 0 禁止
+        default:
+            return true;                // PRIORITY 与未知类型忽略
+    }
+}
+
+/**
+ * 处理接收缓冲区中所有完整的帧 / DoT 消息
+ */
+inline bool dns_tls_process_input(DNSTLSClient& c) {
+    size_t pos = 0;
+    bool ok = true;
+    if (c.mode == DNS_TRANSPORT_DOT) {
+        while (c.in.size() - pos >= 2) {
+            size_t len = ((unsigned char)c.in[pos] << 8) | (unsigned char)c.in[pos + 1];
+            if (c.in.size() - pos - 2 < len) {
+                break;
+            }
+            if (len >= 12) {
+                uint16_t id = ((unsigned char)c.in[pos + 2] << 8) | (unsigned char)c.in[pos + 3];
+                std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.find(id);
+                if (it != c.pending.end()) {
+                    DNSTLSPending p = it->second;
+                    c.pending.erase(it);
+                    std::vector<unsigned char> response(c.in.begin() + pos + 2, c.in.begin() + pos + 2 + len);
+                    dns_tls_finish(c, p.request, DNS_TLS_OK, &response);
+                }
+            }
+            pos += 2 + len;
+        }
+    } else {
+        while (ok && c.in.size() - pos >= 9) {
+            const unsigned char* h = (const unsigned char*)c.in.data() + pos;
+            uint32_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+            if (c.in.size() - pos - 9 < len) {
+                break;
+            }
+            ok = h2_handle_frame(c, h[3], h[4], h2_read_u32(h + 5) & 0x7FFFFFFF, h + 9, len);
+            pos += 9 + len;
+        }
+        if (c.received_unacked >= H2_RECV_WINDOW / 2) {
+            unsigned char increment[4];
+            h2_u32(increment, c.received_unacked);
+            h2_frame(c.out, H2_WINDOW_UPDATE, 0, 0, increment, sizeof(increment));
+            c.received_unacked = 0;
+        }
+    }
+    c.in.erase(0, pos);
+    return ok;
+}
+
+/**
+ * 非阻塞地发送和接收；连接出错时返回 false
+ */
+inline bool dns_tls_transfer(DNSTLSClient& c) {
+    while (!c.out.empty()) {
+        int n = SSL_write(c.ssl, c.out.data(), c.out.size());
+        if (n <= 0) {
+            int err = SSL_get_error(c.ssl, n);
+            if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+                return false;
+            }
+            break;
+        }
+        c.out.erase(0, n);
+    }
+    char buf[16384];
+    while (true) {
+        int n = SSL_read(c.ssl, buf, sizeof(buf));
+        if (n <= 0) {
+            int err = SSL_get_error(c.ssl, n);
+            return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+        }
+        c.in.append(buf, n);
+    }
+}
+
+/**
+ * 超时的查询（包括还在等待队列中的）
+ */
+inline void dns_tls_expire(DNSTLSClient& c, int64_t now) {
+    for (std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.begin(); it != c.pending.end(); ) {
+        if (it->second.request.deadline_ms > now) {
+            ++it;
+            continue;
+        }
+        if (c.mode == DNS_TRANSPORT_DOH && c.connected) {
+            unsigned char code[4];
+            h2_u32(code, 0x8);          // CANCEL
+            h2_frame(c.out, H2_RST_STREAM, 0, it->first, code, sizeof(code));
+        }
+        DNSTLSRequest request = it->second.request;
+        c.pending.erase(it++);
+        dns_tls_finish(c, request, DNS_TLS_TIMEOUT, NULL);
+    }
+    for (std::deque<DNSTLSRequest>::iterator it = c.waiting.begin(); it != c.waiting.end(); ) {
+        if (it->deadline_ms > now) {
+            ++it;
+            continue;
+        }
+        DNSTLSRequest request = *it;
+        it = c.waiting.erase(it);
+        dns_tls_finish(c, request, DNS_TLS_TIMEOUT, NULL);
+    }
+}
+
+/**
+ * I/O 线程
+ */
+inline void dns_tls_io_loop(DNSTLSClient* client) {
+    DNSTLSClient& c = *client;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(c.lock);
+            if (c.stopping) {
+                break;
+            }
+            while (!c.queue.empty()) {
+                c.waiting.push_back(c.queue.front());
+                c.queue.pop_front();
+            }
+        }
+
+        if (!c.connected && !c.waiting.empty() && !dns_tls_connect(c)) {
+            // 连接失败：等待中的查询全部失败，调用者自行降级
+            while (!c.waiting.empty()) {
+                DNSTLSRequest request = c.waiting.front();
+                c.waiting.pop_front();
+                dns_tls_finish(c, request, DNS_TLS_FAILED, NULL);
+            }
+        }
+        dns_tls_dispatch(c);
+
+        int64_t now = dns_tls_now_ms();
+        int64_t next_deadline = now + 1000;
+        for (std::map<uint32_t, DNSTLSPending>::iterator it = c.pending.begin(); it != c.pending.end(); ++it) {
+            next_deadline = std::min(next_deadline, it->second.request.deadline_ms);
+        }
+        if (!c.waiting.empty()) {
+            next_deadline = std::min(next_deadline, c.waiting.front().deadline_ms);
+        }
+        struct pollfd pfds[2] = {{c.wake_fd, POLLIN, 0}, {c.fd, (short)(POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0}};
+        poll(pfds, c.connected ? 2 : 1, (int)std::max<int64_t>(next_deadline - now, 0));
+        if (pfds[0].revents & POLLIN) {
+            uint64_t value;
+            ssize_t n = read(c.wake_fd, &value, sizeof(value));
+            (void)n;
+        }
+
+        if (c.connected && (!dns_tls_transfer(c) || !dns_tls_process_input(c) ||
+                            (c.goaway && c.pending.empty()))) {
+            dns_tls_disconnect(c);
+        } else if (c.connected && !c.out.empty()) {
+            dns_tls_transfer(c);        // 立即发出处理帧时产生的 SETTINGS ACK / WINDOW_UPDATE
+        }
+        dns_tls_expire(c, dns_tls_now_ms());
+    }
+
+    // 停止：剩下的查询全部失败
+    dns_tls_disconnect(c);
+    {
+        std::lock_guard<std::mutex> lock(c.lock);
+        while (!c.queue.empty()) {
+            c.waiting.push_back(c.queue.front());
+            c.queue.pop_front();
+        }
+    }
+    while (!c.waiting.empty()) {
+        DNSTLSRequest request = c.waiting.front();
+        c.waiting.pop_front();
+        dns_tls_finish(c, request, DNS_TLS_FAILED, NULL);
+    }
+}
+
+// ============================================================================
+// 公共接口
+// ============================================================================
+
+/**
+ * 解析上游地址：tls://host[:853] 或 https://host[:443]/path
+ */
+inline bool dns_tls_parse_url(const char* url, int& mode, std::string& host, uint16_t& port, std::string& path) {
+    std::string s(url);
+    size_t start;
+    if (s.compare(0, 6, "tls://") == 0) {
+        mode = DNS_TRANSPORT_DOT;
+        port = 853;
+        start = 6;
+    } else if (s.compare(0, 8, "https://") == 0) {
+        mode = DNS_TRANSPORT_DOH;
+        port = 443;
+        start = 8;
+    } else {
+        return false;
+    }
+    size_t slash = s.find('/', start);
+    std::string hostport = s.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+    path = slash == std::string::npos ? "/dns-query" : s.substr(slash);
+    size_t colon = hostport.rfind(':');
+    host = hostport.substr(0, colon);
+    if (colon != std::string::npos) {
+        port = atoi(hostport.c_str() + colon + 1);
+    }
+    return !host.empty() && port != 0;
+}
+
+/**
+ * 默认的主机名解析（IP 地址直接转换）
+ */
+inline bool dns_tls_default_resolve(const char* host, uint16_t port, struct sockaddr_in& addr) {
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) == 1) {
+        return true;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL) {
+        return false;
+    }
+    addr.sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return true;
+}
+
+/**
+ * 初始化客户端并启动 I/O 线程（连接在第一个查询时建立）
+ *
+ * @param url tls://host[:port] 或 https://host[:port]/path
+ * @param ca_file 校验服务器证书的 CA 文件；NULL 时使用系统的 CA
+ * @param resolve 主机名解析函数；为空时使用 getaddrinfo
+ */
+inline bool dns_tls_open(DNSTLSClient& c, const char* url, const char* ca_file,
+                         DNSTLSResolveFn resolve = DNSTLSResolveFn()) {
+    if (!dns_tls_parse_url(url, c.mode, c.host, c.port, c.path)) {
+        return false;
+    }
+    c.authority = c.host + ((c.mode == DNS_TRANSPORT_DOH && c.port != 443) ? ":" + std::to_string(c.port) : "");
+    c.resolve = resolve ? resolve : DNSTLSResolveFn(dns_tls_default_resolve);
+    c.ctx = SSL_CTX_new(TLS_client_method());
+    if (c.ctx == NULL) {
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(c.ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(c.ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_mode(c.ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    bool ok = ca_file != NULL ? SSL_CTX_load_verify_locations(c.ctx, ca_file, NULL) == 1
+                              : SSL_CTX_set_default_verify_paths(c.ctx) == 1;
+    // DoH 必须协商到 h2；DoT 通告 "dot" (RFC 7858 的 ALPN 标识)
+    static const unsigned char alpn_h2[] = {2, 'h', '2'};
+    static const unsigned char alpn_dot[] = {3, 'd', 'o', 't'};
+    ok = ok && (c.mode == DNS_TRANSPORT_DOH ? SSL_CTX_set_alpn_protos(c.ctx, alpn_h2, sizeof(alpn_h2))
+                                            : SSL_CTX_set_alpn_protos(c.ctx, alpn_dot, sizeof(alpn_dot))) == 0;
+    c.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!ok || c.wake_fd < 0) {
+        SSL_CTX_free(c.ctx);
+        return false;
+    }
+    c.fd = -1;
+    c.ssl = NULL;
+    c.connected = false;
+    c.stopping = false;
+    c.connects = 0;
+    c.sent = 0;
+    c.answered = 0;
+    c.timeouts = 0;
+    c.failures = 0;
+    c.retried = 0;
+    c.header_bytes = 0;
+    c.io = std::thread(dns_tls_io_loop, &c);
+    return true;
+}
+
+/**
+ * 异步提交一个查询；callback 在 I/O 线程中调用，响应的事务ID与 query 相同
+ */
+inline void dns_tls_submit(DNSTLSClient& c, const unsigned char* query, int len, int timeout_ms,
+                           DNSTLSCallback callback) {
+    if (len < 12) {
+        callback(DNS_TLS_FAILED, NULL, 0);
+        return;
+    }
+    DNSTLSRequest request;
+    request.query.assign(query, query + len);
+    request.original_id = (query[0] << 8) | query[1];
+    request.deadline_ms = dns_tls_now_ms() + timeout_ms;
+    request.callback = callback;
+    {
+        std::lock_guard<std::mutex> lock(c.lock);
+        c.queue.push_back(request);
+    }
+    uint64_t one = 1;
+    ssize_t n = write(c.wake_fd, &one, sizeof(one));
+    (void)n;
+}
+
+/**
+ * 阻塞查询（可以从多个线程同时调用，它们共享同一条连接）
+ */
+inline int dns_tls_query(DNSTLSClient& c, const unsigned char* query, int len,
+                         std::vector<unsigned char>& response, int timeout_ms) {
+    struct Waiter {
+        std::mutex lock;
+        std::condition_variable cv;
+        bool done;
+        int result;
+        std::vector<unsigned char> response;
+    };
+    std::shared_ptr<Waiter> w = std::make_shared<Waiter>();
+    w->done = false;
+    dns_tls_submit(c, query, len, timeout_ms, [w](int result, const unsigned char* data, int data_len) {
+        std::lock_guard<std::mutex> lock(w->lock);
+        w->result = result;
+        if (data != NULL) {
+            w->response.assign(data, data + data_len);
+        }
+        w->done = true;
+        w->cv.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(w->lock);
+    w->cv.wait(lock, [&w]() { return w->done; });
+    response.swap(w->response);
+    return w->result;
+}
+
+inline void dns_tls_close(DNSTLSClient& c) {
+    {
+        std::lock_guard<std::mutex> lock(c.lock);
+        c.stopping = true;
+    }
+    uint64_t one = 1;
+    ssize_t n = write(c.wake_fd, &one, sizeof(one));
+    (void)n;
+    c.io.join();
+    close(c.wake_fd);
+    SSL_CTX_free(c.ctx);
+}
+
+#endif // DNS_TRANSPORT_H
@@ -0,0 +1,257 @@
+/**
+ * 预编译的区数据镜像 - zone_compile 把主文件 (RFC 1035 master file) 编译成这个格式，
+ * 权威服务启动时只需 mmap，不再解析文本
+ *
+ * - 所有者名称放在开放寻址的哈希表里（线性探测，装载率不超过 2/3），查找算一次哈希、比较一两个槽位
+ * - 每个名称的 RRset 连续存放，按类型查找时顺序扫描（一个名称通常只有几个 RRset）
+ * - RDATA 是线路格式（名称不压缩），回答时直接复制
+ * - 所有者名称按 dns_zone_normalize 规范化（小写、不带结尾的点），与 dns_hosts.h 共用哈希函数
+ *
+ * 与 dns_hosts.h 一样：文件由生成器写临时文件再 rename，打开时检查大小与头部一致，
+ * 查找时检查每个偏移都在文件内。只有头文件，函数都是 inline。
+ */
+
+#ifndef DNS_ZONE_H
+#define DNS_ZONE_H
+
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dns_message.h"     // DNS_MAX_NAME
+#include "dns_hosts.h"       // dns_hosts_hash
+
+// ============================================================================
+// 文件布局
+// ============================================================================
+
+const uint32_t DNS_ZONE_MAGIC = 0x4E5A5344;         // "DSZN"
+const uint32_t DNS_ZONE_VERSION = 1;
+
+/**
+ * 文件头部 (64 字节)，之后依次是：
+ *   DNSZoneSlot    slots[slot_count]           slot_count 是 2 的幂
+ *   DNSZoneRRset   rrsets[rrset_count]         同一名称的 RRset 相邻
+ *   DNSZoneName    names[name_count]
+ *   char           name_text[names_size]      规范化的所有者名称，不含 '\0'
+ *   unsigned char  data[data_size]            每个 RR: uint16_t rdlength (网络字节序) + RDATA
+ */
+struct DNSZoneHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t name_count;
+    uint32_t rrset_count;
+    uint64_t record_count;
+    uint32_t slot_count;
+    uint32_t origin_name;               // 区顶点 ($ORIGIN) 在 names 中的序号，没有时为 UINT32_MAX
+    uint64_t names_size;
+    uint64_t data_size;
+    int64_t built;                      // 生成时间（Unix 秒）
+    uint8_t reserved[8];
+};
+
+/**
+ * 哈希表槽位，name 为 0 表示空槽位，否则是名称序号 + 1
+ */
+struct DNSZoneSlot {
+    uint32_t hash;                      // 哈希的低 32 位（高 32 位决定起始槽位）
+    uint32_t name;
+};
+
+struct DNSZoneRRset {
+    uint64_t data_off;
+    uint32_t ttl;
+    uint16_t type;
+    uint16_t rr_count;
+};
+
+struct DNSZoneName {
+    uint64_t text_off;
+    uint32_t first_rrset;
+    uint16_t rrset_count;
+    uint16_t text_len;
+};
+
+static_assert(sizeof(DNSZoneHeader) == 64, "区镜像头部应为 64 字节");
+static_assert(sizeof(DNSZoneSlot) == 8, "区镜像槽位应为 8 字节");
+static_assert(sizeof(DNSZoneRRset) == 16, "区镜像 RRset 应为 16 字节");
+static_assert(sizeof(DNSZoneName) == 16, "区镜像名称应为 16 字节");
+
+/**
+ * 一个进程打开的区镜像
+ */
+struct DNSZone {
+    unsigned char* base;
+    size_t size;
+    const DNSZoneHeader* header;
+    const DNSZoneSlot* slots;
+    const DNSZoneRRset* rrsets;
+    const DNSZoneName* names;
+    const char* name_text;
+    const unsigned char* data;
+};
+
+/**
+ * 按头部中的数量计算文件应有的大小
+ */
+inline uint64_t dns_zone_file_size(const DNSZoneHeader& h) {
+    return sizeof(DNSZoneHeader) + (uint64_t)h.slot_count * sizeof(DNSZoneSlot) +
+           (uint64_t)h.rrset_count * sizeof(DNSZoneRRset) + (uint64_t)h.name_count * sizeof(DNSZoneName) +
+           h.names_size + h.data_size;
+}
+
+/**
+ * 名称规范化：小写、去掉结尾的点（根区为空字符串）
+ * @return 长度；超过 DNS_MAX_NAME - 1 时返回 -1
+ */
+inline int dns_zone_normalize(const char* name, int len, char* out) {
+    if (len >= DNS_MAX_NAME) {
+        return -1;
+    }
+    for (int i = 0; i < len; i++) {
+        char c = name[i];
+        out[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    if (len > 0 && out[len - 1] == '.') {
+        len--;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/**
+ * 规范化名称的哈希（生成器与查找共用）
+ */
+inline uint64_t dns_zone_hash(const char* key, int len) {
+    return dns_hosts_hash(key, len, 0);
+}
+
+// ============================================================================
+// 公共接口
+// ============================================================================
+
+/**
+ * 只读映射区镜像，只检查头部与文件大小，不读取其他内容
+ */
+inline bool dns_zone_open(DNSZone& zone, const char* path) {
+    memset(&zone, 0, sizeof(zone));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    DNSZoneHeader header;
+    bool valid = fstat(fd, &st) == 0 &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 header.magic == DNS_ZONE_MAGIC && header.version == DNS_ZONE_VERSION &&
+                 header.slot_count > 0 && (header.slot_count & (header.slot_count - 1)) == 0 &&
+                 header.name_count < header.slot_count &&
+                 header.names_size <= (uint64_t)st.st_size && header.data_size <= (uint64_t)st.st_size &&
+                 dns_zone_file_size(header) == (uint64_t)st.st_size;
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    zone.base = (unsigned char*)p;
+    zone.size = st.st_size;
+    zone.header = (const DNSZoneHeader*)zone.base;
+    zone.slots = (const DNSZoneSlot*)(zone.header + 1);
+    zone.rrsets = (const DNSZoneRRset*)(zone.slots + header.slot_count);
+    zone.names = (const DNSZoneName*)(zone.rrsets + header.rrset_count);
+    zone.name_text = (const char*)(zone.names + header.name_count);
+    zone.data = (const unsigned char*)zone.name_text + header.names_size;
+    return true;
+}
+
+inline void dns_zone_close(DNSZone& zone) {
+    if (zone.base != NULL) {
+        munmap(zone.base, zone.size);
+        zone.base = NULL;
+    }
+}
+
+/**
+ * 查找所有者名称
+ * @return 名称记录；区中没有这个名称时返回 NULL
+ */
+inline const DNSZoneName* dns_zone_find(const DNSZone& zone, const char* name) {
+    if (zone.base == NULL) {
+        return NULL;
+    }
+    char key[DNS_MAX_NAME];
+    int len = dns_zone_normalize(name, strlen(name), key);
+    if (len < 0) {
+        return NULL;
+    }
+    const DNSZoneHeader& header = *zone.header;
+    uint64_t h = dns_zone_hash(key, len);
+    uint32_t mask = header.slot_count - 1;
+    // 生成器保证装载率不超过 2/3；文件不可信，探测次数仍以槽位数为上限
+    uint32_t i = (uint32_t)(h >> 32) & mask;
+    for (uint32_t probes = 0; probes < header.slot_count; probes++, i = (i + 1) & mask) {
+        const DNSZoneSlot& slot = zone.slots[i];
+        if (slot.name == 0 || slot.name > header.name_count) {
+            return NULL;
+        }
+        if (slot.hash != (uint32_t)h) {
+            continue;
+        }
+        const DNSZoneName& n = zone.names[slot.name - 1];
+        if (n.text_len == len && n.text_off <= header.names_size && n.text_len <= header.names_size - n.text_off &&
+            memcmp(zone.name_text + n.text_off, key, len) == 0) {
+            return &n;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 在名称下按类型查找 RRset
+ * @return RRset；没有这个类型时返回 NULL
+ */
+inline const DNSZoneRRset* dns_zone_rrset(const DNSZone& zone, const DNSZoneName* name, uint16_t type) {
+    if (name == NULL || (uint64_t)name->first_rrset + name->rrset_count > zone.header->rrset_count) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < name->rrset_count; i++) {
+        const DNSZoneRRset& rrset = zone.rrsets[name->first_rrset + i];
+        if (rrset.type == type) {
+            return &rrset;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 依次取出 RRset 中的 RR：第一次调用前 *offset 设为 0
+ * @return 是否还有 RR；rdata/rdlength 指向镜像中的 RDATA
+ */
+inline bool dns_zone_next_rr(const DNSZone& zone, const DNSZoneRRset& rrset, uint32_t index, uint64_t& offset,
+                             const unsigned char*& rdata, uint16_t& rdlength) {
+    if (index >= rrset.rr_count) {
+        return false;
+    }
+    // 逐项与剩余长度比较，偏移取任何值都不会回绕
+    uint64_t size = zone.header->data_size;
+    if (rrset.data_off > size || offset > size - rrset.data_off || size - rrset.data_off - offset < 2) {
+        return false;
+    }
+    uint64_t pos = rrset.data_off + offset;
+    rdlength = (zone.data[pos] << 8) | zone.data[pos + 1];
+    if (rdlength > size - pos - 2) {
+        return false;
+    }
+    rdata = zone.data + pos + 2;
+    offset += 2 + rdlength;
+    return true;
+}
+
+#endif // DNS_ZONE_H
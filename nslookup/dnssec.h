@@ -0,0 +1,1081 @@
+/**
+ * DNSSEC 验证 (RFC 4033-4035) - 从信任锚沿 DS/DNSKEY 链验证应答中的 RRset
+ *
+ * 验证一个应答需要：
+ * 1. 应答中每个 RRset 的 RRSIG 由签名区 (signer) 的某个 DNSKEY 签出
+ * 2. 这个区的 DNSKEY RRset 由其中一个与 DS 匹配的密钥 (KSK) 签出
+ * 3. DS 由父区的 DNSKEY 签出（父区再重复 2、3），直到信任锚（配置的 DS，默认是根区的 KSK）
+ *
+ * 代价主要在第 2、3 步，而区的密钥很少变化：验证过的 DNSKEY 集合按区缓存（内存中，并保存到
+ * /dev/shm 下的文件供之后的进程使用），有效期取链上所有记录 TTL 和签名过期时间的最小值。
+ * 应答的签名者使用了缓存中没有的密钥（密钥轮换）时重新获取这个区的链，
+ * 所以整条链只在密钥轮换或过期时验证一次，平时每个查询只验证应答自身的一个签名。
+ *
+ * 同一步中相互独立的签名（DS 与 DNSKEY 集合、应答中的多个 RRset）交给工作线程池并行验证。
+ * 密码学运算使用 OpenSSL：RSA/SHA-1/SHA-256/SHA-512、ECDSA P-256/P-384、Ed25519。
+ *
+ * 暂不支持 NSEC/NSEC3：否定应答、未签名的委派、通配符展开的应答都报告为“无法验证”，
+ * 不会当作已验证的结果。
+ *
+ * 与 dns_message.h 一样只有头文件，函数都是 inline；使用者需要链接 -lcrypto -pthread。
+ */
+
+#ifndef DNSSEC_H
+#define DNSSEC_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/param_build.h>
+
+#include "dns_message.h"
+#include "dns_cache.h"       // DNSCacheEntry（验证后的结果）
+
+// ============================================================================
+// 常量
+// ============================================================================
+
+const uint16_t DNS_TYPE_A = 1;
+const uint16_t DNS_TYPE_CNAME = 5;
+const uint16_t DNS_TYPE_DS = 43;
+const uint16_t DNS_TYPE_RRSIG = 46;
+const uint16_t DNS_TYPE_DNSKEY = 48;
+
+// 验证过的结果在共享缓存中使用的“类型”：与普通 A 记录分开，未验证的写入者不会冒充已验证的结果
+const uint16_t DNSSEC_CACHE_QTYPE_A = 0x8000 | DNS_TYPE_A;
+
+const char* const DNSSEC_KEY_CACHE_PATH = "/dev/shm/nslookup_dnssec_keys";
+
+const uint16_t DNSKEY_FLAG_ZONE = 0x0100;   // 区密钥（只有区密钥能签 RRset）
+const uint16_t DNSKEY_FLAG_SEP = 0x0001;    // KSK
+const int DNSSEC_MAX_CHAIN = 16;            // 信任链最多经过的区数
+
+// 根区信任锚：KSK-2017 与 KSK-2024 (https://data.iana.org/root-anchors/root-anchors.xml)
+const char* const DNSSEC_ROOT_ANCHORS =
+    ". IN DS 20326 8 2 E06D44B80B8F1D39A95C0B0D7C65D08458E880409BBC683457104237C7F8EC8D\n"
+    ". IN DS 38696 8 2 683D2D0ACB8C9B712A1948B27F741219298D0A450D612C483AF444A4C0FB2B16\n";
+
+/**
+ * 验证结果
+ */
+enum DnssecStatus {
+    DNSSEC_SECURE,              // 从信任锚到应答的每个签名都验证通过
+    DNSSEC_INDETERMINATE,       // 没有签名、缺少 DS、算法不支持等：无法证明安全，也不能证明被篡改
+    DNSSEC_BOGUS                // 签名错误、过期、与 DS 不匹配：应答不可信
+};
+
+inline const char* dnssec_status_name(int status) {
+    switch (status) {
+        case DNSSEC_SECURE: return "已验证 (secure)";
+        case DNSSEC_INDETERMINATE: return "无法验证 (indeterminate)";
+        default: return "验证失败 (bogus)";
+    }
+}
+
+// ============================================================================
+// 数据结构
+// ============================================================================
+
+/**
+ * 一个 RRSIG（rdata 解析后的字段）
+ */
+struct DnssecSig {
+    uint16_t type_covered;
+    uint8_t algorithm;
+    uint8_t labels;
+    uint32_t original_ttl;
+    uint32_t expiration;
+    uint32_t inception;
+    uint16_t key_tag;
+    std::string signer;         // 规范格式（小写、未压缩）的线格式域名
+    std::string signature;
+};
+
+/**
+ * 一个 RRset：同一名称、同一类型的所有记录及覆盖它的签名
+ * 名称和 rdata 中的域名都已转成规范格式 (RFC 4034 6.2)
+ */
+struct DnssecRRset {
+    std::string owner;
+    uint16_t type;
+    uint32_t ttl;
+    std::vector<std::string> rdatas;
+    std::vector<DnssecSig> sigs;
+};
+
+/**
+ * 验证过的区密钥
+ */
+struct DnssecKey {
+    uint16_t flags;
+    uint8_t algorithm;
+    uint16_t tag;
+    std::string rdata;          // 完整的 DNSKEY rdata（flags、协议、算法、公钥）
+};
+
+struct DnssecZoneKeys {
+    int64_t expires;            // Unix 秒
+    std::vector<DnssecKey> keys;
+};
+
+/**
+ * 签名验证的工作线程池
+ */
+struct DnssecWorkerPool {
+    std::vector<std::thread> threads;
+    std::deque<std::packaged_task<bool()> > queue;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool stopping;
+};
+
+/**
+ * 向服务器发送一个查询（带 DO 位）并返回响应；由使用者提供（resolver 用 UDP 发给 -S 指定的服务器）
+ */
+typedef std::function<bool(const char* name, uint16_t qtype, std::vector<unsigned char>& response)>
+    DnssecQueryFn;
+
+struct DnssecValidator {
+    DnssecQueryFn query;
+    std::map<std::string, std::vector<std::string> > anchors;  // 区 -> 信任的 DS rdata
+    std::map<std::string, DnssecZoneKeys> zones;                // 区 -> 验证过的 DNSKEY（缓存）
+    bool zones_dirty;
+    DnssecWorkerPool pool;
+
+    // 统计
+    int queries;                // 为建立信任链发出的查询
+    int zone_cache_hits;
+    std::atomic<int> verifications;
+};
+
+// ============================================================================
+// 域名（规范线格式）
+// ============================================================================
+
+/**
+ * 文本域名 -> 规范线格式（小写）；失败时返回空串
+ */
+inline std::string dnssec_name_wire(const char* text) {
+    char lower[DNS_MAX_NAME];
+    int n = 0;
+    for (; text[n] != '\0' && n < DNS_MAX_NAME - 1; n++) {
+        char c = text[n];
+        lower[n] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    lower[n] = '\0';
+    unsigned char wire[DNS_MAX_NAME];
+    int len = encodeDomainName(lower, wire);
+    return len > 0 ? std::string((const char*)wire, len) : std::string();
+}
+
+/**
+ * 线格式域名 -> 文本（以 '.' 结尾，根为 "."）
+ */
+inline std::string dnssec_name_text(const std::string& wire) {
+    std::string text;
+    for (size_t i = 0; i < wire.size() && wire[i] != 0; i += (unsigned char)wire[i] + 1) {
+        text.append(wire, i + 1, (unsigned char)wire[i]);
+        text += '.';
+    }
+    return text.empty() ? "." : text;
+}
+
+/**
+ * 标签数（不含根；RRSIG 的 labels 字段还不含最左边的 '*'）
+ */
+inline int dnssec_label_count(const std::string& wire) {
+    int count = 0;
+    for (size_t i = 0; i < wire.size() && wire[i] != 0; i += (unsigned char)wire[i] + 1) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * child 是否等于 parent 或在 parent 之下（按标签边界比较）
+ */
+inline bool dnssec_is_subdomain(const std::string& child, const std::string& parent) {
+    for (size_t i = 0; i < child.size(); i += (unsigned char)child[i] + 1) {
+        if (child.size() - i == parent.size() && child.compare(i, std::string::npos, parent) == 0) {
+            return true;
+        }
+        if (child[i] == 0) {
+            break;
+        }
+    }
+    return false;
+}
+
+/**
+ * 从报文中读一个（可能压缩的）域名并转成规范线格式
+ */
+inline bool dnssec_read_name(const unsigned char* buffer, int len, int& pos, std::string& wire) {
+    char text[DNS_MAX_NAME];
+    if (!parseDomainName(buffer, len, pos, text)) {
+        return false;
+    }
+    wire = dnssec_name_wire(text);
+    return !wire.empty();
+}
+
+// ============================================================================
+// 报文解析
+// ============================================================================
+
+/**
+ * 把回答部分整理成 RRset，RRSIG 挂到它覆盖的 RRset 上
+ *
+ * CNAME 等 rdata 中的域名解压缩并转小写（规范格式），其他类型的 rdata 原样保存。
+ *
+ * @return 报文是否合法
+ */
+inline bool dnssec_parse_answer(const unsigned char* buffer, int len, DNSMessageInfo& info,
+                                std::vector<DnssecRRset>& rrsets) {
+    rrsets.clear();
+    if (!parseDNSMessage(buffer, len, info)) {
+        return false;
+    }
+    int pos = sizeof(DNSHeader);
+    char name[DNS_MAX_NAME];
+    for (int i = 0; i < info.qdcount; i++) {
+        if (!parseDomainName(buffer, len, pos, name) || pos + (int)sizeof(DNSQuestion) > len) {
+            return false;
+        }
+        pos += sizeof(DNSQuestion);
+    }
+
+    std::vector<DnssecSig> sigs;
+    std::vector<std::string> sig_owners;
+    for (int i = 0; i < info.ancount; i++) {
+        std::string owner;
+        if (!dnssec_read_name(buffer, len, pos, owner) || pos + (int)sizeof(DNSResourceRecord) > len) {
+            return false;
+        }
+        DNSResourceRecord rr;
+        memcpy(&rr, buffer + pos, sizeof(rr));
+        pos += sizeof(rr);
+        uint16_t type = ntohs(rr.type);
+        uint32_t ttl = ntohl(rr.ttl);
+        int rdlength = ntohs(rr.rdlength);
+        int rdata = pos;
+        if (pos + rdlength > len) {
+            return false;
+        }
+        pos += rdlength;
+        if (ntohs(rr.class_) != 1) {
+            continue;
+        }
+
+        if (type == DNS_TYPE_RRSIG) {
+            if (rdlength < 18) {
+                return false;
+            }
+            const unsigned char* p = buffer + rdata;
+            DnssecSig sig;
+            sig.type_covered = (p[0] << 8) | p[1];
+            sig.algorithm = p[2];
+            sig.labels = p[3];
+            sig.original_ttl = ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+            sig.expiration = ((uint32_t)p[8] << 24) | (p[9] << 16) | (p[10] << 8) | p[11];
+            sig.inception = ((uint32_t)p[12] << 24) | (p[13] << 16) | (p[14] << 8) | p[15];
+            sig.key_tag = (p[16] << 8) | p[17];
+            int name_pos = rdata + 18;
+            if (!dnssec_read_name(buffer, rdata + rdlength, name_pos, sig.signer)) {
+                return false;
+            }
+            sig.signature.assign((const char*)buffer + name_pos, rdata + rdlength - name_pos);
+            sigs.push_back(sig);
+            sig_owners.push_back(owner);
+            continue;
+        }
+
+        std::string canonical;
+        if (type == DNS_TYPE_CNAME || type == 2 /* NS */ || type == 12 /* PTR */ || type == 39 /* DNAME */) {
+            int name_pos = rdata;
+            if (!dnssec_read_name(buffer, len, name_pos, canonical) || name_pos != rdata + rdlength) {
+                return false;
+            }
+        } else {
+            canonical.assign((const char*)buffer + rdata, rdlength);
+        }
+
+        size_t k = 0;
+        for (; k < rrsets.size(); k++) {
+            if (rrsets[k].owner == owner && rrsets[k].type == type) {
+                break;
+            }
+        }
+        if (k == rrsets.size()) {
+            DnssecRRset set;
+            set.owner = owner;
+            set.type = type;
+            set.ttl = ttl;
+            rrsets.push_back(set);
+        }
+        rrsets[k].ttl = std::min(rrsets[k].ttl, ttl);
+        rrsets[k].rdatas.push_back(canonical);
+    }
+
+    for (size_t i = 0; i < sigs.size(); i++) {
+        for (size_t k = 0; k < rrsets.size(); k++) {
+            if (rrsets[k].owner == sig_owners[i] && rrsets[k].type == sigs[i].type_covered) {
+                rrsets[k].sigs.push_back(sigs[i]);
+            }
+        }
+    }
+    return true;
+}
+
+inline const DnssecRRset* dnssec_find_rrset(const std::vector<DnssecRRset>& rrsets,
+                                            const std::string& owner, uint16_t type) {
+    for (size_t i = 0; i < rrsets.size(); i++) {
+        if (rrsets[i].owner == owner && rrsets[i].type == type) {
+            return &rrsets[i];
+        }
+    }
+    return NULL;
+}
+
+// ============================================================================
+// 密码学 (OpenSSL)
+// ============================================================================
+
+/**
+ * DNSKEY 的 key tag (RFC 4034 附录 B)
+ */
+inline uint16_t dnssec_key_tag(const std::string& rdata) {
+    uint32_t ac = 0;
+    for (size_t i = 0; i < rdata.size(); i++) {
+        ac += (i & 1) ? (unsigned char)rdata[i] : (unsigned char)rdata[i] << 8;
+    }
+    ac += (ac >> 16) & 0xFFFF;
+    return ac & 0xFFFF;
+}
+
+inline bool dnssec_algorithm_supported(int algorithm) {
+    return algorithm == 5 || algorithm == 7 || algorithm == 8 || algorithm == 10 ||
+           algorithm == 13 || algorithm == 14 || algorithm == 15;
+}
+
+/**
+ * 由 DNSKEY 的公钥字段构造 OpenSSL 公钥
+ *
+ * RSA (RFC 3110): 指数长度（1 字节，为 0 时后跟 2 字节）、指数、模数
+ * ECDSA (RFC 6605): x || y
+ * Ed25519 (RFC 8080): 32 字节原始公钥
+ */
+inline EVP_PKEY* dnssec_public_key(int algorithm, const unsigned char* key, size_t len) {
+    EVP_PKEY* pkey = NULL;
+    if (algorithm == 15) {
+        return len == 32 ? EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, key, len) : NULL;
+    }
+
+    OSSL_PARAM_BLD* bld = OSSL_PARAM_BLD_new();
+    BIGNUM* n = NULL;
+    BIGNUM* e = NULL;
+    const char* type = NULL;
+    unsigned char point[1 + 96];
+    bool ok = bld != NULL;
+    if (ok && (algorithm == 13 || algorithm == 14)) {
+        size_t expected = algorithm == 13 ? 64 : 96;
+        type = "EC";
+        ok = len == expected;
+        if (ok) {
+            point[0] = 0x04;                // 未压缩的点
+            memcpy(point + 1, key, len);
+            ok = OSSL_PARAM_BLD_push_utf8_string(bld, OSSL_PKEY_PARAM_GROUP_NAME,
+                                                 algorithm == 13 ? "prime256v1" : "secp384r1", 0) &&
+                 OSSL_PARAM_BLD_push_octet_string(bld, OSSL_PKEY_PARAM_PUB_KEY, point, len + 1);
+        }
+    } else if (ok) {
+        type = "RSA";
+        size_t exp_len = len > 0 ? key[0] : 0;
+        size_t off = 1;
+        if (len > 0 && exp_len == 0) {
+            exp_len = len >= 3 ? (key[1] << 8) | key[2] : 0;
+            off = 3;
+        }
+        ok = exp_len > 0 && off + exp_len < len;
+        if (ok) {
+            e = BN_bin2bn(key + off, exp_len, NULL);
+            n = BN_bin2bn(key + off + exp_len, len - off - exp_len, NULL);
+            ok = e != NULL && n != NULL && OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, n) &&
+                 OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, e);
+        }
+    }
+
+    OSSL_PARAM* params = ok ? OSSL_PARAM_BLD_to_param(bld) : NULL;
+    EVP_PKEY_CTX* ctx = params != NULL ? EVP_PKEY_CTX_new_from_name(NULL, type, NULL) : NULL;
+    if (ctx == NULL || EVP_PKEY_fromdata_init(ctx) <= 0 ||
+        EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0) {
+        pkey = NULL;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(bld);
+    BN_free(n);
+    BN_free(e);
+    return pkey;
+}
+
+/**
+ * 用 DNSKEY 验证一个签名
+ *
+ * @param dnskey 完整的 DNSKEY rdata
+ * @param data 被签名的数据（RRSIG 头部 + 规范格式的 RRset）
+ * @param signature RRSIG 中的签名（ECDSA 为 r || s，转成 OpenSSL 需要的 DER）
+ */
+inline bool dnssec_verify_signature(int algorithm, const std::string& dnskey, const std::string& data,
+                                    const std::string& signature) {
+    if (dnskey.size() < 4 || !dnssec_algorithm_supported(algorithm)) {
+        return false;
+    }
+    EVP_PKEY* pkey = dnssec_public_key(algorithm, (const unsigned char*)dnskey.data() + 4, dnskey.size() - 4);
+    if (pkey == NULL) {
+        return false;
+    }
+
+    const EVP_MD* md = NULL;
+    switch (algorithm) {
+        case 5: case 7: md = EVP_sha1(); break;
+        case 8: case 13: md = EVP_sha256(); break;
+        case 14: md = EVP_sha384(); break;
+        case 10: md = EVP_sha512(); break;
+        default: md = NULL; break;          // Ed25519 不预先摘要
+    }
+
+    std::string sig = signature;
+    if (algorithm == 13 || algorithm == 14) {
+        size_t half = algorithm == 13 ? 32 : 48;
+        sig.clear();
+        ECDSA_SIG* ecdsa = signature.size() == half * 2 ? ECDSA_SIG_new() : NULL;
+        if (ecdsa != NULL) {
+            const unsigned char* raw = (const unsigned char*)signature.data();
+            BIGNUM* r = BN_bin2bn(raw, half, NULL);
+            BIGNUM* s = BN_bin2bn(raw + half, half, NULL);
+            if (r != NULL && s != NULL && ECDSA_SIG_set0(ecdsa, r, s)) {
+                unsigned char* der = NULL;
+                int der_len = i2d_ECDSA_SIG(ecdsa, &der);
+                if (der_len > 0) {
+                    sig.assign((const char*)der, der_len);
+                }
+                OPENSSL_free(der);
+            } else {
+                BN_free(r);
+                BN_free(s);
+            }
+            ECDSA_SIG_free(ecdsa);
+        }
+    }
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    bool ok = ctx != NULL && !sig.empty() && EVP_DigestVerifyInit(ctx, NULL, md, NULL, pkey) == 1 &&
+              EVP_DigestVerify(ctx, (const unsigned char*)sig.data(), sig.size(),
+                               (const unsigned char*)data.data(), data.size()) == 1;
+    EVP_MD_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return ok;
+}
+
+/**
+ * DS 是否与 DNSKEY 匹配：key tag、算法相同，摘要 = digest(区名 | DNSKEY rdata)
+ */
+inline bool dnssec_ds_matches(const std::string& zone, const std::string& dnskey, const std::string& ds) {
+    if (ds.size() < 4 || dnskey.size() < 4) {
+        return false;
+    }
+    const unsigned char* p = (const unsigned char*)ds.data();
+    if (((p[0] << 8) | p[1]) != dnssec_key_tag(dnskey) || p[2] != (unsigned char)dnskey[3]) {
+        return false;
+    }
+    const EVP_MD* md = NULL;
+    switch (p[3]) {
+        case 1: md = EVP_sha1(); break;
+        case 2: md = EVP_sha256(); break;
+        case 4: md = EVP_sha384(); break;
+        default: return false;
+    }
+    std::string data = zone + dnskey;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    return EVP_Digest(data.data(), data.size(), digest, &digest_len, md, NULL) == 1 &&
+           ds.size() - 4 == digest_len && memcmp(ds.data() + 4, digest, digest_len) == 0;
+}
+
+/**
+ * 被签名的数据 (RFC 4034 3.1.8.1)：RRSIG rdata（不含签名）+ 按 rdata 排序的规范格式记录
+ */
+inline std::string dnssec_signed_data(const DnssecSig& sig, const DnssecRRset& rrset) {
+    std::string data;
+    unsigned char head[18];
+    head[0] = sig.type_covered >> 8;
+    head[1] = sig.type_covered & 0xFF;
+    head[2] = sig.algorithm;
+    head[3] = sig.labels;
+    for (int i = 0; i < 4; i++) {
+        head[4 + i] = sig.original_ttl >> (24 - 8 * i);
+        head[8 + i] = sig.expiration >> (24 - 8 * i);
+        head[12 + i] = sig.inception >> (24 - 8 * i);
+    }
+    head[16] = sig.key_tag >> 8;
+    head[17] = sig.key_tag & 0xFF;
+    data.append((const char*)head, sizeof(head));
+    data += sig.signer;
+
+    std::vector<std::string> rdatas = rrset.rdatas;
+    std::sort(rdatas.begin(), rdatas.end());
+    rdatas.erase(std::unique(rdatas.begin(), rdatas.end()), rdatas.end());
+    for (size_t i = 0; i < rdatas.size(); i++) {
+        unsigned char fixed[10];
+        fixed[0] = rrset.type >> 8;
+        fixed[1] = rrset.type & 0xFF;
+        fixed[2] = 0;
+        fixed[3] = 1;                               // IN
+        for (int k = 0; k < 4; k++) {
+            fixed[4 + k] = sig.original_ttl >> (24 - 8 * k);
+        }
+        fixed[8] = rdatas[i].size() >> 8;
+        fixed[9] = rdatas[i].size() & 0xFF;
+        data += rrset.owner;
+        data.append((const char*)fixed, sizeof(fixed));
+        data += rdatas[i];
+    }
+    return data;
+}
+
+// ============================================================================
+// 工作线程池
+// ============================================================================
+
+inline void dnssec_pool_start(DnssecWorkerPool& pool, int threads) {
+    pool.stopping = false;
+    for (int i = 0; i < threads; i++) {
+        pool.threads.push_back(std::thread([&pool]() {
+            while (true) {
+                std::packaged_task<bool()> task;
+                {
+                    std::unique_lock<std::mutex> lock(pool.lock);
+                    pool.cv.wait(lock, [&pool]() { return pool.stopping || !pool.queue.empty(); });
+                    if (pool.queue.empty()) {
+                        return;
+                    }
+                    task = std::move(pool.queue.front());
+                    pool.queue.pop_front();
+                }
+                task();
+            }
+        }));
+    }
+}
+
+inline std::future<bool> dnssec_pool_submit(DnssecWorkerPool& pool, std::function<bool()> job) {
+    std::packaged_task<bool()> task(job);
+    std::future<bool> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        pool.queue.push_back(std::move(task));
+    }
+    pool.cv.notify_one();
+    return result;
+}
+
+inline void dnssec_pool_stop(DnssecWorkerPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        pool.stopping = true;
+    }
+    pool.cv.notify_all();
+    for (size_t i = 0; i < pool.threads.size(); i++) {
+        pool.threads[i].join();
+    }
+    pool.threads.clear();
+}
+
+// ============================================================================
+// 信任链
+// ============================================================================
+
+/**
+ * 一组提交给线程池的签名验证，任意一个成功即可
+ */
+struct DnssecJobs {
+    std::vector<std::future<bool> > results;
+    std::vector<int64_t> valid_until;       // 对应签名成功时结果的有效期限（Unix 秒）
+    std::string reason;                     // 一个签名都没能提交时的原因
+};
+
+/**
+ * 为 RRset 的每个可用签名（签名者为 zone、时间有效、密钥在 keys 中）提交一个验证任务
+ */
+inline void dnssec_submit_rrset(DnssecValidator& v, const DnssecRRset& rrset, const std::string& zone,
+                                const std::vector<DnssecKey>& keys, int64_t now, DnssecJobs& jobs) {
+    uint32_t now32 = (uint32_t)now;
+    int owner_labels = dnssec_label_count(rrset.owner);
+    for (size_t i = 0; i < rrset.sigs.size(); i++) {
+        const DnssecSig& sig = rrset.sigs[i];
+        if (sig.signer != zone) {
+            continue;
+        }
+        // 时间用序列号算术比较 (RFC 4034 3.1.5)
+        if ((int32_t)(sig.expiration - now32) < 0 || (int32_t)(now32 - sig.inception) < 0) {
+            jobs.reason = "签名不在有效期内";
+            continue;
+        }
+        if (sig.labels != owner_labels) {
+            jobs.reason = sig.labels < owner_labels ? "通配符展开的应答需要 NSEC 证明，暂不支持"
+                                                    : "RRSIG 的标签数大于名称的标签数";
+            continue;
+        }
+        for (size_t k = 0; k < keys.size(); k++) {
+            if (keys[k].tag != sig.key_tag || keys[k].algorithm != sig.algorithm) {
+                continue;
+            }
+            std::string data = dnssec_signed_data(sig, rrset);
+            std::string key = keys[k].rdata;
+            std::string signature = sig.signature;
+            int algorithm = sig.algorithm;
+            std::atomic<int>* counter = &v.verifications;
+            jobs.results.push_back(dnssec_pool_submit(v.pool, [algorithm, key, data, signature, counter]() {
+                (*counter)++;
+                return dnssec_verify_signature(algorithm, key, data, signature);
+            }));
+            int64_t until = now + std::min(rrset.ttl, sig.original_ttl);
+            until = std::min(until, now + (int32_t)(sig.expiration - now32));
+            jobs.valid_until.push_back(until);
+        }
+    }
+    if (jobs.results.empty() && jobs.reason.empty()) {
+        jobs.reason = "没有可用密钥签出的签名";
+    }
+}
+
+/**
+ * 等待一组验证：返回最长的有效期限，全部失败时返回 -1
+ */
+inline int64_t dnssec_wait(DnssecJobs& jobs) {
+    int64_t best = -1;
+    for (size_t i = 0; i < jobs.results.size(); i++) {
+        if (jobs.results[i].get()) {
+            best = std::max(best, jobs.valid_until[i]);
+        }
+    }
+    return best;
+}
+
+/**
+ * 取得 RRset 响应：发查询、解析，返回 (owner, type) 的 RRset
+ */
+inline bool dnssec_fetch(DnssecValidator& v, const std::string& owner, uint16_t type,
+                         std::vector<DnssecRRset>& rrsets, const DnssecRRset*& rrset) {
+    std::vector<unsigned char> response;
+    DNSMessageInfo info;
+    v.queries++;
+    rrset = NULL;
+    if (!v.query(dnssec_name_text(owner).c_str(), type, response) ||
+        !dnssec_parse_answer(response.data(), response.size(), info, rrsets)) {
+        return false;
+    }
+    rrset = dnssec_find_rrset(rrsets, owner, type);
+    return true;
+}
+
+/**
+ * 取得区的已验证 DNSKEY：缓存 -> 信任锚 / 父区签名的 DS -> DNSKEY 集合
+ *
+ * @param refresh 忽略缓存（签名者用了缓存中没有的密钥，可能发生了密钥轮换）
+ * @param out 成功时指向缓存中的条目
+ */
+inline int dnssec_zone_keys(DnssecValidator& v, const std::string& zone, int64_t now, bool refresh,
+                            const DnssecZoneKeys*& out, std::string& reason, int depth = 0) {
+    std::map<std::string, DnssecZoneKeys>::iterator cached = v.zones.find(zone);
+    if (!refresh && cached != v.zones.end() && cached->second.expires > now) {
+        v.zone_cache_hits++;
+        out = &cached->second;
+        return DNSSEC_SECURE;
+    }
+    std::string zone_text = dnssec_name_text(zone);
+    if (depth >= DNSSEC_MAX_CHAIN) {
+        reason = "信任链太长";
+        return DNSSEC_BOGUS;
+    }
+
+    // 1. 信任的 DS：信任锚，或者由父区签名的 DS RRset
+    std::vector<std::string> trusted_ds;
+    std::vector<DnssecRRset> ds_response;
+    const DnssecRRset* ds_set = NULL;
+    DnssecJobs ds_jobs;
+    int64_t expires = INT64_MAX;
+    std::map<std::string, std::vector<std::string> >::iterator anchor = v.anchors.find(zone);
+    if (anchor != v.anchors.end()) {
+        trusted_ds = anchor->second;
+    } else {
+        if (!dnssec_fetch(v, zone, DNS_TYPE_DS, ds_response, ds_set)) {
+            reason = "无法查询 " + zone_text + " 的 DS";
+            return DNSSEC_INDETERMINATE;
+        }
+        if (ds_set == NULL || ds_set->sigs.empty()) {
+            reason = "父区没有 " + zone_text + " 的已签名 DS（未签名的委派需要 NSEC 证明，暂不支持）";
+            return DNSSEC_INDETERMINATE;
+        }
+        const std::string& parent = ds_set->sigs[0].signer;
+        if (parent == zone || !dnssec_is_subdomain(zone, parent)) {
+            reason = zone_text + " 的 DS 不是由上级区签名的";
+            return DNSSEC_BOGUS;
+        }
+        const DnssecZoneKeys* parent_keys = NULL;
+        int status = dnssec_zone_keys(v, parent, now, false, parent_keys, reason, depth + 1);
+        if (status != DNSSEC_SECURE) {
+            return status;
+        }
+        bool known = false;
+        for (size_t i = 0; i < ds_set->sigs.size() && !known; i++) {
+            for (size_t k = 0; k < parent_keys->keys.size(); k++) {
+                known = known || parent_keys->keys[k].tag == ds_set->sigs[i].key_tag;
+            }
+        }
+        if (!known) {
+            status = dnssec_zone_keys(v, parent, now, true, parent_keys, reason, depth + 1);
+            if (status != DNSSEC_SECURE) {
+                return status;
+            }
+        }
+        // DS 的签名与下面 DNSKEY 的签名互不依赖，一起交给线程池
+        dnssec_submit_rrset(v, *ds_set, parent, parent_keys->keys, now, ds_jobs);
+        expires = parent_keys->expires;
+        trusted_ds = ds_set->rdatas;
+    }
+
+    // 2. DNSKEY 集合，必须由一个与 DS 匹配的密钥签名
+    std::vector<DnssecRRset> key_response;
+    const DnssecRRset* key_set = NULL;
+    if (!dnssec_fetch(v, zone, DNS_TYPE_DNSKEY, key_response, key_set) || key_set == NULL) {
+        dnssec_wait(ds_jobs);
+        reason = "无法取得 " + zone_text + " 的 DNSKEY";
+        return DNSSEC_BOGUS;
+    }
+    std::vector<DnssecKey> all_keys;
+    std::vector<DnssecKey> ksks;
+    for (size_t i = 0; i < key_set->rdatas.size(); i++) {
+        const std::string& rdata = key_set->rdatas[i];
+        if (rdata.size() < 5 || rdata[2] != 3) {
+            continue;   // 协议字段必须为 3
+        }
+        DnssecKey key;
+        key.flags = ((unsigned char)rdata[0] << 8) | (unsigned char)rdata[1];
+        key.algorithm = rdata[3];
+        key.tag = dnssec_key_tag(rdata);
+        key.rdata = rdata;
+        if (!(key.flags & DNSKEY_FLAG_ZONE) || !dnssec_algorithm_supported(key.algorithm)) {
+            continue;
+        }
+        all_keys.push_back(key);
+        for (size_t k = 0; k < trusted_ds.size(); k++) {
+            if (dnssec_ds_matches(zone, rdata, trusted_ds[k])) {
+                ksks.push_back(key);
+                break;
+            }
+        }
+    }
+    if (ksks.empty()) {
+        dnssec_wait(ds_jobs);
+        reason = zone_text + " 没有与 DS 匹配且算法受支持的 DNSKEY";
+        return DNSSEC_BOGUS;
+    }
+    DnssecJobs key_jobs;
+    dnssec_submit_rrset(v, *key_set, zone, ksks, now, key_jobs);
+
+    int64_t ds_until = anchor != v.anchors.end() ? INT64_MAX : dnssec_wait(ds_jobs);
+    int64_t key_until = dnssec_wait(key_jobs);
+    if (ds_until < 0) {
+        reason = zone_text + " 的 DS 签名验证失败: " + (ds_jobs.results.empty() ? ds_jobs.reason : "签名错误");
+        return DNSSEC_BOGUS;
+    }
+    if (key_until < 0) {
+        reason = zone_text + " 的 DNSKEY 签名验证失败: " + (key_jobs.results.empty() ? key_jobs.reason : "签名错误");
+        return DNSSEC_BOGUS;
+    }
+
+    DnssecZoneKeys& entry = v.zones[zone];
+    entry.expires = std::min(expires, std::min(ds_until, key_until));
+    entry.keys = all_keys;
+    v.zones_dirty = true;
+    out = &entry;
+    return DNSSEC_SECURE;
+}
+
+// ============================================================================
+// 公共接口
+// ============================================================================
+
+/**
+ * 解析信任锚文本：每行 "区名 [TTL] [IN] DS keytag 算法 摘要类型 十六进制摘要"（dig 的输出格式）
+ */
+inline bool dnssec_load_anchors(DnssecValidator& v, const std::string& text) {
+    size_t start = 0;
+    bool any = false;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        std::string line = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        std::replace(line.begin(), line.end(), '\t', ' ');
+        start = end == std::string::npos ? text.size() : end + 1;
+        char zone[DNS_MAX_NAME];
+        char fields[4][128];
+        const char* ds = strstr(line.c_str(), " DS ");
+        if (line.empty() || line[0] == ';' || line[0] == '#' || ds == NULL ||
+            sscanf(line.c_str(), "%255s", zone) != 1 ||
+            sscanf(ds + 4, "%127s %127s %127s %127s", fields[0], fields[1], fields[2], fields[3]) != 4) {
+            continue;
+        }
+        std::string rdata;
+        int tag = atoi(fields[0]);
+        rdata += (char)(tag >> 8);
+        rdata += (char)(tag & 0xFF);
+        rdata += (char)atoi(fields[1]);
+        rdata += (char)atoi(fields[2]);
+        for (const char* p = fields[3]; p[0] != '\0' && p[1] != '\0'; p += 2) {
+            char hex[3] = {p[0], p[1], '\0'};
+            rdata += (char)strtol(hex, NULL, 16);
+        }
+        std::string wire = dnssec_name_wire(zone);
+        if (!wire.empty()) {
+            v.anchors[wire].push_back(rdata);
+            any = true;
+        }
+    }
+    return any;
+}
+
+inline void dnssec_init(DnssecValidator& v, DnssecQueryFn query) {
+    v.query = query;
+    v.zones_dirty = false;
+    v.queries = 0;
+    v.zone_cache_hits = 0;
+    v.verifications = 0;
+    int threads = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+    dnssec_pool_start(v.pool, threads);
+}
+
+inline void dnssec_shutdown(DnssecValidator& v) {
+    dnssec_pool_stop(v.pool);
+}
+
+/**
+ * 信任锚的指纹：缓存的密钥只在信任锚相同时有效（用测试锚验证过的区不能在默认根锚下直接信任）
+ */
+inline std::string dnssec_anchor_digest(const DnssecValidator& v) {
+    std::string data;
+    for (std::map<std::string, std::vector<std::string> >::const_iterator it = v.anchors.begin();
+         it != v.anchors.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            data += it->first + it->second[i];
+        }
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_Digest(data.data(), data.size(), digest, &digest_len, EVP_sha256(), NULL);
+    std::string hex;
+    char byte[3];
+    for (unsigned int i = 0; i < digest_len; i++) {
+        snprintf(byte, sizeof(byte), "%02x", digest[i]);
+        hex += byte;
+    }
+    return hex;
+}
+
+/**
+ * 读取持久化的区密钥缓存
+ *
+ * 第一行 "anchors 信任锚指纹"，之后每行: 区名 过期时间 十六进制DNSKEY-rdata。
+ * 只信任当前用户（或 root）拥有、其他人不能写的文件，防止本机其他用户放入伪造的密钥
+ */
+inline void dnssec_load_key_cache(DnssecValidator& v, const char* path, int64_t now) {
+    FILE* f = fopen(path, "re");
+    struct stat st;
+    if (f == NULL) {
+        return;
+    }
+    if (fstat(fileno(f), &st) < 0 || (st.st_uid != getuid() && st.st_uid != 0) || (st.st_mode & 022)) {
+        fclose(f);
+        return;
+    }
+    char zone[DNS_MAX_NAME];
+    long long expires;
+    char hex[4096];
+    if (fscanf(f, "anchors %4095s", hex) != 1 || dnssec_anchor_digest(v) != hex) {
+        fclose(f);
+        return;
+    }
+    while (fscanf(f, "%255s %lld %4095s", zone, &expires, hex) == 3) {
+        std::string wire = dnssec_name_wire(zone);
+        if (expires <= now || wire.empty()) {
+            continue;
+        }
+        DnssecKey key;
+        for (const char* p = hex; p[0] != '\0' && p[1] != '\0'; p += 2) {
+            char byte[3] = {p[0], p[1], '\0'};
+            key.rdata += (char)strtol(byte, NULL, 16);
+        }
+        if (key.rdata.size() < 5) {
+            continue;
+        }
+        key.flags = ((unsigned char)key.rdata[0] << 8) | (unsigned char)key.rdata[1];
+        key.algorithm = key.rdata[3];
+        key.tag = dnssec_key_tag(key.rdata);
+        DnssecZoneKeys& entry = v.zones[wire];
+        entry.expires = expires;
+        entry.keys.push_back(key);
+    }
+    fclose(f);
+}
+
+/**
+ * 保存区密钥缓存（写临时文件后 rename，并发的进程看到的总是完整的文件）
+ */
+inline void dnssec_save_key_cache(DnssecValidator& v, const char* path, int64_t now) {
+    if (!v.zones_dirty) {
+        return;
+    }
+    std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "we");
+    if (f == NULL) {
+        return;
+    }
+    fchmod(fileno(f), 0644);
+    fprintf(f, "anchors %s\n", dnssec_anchor_digest(v).c_str());
+    for (std::map<std::string, DnssecZoneKeys>::const_iterator it = v.zones.begin(); it != v.zones.end(); ++it) {
+        if (it->second.expires <= now) {
+            continue;
+        }
+        for (size_t k = 0; k < it->second.keys.size(); k++) {
+            fprintf(f, "%s %lld ", dnssec_name_text(it->first).c_str(), (long long)it->second.expires);
+            const std::string& rdata = it->second.keys[k].rdata;
+            for (size_t i = 0; i < rdata.size(); i++) {
+                fprintf(f, "%02x", (unsigned char)rdata[i]);
+            }
+            fprintf(f, "\n");
+        }
+    }
+    if (fclose(f) != 0 || rename(tmp.c_str(), path) < 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+/**
+ * 验证对 (qname, A) 的应答，并提取经过验证的地址
+ *
+ * 从 qname 开始沿着已验证的 CNAME 走到最终名称，只取这个名称的 A RRset，
+ * 应答中夹带的其他名称的记录（即使签名正确）不会混进结果。
+ *
+ * @param result 成功时为验证过的地址，ttl 为结果可以缓存的时间
+ * @param reason 不是 SECURE 时的原因
+ */
+inline int dnssec_validate_response(DnssecValidator& v, const unsigned char* buffer, int len,
+                                    const char* qname, int64_t now, DNSCacheEntry& result, std::string& reason) {
+    memset(&result, 0, sizeof(result));
+    std::vector<DnssecRRset> rrsets;
+    DNSMessageInfo info;
+    if (!dnssec_parse_answer(buffer, len, info, rrsets)) {
+        reason = "响应格式错误";
+        return DNSSEC_BOGUS;
+    }
+    if (info.rcode != DNS_RCODE_NOERROR || rrsets.empty()) {
+        reason = "否定应答需要 NSEC/NSEC3 证明，暂不支持";
+        return DNSSEC_INDETERMINATE;
+    }
+
+    // 1. 沿 CNAME 链找到要验证的 RRset
+    std::vector<const DnssecRRset*> chain;
+    std::string name = dnssec_name_wire(qname);
+    for (int hops = 0; hops < 16; hops++) {
+        const DnssecRRset* cname = dnssec_find_rrset(rrsets, name, DNS_TYPE_CNAME);
+        if (cname == NULL || cname->rdatas.size() != 1) {
+            break;
+        }
+        chain.push_back(cname);
+        name = cname->rdatas[0];
+    }
+    const DnssecRRset* answer = dnssec_find_rrset(rrsets, name, DNS_TYPE_A);
+    if (answer == NULL) {
+        reason = "应答中没有 " + dnssec_name_text(name) + " 的 A 记录";
+        return DNSSEC_INDETERMINATE;
+    }
+    chain.push_back(answer);
+
+    // 2. 先取得每个签名者的密钥（通常在缓存中），再把所有 RRset 的签名一起交给线程池
+    std::vector<DnssecJobs> jobs(chain.size());
+    for (size_t i = 0; i < chain.size(); i++) {
+        const DnssecRRset& rrset = *chain[i];
+        std::string type_name = rrset.type == DNS_TYPE_A ? "A" : "CNAME";
+        if (rrset.sigs.empty()) {
+            reason = dnssec_name_text(rrset.owner) + " " + type_name + " 没有签名";
+            return DNSSEC_INDETERMINATE;
+        }
+        const std::string& zone = rrset.sigs[0].signer;
+        if (!dnssec_is_subdomain(rrset.owner, zone)) {
+            reason = dnssec_name_text(rrset.owner) + " 的签名者 " + dnssec_name_text(zone) + " 不是它的上级区";
+            return DNSSEC_BOGUS;
+        }
+        const DnssecZoneKeys* keys = NULL;
+        int status = dnssec_zone_keys(v, zone, now, false, keys, reason);
+        if (status != DNSSEC_SECURE) {
+            return status;
+        }
+        bool known = false;
+        for (size_t s = 0; s < rrset.sigs.size(); s++) {
+            for (size_t k = 0; k < keys->keys.size(); k++) {
+                known = known || keys->keys[k].tag == rrset.sigs[s].key_tag;
+            }
+        }
+        if (!known) {
+            status = dnssec_zone_keys(v, zone, now, true, keys, reason);     // 密钥轮换
+            if (status != DNSSEC_SECURE) {
+                return status;
+            }
+        }
+        dnssec_submit_rrset(v, rrset, zone, keys->keys, now, jobs[i]);
+        result.ttl = (uint32_t)std::min<int64_t>(i == 0 ? UINT32_MAX : result.ttl, keys->expires - now);
+    }
+
+    bool bogus = false;
+    for (size_t i = 0; i < chain.size(); i++) {
+        int64_t until = dnssec_wait(jobs[i]);
+        if (until < 0 && !bogus) {
+            bogus = true;
+            reason = dnssec_name_text(chain[i]->owner) + " 的签名验证失败: " +
+                     (jobs[i].results.empty() ? jobs[i].reason : "签名错误");
+        }
+        result.ttl = (uint32_t)std::min<int64_t>(result.ttl, std::max<int64_t>(until - now, 0));
+    }
+    if (bogus) {
+        memset(&result, 0, sizeof(result));
+        return DNSSEC_BOGUS;
+    }
+
+    result.rcode = DNS_RCODE_NOERROR;
+    for (size_t i = 0; i < answer->rdatas.size() && result.addr_count < DNS_CACHE_MAX_ADDRS; i++) {
+        if (answer->rdatas[i].size() == 4) {
+            memcpy(&result.addrs[result.addr_count++], answer->rdatas[i].data(), 4);
+        }
+    }
+    return DNSSEC_SECURE;
+}
+
+#endif // DNSSEC_H
@@ -0,0 +1,603 @@
+/**
+ * 本地 DNS 替身服务器 - 在 UDP、DoT (RFC 7858) 和 DoH (RFC 8484, HTTP/2) 上回答同样的合成记录
+ *
+ * 用来在没有真实上游的环境里测试和比较 dns_transport.h 的三种上游，三种传输共用同一个应答函数：
+ * - 任何 A 查询都返回一个由域名哈希得到的 10.x.y.z 地址 (TTL 300)
+ * - 以 "nx" 开头的域名返回 NXDOMAIN
+ * - -d 给每个响应加固定延迟，模拟远端上游；延迟期间同一连接上的其他查询照常处理
+ * - -z 改为从 zone_compile 生成的区镜像权威回答（见 dns_zone.h），不再合成记录
+ *
+ * HTTP/2 只实现替身需要的部分：请求的头部块不解码（任何带数据的流都当作 POST /dns-query 处理），
+ * 响应头部只用静态表和不索引的字面量；支持 PING、WINDOW_UPDATE 和连接级流量控制。
+ * -g N 在每条连接处理 N 个请求后发送 GOAWAY，用于测试客户端换连接时的重发。
+ *
+ * 编译: make doh_server
+ * 证书: openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 30 \
+ *         -keyout key.pem -out cert.pem -subj /CN=localhost -addext subjectAltName=IP:127.0.0.1
+ * 运行: ./doh_server -c cert.pem -k key.pem [-u 5300] [-t 8530] [-w 8443] [-d 延迟ms] [-g 请求数] [-z 区镜像]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "dns_message.h"     // 报文解析
+#include "dns_transport.h"   // HTTP/2 帧与 HPACK 工具函数
+#include "dns_zone.h"        // -z 区镜像
+
+struct ServerOptions {
+    const char* address;
+    int udp_port;
+    int dot_port;
+    int doh_port;
+    int delay_ms;
+    int goaway_after;           // 每条连接处理这么多请求后发送 GOAWAY（0 = 不发送）
+};
+
+ServerOptions options = {"127.0.0.1", 5300, 8530, 8443, 0, 0};
+
+DNSZone zone;                   // -z 打开的区镜像；base 为 NULL 时回答合成记录
+
+/**
+ * 等待发送的响应（固定延迟，按到期时间先后排列）
+ */
+struct Delayed {
+    int64_t due_ms;
+    uint32_t stream;                    // DoH 流 ID；DoT 不用
+    struct sockaddr_in peer;            // UDP 客户端地址
+    std::vector<unsigned char> response;
+};
+
+// ============================================================================
+// 应答
+// ============================================================================
+
+/**
+ * 从区镜像回答：名称不存在时 NXDOMAIN；有查询类型的 RRset 时返回它，否则有 CNAME 时返回 CNAME
+ * （不继续追踪），都没有时 NODATA。不处理委派和通配符。超过 512 字节时截断并设置 TC。
+ * out 中已有头部和问题，pos 是问题之后的位置
+ */
+int build_zone_answer(const char* name, uint16_t qtype, unsigned char* out, int pos) {
+    out[2] |= 0x04;                     // AA
+    const DNSZoneName* found = dns_zone_find(zone, name);
+    if (found == NULL) {
+        out[3] = 0x80 | DNS_RCODE_NXDOMAIN;
+        return pos;
+    }
+    const DNSZoneRRset* rrset = dns_zone_rrset(zone, found, qtype);
+    if (rrset == NULL) {
+        rrset = dns_zone_rrset(zone, found, 5);
+    }
+    if (rrset == NULL) {
+        return pos;
+    }
+    uint64_t offset = 0;
+    const unsigned char* rdata;
+    uint16_t rdlength;
+    uint16_t count = 0;
+    for (uint32_t i = 0; dns_zone_next_rr(zone, *rrset, i, offset, rdata, rdlength); i++) {
+        if (pos + 12 + rdlength > 512) {
+            out[2] |= 0x02;             // TC
+            break;
+        }
+        unsigned char* rr = out + pos;
+        rr[0] = 0xC0;                   // 指向问题中的域名
+        rr[1] = 0x0C;
+        rr[2] = rrset->type >> 8;
+        rr[3] = rrset->type & 0xFF;
+        rr[4] = 0;
+        rr[5] = 1;                      // IN
+        rr[6] = rrset->ttl >> 24;
+        rr[7] = (rrset->ttl >> 16) & 0xFF;
+        rr[8] = (rrset->ttl >> 8) & 0xFF;
+        rr[9] = rrset->ttl & 0xFF;
+        rr[10] = rdlength >> 8;
+        rr[11] = rdlength & 0xFF;
+        memcpy(rr + 12, rdata, rdlength);
+        pos += 12 + rdlength;
+        count++;
+    }
+    out[6] = count >> 8;
+    out[7] = count & 0xFF;
+    return pos;
+}
+
+/**
+ * 根据查询生成响应（out 至少 512 字节）
+ * @return 响应长度；查询格式错误时返回 -1
+ */
+int build_answer(const unsigned char* query, int len, unsigned char* out) {
+    if (len < 12 || len > 512 || (query[2] & 0x80)) {
+        return -1;
+    }
+    int pos = 12;
+    char name[DNS_MAX_NAME];
+    if (!parseDomainName(query, len, pos, name) || pos + 4 > len) {
+        return -1;
+    }
+    pos += 4;                           // 只回显第一个问题（不带 EDNS 等附加记录）
+    memcpy(out, query, pos);
+    uint16_t qtype = (query[pos - 4] << 8) | query[pos - 3];
+    out[2] = 0x80 | (query[2] & 0x01);  // QR + 原样的 RD
+    out[3] = 0x80 | DNS_RCODE_NOERROR;  // RA
+    out[4] = 0;
+    out[5] = 1;
+    memset(out + 6, 0, 6);
+    if (zone.base != NULL) {
+        return build_zone_answer(name, qtype, out, pos);
+    }
+    bool nx = strncasecmp(name, "nx", 2) == 0;
+    if (nx) {
+        out[3] = 0x80 | DNS_RCODE_NXDOMAIN;
+    }
+    if (nx || qtype != 1) {
+        return pos;
+    }
+
+    uint32_t h = 2166136261u;
+    for (const char* p = name; *p; p++) {
+        h = (h ^ (unsigned char)(*p | 0x20)) * 16777619u;
+    }
+    const unsigned char answer[16] = {
+        0xC0, 0x0C,                     // 指向问题中的域名
+        0, 1, 0, 1,                     // A, IN
+        0, 0, 0x01, 0x2C,               // TTL 300
+        0, 4, 10, (unsigned char)(h >> 16), (unsigned char)(h >> 8), (unsigned char)(h | 1)};
+    memcpy(out + pos, answer, sizeof(answer));
+    out[7] = 1;
+    return pos + sizeof(answer);
+}
+
+// ============================================================================
+// UDP
+// ============================================================================
+
+void serve_udp(int sock) {
+    std::deque<Delayed> delayed;
+    while (true) {
+        int timeout = -1;
+        if (!delayed.empty()) {
+            timeout = (int)std::max<int64_t>(delayed.front().due_ms - dns_tls_now_ms(), 0);
+        }
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, timeout) > 0) {
+            unsigned char query[512], response[1024];
+            struct sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            ssize_t n;
+            while ((n = recvfrom(sock, query, sizeof(query), MSG_DONTWAIT, (struct sockaddr*)&peer, &peer_len)) > 0) {
+                int len = build_answer(query, n, response);
+                if (len < 0) {
+                    continue;
+                }
+                if (options.delay_ms == 0) {
+                    sendto(sock, response, len, 0, (struct sockaddr*)&peer, sizeof(peer));
+                    continue;
+                }
+                Delayed d;
+                d.due_ms = dns_tls_now_ms() + options.delay_ms;
+                d.peer = peer;
+                d.response.assign(response, response + len);
+                delayed.push_back(d);
+            }
+        }
+        int64_t now = dns_tls_now_ms();
+        while (!delayed.empty() && delayed.front().due_ms <= now) {
+            const Delayed& d = delayed.front();
+            sendto(sock, d.response.data(), d.response.size(), 0, (const struct sockaddr*)&d.peer, sizeof(d.peer));
+            delayed.pop_front();
+        }
+    }
+}
+
+// ============================================================================
+// TLS 连接（DoT 与 DoH）
+// ============================================================================
+
+/**
+ * 一条 TLS 连接的状态
+ */
+struct Connection {
+    SSL* ssl;
+    int fd;
+    bool h2;
+    std::string in;
+    std::string out;
+    std::deque<Delayed> delayed;        // 还没到发送时间的响应
+    std::deque<Delayed> blocked;        // DoH：到时间了但连接级发送窗口不够
+    bool preface_seen;
+    std::map<uint32_t, std::vector<unsigned char> > streams;   // 还没回应的流及收到的数据
+    int64_t send_window;
+    uint64_t received_unacked;
+    int requests;
+    uint32_t last_stream;
+    bool goaway_sent;
+    bool closing;
+};
+
+/**
+ * 把一个 DoH 响应写成 HEADERS + DATA；连接级窗口不够时返回 false
+ */
+bool h2_respond(Connection& c, uint32_t stream, const std::vector<unsigned char>& response) {
+    if (c.streams.count(stream) == 0) {
+        return true;                    // 流已被客户端重置
+    }
+    if ((int64_t)response.size() > c.send_window) {
+        return false;
+    }
+    std::string block;
+    if (response.empty()) {
+        block += (char)0x8C;            // :status 400
+        h2_frame(c.out, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, stream, block.data(), block.size());
+    } else {
+        block += (char)0x88;            // :status 200
+        hpack_int(block, 0x00, 4, 31);
+        hpack_string(block, "application/dns-message");
+        hpack_int(block, 0x00, 4, 28);
+        hpack_string(block, std::to_string(response.size()));
+        h2_frame(c.out, H2_HEADERS, H2_FLAG_END_HEADERS, stream, block.data(), block.size());
+        h2_frame(c.out, H2_DATA, H2_FLAG_END_STREAM, stream, response.data(), response.size());
+        c.send_window -= response.size();
+    }
+    c.streams.erase(stream);
+    return true;
+}
+
+/**
+ * 回应一个查询：立即写入发送缓冲区，或者按 -d 延迟
+ */
+void respond(Connection& c, uint32_t stream, const unsigned char* query, int len) {
+    unsigned char buf[1024];
+    int n = build_answer(query, len, buf);
+    Delayed d;
+    d.due_ms = dns_tls_now_ms() + options.delay_ms;
+    d.stream = stream;
+    if (n > 0) {
+        d.response.assign(buf, buf + n);
+    } else if (!c.h2) {
+        return;                         // DoT 收到无法解析的查询：不回应
+    }
+    if (options.delay_ms > 0) {
+        c.delayed.push_back(d);
+    } else if (!c.h2) {
+        c.out += (char)(n >> 8);
+        c.out += (char)(n & 0xFF);
+        c.out.append((const char*)buf, n);
+    } else if (!h2_respond(c, stream, d.response)) {
+        c.blocked.push_back(d);
+    }
+
+    c.requests++;
+    c.last_stream = stream;
+    if (c.h2 && options.goaway_after > 0 && c.requests >= options.goaway_after && !c.goaway_sent) {
+        unsigned char payload[8];
+        h2_u32(payload, c.last_stream);
+        h2_u32(payload + 4, 0);         // NO_ERROR
+        h2_frame(c.out, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+        c.goaway_sent = true;
+    }
+}
+
+/**
+ * 处理客户端发来的一个 HTTP/2 帧
+ */
+bool h2_server_frame(Connection& c, uint8_t type, uint8_t flags, uint32_t stream,
+                     const unsigned char* payload, uint32_t len) {
+    switch (type) {
+        case H2_SETTINGS:
+            if (!(flags & H2_FLAG_ACK)) {
+                h2_frame(c.out, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+            }
+            return true;
+        case H2_PING:
+            if (!(flags & H2_FLAG_ACK) && len == 8) {
+                h2_frame(c.out, H2_PING, H2_FLAG_ACK, 0, payload, 8);
+            }
+            return true;
+        case H2_WINDOW_UPDATE:
+            if (stream == 0 && len == 4) {
+                c.send_window += h2_read_u32(payload) & 0x7FFFFFFF;
+            }
+            return true;
+        case H2_HEADERS:
+            if (c.goaway_sent && stream > c.last_stream) {
+                return true;            // GOAWAY 之后的新流不处理，客户端会换连接重发
+            }
+            c.streams[stream];
+            if (flags & H2_FLAG_END_STREAM) {
+                respond(c, stream, NULL, 0);      // 没有请求体（如 GET）：400
+            }
+            return true;
+        case H2_DATA: {
+            c.received_unacked += len;
+            std::map<uint32_t, std::vector<unsigned char> >::iterator it = c.streams.find(stream);
+            if (it == c.streams.end()) {
+                return true;
+            }
+            uint32_t pad = (flags & H2_FLAG_PADDED) && len > 0 ? payload[0] + 1 : 0;
+            if (pad > len) {
+                return false;
+            }
+            const unsigned char* data = payload + (pad > 0 ? 1 : 0);
+            it->second.insert(it->second.end(), data, data + len - pad);
+            if (flags & H2_FLAG_END_STREAM) {
+                std::vector<unsigned char> query;
+                query.swap(it->second);
+                respond(c, stream, query.data(), query.size());
+            }
+            return true;
+        }
+        case H2_RST_STREAM:
+            c.streams.erase(stream);
+            return true;
+        case H2_GOAWAY:
+            c.closing = true;
+            return true;
+        default:
+            return true;
+    }
+}
+
+/**
+ * 处理接收缓冲区中完整的帧 / DoT 消息
+ */
+bool process_input(Connection& c) {
+    size_t pos = 0;
+    bool ok = true;
+    if (!c.h2) {
+        while (c.in.size() - pos >= 2) {
+            size_t len = ((unsigned char)c.in[pos] << 8) | (unsigned char)c.in[pos + 1];
+            if (c.in.size() - pos - 2 < len) {
+                break;
+            }
+            respond(c, 0, (const unsigned char*)c.in.data() + pos + 2, len);
+            pos += 2 + len;
+        }
+    } else {
+        if (!c.preface_seen) {
+            static const std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+            if (c.in.size() < preface.size()) {
+                return true;
+            }
+            if (c.in.compare(0, preface.size(), preface) != 0) {
+                return false;
+            }
+            pos = preface.size();
+            c.preface_seen = true;
+        }
+        while (ok && c.in.size() - pos >= 9) {
+            const unsigned char* h = (const unsigned char*)c.in.data() + pos;
+            uint32_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+            if (c.in.size() - pos - 9 < len) {
+                break;
+            }
+            ok = h2_server_frame(c, h[3], h[4], h2_read_u32(h + 5) & 0x7FFFFFFF, h + 9, len);
+            pos += 9 + len;
+        }
+        if (c.received_unacked >= H2_RECV_WINDOW / 2) {
+            unsigned char increment[4];
+            h2_u32(increment, c.received_unacked);
+            h2_frame(c.out, H2_WINDOW_UPDATE, 0, 0, increment, sizeof(increment));
+            c.received_unacked = 0;
+        }
+    }
+    c.in.erase(0, pos);
+    return ok;
+}
+
+/**
+ * 发送已到期的延迟响应和窗口不够时积压的响应
+ */
+void flush_delayed(Connection& c) {
+    while (!c.blocked.empty() && h2_respond(c, c.blocked.front().stream, c.blocked.front().response)) {
+        c.blocked.pop_front();
+    }
+    int64_t now = dns_tls_now_ms();
+    while (!c.delayed.empty() && c.delayed.front().due_ms <= now) {
+        Delayed& d = c.delayed.front();
+        if (!c.h2) {
+            c.out += (char)(d.response.size() >> 8);
+            c.out += (char)(d.response.size() & 0xFF);
+            c.out.append((const char*)d.response.data(), d.response.size());
+        } else if (!c.blocked.empty() || !h2_respond(c, d.stream, d.response)) {
+            c.blocked.push_back(d);
+        }
+        c.delayed.pop_front();
+    }
+}
+
+void serve_connection(SSL_CTX* ctx, int fd, bool h2) {
+    Connection c;
+    c.ssl = SSL_new(ctx);
+    c.fd = fd;
+    c.h2 = h2;
+    c.preface_seen = false;
+    c.send_window = 65535;
+    c.received_unacked = 0;
+    c.requests = 0;
+    c.last_stream = 0;
+    c.goaway_sent = false;
+    c.closing = false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    SSL_set_fd(c.ssl, fd);
+    if (SSL_accept(c.ssl) != 1) {
+        SSL_free(c.ssl);
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (h2) {
+        // 服务器前言：SETTINGS（允许 4096 个并发流）+ 扩大连接级接收窗口
+        unsigned char settings[6] = {0, 0x3, 0, 0, 0x10, 0};
+        h2_frame(c.out, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+        unsigned char increment[4];
+        h2_u32(increment, H2_RECV_WINDOW - 65535);
+        h2_frame(c.out, H2_WINDOW_UPDATE, 0, 0, increment, sizeof(increment));
+    }
+
+    char buf[16384];
+    while (true) {
+        int timeout = -1;
+        if (!c.delayed.empty()) {
+            timeout = (int)std::max<int64_t>(c.delayed.front().due_ms - dns_tls_now_ms(), 0);
+        }
+        struct pollfd pfd = {fd, (short)(POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0};
+        poll(&pfd, 1, timeout);
+
+        bool alive = true;
+        int n;
+        while ((n = SSL_read(c.ssl, buf, sizeof(buf))) > 0) {
+            c.in.append(buf, n);
+        }
+        int err = SSL_get_error(c.ssl, n);
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            alive = false;
+        }
+        if (!process_input(c)) {
+            alive = false;
+        }
+        flush_delayed(c);
+        while (alive && !c.out.empty()) {
+            n = SSL_write(c.ssl, c.out.data(), c.out.size());
+            if (n <= 0) {
+                err = SSL_get_error(c.ssl, n);
+                alive = err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+                break;
+            }
+            c.out.erase(0, n);
+        }
+        // 发送 GOAWAY 后等已接受的流都回应完再关闭
+        bool drained = c.streams.empty() && c.delayed.empty() && c.blocked.empty() && c.out.empty();
+        if (!alive || ((c.goaway_sent || c.closing) && drained)) {
+            break;
+        }
+    }
+    SSL_shutdown(c.ssl);
+    SSL_free(c.ssl);
+    close(fd);
+}
+
+/**
+ * ALPN：DoH 监听端口只接受 h2，DoT 端口接受 dot 或不协商
+ */
+int select_alpn(SSL*, const unsigned char** out, unsigned char* outlen,
+                const unsigned char* in, unsigned int inlen, void* arg) {
+    const char* wanted = (const char*)arg;
+    size_t wanted_len = strlen(wanted);
+    for (unsigned int i = 0; i < inlen; i += in[i] + 1) {
+        if (in[i] == wanted_len && i + 1 + wanted_len <= inlen && memcmp(in + i + 1, wanted, wanted_len) == 0) {
+            *out = in + i + 1;
+            *outlen = in[i];
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+    return strcmp(wanted, "h2") == 0 ? SSL_TLSEXT_ERR_ALERT_FATAL : SSL_TLSEXT_ERR_NOACK;
+}
+
+int listen_on(int type, int port) {
+    int sock = socket(AF_INET, type, 0);
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, options.address, &addr.sin_addr);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || (type == SOCK_STREAM && listen(sock, 128) < 0)) {
+        perror("bind");
+        exit(1);
+    }
+    if (type == SOCK_DGRAM) {
+        int size = 4 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    return sock;
+}
+
+void accept_loop(SSL_CTX* ctx, int listener, bool h2) {
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd >= 0) {
+            std::thread(serve_connection, ctx, fd, h2).detach();
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* cert = NULL;
+    const char* key = NULL;
+    int opt;
+    bool bad_option = false;
+    while ((opt = getopt(argc, argv, "a:c:k:u:t:w:d:g:z:")) != -1) {
+        switch (opt) {
+            case 'a': options.address = optarg; break;
+            case 'c': cert = optarg; break;
+            case 'k': key = optarg; break;
+            case 'u': options.udp_port = atoi(optarg); break;
+            case 't': options.dot_port = atoi(optarg); break;
+            case 'w': options.doh_port = atoi(optarg); break;
+            case 'd': options.delay_ms = atoi(optarg); break;
+            case 'g': options.goaway_after = atoi(optarg); break;
+            case 'z':
+                if (!dns_zone_open(zone, optarg)) {
+                    printf("无法打开区镜像: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || cert == NULL || key == NULL) {
+        printf("用法: %s -c 证书 -k 私钥 [-a 地址] [-u UDP端口] [-t DoT端口] [-w DoH端口] [-d 延迟ms] [-g 请求数] [-z 区镜像]\n",
+               argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* contexts[2];
+    static char alpn_dot[] = "dot";
+    static char alpn_h2[] = "h2";
+    for (int i = 0; i < 2; i++) {
+        contexts[i] = SSL_CTX_new(TLS_server_method());
+        if (SSL_CTX_use_certificate_chain_file(contexts[i], cert) != 1 ||
+            SSL_CTX_use_PrivateKey_file(contexts[i], key, SSL_FILETYPE_PEM) != 1) {
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+        SSL_CTX_set_mode(contexts[i], SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        SSL_CTX_set_alpn_select_cb(contexts[i], select_alpn, i == 0 ? alpn_dot : alpn_h2);
+    }
+
+    int udp = listen_on(SOCK_DGRAM, options.udp_port);
+    int dot = listen_on(SOCK_STREAM, options.dot_port);
+    int doh = listen_on(SOCK_STREAM, options.doh_port);
+    printf("UDP %s:%d, DoT tls://%s:%d, DoH https://%s:%d/dns-query, 延迟 %d ms\n",
+           options.address, options.udp_port, options.address, options.dot_port,
+           options.address, options.doh_port, options.delay_ms);
+    fflush(stdout);
+
+    std::thread(accept_loop, contexts[0], dot, false).detach();
+    std::thread(accept_loop, contexts[1], doh, true).detach();
+    serve_udp(udp);
+    return 0;
+}
@@ -0,0 +1,415 @@
+/**
+ * 静态覆盖表生成器 - 把 /etc/hosts 格式的文本编译成内存映射的完美哈希文件 (dns_hosts.h)
+ *
+ * 输入每行 "IPv4地址 域名 [别名...]"，'#' 之后是注释。同一个文件中同一域名的多行地址合并
+ * （与 /etc/hosts 相同）；多个输入文件中出现同一个域名时，后面的文件覆盖前面的。
+ * IPv6 地址的行跳过（覆盖表只有 A 记录）。
+ *
+ * 编译: make
+ * 运行: ./hosts_build -o overrides.phf /etc/hosts internal_overrides.txt
+ *       ./hosts_build -v -o overrides.phf big_list.txt     # 生成后逐个查找验证并测量查找耗时
+ *
+ * 输出先写到同目录下的临时文件，fsync 之后 rename 到目标路径：
+ * 正在使用旧文件的进程不受影响，监视目录的进程 (inotify) 在 rename 之后重新加载。
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "dns_hosts.h"       // 文件格式与哈希函数
+
+// ============================================================================
+// 读取输入
+// ============================================================================
+
+/**
+ * 一条 (域名, 地址) 记录；域名存在公共缓冲区中
+ */
+struct HostRecord {
+    uint64_t hash;              // 种子为 0 的哈希，只用于排序分组
+    uint32_t name_off;
+    uint16_t name_len;
+    uint16_t file;              // 输入文件序号，大的覆盖小的
+    uint32_t line;              // 记录顺序，合并后的地址保持文件中的顺序
+    uint32_t addr;
+};
+
+struct BuildInput {
+    std::string names;          // 所有记录的域名（可能重复）
+    std::vector<HostRecord> records;
+    unsigned long skipped_ipv6;
+    unsigned long skipped_invalid;
+};
+
+bool load_hosts_file(const char* path, uint16_t file_index, BuildInput& input) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char* save = NULL;
+        char* tok = strtok_r(line, " \t\r\n", &save);
+        if (tok == NULL) {
+            continue;
+        }
+        struct in_addr addr;
+        if (inet_pton(AF_INET, tok, &addr) != 1) {
+            if (strchr(tok, ':') != NULL) {
+                input.skipped_ipv6++;
+            } else {
+                input.skipped_invalid++;
+            }
+            continue;
+        }
+        while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            char key[DNS_CACHE_MAX_NAME];
+            int len = dns_cache_normalize(tok, key);
+            if (len <= 0) {
+                input.skipped_invalid++;
+                continue;
+            }
+            HostRecord r;
+            r.hash = dns_hosts_hash(key, len, 0);
+            r.name_off = input.names.size();
+            r.name_len = len;
+            r.file = file_index;
+            r.line = input.records.size();
+            r.addr = addr.s_addr;
+            input.names.append(key, len);
+            input.records.push_back(r);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// ============================================================================
+// 合并与完美哈希
+// ============================================================================
+
+/**
+ * 合并后的一个域名
+ */
+struct HostEntry {
+    uint64_t hash;              // 当前种子下的哈希
+    uint32_t name_off;          // 在 BuildInput::names 中的偏移
+    uint16_t name_len;
+    uint16_t addr_count;
+    uint32_t addr_off;          // 在合并后的地址数组中的偏移
+};
+
+/**
+ * 按域名分组：同一域名只保留最后一个文件中的地址，去重后最多 DNS_CACHE_MAX_ADDRS 个
+ */
+void merge_records(BuildInput& input, std::vector<HostEntry>& entries, std::vector<uint32_t>& addrs,
+                   unsigned long& dropped_addrs) {
+    const char* names = input.names.data();
+    std::sort(input.records.begin(), input.records.end(), [names](const HostRecord& a, const HostRecord& b) {
+        if (a.hash != b.hash) {
+            return a.hash < b.hash;
+        }
+        if (a.name_len != b.name_len) {
+            return a.name_len < b.name_len;
+        }
+        int c = memcmp(names + a.name_off, names + b.name_off, a.name_len);
+        if (c != 0) {
+            return c < 0;
+        }
+        return a.file != b.file ? a.file > b.file : a.line < b.line;   // 最后一个文件排在最前
+    });
+
+    size_t i = 0;
+    while (i < input.records.size()) {
+        const HostRecord& first = input.records[i];
+        HostEntry e;
+        e.name_off = first.name_off;
+        e.name_len = first.name_len;
+        e.addr_off = addrs.size();
+        e.addr_count = 0;
+        size_t j = i;
+        for (; j < input.records.size(); j++) {
+            const HostRecord& r = input.records[j];
+            if (r.hash != first.hash || r.name_len != first.name_len ||
+                memcmp(names + r.name_off, names + first.name_off, r.name_len) != 0) {
+                break;
+            }
+            if (r.file != first.file ||
+                std::find(addrs.begin() + e.addr_off, addrs.end(), r.addr) != addrs.end()) {
+                continue;   // 被后面的文件覆盖，或重复地址
+            }
+            if (e.addr_count == DNS_CACHE_MAX_ADDRS) {
+                dropped_addrs++;
+                continue;
+            }
+            addrs.push_back(r.addr);
+            e.addr_count++;
+        }
+        entries.push_back(e);
+        i = j;
+    }
+}
+
+/**
+ * 为给定种子寻找每个桶的位移值
+ *
+ * 先放大的桶（此时空槽位多），桶内所有键在同一个位移值下都要落到空槽位且互不相同。
+ * 某个桶试遍 max_tries 个位移值都不行时返回 false，调用者换种子重试。
+ */
+bool build_perfect_hash(std::vector<HostEntry>& entries, const char* names, uint64_t seed,
+                        uint32_t bucket_count, uint32_t slot_count,
+                        std::vector<uint32_t>& displacements, std::vector<int32_t>& slot_entry) {
+    const uint32_t max_tries = 1u << 22;
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].hash = dns_hosts_hash(names + entries[i].name_off, entries[i].name_len, seed);
+    }
+
+    // 按桶做计数排序
+    std::vector<uint32_t> bucket_start(bucket_count + 1, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+        bucket_start[dns_hosts_bucket(entries[i].hash, bucket_count) + 1]++;
+    }
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    std::vector<uint32_t> fill(bucket_start.begin(), bucket_start.end() - 1);
+    std::vector<uint32_t> bucket_keys(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        bucket_keys[fill[dns_hosts_bucket(entries[i].hash, bucket_count)]++] = i;
+    }
+
+    // 桶按大小从大到小处理
+    std::vector<uint32_t> order(bucket_count);
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&bucket_start](uint32_t a, uint32_t b) {
+        return bucket_start[a + 1] - bucket_start[a] > bucket_start[b + 1] - bucket_start[b];
+    });
+
+    displacements.assign(bucket_count, 0);
+    slot_entry.assign(slot_count, -1);
+    std::vector<uint32_t> placed;
+    for (uint32_t k = 0; k < bucket_count; k++) {
+        uint32_t b = order[k];
+        uint32_t begin = bucket_start[b], end = bucket_start[b + 1];
+        if (begin == end) {
+            break;      // 后面都是空桶
+        }
+        uint32_t d = 0;
+        for (; d < max_tries; d++) {
+            placed.clear();
+            bool ok = true;
+            for (uint32_t i = begin; i < end && ok; i++) {
+                uint32_t s = dns_hosts_slot(entries[bucket_keys[i]].hash, d, slot_count);
+                ok = slot_entry[s] < 0 && std::find(placed.begin(), placed.end(), s) == placed.end();
+                placed.push_back(s);
+            }
+            if (ok) {
+                break;
+            }
+        }
+        if (d == max_tries) {
+            return false;
+        }
+        displacements[b] = d;
+        for (uint32_t i = begin; i < end; i++) {
+            slot_entry[placed[i - begin]] = bucket_keys[i];
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// 写文件与验证
+// ============================================================================
+
+bool write_table(const char* path, const DNSHostsHeader& header, const std::vector<uint32_t>& displacements,
+                 const std::vector<DNSHostsSlot>& slots, const std::vector<uint32_t>& addrs,
+                 const std::string& names) {
+    std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == NULL) {
+        perror(tmp.c_str());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(displacements.data(), sizeof(uint32_t), displacements.size(), f) == displacements.size() &&
+              fwrite(slots.data(), sizeof(DNSHostsSlot), slots.size(), f) == slots.size() &&
+              fwrite(addrs.data(), sizeof(uint32_t), addrs.size(), f) == addrs.size() &&
+              fwrite(names.data(), 1, names.size(), f) == names.size() &&
+              fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    // rename 是原子的：打开这个路径的进程要么得到旧文件，要么得到完整的新文件
+    if (!ok || rename(tmp.c_str(), path) < 0) {
+        perror(path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 重新打开生成的文件，逐个查找所有域名，检查地址一致并测量每次查找的耗时
+ */
+bool verify_table(const char* path, const std::vector<HostEntry>& entries, const char* names,
+                  const std::vector<uint32_t>& addrs) {
+    DNSHostsTable table;
+    if (!dns_hosts_open(table, path)) {
+        fprintf(stderr, "错误: 无法打开刚生成的 %s\n", path);
+        return false;
+    }
+    std::vector<std::string> keys(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        keys[i].assign(names + entries[i].name_off, entries[i].name_len);
+    }
+    unsigned long errors = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < entries.size(); i++) {
+        DNSCacheEntry out;
+        if (!dns_hosts_lookup(table, keys[i].c_str(), out) || out.addr_count != entries[i].addr_count ||
+            memcmp(out.addrs, &addrs[entries[i].addr_off], out.addr_count * sizeof(uint32_t)) != 0) {
+            errors++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // 不存在的域名应当全部未命中
+    unsigned long false_hits = 0;
+    for (size_t i = 0; i < entries.size() && i < 100000; i++) {
+        DNSCacheEntry out;
+        false_hits += dns_hosts_lookup(table, (keys[i] + ".absent").c_str(), out);
+    }
+    dns_hosts_close(table);
+
+    printf("验证:       %zu 次查找, 错误 %lu, 误命中 %lu, 平均 %.1f ns/次\n",
+           entries.size(), errors, false_hits, entries.empty() ? 0.0 : seconds * 1e9 / entries.size());
+    return errors == 0 && false_hits == 0;
+}
+
+// ============================================================================
+// 主函数
+// ============================================================================
+
+int main(int argc, char* argv[]) {
+    const char* output = DNS_HOSTS_PATH;
+    bool verify = false;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:v")) != -1) {
+        switch (opt) {
+            case 'o': output = optarg; break;
+            case 'v': verify = true; break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || optind >= argc || argc - optind > 65535) {
+        fprintf(stderr, "用法: %s [-o 输出文件] [-v] <hosts 文件> [hosts 文件...]\n", argv[0]);
+        fprintf(stderr, "  -o  输出文件 (默认 %s)\n", DNS_HOSTS_PATH);
+        fprintf(stderr, "  -v  生成后逐个查找验证\n");
+        fprintf(stderr, "多个文件中出现同一个域名时，后面的文件覆盖前面的\n");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BuildInput input;
+    input.skipped_ipv6 = 0;
+    input.skipped_invalid = 0;
+    for (int i = optind; i < argc; i++) {
+        if (!load_hosts_file(argv[i], i - optind, input)) {
+            return 1;
+        }
+    }
+    if (input.names.size() > UINT32_MAX) {
+        fprintf(stderr, "错误: 域名总长度超过 4 GB\n");
+        return 1;
+    }
+
+    std::vector<HostEntry> entries;
+    std::vector<uint32_t> merged_addrs;
+    unsigned long dropped_addrs = 0;
+    merge_records(input, entries, merged_addrs, dropped_addrs);
+    input.records.clear();
+    input.records.shrink_to_fit();
+
+    // 槽位装载率约 0.9，平均每个桶 4 个键
+    uint32_t entry_count = entries.size();
+    uint32_t slot_count = entry_count + entry_count / 9 + 1;
+    uint32_t bucket_count = entry_count / 4 + 1;
+    std::vector<uint32_t> displacements;
+    std::vector<int32_t> slot_entry;
+    uint64_t seed = 0;
+    int attempts = 0;
+    for (; attempts < 16; attempts++) {
+        seed = dns_hosts_mix(time(NULL) + attempts);
+        if (build_perfect_hash(entries, input.names.data(), seed, bucket_count, slot_count,
+                               displacements, slot_entry)) {
+            break;
+        }
+    }
+    if (attempts == 16) {
+        fprintf(stderr, "错误: 找不到完美哈希\n");
+        return 1;
+    }
+
+    // 输出只包含去重后的域名
+    std::string names;
+    std::vector<DNSHostsSlot> slots(slot_count);
+    memset(slots.data(), 0, slots.size() * sizeof(DNSHostsSlot));
+    for (uint32_t s = 0; s < slot_count; s++) {
+        if (slot_entry[s] < 0) {
+            continue;
+        }
+        HostEntry& e = entries[slot_entry[s]];
+        slots[s].name_off = names.size();
+        slots[s].name_len = e.name_len;
+        slots[s].addr_off = e.addr_off;
+        slots[s].addr_count = e.addr_count;
+        slots[s].hash = (uint32_t)e.hash;
+        names.append(input.names, e.name_off, e.name_len);
+    }
+
+    DNSHostsHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DNS_HOSTS_MAGIC;
+    header.version = DNS_HOSTS_VERSION;
+    header.seed = seed;
+    header.entry_count = entry_count;
+    header.bucket_count = bucket_count;
+    header.slot_count = slot_count;
+    header.addr_count = merged_addrs.size();
+    header.names_size = names.size();
+    header.built = time(NULL);
+    if (!write_table(output, header, displacements, slots, merged_addrs, names)) {
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t size = dns_hosts_file_size(header);
+    printf("输出文件:   %s\n", output);
+    printf("域名:       %u 个, 地址 %u 个 (跳过 IPv6 %lu 行, 无效 %lu 项, 超过 %d 个的地址 %lu 个)\n",
+           entry_count, header.addr_count, input.skipped_ipv6, input.skipped_invalid,
+           DNS_CACHE_MAX_ADDRS, dropped_addrs);
+    printf("哈希:       %u 个桶, %u 个槽位 (种子尝试 %d 次)\n", bucket_count, slot_count, attempts + 1);
+    printf("文件大小:   %.1f MB (%.1f 字节/域名)\n", size / 1048576.0,
+           entry_count > 0 ? (double)size / entry_count : 0.0);
+    printf("生成耗时:   %.2f s\n", seconds);
+
+    if (verify && !verify_table(output, entries, input.names.data(), merged_addrs)) {
+        return 1;
+    }
+    return 0;
+}
@@ -6,6 +6,11 @@
  *
  * 编译: g++ -o resolver resolver.cpp -std=c++11
  * 运行: ./resolver google.com
+ *       ./resolver -S 127.0.0.1:5353 google.com   # 指定 DNS 服务器
+ *
+ * 查询结果写入 /dev/shm 中的共享缓存 (dns_cache.h)，TTL 内本机任何进程再次查询同一个域名都直接命中。
+ * 静态覆盖表 (dns_hosts.h，由 hosts_build 生成) 中的域名直接返回固定地址，优先于缓存和网络。
+ * -d 开启 DNSSEC 验证 (dnssec.h)：从信任锚沿 DS/DNSKEY 链验证应答的签名。
  */
 
 #include <iostream>
@@ -16,252 +21,22 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sys/random.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
 
-using namespace std;
-
-// ============================================================================
-// DNS 协议数据结构定义
-// ============================================================================
-
-/**
- * DNS 头部结构 (12 字节)
- * 注意: 使用 __attribute__((packed)) 防止编译器自动对齐，确保结构体大小正确
- *
- * 字段说明:
- * - id: 事务ID，用于匹配请求和响应
- * - flags: 标志位（QR, Opcode, AA, TC, RD, RA, Z, RCODE）
- * - qdcount: 问题数量（Questions Count）
- * - ancount: 回答数量（Answer RRs Count）
- * - nscount: 授权记录数量（Authority RRs Count）
- * - arcount: 附加记录数量（Additional RRs Count）
- */
-struct DNSHeader {
-    uint16_t id;        // 事务ID (2字节)
-    uint16_t flags;     // 标志位 (2字节)
-    uint16_t qdcount;   // 问题计数 (2字节)
-    uint16_t ancount;   // 回答计数 (2字节)
-    uint16_t nscount;   // 授权记录计数 (2字节)
-    uint16_t arcount;   // 附加记录计数 (2字节)
-} __attribute__((packed));
-
-/**
- * DNS 问题部分的尾部 (4 字节)
- * QNAME 之后紧跟的字段
- *
- * 字段说明:
- * - qtype: 查询类型 (1=A记录, 2=NS, 5=CNAME, 等等)
- * - qclass: 查询类 (1=IN互联网)
- */
-struct DNSQuestion {
-    uint16_t qtype;     // 查询类型 (2字节)
-    uint16_t qclass;    // 查询类 (2字节)
-} __attribute__((packed));
-
-/**
- * DNS 资源记录头部 (不包括 NAME 字段)
- * 出现在 Answer, Authority, Additional 部分
- */
-struct DNSResourceRecord {
-    uint16_t type;      // 记录类型 (2字节)
-    uint16_t class_;    // 记录类 (2字节)
-    uint32_t ttl;       // 生存时间 (4字节)
-    uint16_t rdlength;  // 数据长度 (2字节)
-} __attribute__((packed));
-
-// ============================================================================
-// DNS 查询包构建函数
-// ============================================================================
-
-/**
- * 将域名编码为 DNS QNAME 格式
- *
- * DNS QNAME 格式说明:
- * 域名 "google.com" 编码为: [6]google[3]com[0]
- * - 每段前面加上长度字节
- * - 最后以 0x00 结尾
- *
- * 例如:
- * google.com -> \x06google\x03com\x00
- * www.example.org -> \x03www\x07example\x03org\x00
- *
- * @param domain 原始域名字符串 (例如 "google.com")
- * @param buffer 输出缓冲区
- * @return 编码后的长度
- */
-int encodeDomainName(const char* domain, unsigned char* buffer) {
-    unsigned char* ptr = buffer;
-    const char* label_start = domain;
-
-    // 遍历域名的每个字符
-    for (const char* p = domain; ; p++) {
-        // 遇到 '.' 或字符串结尾
-        if (*p == '.' || *p == '\0') {
-            int label_len = p - label_start;  // 计算当前标签长度
-
-            if (label_len > 0) {
-                *ptr++ = (unsigned char)label_len;  // 写入长度字节
-                memcpy(ptr, label_start, label_len);  // 写入标签内容
-                ptr += label_len;
-            }
-
-            // 如果到达字符串结尾，写入终止符 0x00
-            if (*p == '\0') {
-                *ptr++ = 0x00;
-                break;
-            }
-
-            // 移动到下一个标签
-            label_start = p + 1;
-        }
-    }
-
-    return ptr - buffer;  // 返回总长度
-}
-
-/**
- * 构建 DNS 查询包
- *
- * DNS 查询包结构:
- * +---------------------------+
- * |   Header (12 bytes)       |  DNS头部
- * +---------------------------+
- * |   Question Section        |  问题部分
- * |   - QNAME (variable)      |    - 域名（可变长度）
- * |   - QTYPE (2 bytes)       |    - 查询类型
- * |   - QCLASS (2 bytes)      |    - 查询类
- * +---------------------------+
- *
- * @param domain 要查询的域名
- * @param buffer 输出缓冲区
- * @return 查询包的总长度
- */
-int buildDNSQuery(const char* domain, unsigned char* buffer) {
-    // ========================================
-    // 1. 构建 DNS 头部 (12 字节)
-    // ========================================
-    DNSHeader* header = (DNSHeader*)buffer;
-
-    // 生成随机事务ID (用于匹配请求和响应)
-    header->id = htons(rand() % 65536);
-
-    // 设置标志位: 0x0100
-    // - QR=0 (查询)
-    // - Opcode=0 (标准查询)
-    // - RD=1 (期望递归查询，Recursion Desired)
-    // 0x0100 = 0000 0001 0000 0000
-    //          ^^^^ ^^^^ ^^^^ ^^^^
-    //          QR Opcode AA TC RD RA Z RCODE
-    header->flags = htons(0x0100);
-
-    // 设置计数字段
-    header->qdcount = htons(1);  // 1个问题
-    header->ancount = htons(0);  // 0个回答
-    header->nscount = htons(0);  // 0个授权记录
-    header->arcount = htons(0);  // 0个附加记录
-
-    // ========================================
-    // 2. 构建问题部分
-    // ========================================
-    unsigned char* qname_ptr = buffer + sizeof(DNSHeader);
-
-    // 编码域名为 QNAME 格式
-    int qname_len = encodeDomainName(domain, qname_ptr);
+#include "dns_message.h"     // DNS 报文结构定义与域名解析（与 tcp_analyzer 共用）
+#include "dns_cache.h"       // 共享内存 DNS 缓存
+#include "dns_hosts.h"       // 静态覆盖表（完美哈希文件）
+#include "dnssec.h"          // DNSSEC 验证
 
-    // 添加 QTYPE 和 QCLASS
-    DNSQuestion* question = (DNSQuestion*)(qname_ptr + qname_len);
-    question->qtype = htons(1);   // Type A (IPv4 地址)
-    question->qclass = htons(1);  // Class IN (互联网)
-
-    // 返回总长度
-    int total_len = sizeof(DNSHeader) + qname_len + sizeof(DNSQuestion);
-    return total_len;
-}
+using namespace std;
 
 // ============================================================================
 // DNS 响应包解析函数
 // ============================================================================
 
-/**
- * 解析 DNS 响应中的域名（支持指针压缩）
- *
- * DNS 消息压缩 (RFC 1035 Section 4.1.4):
- * 为了减少消息大小，DNS 使用指针来引用之前出现过的域名
- *
- * 格式:
- * - 普通标签: 长度字节 (0-63) + 标签内容
- * - 压缩指针: 前2位为11 (0xC0) + 12位偏移量
- *
- * 例如: 0xC0 0x0C 表示指向数据包偏移量 12 (0x000C) 的位置
- *
- * @param buffer 整个DNS响应包的起始位置
- * @param pos 当前要解析的位置（会被更新）
- * @param name 输出的域名字符串
- * @return 是否解析成功
- */
-bool parseDomainName(const unsigned char* buffer, int& pos, char* name) {
-    int name_pos = 0;
-    bool jumped = false;  // 是否使用了指针跳转
-    int original_pos = pos;  // 记录原始位置
-    int max_jumps = 10;  // 防止无限循环
-    int jumps = 0;
-
-    while (true) {
-        // 读取长度字节
-        unsigned char len = buffer[pos];
-
-        // 情况1: 结束标志 (0x00)
-        if (len == 0) {
-            name[name_pos] = '\0';
-            pos++;
-            if (!jumped) {
-                original_pos = pos;
-            }
-            break;
-        }
-
-        // 情况2: 指针压缩 (前2位为11，即 >= 0xC0)
-        // 0xC0 = 1100 0000
-        if ((len & 0xC0) == 0xC0) {
-            // 读取2字节的偏移量
-            // 前2位是标志位，后14位是偏移量
-            int offset = ((len & 0x3F) << 8) | buffer[pos + 1];
-
-            if (!jumped) {
-                original_pos = pos + 2;  // 记录跳转前的位置
-            }
-
-            pos = offset;  // 跳转到指针指向的位置
-            jumped = true;
-            jumps++;
-
-            if (jumps > max_jumps) {
-                cerr << "错误: DNS 名称压缩指针循环" << endl;
-                return false;
-            }
-            continue;
-        }
-
-        // 情况3: 普通标签
-        pos++;  // 跳过长度字节
-
-        // 添加标签分隔符 '.'
-        if (name_pos > 0) {
-            name[name_pos++] = '.';
-        }
-
-        // 复制标签内容
-        for (int i = 0; i < len; i++) {
-            name[name_pos++] = buffer[pos++];
-        }
-    }
-
-    if (jumped) {
-        pos = original_pos;
-    }
-
-    return true;
-}
-
 /**
  * 解析 DNS 响应包并提取 IP 地址
  *
@@ -286,11 +61,19 @@ bool parseDomainName(const unsigned char* buffer, int& pos, char* name) {
  *
  * @param buffer DNS响应包缓冲区
  * @param len 响应包长度
+ * @param result 输出可缓存的结果（A 记录地址、最小 TTL；NXDOMAIN 使用否定缓存时间），
+ *               ttl 为 0 表示不可缓存
  */
-void parseDNSResponse(unsigned char* buffer, int len) {
+void parseDNSResponse(unsigned char* buffer, int len, DNSCacheEntry& result) {
+    memset(&result, 0, sizeof(result));
+
     // ========================================
     // 1. 解析 DNS 头部
     // ========================================
+    if (len < (int)sizeof(DNSHeader)) {
+        cerr << "错误: 响应包小于 DNS 头部" << endl;
+        return;
+    }
     DNSHeader* header = (DNSHeader*)buffer;
 
     // 转换字节序（网络字节序 -> 主机字节序）
@@ -305,6 +88,10 @@ void parseDNSResponse(unsigned char* buffer, int len) {
 
     // 检查响应码 (RCODE, 最后4位)
     int rcode = flags & 0x000F;
+    result.rcode = rcode;
+    if (rcode == DNS_RCODE_NXDOMAIN) {
+        result.ttl = DNS_CACHE_NEGATIVE_TTL;
+    }
     if (rcode != 0) {
         cerr << "错误: DNS 查询失败，RCODE = " << rcode << endl;
         switch (rcode) {
@@ -333,13 +120,13 @@ void parseDNSResponse(unsigned char* buffer, int len) {
 
     for (int i = 0; i < qdcount; i++) {
         char domain[256];
-        if (!parseDomainName(buffer, pos, domain)) {
+        if (!parseDomainName(buffer, len, pos, domain)) {
             cerr << "错误: 无法解析问题部分的域名" << endl;
             return;
         }
 
         // 跳过 QTYPE 和 QCLASS (各2字节)
-        pos += 4;
+        pos += sizeof(DNSQuestion);
     }
 
     // ========================================
@@ -350,13 +137,13 @@ void parseDNSResponse(unsigned char* buffer, int len) {
     for (int i = 0; i < ancount; i++) {
         // 解析名称
         char name[256];
-        if (!parseDomainName(buffer, pos, name)) {
+        if (!parseDomainName(buffer, len, pos, name)) {
             cerr << "错误: 无法解析回答部分的域名" << endl;
             return;
         }
 
         // 确保不会越界
-        if (pos + sizeof(DNSResourceRecord) > len) {
+        if (pos + (int)sizeof(DNSResourceRecord) > len) {
             cerr << "错误: 响应包数据不完整" << endl;
             return;
         }
@@ -376,6 +163,11 @@ void parseDNSResponse(unsigned char* buffer, int len) {
             return;
         }
 
+        // 结果的 TTL 取所有记录（包括 CNAME 链）中最小的
+        if (type == 1 || type == 5) {
+            result.ttl = (result.ttl == 0) ? ttl : min(result.ttl, ttl);
+        }
+
         cout << "\n记录 #" << (i + 1) << ":" << endl;
         cout << "  名称: " << name << endl;
         cout << "  类型: " << type;
@@ -394,6 +186,9 @@ void parseDNSResponse(unsigned char* buffer, int len) {
                      << (int)ip[1] << "."
                      << (int)ip[2] << "."
                      << (int)ip[3] << endl;
+                if (result.addr_count < DNS_CACHE_MAX_ADDRS) {
+                    memcpy(&result.addrs[result.addr_count++], ip, 4);
+                }
             }
         }
         // 处理 CNAME 记录
@@ -404,10 +199,14 @@ void parseDNSResponse(unsigned char* buffer, int len) {
 
             int cname_pos = pos;
             char cname[256];
-            if (parseDomainName(buffer, cname_pos, cname)) {
+            if (parseDomainName(buffer, len, cname_pos, cname)) {
                 cout << "  别名指向: " << cname << endl;
             }
         }
+        // DNSSEC 签名（-d 时服务器附带）
+        else if (type == 46) {
+            cout << " (RRSIG记录 - DNSSEC 签名)" << endl;
+        }
         // 其他类型
         else {
             cout << " (其他类型)" << endl;
@@ -417,33 +216,246 @@ void parseDNSResponse(unsigned char* buffer, int len) {
         pos += rdlength;
     }
 
+    // 只有 CNAME 没有地址时不缓存
+    if (result.addr_count == 0) {
+        result.ttl = 0;
+    }
     cout << "\n=================================" << endl;
 }
 
+/**
+ * 打印共享缓存的统计（-s）
+ */
+void printCacheStats(const DNSCache& cache) {
+    time_t now = time(NULL);
+    unsigned used = 0, valid = 0, negative = 0;
+    for (uint32_t i = 0; i < DNS_CACHE_SLOTS; i++) {
+        const DNSCacheSlot& slot = cache.slots[i];
+        if (slot.hash == 0) {
+            continue;
+        }
+        used++;
+        if (slot.expires > now) {
+            valid++;
+            negative += slot.rcode != 0;
+        }
+    }
+    cout << "共享缓存: " << DNS_CACHE_SLOTS << " 个槽位 x " << sizeof(DNSCacheSlot) << " 字节"
+         << (cache.writable ? "" : " (只读)") << endl;
+    cout << "已使用:   " << used << " (未过期 " << valid << ", 其中 NXDOMAIN " << negative << ")" << endl;
+    cout << "写入次数: " << cache.header->inserts.load() << ", 淘汰未过期结果 "
+         << cache.header->evictions.load() << " 次" << endl;
+}
+
+/**
+ * 随机事务ID：结果会写入整台主机共用的缓存，ID 不能可预测（rand() 以时间为种子，只作后备）
+ */
+uint16_t randomQueryId() {
+    uint16_t id;
+    if (getrandom(&id, sizeof(id), 0) != (ssize_t)sizeof(id)) {
+        id = (uint16_t)(rand() ^ getpid());
+    }
+    return id;
+}
+
+/**
+ * 发送一个查询并等待对应的响应（DNSSEC 建立信任链时使用）
+ *
+ * connect 之后内核只交付来自服务器地址的报文，再检查事务ID和问题一致
+ */
+bool exchangeDNSQuery(const struct sockaddr_in& server, const char* name, uint16_t qtype,
+                      vector<unsigned char>& response) {
+    unsigned char query[DNS_MAX_QUERY + DNS_EDNS_OPT_SIZE];
+    uint16_t id = randomQueryId();
+    int query_len = buildDNSQuery(name, id, qtype, query);
+    if (query_len < 0) {
+        return false;
+    }
+    query_len = appendEDNS0(query, query_len, 4096, true);
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        return false;
+    }
+    struct timeval timeout = {5, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char expected[DNS_CACHE_MAX_NAME];
+    char answered[DNS_CACHE_MAX_NAME];
+    bool ok = false;
+    if (dns_cache_normalize(name, expected) >= 0 && connect(sockfd, (const struct sockaddr*)&server, sizeof(server)) == 0 &&
+        send(sockfd, query, query_len, 0) == query_len) {
+        response.resize(4096);
+        ssize_t received;
+        while ((received = recv(sockfd, response.data(), response.size(), 0)) >= 0) {
+            DNSMessageInfo info;
+            if (parseDNSMessage(response.data(), received, info) && info.is_response && info.id == id &&
+                info.qtype == qtype && dns_cache_normalize(info.qname, answered) >= 0 &&
+                strcmp(answered, expected) == 0) {
+                response.resize(received);
+                ok = true;
+                break;
+            }
+        }
+    }
+    close(sockfd);
+    return ok;
+}
+
+/**
+ * 读取信任锚文件（dig 输出格式的 DS 记录）
+ */
+bool loadTrustAnchors(DnssecValidator& validator, const char* path) {
+    if (path == NULL) {
+        return dnssec_load_anchors(validator, DNSSEC_ROOT_ANCHORS);
+    }
+    ifstream file(path);
+    stringstream text;
+    text << file.rdbuf();
+    return file.good() && dnssec_load_anchors(validator, text.str());
+}
+
 // ============================================================================
 // 主函数
 // ============================================================================
 
 int main(int argc, char* argv[]) {
+    const char* server = "8.8.8.8";
+    int server_port = 53;
+    const char* cache_path = DNS_CACHE_PATH;
+    const char* hosts_path = DNS_HOSTS_PATH;
+    const char* anchor_path = NULL;
+    bool dnssec = false;
+    bool use_cache = true;
+    bool show_stats = false;
+    bool bad_option = false;
+
+    // 解析命令行参数
+    int opt;
+    while ((opt = getopt(argc, argv, "S:c:H:T:dns")) != -1) {
+        switch (opt) {
+            case 'S': {
+                // 服务器IP[:端口]
+                static char host[64];
+                snprintf(host, sizeof(host), "%s", optarg);
+                char* colon = strchr(host, ':');
+                if (colon != NULL) {
+                    *colon = '\0';
+                    server_port = atoi(colon + 1);
+                }
+                server = host;
+                break;
+            }
+            case 'c': cache_path = optarg; break;
+            case 'H': hosts_path = optarg; break;
+            case 'd': dnssec = true; break;
+            case 'T': anchor_path = optarg; dnssec = true; break;
+            case 'n': use_cache = false; break;
+            case 's': show_stats = true; break;
+            default: bad_option = true; break;
+        }
+    }
+
     // 检查命令行参数
-    if (argc != 2) {
-        cerr << "用法: " << argv[0] << " <域名>" << endl;
+    if (bad_option || (optind != argc - 1 && !(show_stats && optind == argc))) {
+        cerr << "用法: " << argv[0] << " [-S 服务器IP[:端口]] [-n] [-c 缓存文件] [-H 覆盖表] [-d] [-T 信任锚] <域名>" << endl;
+        cerr << "      " << argv[0] << " -s              # 显示共享缓存统计" << endl;
+        cerr << "  -S  DNS 服务器 (默认 8.8.8.8:53)" << endl;
+        cerr << "  -n  不使用共享缓存" << endl;
+        cerr << "  -c  共享缓存文件 (默认 " << DNS_CACHE_PATH << ")" << endl;
+        cerr << "  -H  静态覆盖表 (默认 " << DNS_HOSTS_PATH << "，不存在时忽略)" << endl;
+        cerr << "  -d  DNSSEC 验证 (默认信任锚为根区 KSK)" << endl;
+        cerr << "  -T  信任锚文件 (DS 记录，dig 输出格式)，隐含 -d" << endl;
         cerr << "示例: " << argv[0] << " google.com" << endl;
         return 1;
     }
 
-    const char* domain = argv[1];
+    // 打开共享缓存（失败时直接走网络）
+    DNSCache cache;
+    if (use_cache && !dns_cache_open(cache, cache_path)) {
+        cerr << "警告: 无法打开共享缓存 " << cache_path << "，直接查询" << endl;
+        use_cache = false;
+    }
+    if (show_stats) {
+        if (!use_cache) {
+            return 1;
+        }
+        printCacheStats(cache);
+        dns_cache_close(cache);
+        return 0;
+    }
 
-    // 初始化随机数生成器（用于生成事务ID）
+    const char* domain = argv[optind];
+
+    // 初始化随机数生成器（getrandom 不可用时生成事务ID）
     srand(time(NULL));
 
     cout << "正在查询域名: " << domain << endl;
 
+    // ========================================
+    // 0. 查找静态覆盖表和共享缓存
+    // ========================================
+    DNSHostsTable hosts;
+    if (dns_hosts_open(hosts, hosts_path)) {
+        DNSCacheEntry pinned;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool hit = dns_hosts_lookup(hosts, domain, pinned);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        dns_hosts_close(hosts);
+        if (hit) {
+            double us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+            cout << "命中静态覆盖表 " << hosts_path << " (查找耗时 " << us << " us)" << endl;
+            for (int i = 0; i < pinned.addr_count; i++) {
+                struct in_addr addr;
+                addr.s_addr = pinned.addrs[i];
+                cout << "  IP地址: " << inet_ntoa(addr) << endl;
+            }
+            if (use_cache) {
+                dns_cache_close(cache);
+            }
+            return 0;
+        }
+    }
+
+    if (use_cache) {
+        // -d 时只接受验证过的结果（单独的键，未验证的写入者不会写到这里）；
+        // 这个键只对应默认的根信任锚，-T 指定其他信任锚时不使用缓存的结果
+        DNSCacheEntry cached;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool hit = (!dnssec || anchor_path == NULL) &&
+                   dns_cache_lookup(cache, domain, dnssec ? DNSSEC_CACHE_QTYPE_A : 1, cached, time(NULL));
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (hit) {
+            double us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+            cout << "命中共享缓存" << (dnssec ? " (DNSSEC 已验证" : " (") << (dnssec ? ", " : "")
+                 << "剩余 TTL " << cached.ttl << " 秒, 查找耗时 " << us << " us)" << endl;
+            if (cached.rcode == DNS_RCODE_NXDOMAIN) {
+                cout << "  域名不存在 (NXDOMAIN)" << endl;
+            }
+            for (int i = 0; i < cached.addr_count; i++) {
+                struct in_addr addr;
+                addr.s_addr = cached.addrs[i];
+                cout << "  IP地址: " << inet_ntoa(addr) << endl;
+            }
+            dns_cache_close(cache);
+            return 0;
+        }
+    }
+
     // ========================================
     // 1. 构建 DNS 查询包
     // ========================================
     unsigned char query_buffer[512];
-    int query_len = buildDNSQuery(domain, query_buffer);
+    int query_len = buildDNSQuery(domain, randomQueryId(), 1, query_buffer);
+    if (query_len < 0) {
+        cerr << "错误: 域名不合法（标签超过 63 字节或总长超过 255 字节）" << endl;
+        return 1;
+    }
+    if (dnssec) {
+        // EDNS0 + DO 位：请求签名，并允许超过 512 字节的 UDP 响应
+        query_len = appendEDNS0(query_buffer, query_len, 4096, true);
+    }
 
     cout << "查询包大小: " << query_len << " 字节" << endl;
 
@@ -467,21 +479,21 @@ int main(int argc, char* argv[]) {
     }
 
     // ========================================
-    // 3. 设置 DNS 服务器地址 (Google Public DNS: 8.8.8.8:53)
+    // 3. 设置 DNS 服务器地址 (默认 Google Public DNS: 8.8.8.8:53)
     // ========================================
     struct sockaddr_in dns_server;
     memset(&dns_server, 0, sizeof(dns_server));
     dns_server.sin_family = AF_INET;
-    dns_server.sin_port = htons(53);  // DNS 端口 53
+    dns_server.sin_port = htons(server_port);  // DNS 端口 (默认 53)
 
     // 将 IP 地址字符串转换为二进制形式
-    if (inet_pton(AF_INET, "8.8.8.8", &dns_server.sin_addr) <= 0) {
+    if (inet_pton(AF_INET, server, &dns_server.sin_addr) <= 0) {
         perror("无效的 DNS 服务器地址");
         close(sockfd);
         return 1;
     }
 
-    cout << "DNS 服务器: 8.8.8.8:53" << endl;
+    cout << "DNS 服务器: " << server << ":" << server_port << endl;
 
     // ========================================
     // 4. 发送 DNS 查询
@@ -500,7 +512,7 @@ int main(int argc, char* argv[]) {
     // ========================================
     // 5. 接收 DNS 响应
     // ========================================
-    unsigned char response_buffer[512];
+    unsigned char response_buffer[4096];
     struct sockaddr_in from_addr;
     socklen_t from_len = sizeof(from_addr);
 
@@ -518,10 +530,77 @@ int main(int argc, char* argv[]) {
     // ========================================
     // 6. 解析 DNS 响应
     // ========================================
-    parseDNSResponse(response_buffer, received);
+    DNSCacheEntry result;
+    parseDNSResponse(response_buffer, received, result);
+
+    // ========================================
+    // 7. 检查响应来源
+    // ========================================
+    // 只验证、缓存确实对应本次查询的响应（来源地址、事务ID和问题一致），伪造的响应不能分享给其他进程
+    DNSMessageInfo response_info;
+    char expected[DNS_CACHE_MAX_NAME];
+    char answered[DNS_CACHE_MAX_NAME];
+    bool genuine = from_addr.sin_addr.s_addr == dns_server.sin_addr.s_addr &&
+                   from_addr.sin_port == dns_server.sin_port &&
+                   parseDNSMessage(response_buffer, received, response_info) && response_info.is_response &&
+                   ((DNSHeader*)response_buffer)->id == ((DNSHeader*)query_buffer)->id &&
+                   response_info.qtype == 1 && dns_cache_normalize(domain, expected) >= 0 &&
+                   dns_cache_normalize(response_info.qname, answered) >= 0 && strcmp(answered, expected) == 0;
+
+    // ========================================
+    // 8. DNSSEC 验证，写入共享缓存
+    // ========================================
+    int exit_code = 0;
+    if (dnssec && genuine) {
+        DnssecValidator validator;
+        dnssec_init(validator, [&dns_server](const char* name, uint16_t qtype, vector<unsigned char>& response) {
+            return exchangeDNSQuery(dns_server, name, qtype, response);
+        });
+        if (!loadTrustAnchors(validator, anchor_path)) {
+            cerr << "错误: 无法读取信任锚 " << anchor_path << endl;
+            dnssec_shutdown(validator);
+            return 1;
+        }
+        if (use_cache) {
+            dnssec_load_key_cache(validator, DNSSEC_KEY_CACHE_PATH, time(NULL));
+        }
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        DNSCacheEntry validated;
+        string reason;
+        int status = dnssec_validate_response(validator, response_buffer, received, domain, time(NULL),
+                                              validated, reason);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+        cout << "\n========== DNSSEC ==========" << endl;
+        cout << "结果: " << dnssec_status_name(status) << endl;
+        if (status != DNSSEC_SECURE) {
+            cout << "原因: " << reason << endl;
+        }
+        cout << "信任链查询 " << validator.queries << " 次, 区密钥缓存命中 " << validator.zone_cache_hits
+             << " 次, 签名验证 " << validator.verifications.load() << " 次, 耗时 " << ms << " ms" << endl;
+
+        if (status == DNSSEC_SECURE && use_cache && anchor_path == NULL && validated.ttl > 0) {
+            dns_cache_store(cache, domain, DNSSEC_CACHE_QTYPE_A, validated, time(NULL));
+        }
+        if (use_cache) {
+            dnssec_save_key_cache(validator, DNSSEC_KEY_CACHE_PATH, time(NULL));
+        }
+        dnssec_shutdown(validator);
+        exit_code = status == DNSSEC_BOGUS ? 1 : 0;
+    }
+    // 验证失败 (bogus) 的应答不写入缓存
+    if (use_cache && genuine && result.ttl > 0 && exit_code == 0) {
+        dns_cache_store(cache, domain, 1, result, time(NULL));
+    }
+    if (use_cache) {
+        dns_cache_close(cache);
+    }
 
     // 关闭 socket
     close(sockfd);
 
-    return 0;
+    return exit_code;
 }
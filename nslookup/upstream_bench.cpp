@@ -0,0 +1,220 @@
+/**
+ * 上游传输基准测试 - 比较 UDP、DoT、DoH 上游的吞吐量和延迟
+ *
+ * 保持固定数量的查询同时在途（-c），一共发送 -n 个，域名在 -N 个合成名称中轮换。
+ * DoT 和 DoH 使用 dns_transport.h（一条 TLS 连接复用所有在途查询）；
+ * UDP 用一个套接字，按事务ID匹配响应，不重发（丢失的查询在超时后计为失败）。
+ *
+ *   ./doh_server -c cert.pem -k key.pem &
+ *   ./upstream_bench -n 100000 -c 1000 udp://127.0.0.1:5300
+ *   ./upstream_bench -n 100000 -c 1000 -C cert.pem tls://127.0.0.1:8530
+ *   ./upstream_bench -n 100000 -c 1000 -C cert.pem https://127.0.0.1:8443/dns-query
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dns_message.h"     // 构建查询
+#include "dns_transport.h"   // DoT / DoH 客户端
+
+const int QUERY_TIMEOUT_MS = 5000;
+
+struct BenchResult {
+    std::vector<double> latencies_us;   // 成功查询的延迟
+    unsigned long failures;
+    double seconds;
+};
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int make_query(int index, int name_count, uint16_t id, unsigned char* query) {
+    char name[64];
+    snprintf(name, sizeof(name), "host%d.bench.test", index % name_count);
+    return buildDNSQuery(name, id, 1, query);
+}
+
+/**
+ * DoT / DoH：调用线程提交，回调在 I/O 线程中统计
+ */
+BenchResult bench_tls(DNSTLSClient& client, int total, int concurrency, int name_count) {
+    BenchResult result;
+    result.failures = 0;
+    std::mutex lock;
+    std::condition_variable cv;
+    int inflight = 0;
+    int completed = 0;
+
+    int64_t start = now_us();
+    for (int i = 0; i < total; i++) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [&]() { return inflight < concurrency; });
+            inflight++;
+        }
+        unsigned char query[DNS_MAX_QUERY];
+        int len = make_query(i, name_count, (uint16_t)i, query);
+        int64_t sent = now_us();
+        dns_tls_submit(client, query, len, QUERY_TIMEOUT_MS,
+                       [&, sent](int status, const unsigned char* response, int response_len) {
+            double latency = now_us() - sent;
+            std::lock_guard<std::mutex> guard(lock);
+            if (status == DNS_TLS_OK && response_len >= 12 && (response[3] & 0x0F) == DNS_RCODE_NOERROR) {
+                result.latencies_us.push_back(latency);
+            } else {
+                result.failures++;
+            }
+            inflight--;
+            completed++;
+            cv.notify_all();
+        });
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    cv.wait(guard, [&]() { return completed == total; });
+    result.seconds = (now_us() - start) / 1e6;
+    return result;
+}
+
+/**
+ * UDP：一个套接字，在途查询按事务ID记录发送时间
+ */
+BenchResult bench_udp(const struct sockaddr_in& server, int total, int concurrency, int name_count) {
+    BenchResult result;
+    result.failures = 0;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 4 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    connect(sock, (const struct sockaddr*)&server, sizeof(server));
+
+    std::map<uint16_t, int64_t> inflight;
+    uint16_t next_id = 0;
+    int sent = 0;
+    int64_t start = now_us();
+    while (sent < total || !inflight.empty()) {
+        while (sent < total && (int)inflight.size() < concurrency) {
+            while (inflight.count(next_id) != 0) {
+                next_id++;
+            }
+            unsigned char query[DNS_MAX_QUERY];
+            int len = make_query(sent, name_count, next_id, query);
+            inflight[next_id++] = now_us();
+            send(sock, query, len, 0);
+            sent++;
+        }
+        struct pollfd pfd = {sock, POLLIN, 0};
+        poll(&pfd, 1, 100);
+        unsigned char response[1024];
+        ssize_t n;
+        while ((n = recv(sock, response, sizeof(response), MSG_DONTWAIT)) >= 12) {
+            uint16_t id = (response[0] << 8) | response[1];
+            std::map<uint16_t, int64_t>::iterator it = inflight.find(id);
+            if (it == inflight.end()) {
+                continue;
+            }
+            if ((response[3] & 0x0F) == DNS_RCODE_NOERROR) {
+                result.latencies_us.push_back(now_us() - it->second);
+            } else {
+                result.failures++;
+            }
+            inflight.erase(it);
+        }
+        int64_t expired = now_us() - QUERY_TIMEOUT_MS * 1000LL;
+        for (std::map<uint16_t, int64_t>::iterator it = inflight.begin(); it != inflight.end(); ) {
+            if (it->second < expired) {
+                result.failures++;
+                inflight.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    result.seconds = (now_us() - start) / 1e6;
+    close(sock);
+    return result;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char* argv[]) {
+    int total = 10000;
+    int concurrency = 100;
+    int name_count = 1000;
+    const char* ca_file = NULL;
+    int opt;
+    bool bad_option = false;
+    while ((opt = getopt(argc, argv, "n:c:N:C:")) != -1) {
+        switch (opt) {
+            case 'n': total = atoi(optarg); break;
+            case 'c': concurrency = atoi(optarg); break;
+            case 'N': name_count = atoi(optarg); break;
+            case 'C': ca_file = optarg; break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || optind >= argc || total < 1 || concurrency < 1 || concurrency > 4096 || name_count < 1) {
+        printf("用法: %s [-n 查询数] [-c 并发数(<=4096)] [-N 域名数] [-C CA文件] "
+               "<udp://IP:端口 | tls://主机:端口 | https://主机:端口/路径>\n", argv[0]);
+        return 1;
+    }
+    const char* url = argv[optind];
+
+    BenchResult result;
+    DNSTLSClient client;
+    bool tls = strncmp(url, "udp://", 6) != 0;
+    if (!tls) {
+        struct sockaddr_in server;
+        memset(&server, 0, sizeof(server));
+        server.sin_family = AF_INET;
+        std::string hostport(url + 6);
+        size_t colon = hostport.find(':');
+        server.sin_port = htons(colon == std::string::npos ? 53 : atoi(hostport.c_str() + colon + 1));
+        if (inet_pton(AF_INET, hostport.substr(0, colon).c_str(), &server.sin_addr) != 1) {
+            printf("无效的地址: %s\n", url);
+            return 1;
+        }
+        result = bench_udp(server, total, concurrency, name_count);
+    } else {
+        if (!dns_tls_open(client, url, ca_file)) {
+            printf("无效的上游: %s\n", url);
+            return 1;
+        }
+        result = bench_tls(client, total, concurrency, name_count);
+    }
+
+    std::vector<double>& lat = result.latencies_us;
+    std::sort(lat.begin(), lat.end());
+    printf("上游:       %s\n", url);
+    printf("查询:       %d (并发 %d, %d 个域名), 失败 %lu\n", total, concurrency, name_count, result.failures);
+    printf("吞吐:       %.0f 次/秒 (%.3f s)\n", total / result.seconds, result.seconds);
+    printf("延迟:       p50 %.0f us, p99 %.0f us, 最大 %.0f us\n",
+           percentile(lat, 0.5), percentile(lat, 0.99), lat.empty() ? 0 : lat.back());
+    if (tls) {
+        printf("连接:       %lu 次, 重发 %lu\n", (unsigned long)client.connects.load(),
+               (unsigned long)client.retried.load());
+        if (client.header_bytes > 0) {
+            printf("HPACK:      平均每个请求的头部块 %.1f 字节\n", (double)client.header_bytes / client.sent);
+        }
+        dns_tls_close(client);
+    }
+    return 0;
+}
@@ -0,0 +1,1348 @@
+/**
+ * 区文件编译器 - 把主文件 (RFC 1035 master file) 编译成 mmap 即可使用的区镜像 (dns_zone.h)
+ *
+ * 几百万条记录的区，逐行 fgets + sscanf 解析是权威服务启动的瓶颈。这里：
+ * - mmap 整个区文件，按行边界切成多块，多个线程并行解析
+ * - 分词用 SIMD：每 64 字节用 SSE2 一次算出空白符和分隔符的位图，找下一个分隔符/非空白只需一次 ctz；
+ *   换行用 glibc 的 memchr（本身就是 SIMD 实现）
+ * - $ORIGIN / $TTL 先顺序扫一遍（只找行首的 '$'），每块开始时的状态由此得到；
+ *   没有 $TTL 时“沿用上一条记录的 TTL”跨块的部分在合并时补上
+ * - 合并：所有者名称直接插入镜像的哈希表去重，记录按名称计数排序、按类型分成 RRset，写出镜像
+ *
+ * 支持的类型：A、AAAA、NS、CNAME、PTR、DNAME、MX、TXT、SOA、SRV、CAA，
+ * 以及 RFC 3597 的通用格式 (TYPE65534 \# 3 010203)。只支持 IN 类，不支持 $INCLUDE / $GENERATE。
+ * 切块点选在“行首是所有者名称”的行；某块解析时发现括号不配对（切在了多行记录中间）时整个文件改为单线程解析。
+ *
+ * 编译: make
+ * 运行: ./zone_compile -o example.zimg example.zone
+ *       ./zone_compile -c -v -j 8 -O example.com. -o big.zimg big.zone   # 冷缓存加载、验证并测量查找
+ *       ./zone_compile -q www.example.com -t A example.zimg               # 在镜像中查询
+ *
+ * 输出先写到同目录下的临时文件，fsync 之后 rename 到目标路径（与 hosts_build 相同）。
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#include "dns_zone.h"        // 镜像格式与查找
+
+const uint32_t TTL_UNRESOLVED = 0xFFFFFFFF;     // 沿用前一块最后的 TTL，合并时补上
+const int MAX_REPORTED_ERRORS = 10;
+
+// ============================================================================
+// SIMD 扫描
+// ============================================================================
+
+/**
+ * 64 字节窗口的字符分类位图：第 i 位对应 base[i]
+ *
+ * 超出文件末尾的部分当作换行，调用者看到位置 >= end 时结束
+ */
+struct ScanWindow {
+    const char* base;
+    uint64_t blank;                     // ' ' '\t'
+    uint64_t delim;                     // 空白、'\n' '\r' ';' '(' ')' '"' '\\'
+};
+
+#if defined(__x86_64__)
+/*
+ * SSE2 实现（x86-64 都支持）：每 16 字节比较 9 种字符，movemask 拼成 64 位
+ */
+inline void classify_block(const char* p, uint64_t& blank, uint64_t& delim) {
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r'), semi = _mm_set1_epi8(';'), lp = _mm_set1_epi8('(');
+    const __m128i rp = _mm_set1_epi8(')'), quote = _mm_set1_epi8('"'), bs = _mm_set1_epi8('\\');
+    blank = 0;
+    delim = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        __m128i b = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+        __m128i d = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, semi), _mm_cmpeq_epi8(v, lp)));
+        d = _mm_or_si128(d, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, rp), _mm_cmpeq_epi8(v, quote)),
+                                         _mm_cmpeq_epi8(v, bs)));
+        blank |= (uint64_t)(uint16_t)_mm_movemask_epi8(b) << (16 * i);
+        delim |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(b, d)) << (16 * i);
+    }
+}
+#else
+inline void classify_block(const char* p, uint64_t& blank, uint64_t& delim) {
+    blank = 0;
+    delim = 0;
+    for (int i = 0; i < 64; i++) {
+        char c = p[i];
+        bool b = c == ' ' || c == '\t';
+        bool d = b || c == '\n' || c == '\r' || c == ';' || c == '(' || c == ')' || c == '"' || c == '\\';
+        blank |= (uint64_t)b << i;
+        delim |= (uint64_t)d << i;
+    }
+}
+#endif
+
+inline void scan_load(ScanWindow& w, const char* p, const char* end) {
+    w.base = p;
+    if (end - p >= 64) {
+        classify_block(p, w.blank, w.delim);
+        return;
+    }
+    char tail[64];
+    memset(tail, '\n', sizeof(tail));
+    memcpy(tail, p, end - p);
+    classify_block(tail, w.blank, w.delim);
+}
+
+/**
+ * 从 p 开始第一个分隔符（空白、换行、注释、括号、引号、反斜杠）
+ */
+inline const char* scan_delim(ScanWindow& w, const char* p, const char* end) {
+    while (p < end) {
+        if (p < w.base || p >= w.base + 64) {
+            scan_load(w, p, end);
+        }
+        uint64_t m = w.delim >> (p - w.base);
+        if (m != 0) {
+            return p + __builtin_ctzll(m);
+        }
+        p = w.base + 64;
+    }
+    return end;
+}
+
+/**
+ * 从 p 开始第一个不是空格/制表符的字符
+ */
+inline const char* scan_nonblank(ScanWindow& w, const char* p, const char* end) {
+    while (p < end) {
+        if (p < w.base || p >= w.base + 64) {
+            scan_load(w, p, end);
+        }
+        uint64_t m = ~w.blank >> (p - w.base);
+        if (m != 0) {
+            return p + __builtin_ctzll(m);
+        }
+        p = w.base + 64;
+    }
+    return end;
+}
+
+inline const char* next_line(const char* p, const char* end) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl == NULL ? end : nl + 1;
+}
+
+// ============================================================================
+// 解析状态
+// ============================================================================
+
+struct Token {
+    const char* p;
+    int len;
+    bool quoted;
+};
+
+/**
+ * 解析出的一条记录；所有者名称和 RDATA 在所属块的缓冲区中
+ */
+struct ZoneRecord {
+    uint64_t hash;              // 所有者名称的哈希
+    uint32_t owner_off;
+    uint32_t rdata_off;
+    uint16_t owner_len;
+    uint16_t rdata_len;
+    uint16_t type;
+    uint32_t ttl;
+};
+
+struct ZoneError {
+    const char* where;
+    std::string message;
+};
+
+/**
+ * $ORIGIN / $TTL 状态
+ */
+struct ZoneState {
+    std::string origin;         // 规范化文本（根区为空）；未设置时 has_origin 为 false
+    std::string origin_wire;
+    bool has_origin;
+    int64_t default_ttl;        // $TTL，-1 表示没有
+};
+
+/**
+ * 一块区文件的解析结果
+ */
+struct ZoneChunk {
+    const char* begin;
+    const char* end;
+    ZoneState state;            // 块开始时的状态，解析时随指令更新
+    int64_t last_ttl;           // 块内最后一个显式 TTL，-1 表示没有
+    bool unbalanced;            // 遇到不配对的 ')'：切块点落在多行记录中间
+    uint64_t owner_runs;        // 所有者名称变化的次数（不同名称数的上限）
+    std::string owners;
+    std::string rdata;
+    std::vector<ZoneRecord> records;
+    std::vector<ZoneError> errors;
+};
+
+inline bool token_equals(const Token& t, const char* s) {
+    return (int)strlen(s) == t.len && strncasecmp(t.p, s, t.len) == 0;
+}
+
+bool parse_u32(const Token& t, uint32_t max, uint32_t& value) {
+    if (t.len == 0 || t.len > 10) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < t.len; i++) {
+        if (t.p[i] < '0' || t.p[i] > '9') {
+            return false;
+        }
+        v = v * 10 + (t.p[i] - '0');
+    }
+    value = (uint32_t)v;
+    return v <= max;
+}
+
+/**
+ * TTL：秒数，或 BIND 的单位写法（1h30m、2d）
+ */
+bool parse_ttl(const Token& t, uint32_t& ttl) {
+    uint64_t total = 0, current = 0;
+    bool digits = false;
+    for (int i = 0; i < t.len; i++) {
+        char c = t.p[i] | 0x20;
+        if (t.p[i] >= '0' && t.p[i] <= '9') {
+            current = current * 10 + (t.p[i] - '0');
+            digits = true;
+            if (current > 0x7FFFFFFF) {
+                return false;
+            }
+            continue;
+        }
+        int unit = c == 's' ? 1 : c == 'm' ? 60 : c == 'h' ? 3600 : c == 'd' ? 86400 : c == 'w' ? 604800 : 0;
+        if (unit == 0 || !digits) {
+            return false;
+        }
+        total += current * unit;
+        current = 0;
+        digits = false;
+    }
+    total += current;
+    ttl = (uint32_t)total;
+    return t.len > 0 && total <= 0x7FFFFFFF;
+}
+
+/**
+ * 类型助记符
+ * @return 类型值；不认识时返回 0
+ */
+uint16_t parse_type(const Token& t) {
+    static const struct { const char* name; uint16_t type; } types[] = {
+        {"A", 1}, {"NS", 2}, {"CNAME", 5}, {"SOA", 6}, {"PTR", 12}, {"MX", 15}, {"TXT", 16},
+        {"AAAA", 28}, {"SRV", 33}, {"DNAME", 39}, {"CAA", 257}};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (token_equals(t, types[i].name)) {
+            return types[i].type;
+        }
+    }
+    uint32_t value;
+    if (t.len > 4 && strncasecmp(t.p, "TYPE", 4) == 0) {
+        Token number = {t.p + 4, t.len - 4, false};
+        if (parse_u32(number, 65535, value) && value != 0) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 主文件中的名称 -> 线路格式（相对名称加上 $ORIGIN），处理 \. 和 \DDD 转义
+ * @return 线路格式长度；格式错误返回 -1
+ */
+int encode_name(const Token& t, const ZoneState& state, unsigned char* out) {
+    if (t.len == 1 && t.p[0] == '@') {
+        if (!state.has_origin) {
+            return -1;
+        }
+        memcpy(out, state.origin_wire.data(), state.origin_wire.size());
+        return state.origin_wire.size();
+    }
+    if (t.len == 1 && t.p[0] == '.') {
+        out[0] = 0;
+        return 1;
+    }
+    int pos = 0, label = 0;
+    out[0] = 0;
+    bool absolute = false;
+    for (int i = 0; i < t.len; i++) {
+        unsigned char c = t.p[i];
+        if (c == '.') {
+            if (out[label] == 0) {
+                return -1;                  // 空标签
+            }
+            if (i == t.len - 1) {
+                absolute = true;
+                break;
+            }
+            label = ++pos;
+            out[label] = 0;
+            continue;
+        }
+        if (c == '\\' && i + 1 < t.len) {
+            if (i + 3 < t.len && isdigit((unsigned char)t.p[i + 1]) && isdigit((unsigned char)t.p[i + 2]) &&
+                isdigit((unsigned char)t.p[i + 3])) {
+                int v = (t.p[i + 1] - '0') * 100 + (t.p[i + 2] - '0') * 10 + (t.p[i + 3] - '0');
+                if (v > 255) {
+                    return -1;
+                }
+                c = v;
+                i += 3;
+            } else {
+                c = t.p[++i];
+            }
+        }
+        if (out[label] == 63 || pos + 2 >= 255) {
+            return -1;
+        }
+        out[++pos] = c;
+        out[label]++;
+    }
+    if (out[label] == 0) {
+        return -1;
+    }
+    pos++;
+    if (absolute) {
+        out[pos++] = 0;
+        return pos;
+    }
+    if (!state.has_origin || pos + state.origin_wire.size() > 255) {
+        return -1;
+    }
+    memcpy(out + pos, state.origin_wire.data(), state.origin_wire.size());
+    return pos + state.origin_wire.size();
+}
+
+/**
+ * 所有者名称 -> 规范化文本（查找键）
+ * @return 长度；格式错误返回 -1
+ */
+int owner_key(const Token& t, const ZoneState& state, char* out) {
+    if (t.len == 1 && t.p[0] == '@') {
+        if (!state.has_origin) {
+            return -1;
+        }
+        memcpy(out, state.origin.data(), state.origin.size());
+        return state.origin.size();
+    }
+    int len = dns_zone_normalize(t.p, t.len, out);
+    if (len < 0 || (t.len > 0 && t.p[t.len - 1] == '.' && !(t.len > 1 && t.p[t.len - 2] == '\\'))) {
+        return len;                         // 绝对名称
+    }
+    if (!state.has_origin || len + 1 + state.origin.size() >= (size_t)DNS_MAX_NAME) {
+        return -1;
+    }
+    if (!state.origin.empty()) {
+        out[len++] = '.';
+        memcpy(out + len, state.origin.data(), state.origin.size());
+        len += state.origin.size();
+    }
+    return len;
+}
+
+bool set_origin(ZoneState& state, const Token& t) {
+    unsigned char wire[256];
+    char text[DNS_MAX_NAME];
+    int wire_len = encode_name(t, state, wire);
+    int text_len = owner_key(t, state, text);
+    if (wire_len < 0 || text_len < 0) {
+        return false;
+    }
+    state.origin.assign(text, text_len);
+    state.origin_wire.assign((const char*)wire, wire_len);
+    state.has_origin = true;
+    return true;
+}
+
+// ============================================================================
+// RDATA
+// ============================================================================
+
+/**
+ * 一个 <character-string>：引号内或不带引号的 token，处理转义
+ */
+bool append_string(const Token& t, std::string& rd) {
+    size_t len_pos = rd.size();
+    rd += '\0';
+    for (int i = 0; i < t.len; i++) {
+        unsigned char c = t.p[i];
+        if (c == '\\' && i + 1 < t.len) {
+            if (i + 3 < t.len && isdigit((unsigned char)t.p[i + 1]) && isdigit((unsigned char)t.p[i + 2]) &&
+                isdigit((unsigned char)t.p[i + 3])) {
+                c = (t.p[i + 1] - '0') * 100 + (t.p[i + 2] - '0') * 10 + (t.p[i + 3] - '0');
+                i += 3;
+            } else {
+                c = t.p[++i];
+            }
+        }
+        rd += (char)c;
+    }
+    size_t len = rd.size() - len_pos - 1;
+    rd[len_pos] = (char)len;
+    return len <= 255;
+}
+
+void append_u16(std::string& rd, uint32_t v) {
+    rd += (char)(v >> 8);
+    rd += (char)v;
+}
+
+void append_u32(std::string& rd, uint32_t v) {
+    append_u16(rd, v >> 16);
+    append_u16(rd, v & 0xFFFF);
+}
+
+bool append_name(const Token& t, const ZoneState& state, std::string& rd) {
+    unsigned char wire[256];
+    int len = encode_name(t, state, wire);
+    if (len < 0) {
+        return false;
+    }
+    rd.append((const char*)wire, len);
+    return true;
+}
+
+/**
+ * RFC 3597 通用格式：\# 长度 十六进制（十六进制可以分成多个 token）
+ */
+bool encode_generic(const Token* args, int n, std::string& rd) {
+    uint32_t len;
+    if (n < 2 || !parse_u32(args[1], 65535, len)) {
+        return false;
+    }
+    std::string hex;
+    for (int i = 2; i < n; i++) {
+        hex.append(args[i].p, args[i].len);
+    }
+    if (hex.size() != len * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        char byte[3] = {hex[i], hex[i + 1], 0};
+        char* end;
+        long v = strtol(byte, &end, 16);
+        if (*end != '\0' || !isxdigit((unsigned char)byte[0])) {
+            return false;
+        }
+        rd += (char)v;
+    }
+    return true;
+}
+
+/**
+ * 把 RDATA 的 token 编码成线路格式
+ */
+bool encode_rdata(uint16_t type, const Token* args, int n, const ZoneState& state, std::string& rd) {
+    rd.clear();
+    if (n > 0 && args[0].len == 2 && memcmp(args[0].p, "\\#", 2) == 0 && !args[0].quoted) {
+        return encode_generic(args, n, rd);
+    }
+    char buf[64];
+    uint32_t a, b, c;
+    switch (type) {
+        case 1:
+        case 28: {
+            unsigned char addr[16];
+            if (n != 1 || args[0].len >= (int)sizeof(buf)) {
+                return false;
+            }
+            memcpy(buf, args[0].p, args[0].len);
+            buf[args[0].len] = '\0';
+            if (inet_pton(type == 1 ? AF_INET : AF_INET6, buf, addr) != 1) {
+                return false;
+            }
+            rd.assign((const char*)addr, type == 1 ? 4 : 16);
+            return true;
+        }
+        case 2:
+        case 5:
+        case 12:
+        case 39:
+            return n == 1 && append_name(args[0], state, rd);
+        case 15:
+            if (n != 2 || !parse_u32(args[0], 65535, a)) {
+                return false;
+            }
+            append_u16(rd, a);
+            return append_name(args[1], state, rd);
+        case 16:
+            if (n < 1) {
+                return false;
+            }
+            for (int i = 0; i < n; i++) {
+                if (!append_string(args[i], rd)) {
+                    return false;
+                }
+            }
+            return true;
+        case 6: {
+            if (n != 7 || !append_name(args[0], state, rd) || !append_name(args[1], state, rd) ||
+                !parse_u32(args[2], 0xFFFFFFFF, a)) {
+                return false;
+            }
+            append_u32(rd, a);
+            for (int i = 3; i < 7; i++) {
+                if (!parse_ttl(args[i], b)) {
+                    return false;
+                }
+                append_u32(rd, b);
+            }
+            return true;
+        }
+        case 33:
+            if (n != 4 || !parse_u32(args[0], 65535, a) || !parse_u32(args[1], 65535, b) ||
+                !parse_u32(args[2], 65535, c)) {
+                return false;
+            }
+            append_u16(rd, a);
+            append_u16(rd, b);
+            append_u16(rd, c);
+            return append_name(args[3], state, rd);
+        case 257: {
+            if (n != 3 || !parse_u32(args[0], 255, a) || args[1].len < 1 || args[1].len > 255) {
+                return false;
+            }
+            rd += (char)a;
+            rd += (char)args[1].len;
+            rd.append(args[1].p, args[1].len);
+            // 值占满 RDATA 剩余部分，不带长度前缀：去掉 append_string 写的长度字节
+            size_t value_pos = rd.size();
+            if (!append_string(args[2], rd)) {
+                return false;
+            }
+            rd.erase(value_pos, 1);
+            return true;
+        }
+        default:
+            return false;           // 其他类型只支持通用格式
+    }
+}
+
+// ============================================================================
+// 解析一块
+// ============================================================================
+
+/**
+ * 读一个条目（一行，括号内可以跨行）的所有 token
+ *
+ * @param p 行首，返回时指向下一个条目的行首
+ * @param owner_blank 行首是空白（沿用上一个所有者名称）
+ * @return false 表示格式错误（错误已记录，p 已跳到下一行）
+ */
+bool read_entry(ZoneChunk& chunk, ScanWindow& w, const char*& p, std::vector<Token>& tokens, bool& owner_blank) {
+    const char* end = chunk.end;
+    tokens.clear();
+    owner_blank = *p == ' ' || *p == '\t';
+    int depth = 0;
+    const char* start = p;
+    while (true) {
+        p = scan_nonblank(w, p, end);
+        if (p >= end) {
+            break;
+        }
+        char c = *p;
+        if (c == '\n') {
+            p++;
+            if (depth == 0) {
+                break;
+            }
+            continue;
+        }
+        if (c == '\r') {
+            p++;
+            continue;
+        }
+        if (c == ';') {
+            p = (const char*)memchr(p, '\n', end - p);
+            p = p == NULL ? end : p;
+            continue;
+        }
+        if (c == '(' || c == ')') {
+            if (c == ')' && depth == 0) {
+                chunk.unbalanced = true;
+                chunk.errors.push_back(ZoneError{p, "不配对的 ')'"});
+                p = next_line(p, end);
+                return false;
+            }
+            depth += c == '(' ? 1 : -1;
+            p++;
+            continue;
+        }
+        Token t;
+        if (c == '"') {
+            const char* q = p + 1;
+            while (q < end && *q != '"' && *q != '\n') {
+                q += *q == '\\' ? 2 : 1;
+            }
+            if (q >= end || *q != '"') {
+                chunk.errors.push_back(ZoneError{p, "引号不配对"});
+                p = next_line(p, end);
+                return false;
+            }
+            t.p = p + 1;
+            t.len = q - p - 1;
+            t.quoted = true;
+            p = q + 1;
+        } else {
+            const char* q = scan_delim(w, p, end);
+            while (q < end && *q == '\\') {
+                q = q + 1 < end && isdigit((unsigned char)q[1]) ? q + 4 : q + 2;
+                q = scan_delim(w, std::min(q, end), end);
+            }
+            t.p = p;
+            t.len = q - p;
+            t.quoted = false;
+            p = q;
+        }
+        tokens.push_back(t);
+    }
+    if (depth != 0) {
+        chunk.errors.push_back(ZoneError{start, "括号不配对"});
+        chunk.unbalanced = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 处理 $ORIGIN / $TTL 指令
+ */
+bool apply_directive(ZoneState& state, const std::vector<Token>& tokens, std::string& error) {
+    if (token_equals(tokens[0], "$ORIGIN") && tokens.size() == 2) {
+        if (!set_origin(state, tokens[1])) {
+            error = "无效的 $ORIGIN";
+            return false;
+        }
+        return true;
+    }
+    uint32_t ttl;
+    if (token_equals(tokens[0], "$TTL") && tokens.size() == 2) {
+        if (!parse_ttl(tokens[1], ttl)) {
+            error = "无效的 $TTL";
+            return false;
+        }
+        state.default_ttl = ttl;
+        return true;
+    }
+    error = "不支持的指令 " + std::string(tokens[0].p, tokens[0].len);
+    return false;
+}
+
+/**
+ * 解析一块：逐个条目读 token，处理指令，编码记录
+ */
+void parse_chunk(ZoneChunk& chunk) {
+    ScanWindow w;
+    w.base = NULL;
+    std::vector<Token> tokens;
+    std::string rd;
+    std::string message;
+    uint32_t last_owner_off = 0;
+    uint16_t last_owner_len = 0;
+    uint64_t last_hash = 0;
+    bool have_owner = false;
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* entry = p;
+        bool owner_blank;
+        if (!read_entry(chunk, w, p, tokens, owner_blank) || tokens.empty()) {
+            continue;
+        }
+        if (!owner_blank && tokens[0].p[0] == '$' && !tokens[0].quoted) {
+            if (!apply_directive(chunk.state, tokens, message)) {
+                chunk.errors.push_back(ZoneError{entry, message});
+            }
+            continue;
+        }
+
+        // [所有者] [TTL] [类] 类型 RDATA...（TTL 与类的顺序可以互换）
+        size_t i = 0;
+        if (!owner_blank) {
+            char key[DNS_MAX_NAME];
+            int len = owner_key(tokens[0], chunk.state, key);
+            if (len < 0) {
+                chunk.errors.push_back(ZoneError{entry, "无效的所有者名称"});
+                continue;
+            }
+            if (!have_owner || len != last_owner_len || memcmp(chunk.owners.data() + last_owner_off, key, len) != 0) {
+                last_owner_off = chunk.owners.size();
+                last_owner_len = len;
+                last_hash = dns_zone_hash(key, len);
+                chunk.owners.append(key, len);
+                chunk.owner_runs++;
+                have_owner = true;
+            }
+            i = 1;
+        } else if (!have_owner) {
+            chunk.errors.push_back(ZoneError{entry, "没有所有者名称"});
+            continue;
+        }
+        int64_t ttl = -1;
+        bool bad = false;
+        for (int k = 0; k < 2 && i < tokens.size() && !tokens[i].quoted; k++) {
+            uint32_t value;
+            if (isdigit((unsigned char)tokens[i].p[0])) {
+                if (!parse_ttl(tokens[i], value)) {
+                    bad = true;
+                    break;
+                }
+                ttl = value;
+                i++;
+            } else if (token_equals(tokens[i], "IN")) {
+                i++;
+            } else if (token_equals(tokens[i], "CH") || token_equals(tokens[i], "HS") ||
+                       token_equals(tokens[i], "CS")) {
+                bad = true;
+                break;
+            }
+        }
+        uint16_t type = i < tokens.size() ? parse_type(tokens[i]) : 0;
+        if (bad || type == 0) {
+            chunk.errors.push_back(ZoneError{entry, bad ? "无效的 TTL 或不支持的类" : "缺少或不支持的类型"});
+            continue;
+        }
+        i++;
+        if (!encode_rdata(type, tokens.data() + i, tokens.size() - i, chunk.state, rd) || rd.size() > 65535) {
+            chunk.errors.push_back(ZoneError{entry, "无效的 RDATA"});
+            continue;
+        }
+
+        if (ttl >= 0) {
+            chunk.last_ttl = ttl;
+        } else if (chunk.state.default_ttl >= 0) {
+            ttl = chunk.state.default_ttl;
+        } else {
+            ttl = chunk.last_ttl >= 0 ? chunk.last_ttl : TTL_UNRESOLVED;
+        }
+        if (chunk.rdata.size() > UINT32_MAX - rd.size() || chunk.owners.size() > UINT32_MAX - DNS_MAX_NAME) {
+            chunk.errors.push_back(ZoneError{entry, "块太大"});
+            return;
+        }
+        ZoneRecord r;
+        r.hash = last_hash;
+        r.owner_off = last_owner_off;
+        r.owner_len = last_owner_len;
+        r.rdata_off = chunk.rdata.size();
+        r.rdata_len = rd.size();
+        r.type = type;
+        r.ttl = (uint32_t)ttl;
+        chunk.rdata += rd;
+        chunk.records.push_back(r);
+    }
+}
+
+// ============================================================================
+// 切块
+// ============================================================================
+
+/**
+ * 顺序找出所有行首的 '$' 指令，记下每条指令之后的状态
+ */
+struct DirectiveState {
+    const char* where;
+    ZoneState state;
+};
+
+bool scan_directives(const char* base, const char* end, const ZoneState& initial,
+                     std::vector<DirectiveState>& directives, ZoneChunk& errors) {
+    ZoneState state = initial;
+    ScanWindow w;
+    w.base = NULL;
+    std::vector<Token> tokens;
+    std::string message;
+    for (const char* p = base; p < end; ) {
+        const char* dollar = (const char*)memchr(p, '$', end - p);
+        if (dollar == NULL) {
+            break;
+        }
+        p = dollar + 1;
+        if (dollar != base && dollar[-1] != '\n') {
+            continue;
+        }
+        const char* q = dollar;
+        bool owner_blank;
+        errors.end = end;
+        if (!read_entry(errors, w, q, tokens, owner_blank) || tokens.empty()) {
+            continue;
+        }
+        if (!apply_directive(state, tokens, message)) {
+            continue;                   // 错误由解析这一块时报告
+        }
+        directives.push_back(DirectiveState{dollar, state});
+    }
+    return true;
+}
+
+/**
+ * 切块：大致等分，切块点移到下一个“行首是所有者名称”的行
+ */
+std::vector<const char*> split_chunks(const char* base, const char* end, int count) {
+    std::vector<const char*> starts(1, base);
+    size_t size = end - base;
+    for (int i = 1; i < count; i++) {
+        const char* p = std::max(base + size * i / count, starts.back());
+        if (p != base) {
+            p = next_line(p - 1, end);
+        }
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ';' || *p == '\n' || *p == '\r' ||
+                           *p == '$' || *p == '(' || *p == ')')) {
+            p = next_line(p, end);
+        }
+        if (p >= end) {
+            break;
+        }
+        if (p > starts.back()) {
+            starts.push_back(p);
+        }
+    }
+    return starts;
+}
+
+/**
+ * 切块并行解析；某块括号不配对时改为整体单线程解析
+ */
+void parse_zone(const char* base, const char* end, const ZoneState& initial, int threads,
+                std::vector<ZoneChunk>& chunks) {
+    std::vector<DirectiveState> directives;
+    ZoneChunk scratch;
+    scan_directives(base, end, initial, directives, scratch);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        std::vector<const char*> starts = split_chunks(base, end, attempt == 0 ? threads * 8 : 1);
+        chunks.clear();
+        chunks.resize(starts.size());
+        size_t d = 0;
+        for (size_t i = 0; i < starts.size(); i++) {
+            ZoneChunk& c = chunks[i];
+            c.begin = starts[i];
+            c.end = i + 1 < starts.size() ? starts[i + 1] : end;
+            while (d < directives.size() && directives[d].where < c.begin) {
+                d++;
+            }
+            c.state = d > 0 ? directives[d - 1].state : initial;
+            c.last_ttl = -1;
+            c.unbalanced = false;
+            c.owner_runs = 0;
+            // 按文本大小预留（只占虚拟地址，没写到的页不分配），避免扩容时整块复制
+            c.records.reserve((c.end - c.begin) / 32);
+            c.owners.reserve(c.end - c.begin);
+            c.rdata.reserve((c.end - c.begin) / 2);
+        }
+
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(std::thread([&chunks, &next]() {
+                size_t i;
+                while ((i = next++) < chunks.size()) {
+                    parse_chunk(chunks[i]);
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+
+        bool unbalanced = false;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            unbalanced = unbalanced || chunks[i].unbalanced;
+        }
+        if (!unbalanced || chunks.size() == 1) {
+            break;
+        }
+    }
+
+    // 没有 $TTL 时沿用上一条记录的 TTL：块开头的记录取前面各块最后的显式 TTL
+    int64_t carried = -1;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        for (size_t j = 0; j < chunks[i].records.size(); j++) {
+            ZoneRecord& r = chunks[i].records[j];
+            if (r.ttl != TTL_UNRESOLVED) {
+                break;
+            }
+            r.ttl = carried >= 0 ? carried : 0;
+        }
+        if (chunks[i].last_ttl >= 0) {
+            carried = chunks[i].last_ttl;
+        }
+    }
+}
+
+// ============================================================================
+// 合并成镜像
+// ============================================================================
+
+struct ZoneImage {
+    DNSZoneHeader header;
+    std::vector<DNSZoneSlot> slots;
+    std::vector<DNSZoneRRset> rrsets;
+    std::vector<DNSZoneName> names;
+    std::string name_text;
+    std::string data;
+};
+
+/**
+ * 所有者名称去重（直接插入镜像的哈希表，名称序号按第一次出现的顺序），
+ * 记录按名称计数排序，同名称内按类型分成 RRset（去掉重复的 RR，TTL 取最小值）
+ */
+bool build_image(const std::vector<ZoneChunk>& chunks, ZoneImage& image) {
+    uint64_t record_count = 0, name_bound = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        record_count += chunks[i].records.size();
+        name_bound += chunks[i].owner_runs;
+    }
+    if (name_bound >= 0x7FFFFFFF / 2 || record_count > UINT32_MAX) {
+        fprintf(stderr, "错误: 记录太多\n");
+        return false;
+    }
+    uint32_t slot_count = 16;
+    while (slot_count < name_bound + name_bound / 2 + 1) {
+        slot_count <<= 1;
+    }
+    image.slots.assign(slot_count, DNSZoneSlot{0, 0});
+    uint32_t mask = slot_count - 1;
+
+    std::vector<uint32_t> record_name(record_count);
+    std::vector<const ZoneRecord*> first_record;        // 每个名称第一次出现的记录（取名称文本）
+    std::vector<const ZoneChunk*> first_chunk;
+    std::vector<uint32_t> name_records;                 // 每个名称的记录数
+    size_t k = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        const ZoneChunk& chunk = chunks[c];
+        const char* owners = chunk.owners.data();
+        uint32_t last_off = UINT32_MAX, last_name = 0;
+        for (size_t j = 0; j < chunk.records.size(); j++, k++) {
+            const ZoneRecord& r = chunk.records[j];
+            // 哈希已在解析时算好：提前预取后面记录的槽位，随机访问的缓存未命中重叠起来
+            if (j + 16 < chunk.records.size()) {
+                __builtin_prefetch(&image.slots[(uint32_t)(chunk.records[j + 16].hash >> 32) & mask]);
+            }
+            if (r.owner_off != last_off) {
+                uint32_t s = (uint32_t)(r.hash >> 32) & mask;
+                for (; image.slots[s].name != 0; s = (s + 1) & mask) {
+                    if (image.slots[s].hash != (uint32_t)r.hash) {
+                        continue;
+                    }
+                    uint32_t n = image.slots[s].name - 1;
+                    const ZoneRecord& f = *first_record[n];
+                    if (f.owner_len == r.owner_len &&
+                        memcmp(first_chunk[n]->owners.data() + f.owner_off, owners + r.owner_off, r.owner_len) == 0) {
+                        break;
+                    }
+                }
+                if (image.slots[s].name == 0) {
+                    image.slots[s].hash = (uint32_t)r.hash;
+                    image.slots[s].name = first_record.size() + 1;
+                    first_record.push_back(&r);
+                    first_chunk.push_back(&chunk);
+                    name_records.push_back(0);
+                }
+                last_off = r.owner_off;
+                last_name = image.slots[s].name - 1;
+            }
+            record_name[k] = last_name;
+            name_records[last_name]++;
+        }
+    }
+
+    // 计数排序：同一名称的记录相邻，保持文件中的顺序
+    uint32_t name_count = first_record.size();
+    std::vector<uint32_t> name_start(name_count + 1, 0);
+    for (uint32_t n = 0; n < name_count; n++) {
+        name_start[n + 1] = name_start[n] + name_records[n];
+    }
+    std::vector<std::pair<const ZoneRecord*, const ZoneChunk*> > sorted(record_count);
+    std::vector<uint32_t> fill(name_start.begin(), name_start.end() - 1);
+    k = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        for (size_t j = 0; j < chunks[c].records.size(); j++, k++) {
+            sorted[fill[record_name[k]]++] = std::make_pair(&chunks[c].records[j], &chunks[c]);
+        }
+    }
+    record_name.clear();
+    record_name.shrink_to_fit();
+
+    uint64_t rdata_size = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        rdata_size += chunks[c].rdata.size();
+    }
+    image.names.resize(name_count);
+    image.rrsets.reserve(record_count);
+    image.data.reserve(rdata_size + 2 * record_count);
+    image.header.origin_name = UINT32_MAX;
+    std::vector<std::pair<const unsigned char*, uint16_t> > rrs;
+    uint64_t written = 0;
+    for (uint32_t n = 0; n < name_count; n++) {
+        const ZoneRecord& f = *first_record[n];
+        DNSZoneName& name = image.names[n];
+        name.text_off = image.name_text.size();
+        name.text_len = f.owner_len;
+        name.first_rrset = image.rrsets.size();
+        image.name_text.append(first_chunk[n]->owners, f.owner_off, f.owner_len);
+
+        // 大多数名称只有一条记录或已按类型排列，不必排序（stable_sort 每次都要分配临时缓冲区）
+        uint32_t begin = name_start[n], end = name_start[n + 1];
+        std::vector<std::pair<const ZoneRecord*, const ZoneChunk*> >::iterator first = sorted.begin() + begin;
+        std::vector<std::pair<const ZoneRecord*, const ZoneChunk*> >::iterator last = sorted.begin() + end;
+        bool by_type = true;
+        for (uint32_t i = begin + 1; i < end && by_type; i++) {
+            by_type = sorted[i - 1].first->type <= sorted[i].first->type;
+        }
+        if (!by_type) {
+            std::stable_sort(first, last, [](const std::pair<const ZoneRecord*, const ZoneChunk*>& a,
+                                             const std::pair<const ZoneRecord*, const ZoneChunk*>& b) {
+                return a.first->type < b.first->type;
+            });
+        }
+        for (uint32_t i = begin; i < end; ) {
+            uint16_t type = sorted[i].first->type;
+            DNSZoneRRset rrset;
+            rrset.type = type;
+            rrset.ttl = UINT32_MAX;
+            rrset.data_off = image.data.size();
+            rrs.clear();
+            for (; i < end && sorted[i].first->type == type; i++) {
+                const ZoneRecord& r = *sorted[i].first;
+                rrs.push_back(std::make_pair((const unsigned char*)sorted[i].second->rdata.data() + r.rdata_off,
+                                             r.rdata_len));
+                rrset.ttl = std::min(rrset.ttl, r.ttl);
+            }
+            if (rrs.size() > 1) {
+                std::stable_sort(rrs.begin(), rrs.end(), [](const std::pair<const unsigned char*, uint16_t>& a,
+                                                            const std::pair<const unsigned char*, uint16_t>& b) {
+                    return a.second != b.second ? a.second < b.second : memcmp(a.first, b.first, a.second) < 0;
+                });
+                rrs.erase(std::unique(rrs.begin(), rrs.end(), [](const std::pair<const unsigned char*, uint16_t>& a,
+                                                                 const std::pair<const unsigned char*, uint16_t>& b) {
+                    return a.second == b.second && memcmp(a.first, b.first, a.second) == 0;
+                }), rrs.end());
+            }
+            if (rrs.size() > 65535 || name.rrset_count == 65535) {
+                fprintf(stderr, "错误: %.*s 的记录太多\n", (int)f.owner_len, first_chunk[n]->owners.data() + f.owner_off);
+                return false;
+            }
+            for (size_t j = 0; j < rrs.size(); j++) {
+                image.data += (char)(rrs[j].second >> 8);
+                image.data += (char)(rrs[j].second & 0xFF);
+                image.data.append((const char*)rrs[j].first, rrs[j].second);
+            }
+            rrset.rr_count = rrs.size();
+            written += rrs.size();
+            if (type == 6 && image.header.origin_name == UINT32_MAX) {
+                image.header.origin_name = n;
+            }
+            image.rrsets.push_back(rrset);
+            name.rrset_count++;
+        }
+    }
+
+    DNSZoneHeader& h = image.header;
+    h.magic = DNS_ZONE_MAGIC;
+    h.version = DNS_ZONE_VERSION;
+    h.name_count = name_count;
+    h.rrset_count = image.rrsets.size();
+    h.record_count = written;
+    h.slot_count = slot_count;
+    h.names_size = image.name_text.size();
+    h.data_size = image.data.size();
+    h.built = time(NULL);
+    return true;
+}
+
+bool write_image(const char* path, const ZoneImage& image) {
+    std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == NULL) {
+        perror(tmp.c_str());
+        return false;
+    }
+    bool ok = fwrite(&image.header, sizeof(image.header), 1, f) == 1 &&
+              fwrite(image.slots.data(), sizeof(DNSZoneSlot), image.slots.size(), f) == image.slots.size() &&
+              fwrite(image.rrsets.data(), sizeof(DNSZoneRRset), image.rrsets.size(), f) == image.rrsets.size() &&
+              fwrite(image.names.data(), sizeof(DNSZoneName), image.names.size(), f) == image.names.size() &&
+              fwrite(image.name_text.data(), 1, image.name_text.size(), f) == image.name_text.size() &&
+              fwrite(image.data.data(), 1, image.data.size(), f) == image.data.size() &&
+              fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    // rename 是原子的：打开这个路径的进程要么得到旧镜像，要么得到完整的新镜像
+    if (!ok || rename(tmp.c_str(), path) < 0) {
+        perror(path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// 验证与查询
+// ============================================================================
+
+/**
+ * 从页缓存中丢掉文件（干净的页），之后的读取要从磁盘来，用于测量冷启动
+ */
+void evict_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+double elapsed(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+/**
+ * 冷缓存下重新打开镜像，先随机查找一部分名称（缺页从磁盘读），再逐个查找所有名称
+ */
+bool verify_image(const char* path, const ZoneImage& image) {
+    evict_file(path);
+    auto start = std::chrono::steady_clock::now();
+    DNSZone zone;
+    if (!dns_zone_open(zone, path)) {
+        fprintf(stderr, "错误: 无法打开刚生成的 %s\n", path);
+        return false;
+    }
+    double open_seconds = elapsed(start);
+
+    uint32_t name_count = image.header.name_count;
+    std::vector<std::string> keys(name_count);
+    for (uint32_t n = 0; n < name_count; n++) {
+        keys[n].assign(image.name_text, image.names[n].text_off, image.names[n].text_len);
+    }
+    unsigned long errors = 0;
+    uint32_t cold = std::min<uint32_t>(name_count, 10000);
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < cold; i++) {
+        x = dns_hosts_mix(x + i);
+        uint32_t n = dns_hosts_range((uint32_t)x, name_count);
+        const DNSZoneName* found = dns_zone_find(zone, keys[n].c_str());
+        errors += found == NULL || (uint32_t)(found - zone.names) != n || dns_zone_rrset(zone, found, 0) != NULL;
+    }
+    double cold_seconds = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < name_count; n++) {
+        const DNSZoneName* found = dns_zone_find(zone, keys[n].c_str());
+        errors += found == NULL || (uint32_t)(found - zone.names) != n ||
+                  dns_zone_rrset(zone, found, zone.rrsets[found->first_rrset].type) == NULL;
+    }
+    double warm_seconds = elapsed(start);
+
+    unsigned long false_hits = 0;
+    for (uint32_t n = 0; n < name_count && n < 100000; n++) {
+        false_hits += dns_zone_find(zone, ("absent." + keys[n]).c_str()) != NULL;
+    }
+    dns_zone_close(zone);
+
+    printf("验证:       打开镜像 %.0f us; 冷缓存随机查找 %u 次, 平均 %.1f us/次; "
+           "全部 %u 个名称, 平均 %.0f ns/次; 错误 %lu, 误命中 %lu\n",
+           open_seconds * 1e6, cold, cold > 0 ? cold_seconds * 1e6 / cold : 0.0, name_count,
+           name_count > 0 ? warm_seconds * 1e9 / name_count : 0.0, errors, false_hits);
+    return errors == 0 && false_hits == 0;
+}
+
+/**
+ * 在镜像中查询一个名称，打印 RRset（RDATA 以十六进制显示，A/AAAA 显示地址）
+ */
+int query_image(const char* path, const char* name, const char* type_name) {
+    DNSZone zone;
+    if (!dns_zone_open(zone, path)) {
+        fprintf(stderr, "错误: 无法打开区镜像 %s\n", path);
+        return 1;
+    }
+    const DNSZoneName* found = dns_zone_find(zone, name);
+    if (found == NULL) {
+        printf("%s: 不在区中 (NXDOMAIN)\n", name);
+        dns_zone_close(zone);
+        return 1;
+    }
+    uint16_t wanted = 0;
+    if (type_name != NULL) {
+        Token t = {type_name, (int)strlen(type_name), false};
+        wanted = parse_type(t);
+    }
+    for (uint32_t i = 0; i < found->rrset_count; i++) {
+        const DNSZoneRRset& rrset = zone.rrsets[found->first_rrset + i];
+        if (wanted != 0 && rrset.type != wanted) {
+            continue;
+        }
+        uint64_t offset = 0;
+        const unsigned char* rdata;
+        uint16_t rdlength;
+        for (uint32_t j = 0; dns_zone_next_rr(zone, rrset, j, offset, rdata, rdlength); j++) {
+            printf("%s\t%u\tTYPE%u\t", name, rrset.ttl, rrset.type);
+            char text[INET6_ADDRSTRLEN];
+            if ((rrset.type == 1 && rdlength == 4) || (rrset.type == 28 && rdlength == 16)) {
+                printf("%s\n", inet_ntop(rrset.type == 1 ? AF_INET : AF_INET6, rdata, text, sizeof(text)));
+                continue;
+            }
+            printf("\\# %u ", rdlength);
+            for (uint16_t b = 0; b < rdlength; b++) {
+                printf("%02x", rdata[b]);
+            }
+            printf("\n");
+        }
+    }
+    dns_zone_close(zone);
+    return 0;
+}
+
+// ============================================================================
+// 主函数
+// ============================================================================
+
+int main(int argc, char* argv[]) {
+    const char* output = NULL;
+    const char* origin = NULL;
+    const char* query = NULL;
+    const char* query_type = NULL;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    bool cold = false;
+    bool verify = false;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:O:j:cvq:t:")) != -1) {
+        switch (opt) {
+            case 'o': output = optarg; break;
+            case 'O': origin = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            case 'c': cold = true; break;
+            case 'v': verify = true; break;
+            case 'q': query = optarg; break;
+            case 't': query_type = optarg; break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || optind != argc - 1 || threads < 1 || (query == NULL && output == NULL)) {
+        fprintf(stderr, "用法: %s [-O 初始 $ORIGIN] [-j 线程数] [-c] [-v] -o 镜像文件 <区文件>\n", argv[0]);
+        fprintf(stderr, "      %s -q 名称 [-t 类型] <镜像文件>\n", argv[0]);
+        fprintf(stderr, "  -c  先把区文件从页缓存中丢掉，测量冷缓存加载\n");
+        fprintf(stderr, "  -v  生成后冷缓存打开镜像，逐个查找验证\n");
+        return 1;
+    }
+    if (query != NULL) {
+        return query_image(argv[optind], query, query_type);
+    }
+
+    const char* path = argv[optind];
+    if (cold) {
+        evict_file(path);
+    }
+    auto start = std::chrono::steady_clock::now();
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return 1;
+    }
+    const char* base = "";
+    if (st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        base = (const char*)p;
+    }
+    close(fd);
+    const char* end = base + st.st_size;
+
+    ZoneState initial;
+    initial.has_origin = false;
+    initial.default_ttl = -1;
+    if (origin != NULL) {
+        Token t = {origin, (int)strlen(origin), false};
+        if (t.len == 0 || origin[t.len - 1] != '.' || !set_origin(initial, t)) {
+            fprintf(stderr, "错误: 无效的 -O（需要以 . 结尾的绝对名称）\n");
+            return 1;
+        }
+    }
+
+    std::vector<ZoneChunk> chunks;
+    parse_zone(base, end, initial, threads, chunks);
+    double parse_seconds = elapsed(start);
+
+    // 报告错误（行号只在出错时计算）
+    unsigned long error_count = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        for (size_t e = 0; e < chunks[c].errors.size(); e++, error_count++) {
+            if (error_count >= (unsigned long)MAX_REPORTED_ERRORS) {
+                continue;
+            }
+            const char* where = chunks[c].errors[e].where;
+            unsigned long line = 1;
+            for (const char* p = base; (p = (const char*)memchr(p, '\n', where - p)) != NULL; p++) {
+                line++;
+            }
+            fprintf(stderr, "%s:%lu: %s\n", path, line, chunks[c].errors[e].message.c_str());
+        }
+    }
+    if (error_count > 0) {
+        fprintf(stderr, "错误: %lu 处格式错误，没有生成镜像\n", error_count);
+        return 1;
+    }
+
+    auto build_start = std::chrono::steady_clock::now();
+    ZoneImage image;
+    memset(&image.header, 0, sizeof(image.header));
+    if (!build_image(chunks, image)) {
+        return 1;
+    }
+    uint64_t parsed = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        parsed += chunks[c].records.size();
+    }
+    chunks.clear();
+    double build_seconds = elapsed(build_start);
+
+    auto write_start = std::chrono::steady_clock::now();
+    if (!write_image(output, image)) {
+        return 1;
+    }
+    double write_seconds = elapsed(write_start);
+    double total_seconds = elapsed(start);
+
+    uint64_t size = dns_zone_file_size(image.header);
+    printf("输出文件:   %s\n", output);
+    printf("记录:       %lu 条 (去重后 %lu), %u 个名称, %u 个 RRset\n", (unsigned long)parsed,
+           (unsigned long)image.header.record_count, image.header.name_count, image.header.rrset_count);
+    printf("镜像大小:   %.1f MB (%.1f 字节/记录)\n", size / 1048576.0,
+           parsed > 0 ? (double)size / parsed : 0.0);
+    printf("耗时:       解析 %.2f s (%d 线程, %.1f MB/s), 合并 %.2f s, 写文件 %.2f s, 共 %.2f s%s\n",
+           parse_seconds, threads, st.st_size / 1048576.0 / parse_seconds, build_seconds, write_seconds,
+           total_seconds, cold ? " (冷缓存)" : "");
+
+    if (verify && !verify_image(output, image)) {
+        return 1;
+    }
+    return 0;
+}